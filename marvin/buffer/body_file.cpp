@@ -0,0 +1,127 @@
+//
+//  body_file.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/14/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "body_file.hpp"
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+
+#pragma mark - configuration
+static std::string defaultDirectory()
+{
+    const char* d = getenv("TMPDIR");
+    return ((d != nullptr) && (strlen(d) > 0)) ? std::string(d) : std::string("/tmp");
+}
+std::string BodyFile::__directory = defaultDirectory();
+
+void BodyFile::configSet_Directory(std::string dir)
+{
+    __directory = dir;
+}
+
+#pragma mark - construction
+BodyFileSPtr BodyFile::create()
+{
+    std::string tmpl = __directory + "/marvin_body_XXXXXX";
+    std::vector<char> path(tmpl.begin(), tmpl.end());
+    path.push_back('\0');
+    int fd = mkstemp(&path[0]);
+    if( fd < 0 ) {
+        LogError("cannot create spill file in ", __directory, " errno: ", errno);
+        return nullptr;
+    }
+    // no name - the file goes away with the last descriptor
+    unlink(&path[0]);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return BodyFileSPtr(new BodyFile(fd));
+}
+
+BodyFile::BodyFile(int fd) : _fd(fd), _size(0), _mapPtr(nullptr), _mapSize(0)
+{
+    LogTorTrace();
+}
+
+BodyFile::~BodyFile()
+{
+    LogTorTrace();
+    if( _mapPtr != nullptr ) {
+        munmap(_mapPtr, _mapSize);
+    }
+    if( _fd >= 0 ) {
+        ::close(_fd);
+    }
+}
+
+#pragma mark - writing
+bool BodyFile::append(void* data, std::size_t len)
+{
+    assert( (_mapPtr == nullptr) );
+    const char* p = (const char*)data;
+    std::size_t remaining = len;
+    while( remaining > 0 ) {
+        ssize_t n = ::pwrite(_fd, p, remaining, (off_t)_size);
+        if( n < 0 ) {
+            if( errno == EINTR )
+                continue;
+            LogError("write to spill file failed errno: ", errno);
+            return false;
+        }
+        p += n;
+        remaining -= (std::size_t)n;
+        _size += (std::size_t)n;
+    }
+    return true;
+}
+
+#pragma mark - reading
+std::size_t BodyFile::size()
+{
+    return _size;
+}
+
+int BodyFile::fd()
+{
+    return _fd;
+}
+
+long BodyFile::pread(std::size_t offset, void* buf, std::size_t len)
+{
+    ssize_t n;
+    do {
+        n = ::pread(_fd, buf, len, (off_t)offset);
+    } while( (n < 0) && (errno == EINTR) );
+    return (long)n;
+}
+
+const char* BodyFile::map()
+{
+    if( _mapPtr == nullptr ) {
+        if( _size == 0 )
+            return nullptr;
+        void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if( p == MAP_FAILED ) {
+            LogError("mmap of spill file failed errno: ", errno);
+            return nullptr;
+        }
+        _mapPtr = p;
+        _mapSize = _size;
+    }
+    return (const char*)_mapPtr;
+}
+
+std::string BodyFile::toString()
+{
+    const char* p = map();
+    return (p == nullptr) ? std::string("") : std::string(p, _mapSize);
+}
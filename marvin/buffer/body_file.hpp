@@ -0,0 +1,95 @@
+//
+//  body_file.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/14/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef body_file_hpp
+#define body_file_hpp
+
+#include <cstddef>
+#include <string>
+#include <memory>
+
+class BodyFile;
+typedef std::shared_ptr<BodyFile> BodyFileSPtr;
+typedef std::unique_ptr<BodyFile> BodyFileUPtr;
+
+#pragma mark - BodyFile class
+/**
+ * A BodyFile holds message body data in an anonymous temporary file rather than in memory.
+ *
+ * MessageReaderV2::readMessage() switches to a BodyFile once the body grows past the spill
+ * threshold (see MessageReaderV2::configSet_SpillThreshold). The file is created with mkstemp()
+ * in the configured directory and unlinked immediately, so it disappears when the last
+ * BodyFile referencing it is destroyed - even if the process dies.
+ *
+ * The content can be consumed three ways:
+ *  -   by a connection, using fd() with sendfile() or pread() (see TCPConnection::asyncWrite(BodyFileSPtr,..))
+ *  -   piecemeal with pread()
+ *  -   in one go with map(), which lazily mmaps the file read-only. The mapping is only made
+ *      the first time map() is called and is released in the destructor.
+ *
+ * Appending after map() has been called is an error.
+ */
+class BodyFile
+{
+public:
+    /**
+     * Called at program startup to set the directory that spill files are created in.
+     * Defaults to $TMPDIR or /tmp
+     */
+    static void configSet_Directory(std::string dir);
+
+    /**
+     * Creates a new empty spill file. Returns nullptr (and logs) if the file cannot be created
+     */
+    static BodyFileSPtr create();
+
+    ~BodyFile();
+
+    /**
+     * appends len bytes to the end of the file. Returns false on a write error
+     */
+    bool append(void* data, std::size_t len);
+
+    /**
+     * number of bytes in the file
+     */
+    std::size_t size();
+
+    /**
+     * the file descriptor - for use with sendfile() and friends. Do not close it
+     */
+    int fd();
+
+    /**
+     * reads up to len bytes at offset into buf, returns the number of bytes read or -1
+     */
+    long pread(std::size_t offset, void* buf, std::size_t len);
+
+    /**
+     * maps the whole file read-only (the first time it is called) and returns the address of
+     * the first byte, or nullptr if the file is empty or cannot be mapped
+     */
+    const char* map();
+
+    /**
+     * returns the whole content as a string - intended for small files and tests
+     */
+    std::string toString();
+
+private:
+    BodyFile(int fd);
+
+    static std::string  __directory;
+
+    int                 _fd;
+    std::size_t         _size;
+    void*               _mapPtr;
+    std::size_t         _mapSize;
+};
+
+#endif /* body_file_hpp */
@@ -16,7 +16,10 @@ RBLOGGER_SETLEVEL(LOG_LEVEL_WARN )
 
 MBuffer::MBuffer(std::size_t cap)
 {
-    memPtr = malloc(cap);
+    memPtr = MBufferPool::allocate(cap, poolCapacity_);
+    if( memPtr != nullptr ){
+        BufferBudget::charge(poolCapacity_);
+    }
     cPtr = (char*) memPtr;
     length_ = 0;
     size_ = 0;
@@ -26,8 +29,9 @@ MBuffer::MBuffer(std::size_t cap)
 MBuffer::~MBuffer()
 {
     LogTorTrace();
-    if( (memPtr != nullptr) && (capacity_ > 0) ){
-        free(memPtr);
+    if( memPtr != nullptr ){
+        MBufferPool::release(memPtr, poolCapacity_);
+        BufferBudget::credit(poolCapacity_);
     }
 }
 
@@ -93,27 +97,31 @@ bool MBuffer::contains(char* ptr)
     bool r = ( ptr <= endPtr && ptr >= sPtr);
     return r;
 }
+/**
+* The m_buffer() factories use make_shared so that the MBuffer and the shared_ptr
+* control block are a single allocation, the slab itself comes from MBufferPool
+*/
 MBufferSPtr m_buffer(std::size_t capacity)
 {
-    MBufferSPtr mbp = std::shared_ptr<MBuffer>(new MBuffer(capacity));
+    MBufferSPtr mbp = std::make_shared<MBuffer>(capacity);
     return mbp;
 }
 MBufferSPtr m_buffer(std::string s)
 {
-    MBufferSPtr mbp = std::shared_ptr<MBuffer>(new MBuffer(s.size()));
+    MBufferSPtr mbp = std::make_shared<MBuffer>(s.size());
     mbp->append((void*) s.c_str(), s.size());
     return mbp;
 }
 MBufferSPtr m_buffer(void* mem, std::size_t size)
 {
-    MBufferSPtr mbp = std::shared_ptr<MBuffer>(new MBuffer(size));
+    MBufferSPtr mbp = std::make_shared<MBuffer>(size);
     mbp->append(mem, size);
     return mbp;
 
 }
 MBufferSPtr m_buffer(MBuffer& mb)
 {
-    MBufferSPtr mbp = std::shared_ptr<MBuffer>(new MBuffer(mb.capacity()));
+    MBufferSPtr mbp = std::make_shared<MBuffer>(mb.capacity());
     mbp->append(mb.data(), mb.size());
     return mbp;
 
@@ -139,17 +147,89 @@ boost::asio::mutable_buffer mb_as_mutable_buffer(MBuffer& mb)
 {
     return boost::asio::mutable_buffer(mb.data(), mb.size());
 }
+#pragma mark - BufferSlice
+BufferSlice::BufferSlice(MBufferSPtr owner) : _owner(owner), _offset(0), _length(owner->size())
+{
+}
+BufferSlice::BufferSlice(MBufferSPtr owner, std::size_t offset, std::size_t len) : _owner(owner), _offset(offset), _length(len)
+{
+    assert( (owner != nullptr) );
+    assert( ( (offset + len) <= owner->capacity() ) );
+}
+void* BufferSlice::data()
+{
+    return (void*)( ((char*)_owner->data()) + _offset );
+}
+std::size_t BufferSlice::size()
+{
+    return _length;
+}
+std::size_t BufferSlice::offset()
+{
+    return _offset;
+}
+MBufferSPtr BufferSlice::owner()
+{
+    return _owner;
+}
+bool BufferSlice::isContiguousWith(BufferSlice& other)
+{
+    return (other._owner == _owner) && (other._offset == (_offset + _length));
+}
+BufferSlice& BufferSlice::extendBy(std::size_t len)
+{
+    assert( ( (_offset + _length + len) <= _owner->capacity() ) );
+    _length += len;
+    return *this;
+}
+std::string BufferSlice::toString()
+{
+    return std::string((char*)data(), _length);
+}
+boost::asio::mutable_buffer BufferSlice::asioBuffer()
+{
+    return boost::asio::mutable_buffer(data(), _length);
+}
+BufferSlice buffer_slice(MBufferSPtr owner, void* ptr, std::size_t len)
+{
+    assert( owner->contains(ptr) );
+    std::size_t offset = (std::size_t)( ((char*)ptr) - ((char*)owner->data()) );
+    return BufferSlice(owner, offset, len);
+}
+
 #pragma mark - BufferChain
 BufferChain::BufferChain()
 {
-    _chain = std::vector<MBufferSPtr>();
     _size = 0;
 }
+BufferChain::BufferChain(BufferChain&& other) : _chain(std::move(other._chain)), _asio_chain(std::move(other._asio_chain)), _size(other._size)
+{
+    other.clear();
+}
+BufferChain& BufferChain::operator=(BufferChain&& other)
+{
+    if( this != &other ) {
+        _chain = std::move(other._chain);
+        _asio_chain = std::move(other._asio_chain);
+        _size = other._size;
+        other.clear();
+    }
+    return *this;
+}
 void BufferChain::push_back(MBufferSPtr mb)
 {
-    _size += mb->size();
-    _chain.push_back(mb);
-    _asio_chain.push_back(boost::asio::buffer(mb->data(), mb->size()));
+    push_back(BufferSlice(mb));
+}
+void BufferChain::push_back(BufferSlice slice)
+{
+    _size += slice.size();
+    if( (_chain.size() > 0) && _chain.back().isContiguousWith(slice) ) {
+        _chain.back().extendBy(slice.size());
+        _asio_chain.back() = _chain.back().asioBuffer();
+    } else {
+        _chain.push_back(slice);
+        _asio_chain.push_back(slice.asioBuffer());
+    }
 }
 void BufferChain::clear()
 {
@@ -164,52 +244,55 @@ std::size_t BufferChain::size()
 std::string BufferChain::to_string()
 {
     std::string s = "";
-    for(MBufferSPtr& mb : _chain) {
-        s += mb->toString();
+    for(BufferSlice& slice : _chain) {
+        s += slice.toString();
     }
     return s;
 }
 MBufferSPtr BufferChain::amalgamate()
 {
-    MBufferSPtr mb_final = std::shared_ptr<MBuffer>(new MBuffer(this->size()));
-    for(MBufferSPtr& mb : _chain) {
-        mb_final->append(mb->data(), mb->size());
+    MBufferSPtr mb_final = m_buffer(this->size());
+    for(BufferSlice& slice : _chain) {
+        mb_final->append(slice.data(), slice.size());
     }
     return mb_final;
 }
 
 BufferChainSPtr buffer_chain(std::string& s)
 {
-    BufferChainSPtr sp = std::shared_ptr<BufferChain>(new BufferChain());
+    BufferChainSPtr sp = std::make_shared<BufferChain>();
     sp->push_back(m_buffer(s));
     return sp;
 }
 BufferChainSPtr buffer_chain(MBuffer& mb)
 {
-    BufferChainSPtr sp = std::shared_ptr<BufferChain>(new BufferChain());
+    BufferChainSPtr sp = std::make_shared<BufferChain>();
     sp->push_back(m_buffer(mb));
     return sp;
 }
 BufferChainSPtr buffer_chain(MBufferSPtr mb_sptr)
 {
-    BufferChainSPtr sp = std::shared_ptr<BufferChain>(new BufferChain());
+    BufferChainSPtr sp = std::make_shared<BufferChain>();
     sp->push_back(mb_sptr);
     return sp;
 }
 
+BufferChain::SequenceView BufferChain::buffer_sequence() const
+{
+    return SequenceView(_asio_chain.data(), _asio_chain.data() + _asio_chain.size());
+}
 std::vector<boost::asio::mutable_buffer> BufferChain::asio_buffer_sequence()
 {
-    return this->_asio_chain;
+    return std::vector<boost::asio::mutable_buffer>(_asio_chain.begin(), _asio_chain.end());
 }
 
 std::vector<boost::asio::const_buffer> buffer_chain_to_const_buffer_sequence(BufferChain& bchain)
 {
-    assert(false);
-//    return bchain._asio_chain;
+    return std::vector<boost::asio::const_buffer>(bchain._asio_chain.begin(), bchain._asio_chain.end());
 }
 std::vector<boost::asio::mutable_buffer> buffer_chain_to_mutable_buffer_sequence(BufferChain& bchain)
 {
-    return bchain._asio_chain;
+    return bchain.asio_buffer_sequence();
 }
 
 
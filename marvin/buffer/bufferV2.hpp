@@ -6,10 +6,13 @@
 #include <iterator>
 #include <algorithm>
 #include "boost_stuff.hpp"
+#include "buffer_pool.hpp"
+#include "buffer_budget.hpp"
 //#include <boost/bind.hpp>
 //#include <boost/date_time/posix_time/posix_time.hpp>
 #include <cassert>
 #include <vector>
+#include <boost/container/small_vector.hpp>
 class MBuffer;
 
 typedef std::shared_ptr<MBuffer> MBufferSPtr;
@@ -19,6 +22,10 @@ typedef std::unique_ptr<MBuffer> MBufferUPtr;
  * MBuffer class wraps a contigous buffer an provides manipulation methods.
  * Once constructed the Mbuffer iinstance "own" the raw memory.
  * MBuffer destructor releases the raw memory.
+ *
+ * The raw memory comes from MBufferPool and goes back to the pool in the destructor,
+ * so for an MBufferSPtr the memory is recycled when the last reference drops.
+ * The slab is charged to the process wide BufferBudget for the lifetime of the instance.
  */
 struct MBuffer {
 public:
@@ -104,24 +111,171 @@ protected:
     std::size_t length_;    ///
     std::size_t capacity_;  /// the capacity of the buffer, the value used for the malloc call
     std::size_t size_;      /// size of the currently filled portion of the memory slab
+    std::size_t poolCapacity_; /// the real size of the slab handed out by MBufferPool
 };
 MBufferSPtr m_buffer(std::size_t capacity);
 MBufferSPtr m_buffer(std::string s);
 MBufferSPtr m_buffer(void* mem, std::size_t size);
 MBufferSPtr m_buffer(MBuffer& mb);
 
+#pragma mark - BufferSlice class
+/**
+ * A BufferSlice is a reference counted view of part of an MBuffer. It holds a shared
+ * reference to the owning MBuffer together with an offset and a length, so the memory
+ * it points at stays valid for as long as the slice (or any copy of it) exists.
+ *
+ * Slices are the zero-copy replacement for Fragment/FBuffer. A parser that de-chunks
+ * a body can describe each piece of body data as a slice of the buffer the data was read into
+ * and hand those slices on (in a BufferChain) to a writer or a collector without
+ * copying the bytes.
+ *
+ * Slices never write to the owner, and they do not respect the owners size() - the
+ * creator is responsible for only describing bytes that hold data.
+ */
+class BufferSlice
+{
+public:
+    /**
+     * Constructor - a slice covering the used portion (0 .. size()) of owner
+     */
+    BufferSlice(MBufferSPtr owner);
+    
+    /**
+     * Constructor - a slice covering len bytes of owner starting at offset.
+     * Asserts that the range lies inside the owners capacity
+     */
+    BufferSlice(MBufferSPtr owner, std::size_t offset, std::size_t len);
+    
+    /**
+     * address of the first byte of the slice
+     */
+    void*       data();
+    
+    /**
+     * number of bytes in the slice
+     */
+    std::size_t size();
+    
+    /**
+     * offset of the first byte of the slice from the start of the owner
+     */
+    std::size_t offset();
+    
+    /**
+     * the MBuffer that holds the memory described by this slice
+     */
+    MBufferSPtr owner();
+    
+    /**
+     * true if other starts in the same MBuffer at the first byte past the end of this slice
+     */
+    bool        isContiguousWith(BufferSlice& other);
+    
+    /**
+     * grows the slice by len bytes - the caller must have checked contiguity
+     */
+    BufferSlice& extendBy(std::size_t len);
+    
+    /**
+     * returns a copy of the bytes in the slice as a std::string
+     */
+    std::string toString();
+    
+    /**
+     * converts the slice to a boost::asio::mutable_buffer
+     */
+    boost::asio::mutable_buffer asioBuffer();
+
+private:
+    MBufferSPtr     _owner;
+    std::size_t     _offset;
+    std::size_t     _length;
+};
+/**
+ * Makes a slice from a pointer and length that lies within the memory of owner
+ */
+BufferSlice buffer_slice(MBufferSPtr owner, void* ptr, std::size_t len);
+
+#pragma mark - BufferChain class
 class BufferChain;
 typedef std::shared_ptr<BufferChain> BufferChainSPtr;
+/**
+ * A BufferChain is a sequence of BufferSlices that together make up a (possibly non-contiguous)
+ * piece of data, together with the equivalent boost::asio buffer sequence for gathered writes.
+ *
+ * Pushing a slice that continues the last slice in the same MBuffer extends the last slice
+ * rather than adding a new element, so a de-chunked body read into one buffer stays
+ * as few entries as possible.
+ *
+ * The first kInlineSegments slices (and their asio buffers) are stored inside the
+ * BufferChain object itself, so the common case of a chain of one or two pieces
+ * never touches the heap. The asio buffer sequence is maintained as slices are pushed,
+ * and buffer_sequence() exposes it as a cheap view for async_write.
+ *
+ * Chains should be handed from one component to another as a BufferChainSPtr or
+ * by std::move - copying a chain copies every slice (and bumps every reference count).
+ */
 class BufferChain
 {
     public:
+        /// number of slices stored without a heap allocation
+        static const std::size_t kInlineSegments = 4;
+    
+        typedef boost::container::small_vector<BufferSlice, kInlineSegments>                    SliceStorageType;
+        typedef boost::container::small_vector<boost::asio::mutable_buffer, kInlineSegments>    AsioStorageType;
+    
+        /**
+         * A non owning view of the asio buffer sequence of a chain. It satisfies the
+         * boost::asio MutableBufferSequence and ConstBufferSequence requirements and is two
+         * pointers in size, so async_write can copy it freely. The chain must outlive
+         * any operation using the view.
+         */
+        class SequenceView
+        {
+            public:
+                typedef boost::asio::mutable_buffer         value_type;
+                typedef const boost::asio::mutable_buffer*  const_iterator;
+                SequenceView(const_iterator b, const_iterator e) : _begin(b), _end(e) {}
+                const_iterator begin() const { return _begin; }
+                const_iterator end() const { return _end; }
+                std::size_t    size() const { return (std::size_t)(_end - _begin); }
+            private:
+                const_iterator _begin;
+                const_iterator _end;
+        };
+    
         BufferChain();
+        BufferChain(const BufferChain& other) = default;
+        BufferChain(BufferChain&& other);
+        BufferChain& operator=(const BufferChain& other) = default;
+        BufferChain& operator=(BufferChain&& other);
+        /**
+         * adds the used portion of mb to the chain - no copy is made
+         */
         void            push_back(MBufferSPtr mb);
+        /**
+         * adds a slice to the chain - no copy is made
+         */
+        void            push_back(BufferSlice slice);
         void            clear();
+        /**
+         * a view of the buffer sequence suitable for boost::asio::async_write, no allocation
+         * or copying is involved
+         */
+        SequenceView    buffer_sequence() const;
+        /**
+         * returns a copy of the buffer sequence as a std::vector. Kept for existing callers,
+         * i/o paths should use buffer_sequence()
+         */
         std::vector<boost::asio::mutable_buffer> asio_buffer_sequence();
         std::size_t     size();
         std::string     to_string();
         MBufferSPtr     amalgamate();
+        /**
+         * iteration over the slices of the chain
+         */
+        SliceStorageType::iterator begin() { return _chain.begin(); }
+        SliceStorageType::iterator end() { return _chain.end(); }
         /**
          * outputs the content to a stream
          */
@@ -131,8 +285,8 @@ class BufferChain
         friend std::vector<boost::asio::mutable_buffer> buffer_chain_to_mutable_buffer_sequence(BufferChain& bchain);
 
     private:
-        std::vector<MBufferSPtr>                    _chain;
-        std::vector<boost::asio::mutable_buffer>    _asio_chain;
+        SliceStorageType                            _chain;
+        AsioStorageType                             _asio_chain;
         std::size_t                                 _size;
 };
 BufferChainSPtr buffer_chain(std::string& s);
@@ -142,6 +296,9 @@ BufferChainSPtr buffer_chain(MBufferSPtr mb_sptr);
 
 #pragma mark - Fragment class
 /**
+ * @note Fragment and FBuffer are superseded by BufferSlice and BufferChain and are only
+ * retained for the V1 MessageReader/MessageWriter. New code should use slices.
+ *
  * A Fragment is conceptually a sub buffer of an MBuffer, it consists of a pointer
  * that lies within the address range of the memory managed by an MBuffer and a size which keeps within the
  * MBuffers memory slab.
@@ -0,0 +1,151 @@
+//
+//  buffer_budget.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/12/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "buffer_budget.hpp"
+
+#pragma mark - budget state
+static std::atomic<std::size_t> __limit(0);
+static std::atomic<std::size_t> __current(0);
+static std::atomic<std::size_t> __highWater(0);
+
+#pragma mark - parked readers
+struct BufferBudget::Waiter
+{
+    boost::asio::io_service*    io;
+    std::size_t                 bytes;
+    std::function<void()>       cb;
+};
+typedef std::weak_ptr<BufferBudget::Waiter> WaiterRef;
+
+static std::mutex               __waitersMutex;
+static std::deque<WaiterRef>    __waiters;
+static std::atomic<std::size_t> __waiterCount(0);
+static std::atomic<std::size_t> __reserved(0);  /// bytes promised to woken readers whose callbacks have not run
+
+/**
+* Posts parked readers back to their own io_service, oldest first, for as long as the bytes they
+* asked for fit under the limit. Cancelled waits are dropped on the way. Called whenever
+* the budget may have become available again
+*/
+static void wakeWaiters()
+{
+    // every handle locked here is released after the mutex - one may be the last reference and
+    // the waiter's callback can hold anything, including a buffer whose credit() calls back in
+    std::vector<BufferBudget::WaitHandle> ready;
+    BufferBudget::WaitHandle blocked;
+    {
+        std::lock_guard<std::mutex> lock(__waitersMutex);
+        std::size_t lim = __limit.load();
+        std::size_t used = __current.load() + __reserved.load();
+        while( ! __waiters.empty() ) {
+            BufferBudget::WaitHandle w = __waiters.front().lock();
+            if( w && (lim != 0) && (used + w->bytes > lim) ) {
+                blocked = std::move(w);
+                break;
+            }
+            __waiters.pop_front();
+            if( ! w )
+                continue;
+            used += w->bytes;
+            __reserved += w->bytes;
+            ready.push_back(std::move(w));
+        }
+        __waiterCount.store(__waiters.size());
+    }
+    for(BufferBudget::WaitHandle& w : ready) {
+        WaiterRef ref = w;
+        std::size_t bytes = w->bytes;
+        w->io->post([ref, bytes](){
+            __reserved -= bytes;
+            BufferBudget::WaitHandle w = ref.lock();
+            if( w ) {
+                // a copy - the callback may drop the handle
+                std::function<void()> cb = w->cb;
+                cb();
+            }
+        });
+    }
+}
+
+#pragma mark - BufferBudget implementation
+
+void BufferBudget::configSet_Limit(std::size_t bytes)
+{
+    __limit.store(bytes);
+    if( __waiterCount.load() > 0 )
+        wakeWaiters();
+}
+
+std::size_t BufferBudget::limit()
+{
+    return __limit.load(std::memory_order_relaxed);
+}
+
+void BufferBudget::charge(std::size_t bytes)
+{
+    std::size_t now = __current.fetch_add(bytes) + bytes;
+    std::size_t hw = __highWater.load(std::memory_order_relaxed);
+    while( (now > hw) && ! __highWater.compare_exchange_weak(hw, now, std::memory_order_relaxed) ) {
+        // hw has been reloaded - try again
+    }
+}
+
+void BufferBudget::credit(std::size_t bytes)
+{
+    __current.fetch_sub(bytes);
+    if( __waiterCount.load() > 0 )
+        wakeWaiters();
+}
+
+bool BufferBudget::isExhausted()
+{
+    std::size_t lim = __limit.load(std::memory_order_relaxed);
+    return (lim != 0) && (__current.load(std::memory_order_relaxed) + __reserved.load(std::memory_order_relaxed) >= lim);
+}
+
+BufferBudget::WaitHandle BufferBudget::whenAvailable(boost::asio::io_service& io, std::size_t bytes, std::function<void()> cb)
+{
+    std::size_t lim = __limit.load();
+    WaitHandle w = std::make_shared<Waiter>();
+    w->io = &io;
+    // a reader wanting more than the whole limit waits for all of it
+    w->bytes = (lim != 0) ? std::min(bytes, lim) : bytes;
+    w->cb = cb;
+    {
+        std::lock_guard<std::mutex> lock(__waitersMutex);
+        __waiters.push_back(w);
+        __waiterCount.store(__waiters.size());
+    }
+    // the memory may have been released between the callers isExhausted() test and parking
+    wakeWaiters();
+    return w;
+}
+
+std::size_t BufferBudget::current()
+{
+    return __current.load(std::memory_order_relaxed);
+}
+
+std::size_t BufferBudget::highWater()
+{
+    return __highWater.load(std::memory_order_relaxed);
+}
+
+void BufferBudget::resetHighWater()
+{
+    __highWater.store(__current.load());
+}
+
+std::size_t BufferBudget::waiting()
+{
+    return __waiterCount.load(std::memory_order_relaxed);
+}
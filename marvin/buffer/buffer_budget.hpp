@@ -0,0 +1,105 @@
+//
+//  buffer_budget.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/12/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef buffer_budget_hpp
+#define buffer_budget_hpp
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include "boost_stuff.hpp"
+
+#pragma mark - BufferBudget class
+/**
+ * BufferBudget is a process wide count of the bytes held in MBuffer slabs, together
+ * with an optional limit on that total.
+ *
+ * Every MBuffer charges its slab to the budget when it is constructed and credits it back
+ * in its destructor. The budget never refuses an allocation - it is the components that
+ * start reads (MessageReaderV2 body reads and HalfTunnel) that ask isExhausted() before
+ * reading and, if the budget is exhausted, park themselves with whenAvailable() until
+ * enough buffers have been released. That way a fast upstream feeding a slow downstream
+ * stops reading instead of growing the process without bound.
+ *
+ * A parked reader says how many bytes it is about to allocate. Released memory wakes parked
+ * readers in the order they parked, only as many as the free bytes cover, and the bytes of a
+ * woken reader are reserved until its callback has run so the next release does not hand
+ * the same memory out again.
+ *
+ * whenAvailable() returns a WaitHandle. The wait is cancelled when the last copy of the handle
+ * goes away, so a reader that is destroyed (or gives up) while parked is never called back.
+ *
+ * The counters are lock free. The list of parked readers is protected by a mutex but is
+ * only touched when the budget is actually exhausted.
+ *
+ * All methods are static, there is one budget per process.
+ */
+class BufferBudget
+{
+public:
+    struct Waiter;
+    /// keeps a parked reader waiting, dropping it cancels the wait
+    typedef std::shared_ptr<Waiter> WaitHandle;
+
+    /**
+     * Called at program startup to set the maximum number of bytes that should be held
+     * in buffers. Zero (the default) means no limit.
+     */
+    static void configSet_Limit(std::size_t bytes);
+
+    /**
+     * the current limit, zero means no limit
+     */
+    static std::size_t limit();
+
+    /**
+     * Called by MBuffer to record that bytes of buffer memory are in use
+     */
+    static void charge(std::size_t bytes);
+
+    /**
+     * Called by MBuffer to record that bytes of buffer memory have been released.
+     * Wakes parked readers if the budget is no longer exhausted
+     */
+    static void credit(std::size_t bytes);
+
+    /**
+     * true if a limit is set and the bytes in use, plus those reserved for woken readers,
+     * have reached it
+     */
+    static bool isExhausted();
+
+    /**
+     * Arranges for cb to be posted to io once bytes more can be allocated within the limit.
+     * If they can when this is called cb is posted immediately. cb is only called while the
+     * returned handle (or a copy of it) is still held
+     */
+    static WaitHandle whenAvailable(boost::asio::io_service& io, std::size_t bytes, std::function<void()> cb);
+
+    /**
+     * number of bytes currently held in buffers
+     */
+    static std::size_t current();
+
+    /**
+     * the largest value current() has reached since startup or the last resetHighWater()
+     */
+    static std::size_t highWater();
+
+    /**
+     * sets the high water mark back to the current usage
+     */
+    static void resetHighWater();
+
+    /**
+     * number of readers currently parked waiting for buffer memory
+     */
+    static std::size_t waiting();
+};
+
+#endif /* buffer_budget_hpp */
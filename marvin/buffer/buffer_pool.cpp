@@ -0,0 +1,160 @@
+//
+//  buffer_pool.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/10/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cstdlib>
+#include <cassert>
+#include <atomic>
+#include "buffer_pool.hpp"
+
+#pragma mark - size classes
+/**
+ * Size classes are powers of two with a half step in between above 8K. The half steps
+ * exist because the default header (10000) and body (20000) buffer sizes would otherwise
+ * waste close to half of every slab.
+ */
+static const std::size_t __classSizes[MBufferPool::kNumberOfClasses] = {
+    1024, 2048, 4096, 8192, 12288, 16384, 24576, 32768, 49152, 65536
+};
+
+std::size_t MBufferPool::__maxFreePerClass = 64;
+
+#pragma mark - counters
+static std::atomic<uint64_t> __hits(0);
+static std::atomic<uint64_t> __misses(0);
+static std::atomic<uint64_t> __oversize(0);
+static std::atomic<uint64_t> __recycled(0);
+static std::atomic<uint64_t> __freed(0);
+
+#pragma mark - per thread free lists
+/**
+ * A free block - the link lives inside the block itself
+ */
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+/**
+ * The free lists for a single thread. The destructor runs at thread exit
+ * and returns everything to the system
+ */
+struct ThreadCache
+{
+    FreeBlock*  heads[MBufferPool::kNumberOfClasses];
+    std::size_t counts[MBufferPool::kNumberOfClasses];
+
+    ThreadCache()
+    {
+        for(int i = 0; i < MBufferPool::kNumberOfClasses; i++) {
+            heads[i] = nullptr;
+            counts[i] = 0;
+        }
+    }
+    ~ThreadCache()
+    {
+        trim();
+    }
+    void trim()
+    {
+        for(int i = 0; i < MBufferPool::kNumberOfClasses; i++) {
+            while(heads[i] != nullptr) {
+                FreeBlock* b = heads[i];
+                heads[i] = b->next;
+                free(b);
+            }
+            counts[i] = 0;
+        }
+    }
+};
+
+static ThreadCache& threadCache()
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+#pragma mark - MBufferPool implementation
+
+void MBufferPool::configSet_MaxFreePerClass(std::size_t n)
+{
+    __maxFreePerClass = n;
+}
+
+int MBufferPool::sizeClassFor(std::size_t cap)
+{
+    for(int i = 0; i < kNumberOfClasses; i++) {
+        if( cap <= __classSizes[i] )
+            return i;
+    }
+    return -1;
+}
+
+std::size_t MBufferPool::classSize(int index)
+{
+    assert( (index >= 0) && (index < kNumberOfClasses) );
+    return __classSizes[index];
+}
+
+void* MBufferPool::allocate(std::size_t cap, std::size_t& actualCapacity)
+{
+    int index = sizeClassFor(cap);
+    if( index < 0 ) {
+        __oversize.fetch_add(1, std::memory_order_relaxed);
+        actualCapacity = cap;
+        return malloc(cap);
+    }
+    actualCapacity = __classSizes[index];
+    ThreadCache& tc = threadCache();
+    FreeBlock* b = tc.heads[index];
+    if( b != nullptr ) {
+        tc.heads[index] = b->next;
+        tc.counts[index]--;
+        __hits.fetch_add(1, std::memory_order_relaxed);
+        return (void*) b;
+    }
+    __misses.fetch_add(1, std::memory_order_relaxed);
+    return malloc(actualCapacity);
+}
+
+void MBufferPool::release(void* mem, std::size_t actualCapacity)
+{
+    if( mem == nullptr )
+        return;
+    int index = sizeClassFor(actualCapacity);
+    if( (index < 0) || (__classSizes[index] != actualCapacity) ) {
+        // not one of ours - an oversize slab
+        free(mem);
+        return;
+    }
+    ThreadCache& tc = threadCache();
+    if( tc.counts[index] >= __maxFreePerClass ) {
+        __freed.fetch_add(1, std::memory_order_relaxed);
+        free(mem);
+        return;
+    }
+    FreeBlock* b = (FreeBlock*) mem;
+    b->next = tc.heads[index];
+    tc.heads[index] = b;
+    tc.counts[index]++;
+    __recycled.fetch_add(1, std::memory_order_relaxed);
+}
+
+MBufferPoolStats MBufferPool::stats()
+{
+    MBufferPoolStats s;
+    s.hits      = __hits.load(std::memory_order_relaxed);
+    s.misses    = __misses.load(std::memory_order_relaxed);
+    s.oversize  = __oversize.load(std::memory_order_relaxed);
+    s.recycled  = __recycled.load(std::memory_order_relaxed);
+    s.freed     = __freed.load(std::memory_order_relaxed);
+    return s;
+}
+
+void MBufferPool::trimThreadCache()
+{
+    threadCache().trim();
+}
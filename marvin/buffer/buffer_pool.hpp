@@ -0,0 +1,91 @@
+//
+//  buffer_pool.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/10/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef buffer_pool_hpp
+#define buffer_pool_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+#pragma mark - MBufferPool statistics
+/**
+ * A snapshot of the pool counters. Obtained from MBufferPool::stats() and intended for
+ * sizing the pool (see MBufferPool::configSet_MaxFreePerClass)
+ */
+struct MBufferPoolStats
+{
+    uint64_t    hits;       /// allocations satisfied from a free list
+    uint64_t    misses;     /// allocations of a pooled size that had to go to malloc
+    uint64_t    oversize;   /// allocations larger than the biggest size class - never pooled
+    uint64_t    recycled;   /// releases that were put back on a free list
+    uint64_t    freed;      /// releases that went back to free() because the free list was full
+};
+
+#pragma mark - MBufferPool class
+/**
+ * MBufferPool is the source of the raw memory slabs managed by MBuffer instances.
+ *
+ * Requests are rounded up to one of a small number of size classes and each thread keeps
+ * a free list for each size class. An MBuffer destructor hands its memory back to the free list
+ * of the thread that runs the destructor, so a buffer allocated on one io thread and released on
+ * another simply migrates. Free lists are bounded, anything beyond the bound goes back to free().
+ *
+ * The free lists are intrusive - a free block holds the pointer to the next free block in its
+ * first bytes - so pushing and popping never allocates.
+ *
+ * All methods are static, there is one logical pool per process.
+ */
+class MBufferPool
+{
+public:
+    /// number of size classes
+    static const int kNumberOfClasses = 10;
+
+    /**
+     * Called at program startup to change the maximum number of free blocks
+     * that each thread keeps for each size class
+     */
+    static void configSet_MaxFreePerClass(std::size_t n);
+
+    /**
+     * Returns a memory slab of at least cap bytes. On return actualCapacity holds the
+     * real size of the slab - that value must be passed back to release()
+     */
+    static void* allocate(std::size_t cap, std::size_t& actualCapacity);
+
+    /**
+     * Gives a slab obtained from allocate() back to the pool
+     */
+    static void release(void* mem, std::size_t actualCapacity);
+
+    /**
+     * Returns the index of the size class that will satisfy cap, or -1 if
+     * cap is bigger than the largest class
+     */
+    static int sizeClassFor(std::size_t cap);
+
+    /**
+     * Returns the slab size of size class index
+     */
+    static std::size_t classSize(int index);
+
+    /**
+     * Returns a snapshot of the hit/miss counters
+     */
+    static MBufferPoolStats stats();
+
+    /**
+     * Frees every block on the calling thread's free lists
+     */
+    static void trimThreadCache();
+
+private:
+    static std::size_t  __maxFreePerClass;
+};
+
+#endif /* buffer_pool_hpp */
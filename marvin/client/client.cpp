@@ -112,16 +112,16 @@ void Client::_async_write(MessageBaseSPtr requestMessage,  ResponseHandlerCallba
     bool already_connected = (_conn_shared_ptr != nullptr);
     
     if ( ! already_connected ) {
-        internalConnect();
+        internalConnect([this](){ internalWrite(); });
     }else {
         internalWrite();
     }
 }
 #endif
-void Client::internalConnect()
+void Client::internalConnect(std::function<void()> then)
 {
     LogInfo("", (long)this);
-    asyncConnect([this](Marvin::ErrorType& ec){
+    asyncConnect([this, then](Marvin::ErrorType& ec){
         LogDebug("cb-connect");
         if(!ec) {
 
@@ -131,7 +131,7 @@ void Client::internalConnect()
             TCPConnection& conRef = *_conn_uniq_ptr;
             this->_wrtr = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, conRef));
 #endif
-            internalWrite();
+            then();
         } else {
             _response_handler(ec, _rdr);
         }
@@ -151,13 +151,34 @@ void Client::internalWrite()
     // get a writer
     this->_wrtr = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, _conn_shared_ptr));
 #endif
-
+    startResponseRead();
+    
+    // we are about to write the entire request message
+    // so make sure we have the content-length correct
+    setContentLength();
+    LogInfo("",traceWriterV2(*_wrtr));
+    
+    assert(_body_mbuffer_sptr != nullptr);
+    _wrtr->asyncWrite(_current_request, _body_mbuffer_sptr, [this](Marvin::ErrorType& ec){
+        if (!ec) {
+            // do nothing - let the read happen
+            LogDebug("do nothing");
+        } else {
+            this->_response_handler(ec, _rdr);
+        }
+    });
+}
+/*!
+* Starts reading the response - piecemeal if there are headers and data handlers
+*/
+void Client::startResponseRead()
+{
     if( _on_headers_handler != nullptr ) {
         this->_rdr->readHeaders([this](Marvin::ErrorType ec){
             if (!ec) {
                 this->_on_headers_handler(ec, _rdr);
                 if( _on_data_handler != nullptr ) {
-                    this->_rdr->readBody([this](Marvin::ErrorType err, BufferChain buf_chain){
+                    this->_rdr->readBody([this](Marvin::ErrorType err, BufferChainSPtr buf_chain){
                         _on_data_handler(err, buf_chain);
                     });
                 }
@@ -166,7 +187,7 @@ void Client::internalWrite()
             }
         });
 
-    } else {
+    } else if( _response_handler != nullptr ) {
         this->_rdr->readMessage([this](Marvin::ErrorType ec){
             if (!ec) {
                 this->_response_handler(ec, _rdr);
@@ -175,21 +196,63 @@ void Client::internalWrite()
             }
         });
     }
-    
-    // we are about to write the entire request message
-    // so make sure we have the content-length correct
-    setContentLength();
-    LogInfo("",traceWriterV2(*_wrtr));
-    
-    assert(_body_mbuffer_sptr != nullptr);
-    _wrtr->asyncWrite(_current_request, _body_mbuffer_sptr, [this](Marvin::ErrorType& ec){
-        if (!ec) {
-            // do nothing - let the read happen
-            LogDebug("do nothing");
-        } else {
-            this->_response_handler(ec, _rdr);
+}
+#pragma mark - streaming a request with a chunked body
+/*!
+* The request goes out with Transfer-Encoding: chunked in place of a Content-Length
+*/
+void Client::asyncWriteHeaders(MessageBaseSPtr requestMessage, WriteHeadersCallbackType cb)
+{
+    LogInfo("", (long)this);
+    _current_request = requestMessage;
+    defaultHeaders();
+    requestMessage->removeHeader(HttpHeader::Id::ContentLength);
+    requestMessage->setHeader(HttpHeader::Id::TransferEncoding, "chunked");
+    auto writeHeaders = [this, cb]() {
+        this->_rdr = std::shared_ptr<MessageReaderV2>(new MessageReaderV2(_io, _conn_shared_ptr));
+        this->_wrtr = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, _conn_shared_ptr));
+        this->_wrtr->asyncWriteHeaders(_current_request, [this, cb](Marvin::ErrorType& ec){
+            if( ! ec )
+                startResponseRead();
+            cb(ec);
+        });
+    };
+    if( _conn_shared_ptr == nullptr ) {
+        asyncConnect([this, writeHeaders, cb](Marvin::ErrorType& ec){
+            if( ec )
+                cb(ec);
+            else
+                writeHeaders();
+        });
+    } else {
+        writeHeaders();
+    }
+}
+
+void Client::asyncWriteBodyData(BufferChainSPtr chain_sptr, bool last, WriteBodyDataCallbackType cb)
+{
+    assert(_wrtr != nullptr);
+    auto finish = [this, last, cb](Marvin::ErrorType& ec) {
+        if( ec || ( ! last) ) {
+            cb(ec);
+            return;
         }
-    });
+        _wrtr->asyncWriteTrailers(_current_request, [cb](Marvin::ErrorType& ec2, std::size_t bytes_transfered){
+            cb(ec2);
+        });
+    };
+    if( (chain_sptr != nullptr) && (chain_sptr->size() > 0) ) {
+        _wrtr->asyncWriteBodyData(chain_sptr, finish);
+    } else {
+        Marvin::ErrorType ok = Marvin::make_error_ok();
+        finish(ok);
+    }
+}
+
+void Client::asyncWriteTrailers(MessageBaseSPtr requestMessage,  AsyncWriteCallbackType cb)
+{
+    assert(_wrtr != nullptr);
+    _wrtr->asyncWriteTrailers(requestMessage, cb);
 }
 void Client::end()
 {
@@ -304,7 +367,7 @@ void Client::setContentLength()
     if( _body_mbuffer_sptr != nullptr ) {
         len = _body_mbuffer_sptr->size();
     }
-    msg->setHeader(HttpHeader::Name::ContentLength, std::to_string(len));
+    msg->setHeader(HttpHeader::Id::ContentLength, std::to_string(len));
 }
 MessageReaderV2SPtr Client::getResponse()
 {
@@ -316,6 +379,11 @@ void Client::setOnHeaders(ResponseHandlerCallbackType cb)
     _on_headers_handler = cb;
 }
 
+void Client::setOnResponse(ResponseHandlerCallbackType cb)
+{
+    _response_handler = cb;
+}
+
 void Client::setOnData(ClientDataHandlerCallbackType cb)
 {
     _on_data_handler = cb;
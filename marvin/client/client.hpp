@@ -36,7 +36,7 @@ typedef std::function<void(Marvin::ErrorType& err, MessageReaderV2SPtr msg)> Res
 /**
 * This is the type signature of callbacks that receive chunks of body data
 */
-typedef std::function<void(Marvin::ErrorType& err, BufferChain buf_chain)>  ClientDataHandlerCallbackType;
+typedef std::function<void(Marvin::ErrorType& err, BufferChainSPtr buf_chain)>  ClientDataHandlerCallbackType;
 
 /**
 * determines whether a new MessageReaderV2 and MessageWriterV2
@@ -178,15 +178,20 @@ public:
     * in which case the body will be "chunk" encoded and the headers
     * will be completed to indicate this.
     *
+    * The response is read once the headers are sent and is delivered to the handlers
+    * set with setOnHeaders/setOnData or, if there are none, to the handler set with
+    * setOnResponse.
+    *
     * Dont use this method IF there is no body data, use asyncWrite
     */
     void asyncWriteHeaders(MessageBaseSPtr requestMessage, WriteHeadersCallbackType cb);
     
     /**
     * Transmits a block of body data - the data should NOT be chunk encode
-    * that will be done within the call.
+    * that will be done within the call. Each call is one chunk sent with a single
+    * gathered write, the data is not copied.
     *
-    * @param dataBuffer (type TBD) can also be nullptr
+    * @param chain_sptr the data, can also be nullptr
     * @param last bool - signals this is the last dataBuffer and that the
     *                   chunk trailer should be generated.
     * @param cb     -   handler to be called when operation complete.
@@ -199,11 +204,9 @@ public:
     *       - the chunk encoding trailer.
     *
     */
-    void asyncWriteBodyData(void* dataBuffer, bool last, WriteBodyDataCallbackType cb);
+    void asyncWriteBodyData(BufferChainSPtr chain_sptr, bool last, WriteBodyDataCallbackType cb);
     
     /**
-    * not yet implemented
-    *
     * This method should only be used if the transmission was started with a
     * call to asyncWriteHeaders. The method asyncWrite handles trailers automatically.
     *
@@ -234,8 +237,9 @@ public:
     friend std::string traceRequestMessage(MessageBase& request);
 
 protected:
-    void internalConnect();
+    void internalConnect(std::function<void()> then);
     void internalWrite();
+    void startResponseRead();
 
     void _async_write(MessageBaseSPtr requestMessage,  ResponseHandlerCallbackType cb);
     void putHeadersStuffInBuffer();
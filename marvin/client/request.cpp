@@ -17,6 +17,7 @@ RBLOGGER_SETLEVEL(LOG_LEVEL_INFO)
 
 #include "request.hpp"
 #include "tcp_connection.hpp"
+#include "connection_pool.hpp"
 
 using boost::asio::ip::tcp;
 using boost::system::error_code;
@@ -40,12 +41,15 @@ std::string traceRequest(Request& request)
 Request::~Request()
 {
     LogInfo("");
+    end();
 }
 
 Request::Request(boost::asio::io_service& io): _io(io), MessageWriterV2(io, true)
 {
     LogInfo("");
     _writeSock = nullptr;
+    _connection = nullptr;
+    _reusable = false;
     _oneTripOnly = true;
 }
 /*!--------------------------------------------------------------------------------
@@ -164,12 +168,9 @@ void Request::go(std::function<void(Marvin::ErrorType& err)> cb)
 
 //    asyncGetWriteSocket(cf);
 
-//    ConnectionInterface* conn = connectionFactory(_io, _scheme, _server, _port);
-    ConnectionInterface* conn = (ConnectionInterface*) new TCPConnection(_io, _scheme, _server, _port);
-    //
-    // a bunch of logic here about find existing, add to connection table etc
-    //
-    conn->asyncConnect([this, conn, cb](Marvin::ErrorType& ec, ConnectionInterface* conn){
+    // an idle keep-alive connection to the same origin if the pool has one
+    _reusable = false;
+    ConnectionPool::getInstance(_io)->asyncGetConnection(_scheme, _server, _port, [this](Marvin::ErrorType& ec, ConnectionInterface* conn){
     std::string er_s = Marvin::make_error_description(ec);
         LogInfo(" conn", (long)conn, " er: ", er_s);
         this->haveConnection(ec, conn);
@@ -179,7 +180,25 @@ void Request::go(std::function<void(Marvin::ErrorType& err)> cb)
 
 void Request::end()
 {
-//    _connection = nullptr;
+    if( _connection != nullptr ) {
+        ConnectionPool::getInstance(_io)->releaseConnection(_connection, _reusable);
+        _connection = nullptr;
+        _reusable = false;
+    }
+}
+/**
+* the connection can carry another request if the server did not ask to close it - for
+* HTTP/1.0 it has to have asked to keep it alive
+*/
+bool Request::responseAllowsReuse()
+{
+    std::string conn_value = _rdr->hasHeader(HttpHeader::Id::Connection)
+        ? boost::to_lower_copy(_rdr->getHeader(HttpHeader::Id::Connection)) : std::string();
+    if( conn_value.find("close") != std::string::npos )
+        return false;
+    if( _rdr->httpVersMinor() == 0 )
+        return conn_value.find("keep-alive") != std::string::npos;
+    return true;
 }
 //--------------------------------------------------------------------------------
 // get a socket from the connection manager for this request
@@ -265,6 +284,7 @@ void Request::fullWriteHandler(Marvin::ErrorType& err)
 //            LogTrace(traceReader(*_rdr));
 //        }
         LogInfo("readMessage callback");
+        _reusable = ( ! err ) && responseAllowsReuse();
         auto pf = std::bind(this->_goCb, err);
         _io.post(pf);
     
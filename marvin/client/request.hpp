@@ -35,6 +35,10 @@ public:
     
     void setUrl(std::string url);
     
+    /**
+     * Gives the connection back to the ConnectionPool, for re-use if the response was read
+     * completely and allows the connection to stay open
+     */
     void end();
     
     friend std::string traceRequest(Request& request);
@@ -45,11 +49,13 @@ protected:
     void fullWriteHandler(Marvin::ErrorType& err);
     void readComplete(Marvin::ErrorType& err);
     void defaultHeaders();
+    bool responseAllowsReuse();
 
     boost::asio::io_service&                        _io;
     MessageReaderV2SPtr                             _rdr;
     
-    ConnectionInterfaceSPtr                         _connection;
+    ConnectionInterface*                            _connection;    /// owned by the ConnectionPool
+    bool                                            _reusable;
     ReadSocketInterfaceSPtr                         _readSock;
     
     std::function<void(Marvin::ErrorType& err)>     _goCb;
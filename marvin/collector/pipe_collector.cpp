@@ -31,8 +31,8 @@ bool bodyIsCollectable(MessageBase& msg, std::vector<std::regex>& regexs)
 {
     bool capture = false;
     std::string hv;
-    if( msg.hasHeader(HttpHeader::Name::ContentType) ){
-        hv = msg.getHeader(HttpHeader::Name::ContentType);
+    if( msg.hasHeader(HttpHeader::Id::ContentType) ){
+        hv = msg.getHeader(HttpHeader::Id::ContentType);
         capture = headerValueMatched(hv, regexs);
     }
     return capture;
@@ -106,7 +106,6 @@ void PipeCollector::postedCollect(
     temp << "REQUEST : =========" << std::endl;
     temp << req->getMethodAsString() << " " << req->uri() << " ";
     temp << "HTTP/" << req->httpVersMajor() << "." << req->httpVersMinor() << std::endl;
-    auto reqHeaders = req->getHeaders();
     req->dumpHeaders(temp);
     if( bodyIsCollectable(*req, regexs) ){
         temp << req->getBody();
@@ -115,10 +114,17 @@ void PipeCollector::postedCollect(
     temp << "RESPONSE : ========" << std::endl;
     temp << "HTTP/" << resp->httpVersMajor() << "." << resp->httpVersMinor() << " ";
     temp << resp->statusCode() << " " << resp->status() << std::endl;
-    auto respHeaders = resp->getHeaders();
     resp->dumpHeaders(temp);
     if( bodyIsCollectable(*resp, regexs) ){
-        temp << resp->getBody() << std::endl;
+        // a body spilled to disk is read through a mapping of the file, not copied into the writer
+        BodyFileSPtr body_file = resp->getBodyFile();
+        const char* body_ptr = (body_file != nullptr) ? body_file->map() : nullptr;
+        if( body_ptr != nullptr ){
+            temp.write(body_ptr, body_file->size());
+            temp << std::endl;
+        } else {
+            temp << resp->getBody() << std::endl;
+        }
     }
 
     temp << "------------------------------------------------" << std::endl;
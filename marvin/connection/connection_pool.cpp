@@ -7,6 +7,10 @@
 //
 #include <map>
 #include <set>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <boost/algorithm/string.hpp>
 #include "connection_pool.hpp"
 
 #include "rb_logger.hpp"
@@ -27,21 +31,114 @@ InUseConnectionsType::size()
 {
     return _connections.size();
 }
+std::size_t
+InUseConnectionsType::size(std::string key)
+{
+    auto it = _perKey.find(key);
+    return (it == _perKey.end()) ? 0 : it->second;
+}
 
-void
+std::string
 InUseConnectionsType::remove(ConnectionInterface* aConn)
 {
     if( aConn == NULL )
-        return;
-    if( _connections.find(aConn) == _connections.cend() ) { assert(false);}
-    _connections.erase(aConn);
-    
+        return std::string();
+    auto it = _connections.find(aConn);
+    if( it == _connections.cend() ) { assert(false);}
+    std::string key = it->second;
+    _connections.erase(it);
+    auto kit = _perKey.find(key);
+    if( --(kit->second) == 0 )
+        _perKey.erase(kit);
+    return key;
 }
 
 void
-InUseConnectionsType::add(ConnectionInterface* conn)
+InUseConnectionsType::add(ConnectionInterface* conn, std::string key)
+{
+    _connections[conn] = key;
+    _perKey[key]++;
+}
+//---------------------------------------------------------------------------------------------------
+// IdleConnections - connected, released connections waiting to be re-used, per target
+//---------------------------------------------------------------------------------------------------
+IdleConnectionsType::IdleConnectionsType() : _count(0)
+{
+}
+std::size_t
+IdleConnectionsType::size()
+{
+    return _count;
+}
+std::size_t
+IdleConnectionsType::size(std::string key)
+{
+    auto it = _idle.find(key);
+    return (it == _idle.end()) ? 0 : it->second.size();
+}
+void
+IdleConnectionsType::add(std::string key, ConnectionInterface* conn, Clock::time_point now)
 {
-    _connections[conn] = conn;
+    _idle[key].push_front(Idle{conn, now});
+    _count++;
+}
+ConnectionInterface*
+IdleConnectionsType::take(std::string key)
+{
+    auto it = _idle.find(key);
+    if( it == _idle.end() )
+        return nullptr;
+    ConnectionInterface* conn = it->second.front().conn;
+    it->second.pop_front();
+    if( it->second.empty() )
+        _idle.erase(it);
+    _count--;
+    return conn;
+}
+ConnectionInterface*
+IdleConnectionsType::removeOldest(std::string key)
+{
+    auto oldest = _idle.end();
+    if( ! key.empty() ) {
+        oldest = _idle.find(key);
+    } else {
+        for(auto it = _idle.begin(); it != _idle.end(); it++) {
+            if( (oldest == _idle.end()) || (it->second.back().since < oldest->second.back().since) )
+                oldest = it;
+        }
+    }
+    if( oldest == _idle.end() )
+        return nullptr;
+    ConnectionInterface* conn = oldest->second.back().conn;
+    oldest->second.pop_back();
+    if( oldest->second.empty() )
+        _idle.erase(oldest);
+    _count--;
+    return conn;
+}
+std::vector<ConnectionInterface*>
+IdleConnectionsType::removeIdleSince(Clock::time_point cutoff)
+{
+    std::vector<ConnectionInterface*> result;
+    for(auto it = _idle.begin(); it != _idle.end(); ) {
+        std::deque<Idle>& q = it->second;
+        while( ! q.empty() && (q.back().since < cutoff) ) {
+            result.push_back(q.back().conn);
+            q.pop_back();
+            _count--;
+        }
+        it = q.empty() ? _idle.erase(it) : std::next(it);
+    }
+    return result;
+}
+IdleConnectionsType::Clock::time_point
+IdleConnectionsType::oldestSince()
+{
+    Clock::time_point oldest = Clock::time_point::max();
+    for(auto& entry : _idle) {
+        oldest = std::min(oldest, entry.second.back().since);
+    }
+    return oldest;
 }
 
 //---------------------------------------------------------------------------------------------------
@@ -57,6 +154,8 @@ ConnectionRequest::ConnectionRequest(
     _server = server;
     _service = service;
     _callback = cb;
+    _targetPrev = _targetNext = nullptr;
+    _agePrev = _ageNext = nullptr;
 }
 ConnectionRequest::~ConnectionRequest()
 {
@@ -65,97 +164,163 @@ ConnectionRequest::~ConnectionRequest()
 //---------------------------------------------------------------------------------------------------
 // WaitingRequests - List of requests for a connection that have been put into "wait"
 //---------------------------------------------------------------------------------------------------
-WaitingRequestsType::WaitingRequestsType()
+WaitingRequestsType::WaitingRequestsType() : _oldest(nullptr), _newest(nullptr), _count(0)
 {
 }
     
 std::size_t
 WaitingRequestsType::size()
 {
-    return _waitingRequests.size();
+    return _count;
 }
-ConnectionRequest*
-WaitingRequestsType::find(std::string scheme, std::string server, std::string service)
-{
-    LogDebug(" size:", _waitingRequests.size());
-    for( auto itr = _waitingRequests.begin(); itr < _waitingRequests.end(); itr++ ){
-        auto ent = *itr;
-        if( (ent->_scheme == scheme) && (ent->_server == server) && (ent->_service == service) ){
-            _waitingRequests.erase(itr);
-            return ent;
-        }
+std::size_t
+WaitingRequestsType::size(std::string key)
+{
+    auto it = _targets.find(key);
+    return (it == _targets.end()) ? 0 : it->second.size;
+}
+void
+WaitingRequestsType::add(ConnectionRequest* connReq)
+{
+    LogDebug(" size:", _count);
+    auto it = _targets.find(connReq->_key);
+    if( it == _targets.end() ) {
+        // a target that had nothing waiting joins the back of the turn
+        TargetQueue q{nullptr, nullptr, 0, _turns.insert(_turns.end(), connReq->_key)};
+        it = _targets.emplace(connReq->_key, q).first;
     }
-    return nullptr;
+    TargetQueue& q = it->second;
+    connReq->_targetPrev = q.tail;
+    connReq->_targetNext = nullptr;
+    if( q.tail != nullptr )
+        q.tail->_targetNext = connReq;
+    else
+        q.head = connReq;
+    q.tail = connReq;
+    q.size++;
+
+    connReq->_agePrev = _newest;
+    connReq->_ageNext = nullptr;
+    if( _newest != nullptr )
+        _newest->_ageNext = connReq;
+    else
+        _oldest = connReq;
+    _newest = connReq;
+    _count++;
 }
+void
+WaitingRequestsType::remove(ConnectionRequest* connReq)
+{
+    auto it = _targets.find(connReq->_key);
+    assert( it != _targets.end() );
+    TargetQueue& q = it->second;
+    if( connReq->_targetPrev != nullptr )
+        connReq->_targetPrev->_targetNext = connReq->_targetNext;
+    else
+        q.head = connReq->_targetNext;
+    if( connReq->_targetNext != nullptr )
+        connReq->_targetNext->_targetPrev = connReq->_targetPrev;
+    else
+        q.tail = connReq->_targetPrev;
+    if( --q.size == 0 ) {
+        _turns.erase(q.turn);
+        _targets.erase(it);
+    }
 
+    if( connReq->_agePrev != nullptr )
+        connReq->_agePrev->_ageNext = connReq->_ageNext;
+    else
+        _oldest = connReq->_ageNext;
+    if( connReq->_ageNext != nullptr )
+        connReq->_ageNext->_agePrev = connReq->_agePrev;
+    else
+        _newest = connReq->_agePrev;
+    connReq->_targetPrev = connReq->_targetNext = nullptr;
+    connReq->_agePrev = connReq->_ageNext = nullptr;
+    _count--;
+}
 ConnectionRequest*
-WaitingRequestsType::removeOldest()
+WaitingRequestsType::find(std::string key)
 {
-    LogDebug(" size:", _waitingRequests.size());
-    auto r =  _waitingRequests[0];
-    _waitingRequests.erase(_waitingRequests.begin());
+    LogDebug(" size:", _count);
+    auto it = _targets.find(key);
+    if( it == _targets.end() )
+        return nullptr;
+    ConnectionRequest* r = it->second.head;
+    remove(r);
     return r;
 }
-    
-void
-WaitingRequestsType::add(ConnectionRequest* connReq)
+ConnectionRequest*
+WaitingRequestsType::oldest()
 {
-    LogDebug(" size:", _waitingRequests.size());
-    _waitingRequests.push_back(connReq);
+    return _oldest;
+}
+ConnectionRequest*
+WaitingRequestsType::removeNext(std::function<bool(const std::string& key)> eligible)
+{
+    LogDebug(" size:", _count, " targets:", _turns.size());
+    for(auto turn = _turns.begin(); turn != _turns.end(); turn++) {
+        if( ! eligible(*turn) )
+            continue;
+        std::string key = *turn;
+        ConnectionRequest* r = _targets[key].head;
+        remove(r);
+        auto it = _targets.find(key);
+        if( it != _targets.end() )
+            _turns.splice(_turns.end(), _turns, it->second.turn);
+        return r;
+    }
+    return nullptr;
 }
 
 
-#ifdef NOTYET
-//---------------------------------------------------------------------------------------------------
-// map of counters by assigned host - that is host that have been assigned to a connection
-// where the connection is either inuse of idle
-//---------------------------------------------------------------------------------------------------
-class HostsCounterType
+static std::size_t  __maxIdlePerHost = 8;
+static std::size_t  __maxIdle = 64;
+static long         __idleTimeoutMs = 30000;
+static std::size_t  __maxConnections = 25;
+static std::size_t  __maxConnectionsPerHost = 0;
+static long         __waitTimeoutMs = 30000;
+
+void ConnectionPool::configSet_MaxIdlePerHost(std::size_t n) { __maxIdlePerHost = n; }
+void ConnectionPool::configSet_MaxIdle(std::size_t n) { __maxIdle = n; }
+void ConnectionPool::configSet_IdleTimeout(long millisecs) { __idleTimeoutMs = millisecs; }
+void ConnectionPool::configSet_MaxConnections(std::size_t n) { __maxConnections = n; }
+void ConnectionPool::configSet_MaxConnectionsPerHost(std::size_t n) { __maxConnectionsPerHost = n; }
+void ConnectionPool::configSet_WaitTimeout(long millisecs) { __waitTimeoutMs = millisecs; }
+
+double ConnectionPool::Metrics::reuseRatio() const
 {
-    private:
-    std::map<std::string, std::size_t>  _count;
-    
-    public:
-    HostsCounterType(){}
-    void addHost(std::string hostId)
-    {
-        if( _count.find(hostId) != std::map::end { assert(false);}
-        _count[hostId] = 0;
-    }
-    void removeHost(std::string hostId)
-    {
-        if( _count.erase(hostId) != 1) { assert(false); };
-    }
-    void incrementHost(std::string hostId)
-    {
-        if( _count.find(hostId) != std::map::end { assert(false);}
-        _count[hostId] = _count[hostId]++;
-    }
-    void decrementHost(std::string hostId)
-    {
-        if( _count.find(hostId) != std::map::end { assert(false);}
-        _count[hostId]-- = _count[hostId]--;
-    }
-    std::size_t countFor(std::string hostId)
-    {
-        if( _count.find(hostId) != std::map::end { assert(false);}
-        return _count[hostId];
-    }
-    
-};
-#endif
-ConnectionPool* globalConnectionPool = NULL;
+    std::size_t total = created + reused;
+    return (total == 0) ? 0.0 : (double)reused / (double)total;
+}
 
-ConnectionPool::ConnectionPool(boost::asio::io_service& io_service): io(io_service), resolver_(io_service), _poolStrand(io)
+ConnectionPool::ConnectionPool(boost::asio::io_service& io_service)
+    : io(io_service), _waitTimer(io_service), _waitTimerArmed(false),
+      _idleTimer(io_service), _idleTimerArmed(false), _metrics(), _poolStrand(io)
 {
-    _maxConnections = 25;
+    _maxConnections = __maxConnections;
 }
+/**
+* Owns the pool of one io_service, like TimingWheel is an asio service so there is exactly one
+* per io_service. The pool is made in the constructor so the services its timers and strand use
+* are registered before this one, and are still there when this one is destroyed
+*/
+class ConnectionPool::Service : public boost::asio::io_service::service
+{
+public:
+    static boost::asio::io_service::id id;
+    explicit Service(boost::asio::io_service& io)
+        : boost::asio::io_service::service(io), pool(new ConnectionPool(io))
+    {}
+    std::unique_ptr<ConnectionPool> pool;
+private:
+    void shutdown_service() {}
+};
+boost::asio::io_service::id ConnectionPool::Service::id;
+
 ConnectionPool* ConnectionPool::getInstance(boost::asio::io_service& io)
 {
-    if( globalConnectionPool == NULL ){
-        globalConnectionPool = new ConnectionPool(io);
-    }
-    return globalConnectionPool;
+    return boost::asio::use_service<Service>(io).pool.get();
 }
 /**
  * get a connection to the scheme::server
@@ -167,7 +332,10 @@ void ConnectionPool::asyncGetConnection(
             ConnectCallbackType cb
 )
 {
-    auto hf = _poolStrand.wrap(std::bind(&ConnectionPool::__asyncGetConnection, this, scheme, server, service, cb));
+    auto hf = _poolStrand.wrap([this, scheme, server, service, cb](){
+        __asyncGetConnection(scheme, server, service, cb);
+        updateCountMetrics();
+    });
     io.post(hf);
 }
 void ConnectionPool::__asyncGetConnection(
@@ -178,12 +346,94 @@ void ConnectionPool::__asyncGetConnection(
 )
 {
     LogDebug(" inUser size : ", _inUse.size());
-    if( _inUse.size() >= _maxConnections){
-        auto r = new ConnectionRequest(scheme, server, service, cb);
-        _waitingRequests.add(r);
-    }else{
-        createNewConnection(scheme, server, service, cb);
+    auto r = new ConnectionRequest(scheme, server, service, cb);
+    r->_key = targetKey(scheme, server, service);
+    // requests already waiting for the target go first, even if there is room now
+    if( hasRoom(r->_key) && (_waitingRequests.size(r->_key) == 0) ) {
+        serveRequest(r);
+        return;
+    }
+    r->_deadline = (__waitTimeoutMs > 0)
+        ? std::chrono::steady_clock::now() + std::chrono::milliseconds(__waitTimeoutMs)
+        : std::chrono::steady_clock::time_point::max();
+    _waitingRequests.add(r);
+    armWaitTimer();
+    // look the name up while the request waits, the connect will find it in the cache
+    ResolverCache::getInstance().asyncResolve(io, server, service, [](Marvin::ErrorType& err, EndpointsSPtr endpoints){});
+}
+bool ConnectionPool::hasRoom(const std::string& key)
+{
+    if( _inUse.size() >= _maxConnections )
+        return false;
+    return (__maxConnectionsPerHost == 0) || (_inUse.size(key) < __maxConnectionsPerHost);
+}
+/**
+* gives the request an idle connection for its target or a new one, and deletes it
+*/
+void ConnectionPool::serveRequest(ConnectionRequest* req)
+{
+    ConnectionInterface* idle_conn = takeIdle(req->_key);
+    if( idle_conn != nullptr ) {
+        _inUse.add(idle_conn, req->_key);
+        postSuccess(req->_callback, idle_conn);
+    } else {
+        createNewConnection(req->_scheme, req->_server, req->_service, req->_callback);
+    }
+    delete req;
+}
+/**
+* serves waiting requests while there is room, taking the targets in turn so each target
+* that has room gets one connection before any gets a second
+*/
+void ConnectionPool::dispatchWaiting()
+{
+    while( (_waitingRequests.size() > 0) && (_inUse.size() < _maxConnections) ) {
+        ConnectionRequest* req = _waitingRequests.removeNext([this](const std::string& key){
+            return hasRoom(key);
+        });
+        if( req == nullptr )
+            break;
+        LogDebug(" dispatch a waiting connection request size: ", _waitingRequests.size());
+        serveRequest(req);
+    }
+}
+#pragma mark - wait deadlines
+/**
+* One timer for all waiting requests, set for the oldest. The wait timeout is the same for
+* every request so the oldest has the first deadline - if the timeout is changed while
+* requests wait a newer request may fail a little late, never early
+*/
+void ConnectionPool::armWaitTimer()
+{
+    ConnectionRequest* oldest = _waitingRequests.oldest();
+    if( _waitTimerArmed || (oldest == nullptr)
+        || (oldest->_deadline == std::chrono::steady_clock::time_point::max()) )
+        return;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(oldest->_deadline - std::chrono::steady_clock::now());
+    _waitTimerArmed = true;
+    _waitTimer.expires_from_now(boost::posix_time::milliseconds(std::max<long>(0, (long)wait.count() + 1)));
+    _waitTimer.async_wait(_poolStrand.wrap([this](const boost::system::error_code& err){
+        handleWaitTimer(err);
+        updateCountMetrics();
+    }));
+}
+void ConnectionPool::handleWaitTimer(const boost::system::error_code& err)
+{
+    _waitTimerArmed = false;
+    auto now = std::chrono::steady_clock::now();
+    ConnectionRequest* req;
+    while( ((req = _waitingRequests.oldest()) != nullptr) && (req->_deadline <= now) ) {
+        LogWarn(" request for ", req->_key, " waited too long for a connection");
+        _waitingRequests.remove(req);
+        {
+            std::lock_guard<std::mutex> lock(_metricsMutex);
+            _metrics.timedOut++;
+        }
+        Marvin::ErrorType ec = boost::asio::error::make_error_code(boost::asio::error::timed_out);
+        postFail(req->_callback, ec);
+        delete req;
     }
+    armWaitTimer();
 }
 void ConnectionPool::createNewConnection(
             std::string scheme, // http: or https:
@@ -197,16 +447,18 @@ void ConnectionPool::createNewConnection(
             //                                                tcp::resolver::query::canonical_name);
     
     ConnectionInterface* conn = connectionFactory(io, scheme, server, service);
-    //
-    // a bunch of logic here about find existing, add to connection table etc
-    //
-    _inUse.add(conn);
-    //
-    //
-    conn->asyncConnect([this, conn, cb](Marvin::ErrorType& ec, ConnectionInterface* conn){
+    conn->setSocketOptions(socketOptionsFor(scheme, server, service));
+    _inUse.add(conn, targetKey(scheme, server, service));
+    {
+        std::lock_guard<std::mutex> lock(_metricsMutex);
+        _metrics.created++;
+    }
+    conn->asyncConnect([this, conn, cb](Marvin::ErrorType& ec, ConnectionInterface* connected){
         if( !ec ){
-            postSuccess(cb, conn);
+            postSuccess(cb, connected);
         }else{
+            // the caller never sees this connection so it is given back here
+            releaseConnection(conn, false);
             postFail(cb, ec);
         }
     });
@@ -215,60 +467,171 @@ void ConnectionPool::createNewConnection(
 //
 //so far all we implement is a limit on the number of connections
 //
-void ConnectionPool::releaseConnection(ConnectionInterface* conn)
+void ConnectionPool::releaseConnection(ConnectionInterface* conn, bool reusable)
 {
-    auto hf = _poolStrand.wrap(std::bind(&ConnectionPool::__releaseConnection, this, conn));
+    auto hf = _poolStrand.wrap([this, conn, reusable](){
+        __releaseConnection(conn, reusable);
+        updateCountMetrics();
+    });
     io.post(hf);
 
 }
-void ConnectionPool::__releaseConnection(ConnectionInterface* conn)
+void ConnectionPool::__releaseConnection(ConnectionInterface* conn, bool reusable)
 {
-    LogDebug(" conn: ", conn);
+    LogDebug(" conn: ", conn, " reusable: ", reusable);
     assert( conn != NULL );
-    _inUse.remove(conn);
-//    delete conn;
-    if( _waitingRequests.size() > 0 )
-    {
-        LogDebug(" dispatch a waiting connection request size: ", _waitingRequests.size());
-        //
-        // get the req that has been waiting the lngests
-        //
-        auto req = _waitingRequests.removeOldest();
-        std::string scheme = req->_scheme;
-        std::string server = req->_server;
-        std::string service = req->_service;
-        ConnectCallbackType cb = req->_callback;
-        delete req;
-        createNewConnection(scheme, server, service, cb);
-    }
-// have not implemented real pooling - where we keep connections open
-#ifdef CONN_POOLING
-    return;
-    if( _waitingRequests.size() > 0 ){
-        auto req = _waitingRequests.find(conn->scheme(), conn->server(), conn->service());
-        // found a request for the same host
-        if( req != nullptr ){
+    std::string key = _inUse.remove(conn);
+    closeExpired();
+    if( reusable && conn->isAlive() ) {
+        auto req = _waitingRequests.find(key);
+        if( req != nullptr ) {
+            // a request for the same target has been waiting - give it this connection
+            LogDebug(" hand released connection to a waiting request");
+            {
+                std::lock_guard<std::mutex> lock(_metricsMutex);
+                _metrics.reused++;
+            }
+            _inUse.add(conn, key);
             postSuccess(req->_callback, conn);
+            delete req;
             return;
-        }else{
-            // none of the request are for same host
-            // destroy releasing conn and create a new one
-            
-            // could try and be trickey here and repurpose the conn
-            
-            _inUse.remove(conn);
-            delete conn;
-            // get oldest waiting request
-            req = _waitingRequests.removeOldest();
-            // create a connection for it
-            createNewConnection(req->_scheme, req->_server, req->_service, req->_callback);
         }
-    }else{
-        LogDebug("");
-        _inUse.remove(conn);
-        delete conn;
+        _idle.add(key, conn, IdleConnectionsType::Clock::now());
+        armIdleTimer();
+        std::size_t evicted = 0;
+        while( _idle.size(key) > __maxIdlePerHost ) {
+            closeConnection(_idle.removeOldest(key));
+            evicted++;
+        }
+        while( _idle.size() > __maxIdle ) {
+            closeConnection(_idle.removeOldest());
+            evicted++;
+        }
+        if( evicted > 0 ) {
+            std::lock_guard<std::mutex> lock(_metricsMutex);
+            _metrics.evicted += evicted;
+        }
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(_metricsMutex);
+            _metrics.closed++;
+        }
+        closeConnection(conn);
     }
-#endif
+    dispatchWaiting();
+}
+#pragma mark - idle connections
+/**
+* the newest live idle connection for key, closing any dead ones found on the way
+*/
+ConnectionInterface* ConnectionPool::takeIdle(std::string key)
+{
+    closeExpired();
+    ConnectionInterface* conn;
+    while( (conn = _idle.take(key)) != nullptr ) {
+        if( conn->isAlive() ) {
+            std::lock_guard<std::mutex> lock(_metricsMutex);
+            _metrics.reused++;
+            return conn;
+        }
+        LogDebug(" idle connection is dead: ", conn);
+        {
+            std::lock_guard<std::mutex> lock(_metricsMutex);
+            _metrics.stale++;
+        }
+        closeConnection(conn);
+    }
+    return nullptr;
+}
+/**
+* One timer for all idle connections, set for when the one idle longest expires. Idle
+* connections are closed at the idle timeout even if the pool is not used again
+*/
+void ConnectionPool::armIdleTimer()
+{
+    if( _idleTimerArmed || (__idleTimeoutMs <= 0) || (_idle.size() == 0) )
+        return;
+    auto expires = _idle.oldestSince() + std::chrono::milliseconds(__idleTimeoutMs);
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(expires - IdleConnectionsType::Clock::now());
+    _idleTimerArmed = true;
+    _idleTimer.expires_from_now(boost::posix_time::milliseconds(std::max<long>(0, (long)wait.count() + 1)));
+    _idleTimer.async_wait(_poolStrand.wrap([this](const boost::system::error_code& err){
+        handleIdleTimer(err);
+        updateCountMetrics();
+    }));
+}
+void ConnectionPool::handleIdleTimer(const boost::system::error_code& err)
+{
+    _idleTimerArmed = false;
+    closeExpired();
+    armIdleTimer();
+}
+void ConnectionPool::closeExpired()
+{
+    auto cutoff = IdleConnectionsType::Clock::now() - std::chrono::milliseconds(__idleTimeoutMs);
+    std::vector<ConnectionInterface*> expired = _idle.removeIdleSince(cutoff);
+    for(ConnectionInterface* conn : expired) {
+        closeConnection(conn);
+    }
+    if( ! expired.empty() ) {
+        std::lock_guard<std::mutex> lock(_metricsMutex);
+        _metrics.expired += expired.size();
+    }
+}
+void ConnectionPool::closeConnection(ConnectionInterface* conn)
+{
+    conn->close();
+    delete conn;
+}
+void ConnectionPool::updateCountMetrics()
+{
+    std::lock_guard<std::mutex> lock(_metricsMutex);
+    _metrics.idle = _idle.size();
+    _metrics.inUse = _inUse.size();
+    _metrics.waiting = _waitingRequests.size();
+}
+ConnectionPool::Metrics ConnectionPool::metrics()
+{
+    std::lock_guard<std::mutex> lock(_metricsMutex);
+    return _metrics;
+}
+#pragma mark - socket options
+void ConnectionPool::setSocketOptions(SocketOptions options)
+{
+    auto hf = _poolStrand.wrap(std::bind(&ConnectionPool::__setSocketOptions, this, std::string(), options));
+    io.post(hf);
+}
+void ConnectionPool::setSocketOptions(std::string scheme, std::string server, std::string port, SocketOptions options)
+{
+    auto hf = _poolStrand.wrap(std::bind(&ConnectionPool::__setSocketOptions, this, targetKey(scheme, server, port), options));
+    io.post(hf);
+}
+/**
+* an empty target means the pool wide options
+*/
+void ConnectionPool::__setSocketOptions(std::string target, SocketOptions options)
+{
+    LogInfo("target: ", target, " options: ", options.str());
+    if( target.empty() ) {
+        _socketOptions = options;
+    } else {
+        _targetSocketOptions[target] = options;
+    }
+}
+SocketOptions ConnectionPool::socketOptionsFor(std::string scheme, std::string server, std::string port)
+{
+    if( _targetSocketOptions.empty() )
+        return _socketOptions;
+    auto it = _targetSocketOptions.find(targetKey(scheme, server, port));
+    return (it == _targetSocketOptions.end()) ? _socketOptions : it->second;
+}
+std::string ConnectionPool::targetKey(std::string scheme, std::string server, std::string port)
+{
+    return boost::to_lower_copy(scheme) + "://" + boost::to_lower_copy(server) + ":" + port;
+}
+SocketOptions ConnectionPool::effectiveSocketOptions(ConnectionInterface* conn)
+{
+    return SocketOptions::effective(conn->nativeSocketFD(), SocketOptions::Role::Upstream);
 }
 void ConnectionPool::postSuccess(ConnectCallbackType cb, ConnectionInterface* conn)
 {
@@ -13,7 +13,13 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
 #include "connection_interface.hpp"
+#include "resolver_cache.hpp"
 #include "connection_pool.hpp"
 
 //---------------------------------------------------------------------------------------------------
@@ -22,16 +28,50 @@
 class InUseConnectionsType
 {
     private:
-    std::map<ConnectionInterface*, ConnectionInterface*>  _connections;
+    std::map<ConnectionInterface*, std::string>  _connections;   /// connection -> its target key
+    std::map<std::string, std::size_t>           _perKey;        /// target key -> connections in use
     
     public:
     
     InUseConnectionsType();
     std::size_t size();
+    std::size_t size(std::string key);
     
-    void remove(ConnectionInterface* aConn);
+    /// returns the target key the connection was added with
+    std::string remove(ConnectionInterface* aConn);
     
-    void add(ConnectionInterface* conn);
+    void add(ConnectionInterface* conn, std::string key);
+};
+//---------------------------------------------------------------------------------------------------
+// IdleConnections - connected, released connections waiting to be re-used, per target
+//---------------------------------------------------------------------------------------------------
+class IdleConnectionsType
+{
+    public:
+    typedef std::chrono::steady_clock Clock;
+
+    IdleConnectionsType();
+    std::size_t size();
+    std::size_t size(std::string key);
+
+    /// most recently released first - the warmest connection is re-used first
+    void add(std::string key, ConnectionInterface* conn, Clock::time_point now);
+    /// the most recently released connection for key, or nullptr
+    ConnectionInterface* take(std::string key);
+    /// the connection that has been idle longest for key (or any key if key is empty), or nullptr
+    ConnectionInterface* removeOldest(std::string key = std::string());
+    /// every connection that has been idle since before cutoff
+    std::vector<ConnectionInterface*> removeIdleSince(Clock::time_point cutoff);
+    /// when the connection idle longest was released, time_point::max() if there is none
+    Clock::time_point oldestSince();
+
+    private:
+    struct Idle {
+        ConnectionInterface*    conn;
+        Clock::time_point       since;
+    };
+    std::map<std::string, std::deque<Idle>>  _idle;
+    std::size_t                              _count;
 };
 //---------------------------------------------------------------------------------------------------
 // ConnectionRequest - Holds a pending request for a connection
@@ -43,7 +83,15 @@ class ConnectionRequest
         std::string             _scheme;
         std::string             _server;
         std::string             _service;
+        std::string             _key;       /// ConnectionPool::targetKey of the above
         ConnectCallbackType    _callback;
+        std::chrono::steady_clock::time_point   _deadline;  /// fails with timed_out if still waiting then
+    
+        // links for WaitingRequestsType - the queue of its target, and the queue of all requests by age
+        ConnectionRequest*      _targetPrev;
+        ConnectionRequest*      _targetNext;
+        ConnectionRequest*      _agePrev;
+        ConnectionRequest*      _ageNext;
     
         ConnectionRequest(
             std::string scheme,
@@ -60,17 +108,36 @@ class ConnectionRequest
 //---------------------------------------------------------------------------------------------------
 class WaitingRequestsType
 {
-    private:
-    std::vector<ConnectionRequest*>  _waitingRequests;
-    
     public:
     WaitingRequestsType();
     std::size_t    size();
+    std::size_t    size(std::string key);
 
-    ConnectionRequest*  find(std::string scheme,std::string server,std::string service);
-    
-    ConnectionRequest*  removeOldest();
     void add(ConnectionRequest* connReq);
+    /// takes connReq out of the queues wherever it is
+    void remove(ConnectionRequest* connReq);
+    /// removes and returns the oldest request for the target key, or nullptr
+    ConnectionRequest*  find(std::string key);
+    /// the request that has waited longest for any target, not removed, or nullptr
+    ConnectionRequest*  oldest();
+    /**
+     * removes and returns the oldest request of the first target, in round robin order, that
+     * eligible accepts - that target then goes to the back of the turn. nullptr if none
+     */
+    ConnectionRequest*  removeNext(std::function<bool(const std::string& key)> eligible);
+
+    private:
+    struct TargetQueue {
+        ConnectionRequest*                  head;
+        ConnectionRequest*                  tail;
+        std::size_t                         size;
+        std::list<std::string>::iterator    turn;   /// this target in _turns
+    };
+    std::unordered_map<std::string, TargetQueue>    _targets;   /// only targets with waiting requests
+    std::list<std::string>                          _turns;     /// target keys, the next to be served first
+    ConnectionRequest*                              _oldest;
+    ConnectionRequest*                              _newest;
+    std::size_t                                     _count;
 };
 
 //
@@ -95,49 +162,105 @@ class WaitingRequestsType
 //
 //  idle
 //  ====
-//  is a list of connections that have been assigned to a host but have since been released
-//  so are available for re-use.
+//  is a list per target (scheme, host, port) of connections that have been released still
+//  connected so are available for re-use. Newest at the front, it is the one re-used. There are
+//  limits per target and in total, when one is hit the connection idle longest is closed.
+//  Connections idle for longer than the idle timeout are closed by the idle timer, and a
+//  connection is asked whether it is still alive (ConnectionInterface::isAlive) before it is re-used.
 //
-//  access requirement add to top, search from bottom to top, removed from anywhere
+//  access requirement add to top, take from top, remove from bottom
 //
 //  waiting_requests
 //  ================
-//  a list of requests to obtain a connection
+//  requests for a connection that could not be served because a limit was hit. A FIFO queue
+//  per target plus a round robin turn of the targets that have requests waiting, so one busy
+//  target cannot starve the others. The requests are also linked in arrival order so the
+//  one whose wait deadline comes first is always at hand.
 //
-//  add to top, search from bottom to top, remove from anywhere
+//  access requirement add to back of its target, take from the front of a target, remove
+//  from anywhere (deadline) - all without searching
 //
-//  host_counter
-//  ============
-//  a list of hosts that have connections assigned and are in_use or idle, plus a waiting_list for each host
+//  limits
+//  ======
+//  max_connections in use in total, and max_connections_per_host in use for one target
+//  (0 means only the total applies). Connections that are being connected count as in use.
 //
 //
 //  algorithm - rqeuest a connection
 //
 //  get_a_connection(host_id, callback)
 //
-//      if inUse.size()= max_connections
-//          req = make_conn_request(host_id, callback)
+//      if no room for host_id or requests for host_id are already waiting
+//          req = make_conn_request(host_id, callback, now + wait_timeout)
 //          waitingRequests.add(req)
+//      else if idle has a live connection for host_id
+//          inUse.add(conn)
+//          req.callback(conn)
 //      else
 //          conn = create_and_connect()
 //          inUse.add(conn)
-//          connection_count++
 //          req.callback(conn)
 //
-//  release_connection(conn)
-//      if waitinRequests.size() > 0
-//          req = waitRequests.findOldestRequestForHost(conn.host_id)
-//          req.callback(conn)
+//  release_connection(conn, reusable)
+//      inUse.remove(conn)
+//      if reusable and conn is alive
+//          if req = waitRequests.find(conn.host_id)
+//              inUse.add(conn)
+//              req.callback(conn)
+//          else
+//              idle.add(conn)
 //      else
-//          inUse.remove(conn)
 //          conn.close
 //          delete conn
-//          connection_count--
+//      while req = waitingRequests.removeNext(targets with room)
+//          get_a_connection(req)
+//
+//  wait_timer - fires at the deadline of the oldest waiting request
+//      every request past its deadline is removed and called back with timed_out
+//
+//  idle_timer - fires when the connection idle longest reaches the idle timeout
+//      every idle connection past the idle timeout is closed
 //
 class ConnectionPool
 {
 public:
+    struct Metrics
+    {
+        std::size_t created;        /// new connections opened
+        std::size_t reused;         /// requests served with an idle connection
+        std::size_t stale;          /// idle connections found dead when about to be re-used
+        std::size_t expired;        /// idle connections closed by the idle timeout
+        std::size_t evicted;        /// idle connections closed to keep under the idle limits
+        std::size_t closed;         /// connections released as not reusable
+        std::size_t timedOut;       /// requests failed because they waited past the wait timeout
+        std::size_t idle;           /// idle connections now
+        std::size_t inUse;          /// connections handed out now
+        std::size_t waiting;        /// requests waiting for a connection now
+        double reuseRatio() const;  /// reused / (created + reused)
+    };
+
+    /**
+     * the pool of io. Each io_service - each shard of a sharded server - has a pool of its own,
+     * made on first use and destroyed with the io_service. Its connections, timers and callbacks
+     * all run on io, so a Request only ever sees the io_service it was made with
+     */
     static ConnectionPool* getInstance(boost::asio::io_service& io);
+
+    /// most idle connections kept for one target. Defaults to 8
+    static void configSet_MaxIdlePerHost(std::size_t n);
+    /// most idle connections kept in total. Defaults to 64
+    static void configSet_MaxIdle(std::size_t n);
+    /// an idle connection not re-used in this many milliseconds is closed. Defaults to 30000
+    static void configSet_IdleTimeout(long millisecs);
+    /// most connections in use at once, for pools created after the call. Defaults to 25
+    static void configSet_MaxConnections(std::size_t n);
+    /// most connections in use at once to one target, 0 for no limit other than the total. Defaults to 0
+    static void configSet_MaxConnectionsPerHost(std::size_t n);
+    /**
+     * a request that has waited this many milliseconds for a connection fails with timed_out,
+     * 0 to wait for ever. Defaults to 30000
+     */
+    static void configSet_WaitTimeout(long millisecs);
            
     ConnectionPool(boost::asio::io_service& io);
     
@@ -150,9 +273,35 @@ public:
         ConnectCallbackType cb
     );
     
-    void releaseConnection(ConnectionInterface* conn);
+    /**
+     * Gives a connection back to the pool. Pass reusable as true only when the last response
+     * was read completely and neither side asked to close - the connection then goes to the
+     * idle list of its target. Otherwise it is closed and deleted
+     */
+    void releaseConnection(ConnectionInterface* conn, bool reusable = false);
+
+    Metrics metrics();
+
+    /**
+     * Sets the socket options used for every upstream connection the pool opens from now on,
+     * unless the target has its own options
+     */
+    void setSocketOptions(SocketOptions options);
+    /**
+     * Sets the socket options used for connections to one target, they replace (not add to)
+     * the pool wide options
+     */
+    void setSocketOptions(std::string scheme, std::string server, std::string port, SocketOptions options);
+    /**
+     * the values the kernel reports for a connection the pool handed out
+     */
+    static SocketOptions effectiveSocketOptions(ConnectionInterface* conn);
+    /// the key connections are pooled under - lower case scheme and host, and the port
+    static std::string targetKey(std::string scheme, std::string server, std::string port);
 
 private:
+
+    class Service;
     
     // this is the real interface - but is wrapped in a strand by the public call
     void __asyncGetConnection(
@@ -163,7 +312,19 @@ private:
     );
 
     // this is the real interface - but is wrapped in a strand by the public call
-    void __releaseConnection(ConnectionInterface* conn);
+    void __releaseConnection(ConnectionInterface* conn, bool reusable);
+
+    bool hasRoom(const std::string& key);
+    void serveRequest(ConnectionRequest* req);
+    void dispatchWaiting();
+    void armWaitTimer();
+    void handleWaitTimer(const boost::system::error_code& err);
+    void armIdleTimer();
+    void handleIdleTimer(const boost::system::error_code& err);
+    ConnectionInterface* takeIdle(std::string key);
+    void closeConnection(ConnectionInterface* conn);
+    void closeExpired();
+    void updateCountMetrics();
     
     void createNewConnection(
                 std::string scheme, // http: or https:
@@ -172,15 +333,26 @@ private:
                 ConnectCallbackType cb
     );
 
+    void __setSocketOptions(std::string target, SocketOptions options);
+    SocketOptions socketOptionsFor(std::string scheme, std::string server, std::string port);
+
     void postSuccess(ConnectCallbackType cb, ConnectionInterface* conn);
     void postFail(ConnectCallbackType cb, Marvin::ErrorType& ec);
     
     boost::asio::io_service&        io;
-    boost::asio::ip::tcp::resolver  resolver_;
     
     std::size_t                     _maxConnections;
     InUseConnectionsType            _inUse;
+    IdleConnectionsType             _idle;
     WaitingRequestsType             _waitingRequests;
+    boost::asio::deadline_timer     _waitTimer;
+    bool                            _waitTimerArmed;
+    boost::asio::deadline_timer     _idleTimer;
+    bool                            _idleTimerArmed;
+    std::mutex                      _metricsMutex;
+    Metrics                         _metrics;
+    SocketOptions                   _socketOptions;
+    std::map<std::string, SocketOptions>    _targetSocketOptions;    /// keyed by targetKey()
     
     // a srand on which to execute all the pools functions to prevent thread contention
     boost::asio::strand             _poolStrand;
@@ -6,37 +6,214 @@
 //  Copyright © 2016 Blackwellapps. All rights reserved.
 //
 
+#include <algorithm>
 #include "half_tunnel.hpp"
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
 
-HalfTunnel::HalfTunnel(ConnectionInterfaceSPtr readEnd, ConnectionInterfaceSPtr writeEnd)
+static long         __writeTimeoutMs = 300000;
+static std::size_t  __buffers = 2;
+static std::size_t  __minBufferSize = 4096;
+static std::size_t  __maxBufferSize = 65536;
+
+/// the size a half tunnel starts with, inside the configured range
+static const std::size_t kInitialBufferSize = 16384;
+/// consecutive reads using under a quarter of the buffer before it is halved
+static const int kSmallReadsBeforeShrink = 4;
+
+void HalfTunnel::configSet_WriteTimeout(long millisecs) { __writeTimeoutMs = millisecs; }
+long HalfTunnel::writeTimeout() { return __writeTimeoutMs; }
+void HalfTunnel::configSet_Buffers(std::size_t n) { __buffers = std::max<std::size_t>(2, n); }
+void HalfTunnel::configSet_BufferSizeRange(std::size_t min_size, std::size_t max_size)
+{
+    __minBufferSize = std::max<std::size_t>(1, min_size);
+    __maxBufferSize = std::max(__minBufferSize, max_size);
+}
+
+HalfTunnel::HalfTunnel(boost::asio::io_service& io, ConnectionInterfaceSPtr readEnd, ConnectionInterfaceSPtr writeEnd)
+    : _io(io), _readPending(false), _writePending(false), _readDeferred(false), _readEndShut(false),
+      _eof(false), _done(false), _smallReads(0), _bytes(0)
 {
     _readEnd = readEnd;
     _writeEnd = writeEnd;
-    _bufferPtr = new MBuffer(20000);
-    _bufferUPtr = std::unique_ptr<MBuffer>(_bufferPtr);
+    _err = Marvin::make_error_ok();
+    _bufferSize = std::min(std::max(kInitialBufferSize, __minBufferSize), __maxBufferSize);
+    for(std::size_t i = 0; i < __buffers; i++) {
+        _free.push_back(MBufferUPtr(new MBuffer(_bufferSize)));
+    }
+}
+void HalfTunnel::setTrafficCallback(std::function<void()> cb)
+{
+    _trafficCallback = cb;
 }
 void HalfTunnel::start(std::function<void(Marvin::ErrorType& err)> cb)
 {
     _callback = cb;
-    startRead();
+    std::unique_lock<std::mutex> lock(_mutex);
+    pump(lock);
 }
-void HalfTunnel::startRead()
+void HalfTunnel::stop(Marvin::ErrorType err)
 {
-    auto hf = std::bind(&HalfTunnel::handleRead, this, std::placeholders::_1, std::placeholders::_2);
-    _readEnd->asyncRead(*_bufferPtr, hf);
+    std::unique_lock<std::mutex> lock(_mutex);
+    if( _done )
+        return;
+    if( ! _err )
+        _err = err;
+    if( _readDeferred ) {
+        _readDeferred = false;
+        _budgetWait = nullptr;
+    }
+    pump(lock);
+}
+std::size_t HalfTunnel::bytesTransferred() const
+{
+    return _bytes;
+}
+std::size_t HalfTunnel::bufferSize()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bufferSize;
+}
+/**
+* Called with _mutex held, returns with it released. Starts the write of the oldest filled
+* buffer and a read into a free buffer if they are not already going, or calls the callback
+* if the tunnel has ended and nothing is in flight.
+*
+* An operation is marked pending before the lock is released, so this object cannot be
+* finished and destroyed on another thread while the operation is being started.
+*
+* Reads are deferred while the process wide BufferBudget is exhausted, so a tunnel
+* does not keep pulling data in while other connections hold on to buffers. The wait
+* is cancelled if this object is destroyed or stopped
+*/
+void HalfTunnel::pump(std::unique_lock<std::mutex>& lock)
+{
+    ConnectionInterfaceSPtr read_end = _readEnd;
+    ConnectionInterfaceSPtr write_end = _writeEnd;
+    MBuffer* to_write = nullptr;
+    MBuffer* to_read = nullptr;
+    bool defer = false;
+    bool shut_read_end = false;
+    bool finished = false;
+
+    if( ! _err && ! _writePending && ! _filled.empty() ) {
+        _writePending = true;
+        to_write = _filled.front().get();
+    }
+    if( ! _err && ! _eof && ! _readPending && ! _readDeferred && ! _free.empty() ) {
+        if( BufferBudget::isExhausted() ) {
+            _readDeferred = true;
+            defer = true;
+            _budgetWait = BufferBudget::whenAvailable(_io, _bufferSize, [this](){
+                std::unique_lock<std::mutex> lock(_mutex);
+                if( ! _readDeferred )
+                    return;
+                _readDeferred = false;
+                _budgetWait = nullptr;
+                pump(lock);
+            });
+        } else {
+            _reading = std::move(_free.back());
+            _free.pop_back();
+            if( _reading->capacity() != _bufferSize )
+                _reading = MBufferUPtr(new MBuffer(_bufferSize));
+            _readPending = true;
+            to_read = _reading.get();
+        }
+    }
+    if( _err && _readPending && ! _readEndShut ) {
+        // what is read can no longer be delivered - end the read so the tunnel can finish
+        _readEndShut = true;
+        shut_read_end = true;
+    }
+    bool idle = ! _readPending && ! _writePending && ! _readDeferred;
+    if( idle && ! _done && (_err || (_eof && _filled.empty())) ) {
+        _done = true;
+        finished = true;
+    }
+    bool ended_by_eof = ! _err;
+    Marvin::ErrorType err = _err ? _err : Marvin::ErrorType(boost::asio::error::eof);
+    // called once - let go of it, so nothing it holds outlives the tunnel
+    std::function<void(Marvin::ErrorType& err)> cb;
+    if( finished )
+        cb.swap(_callback);
+    lock.unlock();
+
+    if( to_write != nullptr ) {
+        write_end->setWriteDeadline(__writeTimeoutMs);
+        write_end->asyncWrite(*to_write, std::bind(&HalfTunnel::handleWrite, this, std::placeholders::_1, std::placeholders::_2));
+    }
+    if( to_read != nullptr ) {
+        read_end->asyncRead(*to_read, std::bind(&HalfTunnel::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+    }
+    if( defer ) {
+        LogWarn("buffer budget exhausted - deferring tunnel read fd: ", read_end->nativeSocketFD());
+    }
+    if( shut_read_end ) {
+        read_end->shutdown();
+    }
+    if( finished ) {
+        if( ended_by_eof ) {
+            // the read end has finished sending and all of it has been written - pass that on
+            write_end->shutdownSend();
+        }
+        cb(err);
+    }
 }
 void HalfTunnel::handleRead(Marvin::ErrorType& err, std::size_t bytes_transfered)
 {
-    if( ! err ){
-        auto hf = std::bind(&HalfTunnel::handleWrite, this, std::placeholders::_1, std::placeholders::_2);
-        _writeEnd->asyncWrite(*_bufferPtr, hf);
+    if( ! err && _trafficCallback )
+        _trafficCallback();
+    std::unique_lock<std::mutex> lock(_mutex);
+    _readPending = false;
+    MBufferUPtr buffer = std::move(_reading);
+    if( ! err ) {
+        adaptBufferSize(bytes_transfered, buffer->capacity());
+        _filled.push_back(std::move(buffer));
     } else {
+        LogDebug("tunnel read ended fd: ", _readEnd->nativeSocketFD(), " ", err.message());
+        _free.push_back(std::move(buffer));
+        if( err == boost::asio::error::eof )
+            _eof = true;
+        else if( ! _err )
+            _err = err;
     }
+    pump(lock);
 }
 void HalfTunnel::handleWrite(Marvin::ErrorType& err, std::size_t bytes_transfered)
 {
+    if( ! err && _trafficCallback )
+        _trafficCallback();
+    _writeEnd->setWriteDeadline(0);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _writePending = false;
+    _free.push_back(std::move(_filled.front()));
+    _filled.pop_front();
     if( ! err ){
-        startRead();
+        _bytes += bytes_transfered;
+    } else {
+        LogDebug("tunnel write failed fd: ", _writeEnd->nativeSocketFD(), " ", err.message());
+        if( ! _err )
+            _err = err;
+    }
+    pump(lock);
+}
+/**
+* A read that fills the buffer means the peer has more ready than one buffer holds, so the
+* next buffers are twice the size. A run of reads that use little of it halves the size.
+* Called with _mutex held
+*/
+void HalfTunnel::adaptBufferSize(std::size_t bytes_read, std::size_t capacity)
+{
+    if( bytes_read >= capacity ) {
+        _smallReads = 0;
+        _bufferSize = std::min(_bufferSize * 2, __maxBufferSize);
+    } else if( bytes_read < capacity / 4 ) {
+        if( ++_smallReads >= kSmallReadsBeforeShrink ) {
+            _smallReads = 0;
+            _bufferSize = std::max(_bufferSize / 2, __minBufferSize);
+        }
     } else {
+        _smallReads = 0;
     }
 }
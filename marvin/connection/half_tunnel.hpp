@@ -10,6 +10,10 @@
 #define half_tunnel_hpp
 
 #include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
 #include "bufferV2.hpp"
 #include "connection_interface.hpp"
 
@@ -18,22 +22,77 @@ typedef std::shared_ptr<HalfTunnel> HalfTunnelSPtr;
 typedef std::unique_ptr<HalfTunnel> HalfTunnelUPtr;
 
 
+/**
+* Copies one direction of a tunnel, from readEnd to writeEnd.
+*
+*   -   a few pooled buffers are used in turn, so the next read is in flight while earlier
+*       ones are written, and data is always written in the order it was read
+*   -   the buffer size adapts to the traffic - it doubles after reads that fill a buffer and
+*       halves after a run of reads that use little of it
+*   -   EOF on the read end is passed on as a shutdown of the write end's sending side once
+*       everything read has been written, then the callback gets the EOF. A write error shuts
+*       the read end down, so the peer sending stops too
+*   -   there is no idle deadline of its own. The TunnelHandler keeps one idle deadline for
+*       both directions, it is told about traffic through the traffic callback and ends the
+*       half with stop(). Each write has the write timeout as its deadline, so a peer that
+*       stops reading can not hold the tunnel open while the other direction is busy
+*
+* The callback is called once, when nothing is in flight any more.
+*/
 class HalfTunnel
 {
     public:
-        HalfTunnel(ConnectionInterfaceSPtr readEnd, ConnectionInterfaceSPtr writeEnd);
+        /**
+        * milliseconds one write to the write end may take before the half tunnel ends with
+        * Marvin::errc::timeout, 0 for ever. Defaults to 300000
+        */
+        static void configSet_WriteTimeout(long millisecs);
+        static long writeTimeout();
+        /// buffers each half tunnel uses, at least 2. Defaults to 2
+        static void configSet_Buffers(std::size_t n);
+        /// the range the buffer size adapts in. Defaults to 4096 - 65536
+        static void configSet_BufferSizeRange(std::size_t min_size, std::size_t max_size);
+
+        HalfTunnel(boost::asio::io_service& io, ConnectionInterfaceSPtr readEnd, ConnectionInterfaceSPtr writeEnd);
+        /// cb is called, on an io thread, each time data has been read or written. Set before start()
+        void setTrafficCallback(std::function<void()> cb);
         void start(std::function<void(Marvin::ErrorType& err)> cb);
+        /**
+        * ends the half tunnel with err - a read waiting for the BufferBudget is given up and a
+        * pending read is ended by shutting the read end down. A pending write is left to the
+        * caller, which shuts the write end down
+        */
+        void stop(Marvin::ErrorType err);
+        /// bytes written to the write end so far
+        std::size_t bytesTransferred() const;
+        /// the size the next buffer will be allocated with
+        std::size_t bufferSize();
     private:
-        void startRead();
+        void pump(std::unique_lock<std::mutex>& lock);
         void handleRead(Marvin::ErrorType& err, std::size_t bytes_transfered);
         void handleWrite(Marvin::ErrorType& err, std::size_t bytes_transfered);
-    
-    
+        void adaptBufferSize(std::size_t bytes_read, std::size_t capacity);
+
+        boost::asio::io_service&    _io;
+        BufferBudget::WaitHandle    _budgetWait;
         ConnectionInterfaceSPtr     _readEnd;
         ConnectionInterfaceSPtr     _writeEnd;
         std::function<void(Marvin::ErrorType& err)> _callback;
-        MBufferUPtr                 _bufferUPtr;
-        MBuffer*                    _bufferPtr;
+        std::function<void()>       _trafficCallback;
+        std::mutex                  _mutex;
+        std::vector<MBufferUPtr>    _free;          /// buffers not in use
+        std::deque<MBufferUPtr>     _filled;        /// read and waiting to be written, the front one may be being written
+        MBufferUPtr                 _reading;       /// the buffer of the read in flight
+        bool                        _readPending;
+        bool                        _writePending;
+        bool                        _readDeferred;  /// waiting for the BufferBudget
+        bool                        _readEndShut;
+        bool                        _eof;           /// the read end has ended
+        bool                        _done;          /// the callback has been called
+        Marvin::ErrorType           _err;           /// what ended the tunnel
+        std::size_t                 _bufferSize;
+        int                         _smallReads;    /// consecutive reads that used under a quarter of the buffer
+        std::atomic<std::size_t>    _bytes;
 };
 
 #endif /* half_tunnel_hpp */
@@ -0,0 +1,175 @@
+//
+//  resolver_cache.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <boost/algorithm/string.hpp>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "resolver_cache.hpp"
+
+using boost::asio::ip::tcp;
+
+static long         __ttlSecs = 60;
+static long         __negativeTtlSecs = 5;
+static long         __refreshAheadSecs = 10;
+static std::size_t  __maxEntries = 1024;
+
+void ResolverCache::configSet_Ttl(long secs)            { __ttlSecs = secs; }
+void ResolverCache::configSet_NegativeTtl(long secs)    { __negativeTtlSecs = secs; }
+void ResolverCache::configSet_RefreshAhead(long secs)   { __refreshAheadSecs = secs; }
+void ResolverCache::configSet_MaxEntries(std::size_t n) { __maxEntries = n; }
+
+double ResolverCache::Metrics::hitRate() const
+{
+    std::size_t total = hits + misses + merged;
+    return (total == 0) ? 0.0 : (double)hits / (double)total;
+}
+
+ResolverCache& ResolverCache::getInstance()
+{
+    static ResolverCache __instance;
+    return __instance;
+}
+
+ResolverCache::ResolverCache() : _metrics()
+{
+}
+
+void ResolverCache::asyncResolve(boost::asio::io_service& io, const std::string& host, const std::string& service, ResolveCallbackType cb)
+{
+    std::string key = boost::to_lower_copy(host) + ":" + service;
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry& e = _entries[key];
+    e.lastUsed = now;
+    if( e.resolved && (now < e.expires) ) {
+        _metrics.hits++;
+        if( e.err )
+            _metrics.negativeHits++;
+        // a second use late in its life makes it worth refreshing before it expires
+        if( ! e.err && ! e.inFlight && e.usedSinceRefresh
+            && (now + std::chrono::seconds(__refreshAheadSecs) >= e.expires) ) {
+            LogDebug("refresh ", key);
+            _metrics.refreshes++;
+            startLookup(io, key, host, service);
+        }
+        e.usedSinceRefresh = true;
+        post(io, cb, e.err, e.endpoints);
+        return;
+    }
+    e.waiters.push_back(Waiter{&io, cb});
+    if( e.inFlight ) {
+        _metrics.merged++;
+        return;
+    }
+    _metrics.misses++;
+    e.resolved = false;
+    startLookup(io, key, host, service);
+    evictIfFull(now);
+}
+
+/**
+* called with _mutex held
+*/
+void ResolverCache::startLookup(boost::asio::io_service& io, const std::string& key, const std::string& host, const std::string& service)
+{
+    _entries[key].inFlight = true;
+    _metrics.lookups++;
+    std::shared_ptr<tcp::resolver> resolver = std::make_shared<tcp::resolver>(io);
+    tcp::resolver::query query(host, service);
+    resolver->async_resolve(query, [this, key, resolver](const boost::system::error_code& err, tcp::resolver::iterator it) {
+        lookupDone(key, err, it);
+    });
+}
+
+void ResolverCache::lookupDone(const std::string& key, const boost::system::error_code& err, tcp::resolver::iterator it)
+{
+    std::vector<Waiter> waiters;
+    Marvin::ErrorType result_err;
+    EndpointsSPtr result_endpoints;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Clock::time_point now = Clock::now();
+        Entry& e = _entries[key];
+        e.inFlight = false;
+        if( err ) {
+            _metrics.failures++;
+            LogWarn("resolve failed ", key, " ", err.message());
+        }
+        bool keep_old = err && e.resolved && ! e.err && (now < e.expires);
+        if( ! keep_old ) {
+            std::shared_ptr<std::vector<tcp::endpoint>> endpoints = std::make_shared<std::vector<tcp::endpoint>>();
+            for(; it != tcp::resolver::iterator(); it++) {
+                endpoints->push_back(*it);
+            }
+            e.resolved = true;
+            e.err = err;
+            e.endpoints = endpoints;
+            e.expires = now + std::chrono::seconds(err ? __negativeTtlSecs : __ttlSecs);
+            e.usedSinceRefresh = false;
+        }
+        waiters.swap(e.waiters);
+        result_err = e.err;
+        result_endpoints = e.endpoints;
+    }
+    for(Waiter& w : waiters) {
+        post(*w.io, w.cb, result_err, result_endpoints);
+    }
+}
+
+/**
+* called with _mutex held. Drops expired entries, and if that is not enough the least
+* recently used one. Entries with a lookup in flight are never dropped
+*/
+void ResolverCache::evictIfFull(Clock::time_point now)
+{
+    if( _entries.size() <= __maxEntries )
+        return;
+    auto oldest = _entries.end();
+    for(auto it = _entries.begin(); it != _entries.end(); ) {
+        Entry& e = it->second;
+        if( e.inFlight ) {
+            it++;
+        } else if( e.resolved && (now >= e.expires) ) {
+            it = _entries.erase(it);
+        } else {
+            if( (oldest == _entries.end()) || (e.lastUsed < oldest->second.lastUsed) )
+                oldest = it;
+            it++;
+        }
+    }
+    if( (_entries.size() > __maxEntries) && (oldest != _entries.end()) )
+        _entries.erase(oldest);
+}
+
+ResolverCache::Metrics ResolverCache::metrics()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Metrics m = _metrics;
+    m.entries = _entries.size();
+    return m;
+}
+
+void ResolverCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto it = _entries.begin(); it != _entries.end(); ) {
+        if( it->second.inFlight ) {
+            it->second.resolved = false;
+            it++;
+        } else {
+            it = _entries.erase(it);
+        }
+    }
+}
+
+void ResolverCache::post(boost::asio::io_service& io, ResolveCallbackType cb, Marvin::ErrorType err, EndpointsSPtr endpoints)
+{
+    io.post([cb, err, endpoints]() {
+        Marvin::ErrorType m_err = err;
+        cb(m_err, endpoints);
+    });
+}
@@ -0,0 +1,115 @@
+//
+//  resolver_cache.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef resolver_cache_hpp
+#define resolver_cache_hpp
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <boost/asio.hpp>
+#include "marvin_error.hpp"
+
+class ResolverCache;
+typedef std::shared_ptr<const std::vector<boost::asio::ip::tcp::endpoint>> EndpointsSPtr;
+
+#pragma mark - ResolverCache class
+/**
+ * A process wide cache of name lookups, in front of tcp::resolver.
+ *
+ * Boost resolves with a blocking getaddrinfo() on an internal thread, so each lookup ties up
+ * that thread and every connection to the same host pays for it again. The cache keeps the
+ * result for each (host, service):
+ *
+ *  -   a successful lookup is kept for the ttl, a failed one for the negative ttl.
+ *      getaddrinfo() does not report the record TTL so both are configured
+ *  -   lookups for a name that is already being resolved wait for that lookup, only one
+ *      goes to the resolver
+ *  -   an entry that is used again in the last part of its life is refreshed in the background,
+ *      callers keep getting the old result until the new one arrives. If the refresh fails the
+ *      old result is kept until it expires
+ *  -   when there are more than the maximum number of entries the least recently used is dropped
+ *
+ * Callbacks are always posted to the io_service passed to asyncResolve, never called inline.
+ * Everything is guarded by one mutex so the cache can be used from any thread.
+ */
+class ResolverCache
+{
+public:
+    typedef std::function<void(Marvin::ErrorType& err, EndpointsSPtr endpoints)> ResolveCallbackType;
+
+    struct Metrics
+    {
+        std::size_t hits;           /// answered from the cache, including negative entries
+        std::size_t negativeHits;   /// answered with a cached failure
+        std::size_t misses;         /// had to wait for a lookup that was started for them
+        std::size_t merged;         /// joined a lookup someone else started
+        std::size_t lookups;        /// lookups sent to the resolver, including refreshes
+        std::size_t refreshes;      /// background refreshes started
+        std::size_t failures;       /// lookups that failed
+        std::size_t entries;        /// entries in the cache now
+        double hitRate() const;     /// hits / (hits + misses + merged)
+    };
+
+    static ResolverCache& getInstance();
+
+    /// how long a successful lookup is kept, in seconds. Defaults to 60
+    static void configSet_Ttl(long secs);
+    /// how long a failed lookup is kept, in seconds. Defaults to 5
+    static void configSet_NegativeTtl(long secs);
+    /// an entry used in this last part of its ttl is refreshed in the background, in seconds. Defaults to 10
+    static void configSet_RefreshAhead(long secs);
+    /// the most entries kept. Defaults to 1024
+    static void configSet_MaxEntries(std::size_t n);
+
+    /**
+     * Resolves host and service (a port number or a name such as "http"), from the cache if it can.
+     * cb is posted to io
+     */
+    void asyncResolve(boost::asio::io_service& io, const std::string& host, const std::string& service, ResolveCallbackType cb);
+
+    Metrics metrics();
+    /// forgets every entry, lookups in flight still complete for the callers waiting on them
+    void clear();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Waiter
+    {
+        boost::asio::io_service*    io;
+        ResolveCallbackType         cb;
+    };
+    struct Entry
+    {
+        Entry() : resolved(false), inFlight(false), usedSinceRefresh(false) {}
+        bool                    resolved;           /// err and endpoints hold a result
+        bool                    inFlight;           /// a lookup has been sent to the resolver
+        bool                    usedSinceRefresh;
+        Marvin::ErrorType       err;
+        EndpointsSPtr           endpoints;
+        Clock::time_point       expires;
+        Clock::time_point       lastUsed;
+        std::vector<Waiter>     waiters;
+    };
+
+    ResolverCache();
+    void startLookup(boost::asio::io_service& io, const std::string& key, const std::string& host, const std::string& service);
+    void lookupDone(const std::string& key, const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator it);
+    void evictIfFull(Clock::time_point now);
+    static void post(boost::asio::io_service& io, ResolveCallbackType cb, Marvin::ErrorType err, EndpointsSPtr endpoints);
+
+    std::mutex                      _mutex;
+    std::map<std::string, Entry>    _entries;   /// keyed by host + ":" + service
+    Metrics                         _metrics;
+};
+
+#endif /* resolver_cache_hpp */
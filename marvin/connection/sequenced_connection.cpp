@@ -0,0 +1,213 @@
+//
+//  sequenced_connection.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/18/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cassert>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "sequenced_connection.hpp"
+
+#pragma mark - WriteSequencer
+WriteSequencer::WriteSequencer() : _nextTicket(0), _current(0), _outstanding(0)
+{
+    LogTorTrace();
+}
+
+WriteSequencer::~WriteSequencer()
+{
+    LogTorTrace();
+}
+
+std::size_t WriteSequencer::nextTicket()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nextTicket++;
+}
+
+void WriteSequencer::submit(std::size_t ticket, std::function<void()> write)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if( ticket != _current ) {
+            assert( ticket > _current );
+            _queued[ticket].push_back(write);
+            return;
+        }
+        _outstanding++;
+    }
+    write();
+}
+
+void WriteSequencer::writeDone(std::size_t ticket)
+{
+    std::deque<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        assert( (ticket == _current) && (_outstanding > 0) );
+        _outstanding--;
+        ready = advance();
+    }
+    for(auto& w : ready)
+        w();
+}
+
+void WriteSequencer::complete(std::size_t ticket)
+{
+    std::deque<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if( ticket < _current )
+            return;
+        _completed.insert(ticket);
+        ready = advance();
+    }
+    for(auto& w : ready)
+        w();
+}
+
+/**
+* Moves past every complete ticket that has no write in flight and collects the queued
+* writes of the new current ticket. Those writes are counted as outstanding now, they are
+* started by the caller once the mutex has been released
+*/
+std::deque<std::function<void()>> WriteSequencer::advance()
+{
+    std::deque<std::function<void()>> ready;
+    while( (_outstanding == 0) && ready.empty() && (_completed.count(_current) > 0) ) {
+        _completed.erase(_current);
+        _current++;
+        auto it = _queued.find(_current);
+        if( it != _queued.end() ) {
+            ready = std::move(it->second);
+            _queued.erase(it);
+            _outstanding += ready.size();
+        }
+    }
+    return ready;
+}
+
+#pragma mark - SequencedConnection
+SequencedConnection::SequencedConnection(ConnectionInterfaceSPtr conn, WriteSequencerSPtr sequencer, std::size_t ticket)
+    : _conn(conn), _sequencer(sequencer), _ticket(ticket)
+{
+    LogTorTrace();
+}
+
+SequencedConnection::~SequencedConnection()
+{
+    LogTorTrace();
+}
+/**
+* Submits a write under this connections ticket. The callback tells the sequencer the write
+* is over after the caller has seen the result
+*/
+void SequencedConnection::sequence(std::function<void(AsyncWriteCallback)> write, AsyncWriteCallback cb)
+{
+    WriteSequencerSPtr seq = _sequencer;
+    std::size_t ticket = _ticket;
+    AsyncWriteCallback done = [seq, ticket, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+        cb(err, bytes_transfered);
+        seq->writeDone(ticket);
+    };
+    _sequencer->submit(_ticket, [write, done]() {
+        write(done);
+    });
+}
+
+void SequencedConnection::asyncWrite(MBuffer& buffer, AsyncWriteCallbackType cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    MBuffer* bp = &buffer;
+    sequence([conn, bp](AsyncWriteCallback done) { conn->asyncWrite(*bp, done); }, cb);
+}
+
+void SequencedConnection::asyncWrite(std::string& str, AsyncWriteCallbackType cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    std::string* sp = &str;
+    sequence([conn, sp](AsyncWriteCallback done) { conn->asyncWrite(*sp, done); }, cb);
+}
+
+void SequencedConnection::asyncWrite(BufferChainSPtr buf_chain_sptr, AsyncWriteCallback cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    sequence([conn, buf_chain_sptr](AsyncWriteCallback done) { conn->asyncWrite(buf_chain_sptr, done); }, cb);
+}
+
+void SequencedConnection::asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    sequence([conn, buf](AsyncWriteCallback done) { conn->asyncWrite(buf, done); }, cb);
+}
+
+void SequencedConnection::asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    boost::asio::streambuf* sbp = &sb;
+    sequence([conn, sbp](AsyncWriteCallback done) { conn->asyncWrite(*sbp, done); }, cb);
+}
+
+void SequencedConnection::asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb)
+{
+    ConnectionInterfaceSPtr conn = _conn;
+    sequence([conn, body_file_sptr](AsyncWriteCallback done) { conn->asyncWrite(body_file_sptr, done); }, cb);
+}
+
+#pragma mark - pass through to the underlying connection
+void SequencedConnection::asyncConnect(ConnectCallbackType cb)
+{
+    _conn->asyncConnect(cb);
+}
+
+void SequencedConnection::asyncAccept(boost::asio::ip::tcp::acceptor& acceptor, std::function<void(const boost::system::error_code& err)> cb)
+{
+    _conn->asyncAccept(acceptor, cb);
+}
+
+void SequencedConnection::asyncRead(MBuffer& mb, AsyncReadCallbackType cb)
+{
+    _conn->asyncRead(mb, cb);
+}
+
+void SequencedConnection::setReadDeadline(long millisecs)
+{
+    _conn->setReadDeadline(millisecs);
+}
+
+void SequencedConnection::setWriteDeadline(long millisecs)
+{
+    _conn->setWriteDeadline(millisecs);
+}
+
+void SequencedConnection::setSocketOptions(const SocketOptions& options)
+{
+    _conn->setSocketOptions(options);
+}
+
+void SequencedConnection::shutdown()
+{
+    _conn->shutdown();
+}
+
+void SequencedConnection::shutdownSend()
+{
+    _conn->shutdownSend();
+}
+
+void SequencedConnection::close()
+{
+    _conn->close();
+}
+
+bool SequencedConnection::isAlive()
+{
+    return _conn->isAlive();
+}
+
+long SequencedConnection::nativeSocketFD()
+{
+    return _conn->nativeSocketFD();
+}
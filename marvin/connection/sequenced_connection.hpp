@@ -0,0 +1,130 @@
+//
+//  sequenced_connection.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/18/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef sequenced_connection_hpp
+#define sequenced_connection_hpp
+
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <functional>
+#include "boost_stuff.hpp"
+#include "marvin_error.hpp"
+#include "callback_typedefs.hpp"
+#include "bufferV2.hpp"
+#include "body_file.hpp"
+#include "connection_interface.hpp"
+
+class WriteSequencer;
+typedef std::shared_ptr<WriteSequencer> WriteSequencerSPtr;
+
+class SequencedConnection;
+typedef std::shared_ptr<SequencedConnection> SequencedConnectionSPtr;
+
+#pragma mark - WriteSequencer class
+/**
+ * Keeps the responses on a pipelined connection in request order.
+ *
+ * Each request read from the connection is given a ticket (nextTicket()) in the order the requests
+ * arrived. Writes are submitted with their ticket - writes for the current ticket go straight to
+ * the connection, writes for a later ticket are queued. When the response for the current ticket
+ * is complete (complete()) and its last write has finished, the queued writes of the next
+ * ticket are started, in the order they were submitted.
+ *
+ * Write completions can arrive on any io_service thread so the state is protected by a mutex.
+ * Writes are never started while the mutex is held.
+ */
+class WriteSequencer
+{
+public:
+    WriteSequencer();
+    ~WriteSequencer();
+
+    /**
+     * the ticket for the next request read from the connection
+     */
+    std::size_t nextTicket();
+
+    /**
+     * starts write now if ticket is current, otherwise queues it until all earlier
+     * tickets are complete. write must end up calling writeDone(ticket)
+     */
+    void submit(std::size_t ticket, std::function<void()> write);
+
+    /**
+     * a write started by submit() has finished
+     */
+    void writeDone(std::size_t ticket);
+
+    /**
+     * the response for ticket has been fully written (or abandoned)
+     */
+    void complete(std::size_t ticket);
+
+private:
+    /// called with the mutex held - returns the writes that can now start
+    std::deque<std::function<void()>> advance();
+
+    std::mutex                                                  _mutex;
+    std::size_t                                                 _nextTicket;
+    std::size_t                                                 _current;
+    std::size_t                                                 _outstanding;   /// writes of _current in flight
+    std::set<std::size_t>                                       _completed;
+    std::map<std::size_t, std::deque<std::function<void()>>>    _queued;
+};
+
+#pragma mark - SequencedConnection class
+/**
+ * A decorator for a ConnectionInterface that routes every write through a WriteSequencer
+ * under a single ticket. The server gives the MessageWriterV2 of each pipelined response one of
+ * these, so request handlers can run concurrently and write whenever they like while the
+ * responses still leave the connection in request order.
+ *
+ * Reads, connect, accept, shutdown and close go straight to the underlying connection.
+ *
+ * The buffers passed to a write must stay valid until its callback runs, exactly as for the
+ * underlying connection - a queued write holds on to them for longer than usual.
+ */
+class SequencedConnection : public ConnectionInterface
+{
+public:
+    SequencedConnection(ConnectionInterfaceSPtr conn, WriteSequencerSPtr sequencer, std::size_t ticket);
+    ~SequencedConnection();
+
+    void asyncConnect(ConnectCallbackType cb);
+    void asyncAccept(boost::asio::ip::tcp::acceptor& acceptor, std::function<void(const boost::system::error_code& err)> cb);
+
+    void asyncWrite(MBuffer& buffer, AsyncWriteCallbackType cb);
+    void asyncWrite(std::string& str, AsyncWriteCallbackType cb);
+    void asyncWrite(BufferChainSPtr buf_chain_sptr, AsyncWriteCallback cb);
+    void asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb);
+    void asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback cb);
+    void asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb);
+
+    void asyncRead(MBuffer& mb, AsyncReadCallbackType cb);
+    void setReadDeadline(long millisecs);
+    void setWriteDeadline(long millisecs);
+    void setSocketOptions(const SocketOptions& options);
+    void shutdown();
+    void shutdownSend();
+    void close();
+    bool isAlive();
+
+    long nativeSocketFD();
+
+private:
+    void sequence(std::function<void(AsyncWriteCallback)> write, AsyncWriteCallback cb);
+
+    ConnectionInterfaceSPtr     _conn;
+    WriteSequencerSPtr          _sequencer;
+    std::size_t                 _ticket;
+};
+
+#endif /* sequenced_connection_hpp */
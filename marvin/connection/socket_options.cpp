@@ -0,0 +1,179 @@
+//
+//  socket_options.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/21/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cerrno>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <boost/asio.hpp>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "socket_options.hpp"
+
+#if defined(TCP_KEEPIDLE)
+#define MARVIN_TCP_KEEPIDLE TCP_KEEPIDLE
+#elif defined(TCP_KEEPALIVE)
+#define MARVIN_TCP_KEEPIDLE TCP_KEEPALIVE
+#endif
+
+namespace {
+
+    typedef SocketOptions::Role Role;
+
+    const int kNotAvailable = -1;
+
+    /**
+    * one entry per option - which field it is, the level/name to give setsockopt and
+    * the roles it applies to
+    */
+    struct OptionDef
+    {
+        const char*             name;
+        int                     level;
+        int                     optname;
+        bool                    downstream;
+        bool                    upstream;
+        bool                    listener;
+        boost::optional<int>    SocketOptions::* intField;
+        boost::optional<bool>   SocketOptions::* boolField;
+
+        bool appliesTo(Role role) const
+        {
+            return (role == Role::Downstream) ? downstream : (role == Role::Upstream) ? upstream : listener;
+        }
+    };
+
+    const OptionDef kOptionDefs[] = {
+        {"noDelay",             IPPROTO_TCP, TCP_NODELAY,   true, true, false, nullptr, &SocketOptions::noDelay},
+        {"sendBufferSize",      SOL_SOCKET,  SO_SNDBUF,     true, true, true,  &SocketOptions::sendBufferSize, nullptr},
+        {"receiveBufferSize",   SOL_SOCKET,  SO_RCVBUF,     true, true, true,  &SocketOptions::receiveBufferSize, nullptr},
+#ifdef TCP_QUICKACK
+        {"quickAck",            IPPROTO_TCP, TCP_QUICKACK,  true, true, false, nullptr, &SocketOptions::quickAck},
+#else
+        {"quickAck",            IPPROTO_TCP, kNotAvailable, true, true, false, nullptr, &SocketOptions::quickAck},
+#endif
+        {"keepAlive",           SOL_SOCKET,  SO_KEEPALIVE,  true, true, false, nullptr, &SocketOptions::keepAlive},
+#ifdef MARVIN_TCP_KEEPIDLE
+        {"keepAliveIdle",       IPPROTO_TCP, MARVIN_TCP_KEEPIDLE, true, true, false, &SocketOptions::keepAliveIdle, nullptr},
+#else
+        {"keepAliveIdle",       IPPROTO_TCP, kNotAvailable, true, true, false, &SocketOptions::keepAliveIdle, nullptr},
+#endif
+#ifdef TCP_KEEPINTVL
+        {"keepAliveInterval",   IPPROTO_TCP, TCP_KEEPINTVL, true, true, false, &SocketOptions::keepAliveInterval, nullptr},
+        {"keepAliveCount",      IPPROTO_TCP, TCP_KEEPCNT,   true, true, false, &SocketOptions::keepAliveCount, nullptr},
+#else
+        {"keepAliveInterval",   IPPROTO_TCP, kNotAvailable, true, true, false, &SocketOptions::keepAliveInterval, nullptr},
+        {"keepAliveCount",      IPPROTO_TCP, kNotAvailable, true, true, false, &SocketOptions::keepAliveCount, nullptr},
+#endif
+#ifdef TCP_FASTOPEN
+        {"fastOpen",            IPPROTO_TCP, TCP_FASTOPEN,  false, false, true, &SocketOptions::fastOpen, nullptr},
+#else
+        {"fastOpen",            IPPROTO_TCP, kNotAvailable, false, false, true, &SocketOptions::fastOpen, nullptr},
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+        {"fastOpen",            IPPROTO_TCP, TCP_FASTOPEN_CONNECT, false, true, false, &SocketOptions::fastOpen, nullptr},
+#else
+        {"fastOpen",            IPPROTO_TCP, kNotAvailable, false, true, false, &SocketOptions::fastOpen, nullptr},
+#endif
+#ifdef TCP_DEFER_ACCEPT
+        {"deferAccept",         IPPROTO_TCP, TCP_DEFER_ACCEPT, false, false, true, &SocketOptions::deferAccept, nullptr},
+#else
+        {"deferAccept",         IPPROTO_TCP, kNotAvailable, false, false, true, &SocketOptions::deferAccept, nullptr},
+#endif
+        {"reuseAddress",        SOL_SOCKET,  SO_REUSEADDR,  false, false, true, nullptr, &SocketOptions::reuseAddress},
+#ifdef SO_REUSEPORT
+        {"reusePort",           SOL_SOCKET,  SO_REUSEPORT,  false, false, true, nullptr, &SocketOptions::reusePort},
+#else
+        {"reusePort",           SOL_SOCKET,  kNotAvailable, false, false, true, nullptr, &SocketOptions::reusePort},
+#endif
+    };
+
+    /// the value of the field def describes, as the int setsockopt wants - or none
+    boost::optional<int> fieldValue(const SocketOptions& options, const OptionDef& def)
+    {
+        if( def.intField != nullptr )
+            return options.*(def.intField);
+        if( (options.*(def.boolField)) )
+            return (*(options.*(def.boolField))) ? 1 : 0;
+        return boost::none;
+    }
+    void setFieldValue(SocketOptions& options, const OptionDef& def, int value)
+    {
+        if( def.intField != nullptr )
+            options.*(def.intField) = value;
+        else
+            options.*(def.boolField) = (value != 0);
+    }
+}
+
+SocketOptions SocketOptions::listenerDefaults()
+{
+    SocketOptions options;
+    options.reuseAddress = true;
+    options.listenBacklog = (int)boost::asio::socket_base::max_connections;
+    return options;
+}
+
+Marvin::ErrorType SocketOptions::apply(long fd, Role role) const
+{
+    Marvin::ErrorType first_err = Marvin::make_error_ok();
+    for(const OptionDef& def : kOptionDefs) {
+        boost::optional<int> value = fieldValue(*this, def);
+        if( ! value || ! def.appliesTo(role) )
+            continue;
+        Marvin::ErrorType err;
+        if( def.optname == kNotAvailable ) {
+            err = boost::system::errc::make_error_code(boost::system::errc::not_supported);
+        } else {
+            int v = *value;
+            if( ::setsockopt((int)fd, def.level, def.optname, &v, sizeof(v)) != 0 )
+                err = Marvin::ErrorType(errno, boost::system::system_category());
+        }
+        if( err ) {
+            LogWarn("could not set ", def.name, "=", *value, " fd: ", fd, " ", err.message());
+            if( ! first_err )
+                first_err = err;
+        }
+    }
+    return first_err;
+}
+
+SocketOptions SocketOptions::effective(long fd, Role role, const SocketOptions& requested)
+{
+    SocketOptions result;
+    for(const OptionDef& def : kOptionDefs) {
+        if( (def.optname == kNotAvailable) || ! def.appliesTo(role) )
+            continue;
+        int v = 0;
+        socklen_t len = sizeof(v);
+        if( ::getsockopt((int)fd, def.level, def.optname, &v, &len) == 0 )
+            setFieldValue(result, def, v);
+    }
+    if( role == Role::Listener )
+        result.listenBacklog = requested.listenBacklog;
+    return result;
+}
+
+std::string SocketOptions::str() const
+{
+    std::ostringstream os;
+    const char* sep = "";
+    for(const OptionDef& def : kOptionDefs) {
+        boost::optional<int> value = fieldValue(*this, def);
+        // fastOpen has an entry per role, only print it once
+        if( value && ! ((def.intField == &SocketOptions::fastOpen) && def.upstream) ) {
+            os << sep << def.name << "=" << *value;
+            sep = " ";
+        }
+    }
+    if( listenBacklog ) {
+        os << sep << "listenBacklog=" << *listenBacklog;
+    }
+    return os.str();
+}
@@ -0,0 +1,74 @@
+//
+//  socket_options.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/21/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef socket_options_hpp
+#define socket_options_hpp
+
+#include <string>
+#include <boost/optional.hpp>
+#include "marvin_error.hpp"
+
+#pragma mark - SocketOptions class
+/**
+ * A profile of socket level settings that is applied to a socket in one go.
+ *
+ * Every field is optional - a field that is not set leaves the operating system default
+ * alone. The same struct is used for the three kinds of socket the library owns:
+ *
+ *  -   Downstream, sockets accepted by HTTPServer
+ *  -   Upstream, sockets ConnectionPool opens to an origin server
+ *  -   Listener, the acceptor of HTTPServer
+ *
+ * Fields that make no sense for a kind of socket are ignored for it, so one profile can be
+ * written once and shared. Options the platform does not have (TCP_QUICKACK, TCP_DEFER_ACCEPT
+ * and TCP_FASTOPEN outside Linux) are skipped with a warning.
+ *
+ * effective() reads the values back from the kernel, which often differ from what was asked
+ * for - Linux doubles SO_SNDBUF/SO_RCVBUF and rounds TCP_DEFER_ACCEPT to a retransmit count.
+ */
+struct SocketOptions
+{
+    enum class Role { Downstream, Upstream, Listener };
+
+    boost::optional<bool>   noDelay;            /// TCP_NODELAY
+    boost::optional<int>    sendBufferSize;     /// SO_SNDBUF in bytes
+    boost::optional<int>    receiveBufferSize;  /// SO_RCVBUF in bytes
+    boost::optional<bool>   quickAck;           /// TCP_QUICKACK, Linux clears it again by itself so it only helps the first exchanges
+    boost::optional<bool>   keepAlive;          /// SO_KEEPALIVE
+    boost::optional<int>    keepAliveIdle;      /// TCP_KEEPIDLE (TCP_KEEPALIVE on macOS) in seconds
+    boost::optional<int>    keepAliveInterval;  /// TCP_KEEPINTVL in seconds
+    boost::optional<int>    keepAliveCount;     /// TCP_KEEPCNT
+    boost::optional<int>    fastOpen;           /// Listener - TCP_FASTOPEN queue length. Upstream - non zero turns on TCP_FASTOPEN_CONNECT
+    boost::optional<int>    deferAccept;        /// Listener only - TCP_DEFER_ACCEPT in seconds
+    boost::optional<bool>   reuseAddress;       /// Listener only - SO_REUSEADDR
+    boost::optional<bool>   reusePort;          /// Listener only - SO_REUSEPORT, lets several acceptors bind the same port
+    boost::optional<int>    listenBacklog;      /// Listener only - the backlog passed to listen(), cannot be read back
+
+    /**
+     * the settings HTTPServer has always used for its listener - SO_REUSEADDR and the
+     * default backlog
+     */
+    static SocketOptions listenerDefaults();
+
+    /**
+     * Applies every field that is set and that means something for role. A failure is
+     * logged and the rest are still tried, the first error is returned
+     */
+    Marvin::ErrorType apply(long fd, Role role) const;
+
+    /**
+     * The values the kernel reports for fd, every field that can be read for role is set.
+     * listenBacklog is taken from requested as there is no way to read it back
+     */
+    static SocketOptions effective(long fd, Role role, const SocketOptions& requested = SocketOptions());
+
+    /// the fields that are set as "name=value ..." for logging
+    std::string str() const;
+};
+
+#endif /* socket_options_hpp */
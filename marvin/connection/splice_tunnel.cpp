@@ -0,0 +1,235 @@
+//
+//  splice_tunnel.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/23/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cerrno>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "splice_tunnel.hpp"
+
+/// the most moved by one splice() call, the default pipe capacity
+static const std::size_t kSpliceChunk = 65536;
+
+bool SpliceTunnel::isAvailable()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+SpliceTunnel::SpliceTunnel(boost::asio::io_service& io, TCPConnectionSPtr readEnd, TCPConnectionSPtr writeEnd)
+    : _io(io), _readEnd(readEnd), _writeEnd(writeEnd), _stopped(false), _inPipe(0), _writeWaiting(false), _bytes(0)
+{
+    _pipe[0] = _pipe[1] = -1;
+}
+SpliceTunnel::~SpliceTunnel()
+{
+#ifdef __linux__
+    if( _pipe[0] >= 0 ) ::close(_pipe[0]);
+    if( _pipe[1] >= 0 ) ::close(_pipe[1]);
+#endif
+}
+bool SpliceTunnel::open()
+{
+#ifdef __linux__
+    if( ::pipe2(_pipe, O_NONBLOCK | O_CLOEXEC) == 0 )
+        return true;
+    LogWarn("could not make a pipe for splice errno: ", errno);
+    _pipe[0] = _pipe[1] = -1;
+#endif
+    return false;
+}
+void SpliceTunnel::setTrafficCallback(std::function<void()> cb)
+{
+    _trafficCallback = cb;
+}
+void SpliceTunnel::start(std::function<void(Marvin::ErrorType& err)> cb)
+{
+    _callback = cb;
+    if( _pipe[0] < 0 ) {
+        fallBack();
+        return;
+    }
+    startRead();
+}
+std::size_t SpliceTunnel::bytesTransferred() const
+{
+    return _bytes + (_fallback ? _fallback->bytesTransferred() : 0);
+}
+bool SpliceTunnel::spliced() const
+{
+    return ! _fallback;
+}
+void SpliceTunnel::stop(Marvin::ErrorType err)
+{
+    HalfTunnel* fallback;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if( ! _stopped ) {
+            _stopped = true;
+            _stopErr = err;
+        }
+        fallback = _fallback.get();
+    }
+    if( fallback != nullptr )
+        fallback->stop(err);
+}
+/// true, with err set, once stop() has been called
+bool SpliceTunnel::stopped(Marvin::ErrorType& err)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if( _stopped )
+        err = _stopErr;
+    return _stopped;
+}
+
+void SpliceTunnel::abandon()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _callback = nullptr;
+    _trafficCallback = nullptr;
+    if( ! _stopped ) {
+        _stopped = true;
+        _stopErr = boost::asio::error::operation_aborted;
+    }
+}
+/// tells the owner about traffic, unless it has abandoned the tunnel
+void SpliceTunnel::traffic()
+{
+    std::function<void()> cb;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        cb = _trafficCallback;
+    }
+    if( cb )
+        cb();
+}
+
+void SpliceTunnel::startRead()
+{
+    _readEnd->asyncWaitReadable(std::bind(&SpliceTunnel::handleReadable, shared_from_this(), std::placeholders::_1));
+}
+/**
+* the read end is readable - move what it has into the pipe, then out of the pipe. Only one
+* read is ever in the pipe, so it always has room for kSpliceChunk
+*/
+void SpliceTunnel::handleReadable(Marvin::ErrorType& err)
+{
+    Marvin::ErrorType stop_err;
+    if( stopped(stop_err) ) {
+        finish(stop_err);
+        return;
+    }
+    if( err ) {
+        finish(err);
+        return;
+    }
+#ifdef __linux__
+    ssize_t n;
+    do {
+        n = ::splice((int)_readEnd->nativeSocketFD(), nullptr, _pipe[1], nullptr, kSpliceChunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while( (n < 0) && (errno == EINTR) );
+    if( n > 0 ) {
+        _inPipe = (std::size_t)n;
+        drain();
+    } else if( n == 0 ) {
+        // the pipe is empty, everything read has been written - pass the EOF on
+        _writeEnd->shutdownSend();
+        finish(boost::asio::error::eof);
+    } else if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+        startRead();
+    } else if( (errno == EINVAL) && (_bytes == 0) ) {
+        fallBack();
+    } else {
+        finish(Marvin::ErrorType(errno, boost::system::system_category()));
+    }
+#endif
+}
+/**
+* empties the pipe into the write end, waiting for it to be writable when it is full. The
+* wait has the write timeout as its deadline, it is cleared once the pipe is empty
+*/
+void SpliceTunnel::drain()
+{
+#ifdef __linux__
+    while( _inPipe > 0 ) {
+        ssize_t n = ::splice(_pipe[0], nullptr, (int)_writeEnd->nativeSocketFD(), nullptr, _inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if( n > 0 ) {
+            _inPipe -= (std::size_t)n;
+            _bytes += (std::size_t)n;
+            traffic();
+            continue;
+        }
+        if( (n < 0) && (errno == EINTR) )
+            continue;
+        if( (n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ) {
+            if( ! _writeWaiting ) {
+                _writeWaiting = true;
+                _writeEnd->setWriteDeadline(HalfTunnel::writeTimeout());
+            }
+            SpliceTunnelSPtr self = shared_from_this();
+            _writeEnd->asyncWaitWritable([this, self](Marvin::ErrorType& err){
+                Marvin::ErrorType stop_err;
+                if( stopped(stop_err) )
+                    finish(stop_err);
+                else if( err )
+                    finish(err);
+                else
+                    drain();
+            });
+            return;
+        }
+        finish((n < 0) ? Marvin::ErrorType(errno, boost::system::system_category()) : boost::asio::error::broken_pipe);
+        return;
+    }
+    if( _writeWaiting ) {
+        _writeWaiting = false;
+        _writeEnd->setWriteDeadline(0);
+    }
+#endif
+    startRead();
+}
+void SpliceTunnel::fallBack()
+{
+    LogWarn("splice not possible - copying fd: ", _readEnd->nativeSocketFD());
+    Marvin::ErrorType stop_err;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if( ! _stopped ) {
+            // the half tunnel keeps its traffic callback, a strong reference would be a cycle
+            std::weak_ptr<SpliceTunnel> weak = shared_from_this();
+            _fallback = std::unique_ptr<HalfTunnel>(new HalfTunnel(_io, _readEnd, _writeEnd));
+            _fallback->setTrafficCallback([weak]() {
+                if( SpliceTunnelSPtr self = weak.lock() )
+                    self->traffic();
+            });
+        } else {
+            stop_err = _stopErr;
+        }
+    }
+    if( ! _fallback ) {
+        finish(stop_err);
+        return;
+    }
+    _fallback->start(std::bind(&SpliceTunnel::finish, shared_from_this(), std::placeholders::_1));
+}
+void SpliceTunnel::finish(Marvin::ErrorType err)
+{
+    LogDebug("tunnel ended fd: ", _readEnd->nativeSocketFD(), " ", err.message());
+    std::function<void(Marvin::ErrorType& err)> cb;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        cb = _callback;
+    }
+    if( cb )
+        cb(err);
+}
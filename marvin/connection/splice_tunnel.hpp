@@ -0,0 +1,95 @@
+//
+//  splice_tunnel.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/23/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef splice_tunnel_hpp
+#define splice_tunnel_hpp
+
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include "marvin_error.hpp"
+#include "tcp_connection.hpp"
+#include "half_tunnel.hpp"
+
+class SpliceTunnel;
+typedef std::shared_ptr<SpliceTunnel> SpliceTunnelSPtr;
+typedef std::unique_ptr<SpliceTunnel> SpliceTunnelUPtr;
+
+#pragma mark - SpliceTunnel class
+/**
+ * One direction of a tunnel between two TCP sockets that never copies the data into user space.
+ * Data is moved socket to pipe and pipe to socket with splice(SPLICE_F_MOVE|SPLICE_F_NONBLOCK),
+ * the io_service only says when the sockets are ready (waits on null_buffers).
+ *
+ *  -   Linux only. isAvailable() is false elsewhere, and so is open() if no pipe can be made,
+ *      the caller then uses a HalfTunnel
+ *  -   if the kernel refuses to splice one of the sockets (EINVAL) before any data has moved
+ *      the tunnel carries on as a HalfTunnel, so start()'s callback is called either way
+ *  -   like a HalfTunnel it has no idle deadline of its own, the TunnelHandler's idle deadline
+ *      covers both directions - it is told about traffic and ends the tunnel with stop(). A
+ *      full pipe waits for the write end no longer than HalfTunnel's write timeout
+ *  -   made with std::make_shared - every wait holds a reference, so the tunnel lives until
+ *      the socket completes it even if the owner has let go. An owner going away first calls
+ *      abandon() so that completion calls nobody
+ *
+ * Ends like a HalfTunnel - EOF on the read end is passed on by shutting down the sending side
+ * of the write end, and the callback gets the error that stopped it, EOF included.
+ */
+class SpliceTunnel : public std::enable_shared_from_this<SpliceTunnel>
+{
+    public:
+        /// true when this build can splice at all
+        static bool isAvailable();
+
+        SpliceTunnel(boost::asio::io_service& io, TCPConnectionSPtr readEnd, TCPConnectionSPtr writeEnd);
+        ~SpliceTunnel();
+        /// makes the pipe, false if it could not
+        bool open();
+        /// cb is called, on an io thread, each time data has been moved. Set before start()
+        void setTrafficCallback(std::function<void()> cb);
+        void start(std::function<void(Marvin::ErrorType& err)> cb);
+        /**
+        * ends the tunnel with err. A pending wait on either socket ends when the caller shuts
+        * the sockets down
+        */
+        void stop(Marvin::ErrorType err);
+        /**
+        * drops both callbacks and marks the tunnel stopped, for an owner that goes away
+        * before the tunnel has ended
+        */
+        void abandon();
+        /// bytes written to the write end so far
+        std::size_t bytesTransferred() const;
+        /// false once the tunnel has fallen back to copying
+        bool spliced() const;
+
+    private:
+        void startRead();
+        void handleReadable(Marvin::ErrorType& err);
+        void drain();
+        void fallBack();
+        bool stopped(Marvin::ErrorType& err);
+        void traffic();
+        void finish(Marvin::ErrorType err);
+
+        boost::asio::io_service&    _io;
+        TCPConnectionSPtr           _readEnd;
+        TCPConnectionSPtr           _writeEnd;
+        std::function<void(Marvin::ErrorType& err)> _callback;
+        std::function<void()>       _trafficCallback;
+        std::mutex                  _mutex;
+        bool                        _stopped;
+        Marvin::ErrorType           _stopErr;   /// what stop() was called with
+        int                         _pipe[2];
+        std::size_t                 _inPipe;    /// bytes spliced into the pipe not yet out of it
+        bool                        _writeWaiting;  /// the write deadline is set for a full pipe
+        std::atomic<std::size_t>    _bytes;
+        HalfTunnelUPtr              _fallback;
+};
+
+#endif /* splice_tunnel_hpp */
@@ -13,6 +13,13 @@
 #include <ostream>
 #include <string>
 #include <cassert>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "boost_stuff.hpp"
 
@@ -24,6 +31,7 @@ RBLOGGER_SETLEVEL(LOG_LEVEL_DEBUG)
 
 #include "connection_interface.hpp"
 #include "tcp_connection.hpp"
+#include "resolver_cache.hpp"
 
 using boost::asio::ip::tcp;
 using boost::bind;
@@ -31,6 +39,26 @@ using boost::function;
 using boost::system::error_code;
 using boost::asio::io_service;
 
+static long             __connectTimeoutMs = 30000;
+
+/**
+* The state of one asyncConnect, shared by the handlers of every attempt. The handlers can
+* run on different threads so everything is under the mutex, including the timer
+*/
+struct TCPConnection::ConnectRace
+{
+    ConnectRace(boost::asio::io_service& io) : timer(io), next(0), pending(0), done(false), stopped(false) {}
+
+    std::mutex                                  mutex;
+    std::vector<tcp::endpoint>                  endpoints;  /// in the order they are tried
+    std::vector<std::shared_ptr<tcp::socket>>   sockets;    /// one per attempt started
+    boost::asio::deadline_timer                 timer;      /// when to start the next attempt
+    std::size_t                                 next;       /// index of the next endpoint to try
+    std::size_t                                 pending;    /// attempts not yet finished
+    bool                                        done;       /// the final callback has been decided
+    bool                                        stopped;    /// close() was called, start nothing new
+};
+
 /**
  * Constructor
  *  @param {io_service} io_service  -   to use for running
@@ -46,7 +74,6 @@ TCPConnection::TCPConnection(
             )
             :
             _io(io_service),
-            _resolver(io_service),
             _boost_socket(io_service),
             _scheme(scheme),
             _server(server),
@@ -63,11 +90,16 @@ TCPConnection::TCPConnection(
             )
             :
             _io(io_service),
-            _resolver(io_service),
             _boost_socket(io_service),
             _scheme(scheme),
             _server(server),
-            _port(port)
+            _port(port),
+            _readTimer(io_service),
+            _readExpired(false),
+            _writeTimer(io_service),
+            _writeExpired(false),
+            _connectTimer(io_service),
+            _connectDone(false)
 {
     LogTorTrace();
 }
@@ -76,8 +108,13 @@ TCPConnection::TCPConnection(
 TCPConnection::TCPConnection(
     boost::asio::io_service& io_service
     ):   _io(io_service),
-         _resolver(io_service), // dont really need this
-         _boost_socket(io_service)
+         _boost_socket(io_service),
+         _readTimer(io_service),
+         _readExpired(false),
+         _writeTimer(io_service),
+         _writeExpired(false),
+         _connectTimer(io_service),
+         _connectDone(false)
 
 {
     LogTorTrace();
@@ -85,6 +122,9 @@ TCPConnection::TCPConnection(
 TCPConnection::~TCPConnection()
 {
     LogTorTrace();
+    _readTimer.cancel();
+    _writeTimer.cancel();
+    _connectTimer.cancel();
 }
 std::string TCPConnection::scheme(){return _scheme;}
 std::string TCPConnection::server(){return _server;}
@@ -93,14 +133,58 @@ std::string TCPConnection::service(){return _port;}
 void TCPConnection::close()
 {
     LogDebug(" fd: ", nativeSocketFD());
+    ConnectRaceSPtr race = _race;
+    if( race ) {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->stopped = true;
+        race->timer.cancel();
+        for(auto& s : race->sockets) {
+            boost::system::error_code ignored;
+            s->close(ignored);
+        }
+    }
+    _readTimer.cancel();
+    _writeTimer.cancel();
+    _connectTimer.cancel();
     _boost_socket.cancel();
     _boost_socket.close();
 }
+void TCPConnection::setSocketOptions(const SocketOptions& options)
+{
+    _socketOptions = options;
+}
+/**
+* a peer that has already gone leaves the socket not connected, which is not worth an exception
+*/
 void TCPConnection::shutdown()
 {
-    _boost_socket.shutdown(boost::asio::socket_base::shutdown_both);
+    boost::system::error_code err;
+    _boost_socket.shutdown(boost::asio::socket_base::shutdown_both, err);
+    if( err )
+        LogDebug(" fd: ", nativeSocketFD(), " ", err.message());
+}
+void TCPConnection::shutdownSend()
+{
+    boost::system::error_code err;
+    _boost_socket.shutdown(boost::asio::socket_base::shutdown_send, err);
+    if( err )
+        LogDebug(" fd: ", nativeSocketFD(), " ", err.message());
 }
 
+/**
+* An idle connection should have nothing to read. A peek that would block means the peer has
+* not closed it, 0 means it has, and data means the connection is out of step (a late or
+* unasked for response) - only the first is safe to re-use
+*/
+bool TCPConnection::isAlive()
+{
+    int fd = (int)nativeSocketFD();
+    if( fd < 0 )
+        return false;
+    char c;
+    ssize_t n = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return (n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+}
 long TCPConnection::nativeSocketFD()
 {
     return _boost_socket.native_handle();
@@ -113,82 +197,212 @@ void TCPConnection::asyncAccept(
 //    _boost_socket.non_blocking(true);
     acceptor.async_accept(_boost_socket, cb);
 }
+Marvin::ErrorType TCPConnection::accept(boost::asio::ip::tcp::acceptor& acceptor)
+{
+    Marvin::ErrorType err;
+    acceptor.accept(_boost_socket, err);
+    return err;
+}
 
 void TCPConnection::asyncConnect(ConnectCallbackType final_cb)
 {
-    tcp::resolver::query query(this->_server, _port);
     _finalCb = final_cb; // save the final callback
-    
-    _resolver.async_resolve(query, [this](const boost::system::error_code& ec,
-                                          tcp::resolver::iterator endpoint_iterator){
+    _connectDone = false;
+    ConnectRaceSPtr race = std::make_shared<ConnectRace>(_io);
+    _race = race;
+    if( __connectTimeoutMs > 0 ) {
+        _connectTimer.expiresIn(__connectTimeoutMs, std::bind(&TCPConnection::connectDeadlinePassed, this));
+    }
+    /**
+    * The deadline can complete the connect while the resolve is in flight and the owner is then
+    * free to delete this connection, so the resolve callback only looks at the race until it
+    * knows the connect is still undecided
+    */
+    ResolverCache::getInstance().asyncResolve(_io, _server, _port, [this, race](Marvin::ErrorType& ec, EndpointsSPtr endpoints){
         LogDebug("resolve OK","so now connect");
-        if( ec ){
-            Marvin::ErrorType me = ec;
-            LogError("error_value", ec.value(), " message: ", ec.message());
-            completeWithError(me);
-        } else {
-            tcp::endpoint endpoint = *endpoint_iterator;
-            auto connect_cb = bind(&TCPConnection::handle_connect, this, _1, ++endpoint_iterator);
-            _boost_socket.async_connect(endpoint, connect_cb);
-            LogDebug("leaving");
+        Marvin::ErrorType err = ec;
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            if( race->done ) {
+                // the connect deadline passed while resolving
+                return;
+            }
+            if( ! err && race->stopped )
+                err = boost::asio::error::operation_aborted;
+            if( ! err && endpoints->empty() ) {
+                LogError("no addresses for ", _server);
+                err = boost::asio::error::host_not_found;
+            }
+            if( ! err ) {
+                startRace(race, *endpoints);
+                LogDebug("leaving");
+                return;
+            }
+            race->done = true;
         }
+        LogError("error_value", err.value(), " message: ", err.message());
+        completeWithError(err);
     });
 }
 
-void TCPConnection::handle_resolve(
-                    const error_code& err,
-                    tcp::resolver::iterator endpoint_iterator)
+#pragma mark - racing connect attempts
+static long             __connectionAttemptDelayMs = 250;
+static std::atomic<int> __preferredFamily(0);     /// AF_INET or AF_INET6 of the last connect that worked
+
+void TCPConnection::configSet_ConnectionAttemptDelay(long millisecs)
 {
-    LogDebug("entry");
-    if (err)
-    {
-        LogError("resolve FAILED","Error: ",err.message());
-        Marvin::ErrorType me = err;
-        completeWithError(me);
+    __connectionAttemptDelayMs = millisecs;
+}
+void TCPConnection::configSet_ConnectTimeout(long millisecs)
+{
+    __connectTimeoutMs = millisecs;
+}
+/**
+* The connect deadline covers the resolve and the whole race. When it passes the attempts still
+* in flight are stopped and closed and the connect completes with a timeout
+*/
+void TCPConnection::connectDeadlinePassed()
+{
+    LogWarn("connect deadline passed ", _server, ":", _port);
+    ConnectRaceSPtr race = _race;
+    if( race ) {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        if( race->done )
+            return;
+        race->done = true;
+        race->stopped = true;
+        race->timer.cancel();
+        for(auto& s : race->sockets) {
+            boost::system::error_code ignored;
+            s->close(ignored);
+        }
+    }
+    Marvin::ErrorType ec = Marvin::make_error_timeout();
+    completeWithError(ec);
+}
+std::vector<tcp::endpoint> TCPConnection::orderEndpoints(const std::vector<tcp::endpoint>& endpoints, int preferred_family)
+{
+    std::vector<tcp::endpoint> v6;
+    std::vector<tcp::endpoint> v4;
+    bool v6_first = (preferred_family == AF_INET6);
+    if( (preferred_family == 0) && ! endpoints.empty() )
+        v6_first = endpoints[0].address().is_v6();
+    for(const tcp::endpoint& ep : endpoints) {
+        (ep.address().is_v6() ? v6 : v4).push_back(ep);
+    }
+    if( (v6_first && v6.empty()) || (! v6_first && v4.empty()) )
+        v6_first = ! v6_first;
+    std::vector<tcp::endpoint>& a = v6_first ? v6 : v4;
+    std::vector<tcp::endpoint>& b = v6_first ? v4 : v6;
+    std::vector<tcp::endpoint> result;
+    for(std::size_t i = 0; (i < a.size()) || (i < b.size()); i++) {
+        if( i < a.size() ) result.push_back(a[i]);
+        if( i < b.size() ) result.push_back(b[i]);
+    }
+    return result;
+}
+/**
+* Happy eyeballs (RFC 8305). The first address is tried at once, every attempt delay another
+* attempt is started in parallel, or straight away when an attempt fails. The first socket to
+* connect becomes this connections socket and the others are closed.
+* Called with race->mutex held and a non empty list of endpoints.
+*/
+void TCPConnection::startRace(ConnectRaceSPtr race, const std::vector<tcp::endpoint>& endpoints)
+{
+    race->endpoints = orderEndpoints(endpoints, __preferredFamily.load());
+    startNextAttempt(race);
+}
+/**
+* Called with race->mutex held. Each socket is opened and has the socket options applied
+* before connecting, so buffer sizes and fast open are in place for the SYN
+*/
+void TCPConnection::startNextAttempt(ConnectRaceSPtr race)
+{
+    if( race->done || race->stopped || (race->next >= race->endpoints.size()) )
         return;
-    }else{
-        LogDebug("resolve OK","so now connect");
-        tcp::endpoint endpoint = *endpoint_iterator;
-        auto connect_cb = bind(&TCPConnection::handle_connect, this, _1, ++endpoint_iterator);
-        _boost_socket.async_connect(endpoint, connect_cb);
-        LogDebug("leaving");
+    tcp::endpoint endpoint = race->endpoints[race->next++];
+    LogDebug("attempt ", race->next, " of ", race->endpoints.size(), " ", endpoint.address().to_string());
+    std::shared_ptr<tcp::socket> sock = std::make_shared<tcp::socket>(_io);
+    Marvin::ErrorType err;
+    sock->open(endpoint.protocol(), err);
+    if( ! err ) {
+        _socketOptions.apply(sock->native_handle(), SocketOptions::Role::Upstream);
+    }
+    race->sockets.push_back(sock);
+    race->pending++;
+    sock->async_connect(endpoint, [this, race, sock, endpoint](const boost::system::error_code& err) {
+        attemptDone(race, sock, endpoint, err);
+    });
+    if( race->next < race->endpoints.size() ) {
+        race->timer.expires_from_now(boost::posix_time::milliseconds(__connectionAttemptDelayMs));
+        race->timer.async_wait([this, race](const boost::system::error_code& err) {
+            if( err )
+                return;
+            std::lock_guard<std::mutex> lock(race->mutex);
+            startNextAttempt(race);
+        });
     }
 }
-
-
-void TCPConnection::handle_connect(
-                    const boost::system::error_code& err,
-                    tcp::resolver::iterator endpoint_iterator)
+void TCPConnection::attemptDone(ConnectRaceSPtr race, std::shared_ptr<tcp::socket> sock, tcp::endpoint endpoint, const boost::system::error_code& err)
 {
-    LogDebug("entry");
-    if (!err)
+    bool won = false;
+    bool lost = false;
     {
-        LogDebug("connect OK");
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->pending--;
+        if( race->done )
+            return;
+        if( ! err && ! race->stopped ) {
+            won = true;
+            race->done = true;
+            race->timer.cancel();
+            for(auto& s : race->sockets) {
+                if( s != sock ) {
+                    boost::system::error_code ignored;
+                    s->close(ignored);
+                }
+            }
+            race->sockets.clear();
+        } else {
+            LogDebug("attempt failed ", endpoint.address().to_string(), " ", err.message());
+            startNextAttempt(race);
+            if( race->pending == 0 ) {
+                lost = true;
+                race->done = true;
+            }
+        }
+    }
+    if( won ) {
+        LogDebug("connect OK ", endpoint.address().to_string());
+        __preferredFamily = endpoint.address().is_v6() ? AF_INET6 : AF_INET;
+        _boost_socket = std::move(*sock);
         _boost_socket.non_blocking(true);
+        LogDebug("socket options fd: ", nativeSocketFD(), " ",
+            SocketOptions::effective(nativeSocketFD(), SocketOptions::Role::Upstream).str());
         completeWithSuccess();
-    }
-    else if (endpoint_iterator != tcp::resolver::iterator())
-    {
-        LogDebug("try next iterator");
-        _boost_socket.close();
-        tcp::endpoint endpoint = *endpoint_iterator;
-        auto handler = boost::bind(&TCPConnection::handle_connect, this, _1, ++endpoint_iterator);
-        _boost_socket.async_connect(endpoint, handler);
-    }
-    else
-    {
-        LogError("resolve FAILED","Error: ",err.message());
+    } else if( lost ) {
+        LogError("connect FAILED","Error: ", err.message());
         Marvin::ErrorType me = err;
+        if( ! me )
+            me = boost::asio::error::operation_aborted;
         completeWithError(me);
     }
-    LogDebug("leaving");
 }
+/**
+* The connect completes exactly once - the deadline and the race can both try
+*/
 void TCPConnection::completeWithError(Marvin::ErrorType& ec)
 {
+    if( _connectDone.exchange(true) )
+        return;
+    _connectTimer.cancel();
     _finalCb(ec, nullptr);
 }
 void TCPConnection::completeWithSuccess()
 {
+    if( _connectDone.exchange(true) )
+        return;
+    _connectTimer.cancel();
     Marvin::ErrorType err = Marvin::make_error_ok();
     _finalCb(err, this);
 }
@@ -202,20 +416,159 @@ void TCPConnection::asyncRead(MBuffer& buffer, AsyncReadCallbackType cb)
     //
     // start a boost async_read, on callback pass the data to the http parser
     //
-    auto b = boost::asio::buffer(buffer.data(), buffer.capacity());
-//    auto opn = _boost_socket.is_open();
-    _boost_socket.async_read_some(b, [this, cb, &buffer](const Marvin::ErrorType& err, std::size_t bytes_transfered){
+    if( _readExpired ) {
+        _io.post([cb](){
+            Marvin::ErrorType m_err = Marvin::make_error_timeout();
+            cb(m_err, 0);
+        });
+        return;
+    }
+    ReadOpSPtr op = std::make_shared<ReadOp>();
+    op->expire = [cb](){
+        Marvin::ErrorType m_err = Marvin::make_error_timeout();
+        cb(m_err, 0);
+    };
+    std::atomic_store(&_readOp, op);
+    boost::system::error_code ignored;
+    _boost_socket.non_blocking(true, ignored);
+    waitToRead(op, buffer, cb);
+}
+/**
+* A read is a wait for the socket to be readable followed by a non blocking read_some(). Only
+* the read_some() touches the buffer, so when the deadline has already completed the read
+* the wait can be left to finish on its own - no other operation on the socket is cancelled
+*/
+void TCPConnection::waitToRead(ReadOpSPtr op, MBuffer& buffer, AsyncReadCallbackType cb)
+{
+    _boost_socket.async_read_some(boost::asio::null_buffers(), [this, op, &buffer, cb](const Marvin::ErrorType& err, std::size_t bytes_transfered){
+        if( op->done.exchange(true) )
+            return;
         Marvin::ErrorType m_err = err;
-        buffer.setSize(bytes_transfered);
-        cb(m_err, bytes_transfered);
+        std::size_t n = 0;
+        if( ! m_err ) {
+            n = _boost_socket.read_some(boost::asio::buffer(buffer.data(), buffer.capacity()), m_err);
+            if( m_err == boost::asio::error::would_block ) {
+                // woken but nothing to read after all - wait again unless the deadline passed meanwhile
+                op->done = false;
+                if( (! _readExpired) || op->done.exchange(true) ) {
+                    waitToRead(op, buffer, cb);
+                    return;
+                }
+                m_err = Marvin::make_error_timeout();
+            }
+        }
+        buffer.setSize(n);
+        cb(m_err, n);
     });
-    
+}
+void TCPConnection::asyncWaitReadable(std::function<void(Marvin::ErrorType& err)> cb)
+{
+    if( _readExpired ) {
+        _io.post([cb](){
+            Marvin::ErrorType m_err = Marvin::make_error_timeout();
+            cb(m_err);
+        });
+        return;
+    }
+    boost::system::error_code ignored;
+    _boost_socket.non_blocking(true, ignored);
+    ReadOpSPtr op = std::make_shared<ReadOp>();
+    op->expire = [cb](){
+        Marvin::ErrorType m_err = Marvin::make_error_timeout();
+        cb(m_err);
+    };
+    std::atomic_store(&_readOp, op);
+    _boost_socket.async_read_some(boost::asio::null_buffers(), [op, cb](const Marvin::ErrorType& err, std::size_t bytes_transfered){
+        if( op->done.exchange(true) )
+            return;
+        Marvin::ErrorType m_err = err;
+        cb(m_err);
+    });
+}
+void TCPConnection::asyncWaitWritable(std::function<void(Marvin::ErrorType& err)> cb)
+{
+    if( writeExpired(cb) )
+        return;
+    boost::system::error_code ignored;
+    _boost_socket.non_blocking(true, ignored);
+    _boost_socket.async_write_some(boost::asio::null_buffers(), [this, cb](const Marvin::ErrorType& err, std::size_t bytes_transfered){
+        Marvin::ErrorType m_err = _writeExpired ? Marvin::make_error_timeout() : err;
+        cb(m_err);
+    });
+}
+/**
+* the deadline is a timer on the io_service's TimingWheel, when it passes the pending read
+* (if any) is completed with a timeout and abandoned - writes and waits for writability
+* are not affected
+*/
+void TCPConnection::setReadDeadline(long millisecs)
+{
+    _readExpired = false;
+    if( millisecs <= 0 ) {
+        _readTimer.cancel();
+        return;
+    }
+    _readTimer.expiresIn(millisecs, std::bind(&TCPConnection::readDeadlinePassed, this));
+}
+void TCPConnection::readDeadlinePassed()
+{
+    LogDebug(" fd: ", nativeSocketFD());
+    _readExpired = true;
+    ReadOpSPtr op = std::atomic_load(&_readOp);
+    if( (op != nullptr) && ! op->done.exchange(true) ) {
+        _io.post(op->expire);
+    }
+}
+/**
+* A write that is stuck because the peer is not reading can not be taken back, so when the
+* write deadline passes the sending side of the socket is shut down. The pending write fails
+* at once and is reported as a timeout, as is every later write - the connection can not send
+* any more. Reads are not affected
+*/
+void TCPConnection::setWriteDeadline(long millisecs)
+{
+    if( millisecs <= 0 ) {
+        _writeTimer.cancel();
+        return;
+    }
+    _writeTimer.expiresIn(millisecs, std::bind(&TCPConnection::writeDeadlinePassed, this));
+}
+void TCPConnection::writeDeadlinePassed()
+{
+    LogWarn("write deadline passed fd: ", nativeSocketFD());
+    _writeExpired = true;
+    boost::system::error_code ignored;
+    _boost_socket.shutdown(boost::asio::socket_base::shutdown_send, ignored);
+}
+/**
+* a write after the write deadline passed fails with a timeout without touching the socket
+*/
+bool TCPConnection::writeExpired(AsyncWriteCallback cb)
+{
+    if( ! _writeExpired )
+        return false;
+    _io.post([cb](){
+        Marvin::ErrorType m_err = Marvin::make_error_timeout();
+        cb(m_err, 0);
+    });
+    return true;
+}
+bool TCPConnection::writeExpired(std::function<void(Marvin::ErrorType& err)> cb)
+{
+    return writeExpired([cb](Marvin::ErrorType& err, std::size_t bytes_transfered){ cb(err); });
+}
+/// the error a write completed with, a write the deadline broke off is a timeout
+Marvin::ErrorType TCPConnection::writeError(const Marvin::ErrorType& err)
+{
+    return (err && _writeExpired) ? Marvin::make_error_timeout() : err;
 }
 /**
  * write
  */
 void TCPConnection::asyncWrite(MBuffer& buf, AsyncWriteCallbackType cb)
 {
+    if( writeExpired(cb) )
+        return;
     LogDebug("");
     void* bp = buf.data();
 //    char* cp = (char*) bp;
@@ -235,7 +588,7 @@ void TCPConnection::asyncWrite(MBuffer& buf, AsyncWriteCallbackType cb)
             Marvin::ErrorType m_err = Marvin::make_error_ok();
             cb(m_err, bytes_transfered);
         }else{
-            Marvin::ErrorType m_err = err;
+            Marvin::ErrorType m_err = writeError(err);
             cb(m_err, bytes_transfered);
         }
     });
@@ -243,6 +596,8 @@ void TCPConnection::asyncWrite(MBuffer& buf, AsyncWriteCallbackType cb)
 
 void TCPConnection::asyncWrite(std::string& str, AsyncWriteCallback cb)
 {
+    if( writeExpired(cb) )
+        return;
     LogDebug("");
     boost::asio::async_write(
         (this->_boost_socket),
@@ -257,7 +612,7 @@ void TCPConnection::asyncWrite(std::string& str, AsyncWriteCallback cb)
             Marvin::ErrorType m_err = Marvin::make_error_ok();
             cb(m_err, bytes_transfered);
         }else{
-            Marvin::ErrorType m_err = err;
+            Marvin::ErrorType m_err = writeError(err);
             cb(m_err, bytes_transfered);
         }
     });
@@ -265,14 +620,18 @@ void TCPConnection::asyncWrite(std::string& str, AsyncWriteCallback cb)
 }
 void TCPConnection::asyncWrite(BufferChainSPtr buf_chain_sptr, AsyncWriteCallback cb)
 {
+    if( writeExpired(cb) )
+        return;
     /// this took a while to work out - change buffer code at your peril
-    auto tmp = buf_chain_sptr->asio_buffer_sequence();
+    /// the view does not own the memory - the handler holds buf_chain_sptr so the
+    /// chain and its buffers outlive the write
+    BufferChain::SequenceView seq = buf_chain_sptr->buffer_sequence();
     
     LogDebug("");
     boost::asio::async_write(
         (this->_boost_socket),
-        tmp,
-        [this, &tmp, cb](
+        seq,
+        [this, buf_chain_sptr, cb](
             const Marvin::ErrorType& err,
             std::size_t bytes_transfered
             )
@@ -282,7 +641,7 @@ void TCPConnection::asyncWrite(BufferChainSPtr buf_chain_sptr, AsyncWriteCallbac
             Marvin::ErrorType m_err = Marvin::make_error_ok();
             cb(m_err, bytes_transfered);
         }else{
-            Marvin::ErrorType m_err = err;
+            Marvin::ErrorType m_err = writeError(err);
             cb(m_err, bytes_transfered);
         }
     });
@@ -306,7 +665,7 @@ void TCPConnection::asyncWrite(boost::asio::const_buffer abuf, AsyncWriteCallbac
             Marvin::ErrorType m_err = Marvin::make_error_ok();
             cb(m_err, bytes_transfered);
         }else{
-            Marvin::ErrorType m_err = err;
+            Marvin::ErrorType m_err = writeError(err);
             cb(m_err, bytes_transfered);
         }
     });
@@ -314,6 +673,8 @@ void TCPConnection::asyncWrite(boost::asio::const_buffer abuf, AsyncWriteCallbac
 }
 void TCPConnection::asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback cb)
 {
+    if( writeExpired(cb) )
+        return;
     LogDebug("");
     boost::asio::async_write(
         (this->_boost_socket),
@@ -328,10 +689,121 @@ void TCPConnection::asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback cb
             Marvin::ErrorType m_err = Marvin::make_error_ok();
             cb(m_err, bytes_transfered);
         }else{
-            Marvin::ErrorType m_err = err;
+            Marvin::ErrorType m_err = writeError(err);
             cb(m_err, bytes_transfered);
         }
     });
 }
 
 #endif
+#pragma mark - writing a BodyFile
+/// size of the pread() chunks used when sendfile() is not available
+static const std::size_t kFileChunkSize = 65536;
+
+/**
+ * Writes the whole of a BodyFile (a spilled message body) to the socket.
+ *
+ * On Linux the data goes straight from the page cache to the socket with sendfile(),
+ * waiting for the socket to become writable (a null_buffers operation) whenever its send
+ * buffer is full. Elsewhere, or if sendfile() refuses this file/socket pair, the file is
+ * read in chunks with pread() into a single pooled buffer and each chunk is written with async_write.
+ *
+ * cb is always called from the io_service, with the number of bytes written.
+ */
+void TCPConnection::asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb)
+{
+    if( writeExpired(cb) )
+        return;
+    LogDebug("");
+#ifdef __linux__
+    // sendfile must not block the io thread
+    _boost_socket.non_blocking(true);
+    sendFileSome(body_file_sptr, 0, cb);
+#else
+    copyFileSome(body_file_sptr, 0, m_buffer(kFileChunkSize), cb);
+#endif
+}
+void TCPConnection::sendFileSome(BodyFileSPtr body_file_sptr, std::size_t offset, AsyncWriteCallback cb)
+{
+#ifdef __linux__
+    int sock = (int)_boost_socket.native_handle();
+    std::size_t total = body_file_sptr->size();
+    while( offset < total ) {
+        off_t off = (off_t)offset;
+        ssize_t n = ::sendfile(sock, body_file_sptr->fd(), &off, total - offset);
+        if( n > 0 ) {
+            offset = (std::size_t)off;
+            continue;
+        }
+        if( (n < 0) && (errno == EINTR) ) {
+            continue;
+        }
+        if( (n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ) {
+            _boost_socket.async_write_some(boost::asio::null_buffers(), [this, body_file_sptr, offset, cb](
+                const Marvin::ErrorType& err,
+                std::size_t bytes_transfered)
+            {
+                if( err || _writeExpired ) {
+                    // after the write deadline the socket is writable because it is shut down
+                    postFileWriteResult(_writeExpired ? Marvin::make_error_timeout() : err, offset, cb);
+                } else {
+                    sendFileSome(body_file_sptr, offset, cb);
+                }
+            });
+            return;
+        }
+        if( (n < 0) && ((errno == EINVAL) || (errno == ENOSYS)) ) {
+            LogWarn("sendfile not supported - falling back to pread fd: ", nativeSocketFD());
+            copyFileSome(body_file_sptr, offset, m_buffer(kFileChunkSize), cb);
+            return;
+        }
+        if( n == 0 ) {
+            // the file is shorter than it claims - nothing more to send
+            break;
+        }
+        postFileWriteResult(Marvin::ErrorType(errno, boost::system::system_category()), offset, cb);
+        return;
+    }
+    postFileWriteResult(Marvin::make_error_ok(), offset, cb);
+#else
+    copyFileSome(body_file_sptr, offset, m_buffer(kFileChunkSize), cb);
+#endif
+}
+void TCPConnection::copyFileSome(BodyFileSPtr body_file_sptr, std::size_t offset, MBufferSPtr chunk, AsyncWriteCallback cb)
+{
+    std::size_t total = body_file_sptr->size();
+    if( offset >= total ) {
+        postFileWriteResult(Marvin::make_error_ok(), offset, cb);
+        return;
+    }
+    long n = body_file_sptr->pread(offset, chunk->data(), std::min(chunk->capacity(), total - offset));
+    if( n <= 0 ) {
+        Marvin::ErrorType err = (n == 0) ? Marvin::make_error_ok() : Marvin::ErrorType(errno, boost::system::system_category());
+        postFileWriteResult(err, offset, cb);
+        return;
+    }
+    chunk->setSize((std::size_t)n);
+    boost::asio::async_write(
+        (this->_boost_socket),
+        boost::asio::buffer(chunk->data(), chunk->size()),
+        [this, body_file_sptr, offset, chunk, cb](
+            const Marvin::ErrorType& err,
+            std::size_t bytes_transfered
+            )
+        {
+        if( err ) {
+            Marvin::ErrorType m_err = writeError(err);
+            cb(m_err, offset + bytes_transfered);
+        } else {
+            copyFileSome(body_file_sptr, offset + bytes_transfered, chunk, cb);
+        }
+    });
+}
+void TCPConnection::postFileWriteResult(Marvin::ErrorType err, std::size_t bytes_transfered, AsyncWriteCallback cb)
+{
+    Marvin::ErrorType m_err = writeError(err);
+    _io.post([m_err, bytes_transfered, cb](){
+        Marvin::ErrorType e = m_err;
+        cb(e, bytes_transfered);
+    });
+}
@@ -6,6 +6,9 @@
 #include <istream>
 #include <ostream>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 //#include <boost/asio.hpp>
 //#include <boost/bind.hpp>
@@ -18,6 +21,7 @@
 #include "read_socket_interface.hpp"
 #include "bufferV2.hpp"
 #include "connection_interface.hpp"
+#include "timing_wheel.hpp"
 
 using namespace boost;
 using namespace boost::system;
@@ -39,6 +43,23 @@ typedef std::unique_ptr<TCPConnection> TCPConnectionUPtr;
 class TCPConnection : public ConnectionInterface
 {
     public:
+    /**
+     * How long a connect attempt to one address is given before the next address is tried
+     * in parallel, RFC 8305 recommends 250ms. Defaults to 250
+     */
+    static void configSet_ConnectionAttemptDelay(long millisecs);
+    /**
+     * How long asyncConnect() - resolve and every connect attempt - may take before it
+     * completes with Marvin::errc::timeout, 0 for ever. Defaults to 30000
+     */
+    static void configSet_ConnectTimeout(long millisecs);
+    /**
+     * The order the resolved addresses are tried in, alternating between IPv6 and IPv4 and
+     * starting with preferred_family (AF_INET or AF_INET6, 0 for whichever comes first) - RFC 8305
+     * section 4. Public for testing
+     */
+    static std::vector<tcp::endpoint> orderEndpoints(const std::vector<tcp::endpoint>& endpoints, int preferred_family);
+
     // client socket needs to know who to connect to
 #if 0
     TCPConnection(
@@ -63,16 +84,39 @@ class TCPConnection : public ConnectionInterface
     
     void asyncConnect(ConnectCallbackType cb);
     void asyncAccept(boost::asio::ip::tcp::acceptor& acceptor, std::function<void(const boost::system::error_code& err)> cb);
+    /**
+     * accepts a connection that is already waiting. With a non-blocking acceptor it returns
+     * would_block at once when there is none
+     */
+    Marvin::ErrorType accept(boost::asio::ip::tcp::acceptor& acceptor);
     
     void asyncWrite(MBuffer& buffer, AsyncWriteCallbackType cb);
     void asyncWrite(std::string& str, AsyncWriteCallbackType cb);
     void asyncWrite(BufferChainSPtr buf_chain_sptr, AsyncWriteCallback cb);
     void asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb);
     void asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback);
+    void asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb);
 
     void asyncRead(MBuffer& mb,  AsyncReadCallbackType cb);
+    void setReadDeadline(long millisecs);
+    /**
+     * Writes still pending millisecs from now, and writes started after that, complete with
+     * Marvin::errc::timeout. The sending side of the socket is shut down when it passes, so
+     * the connection can not write any more. Replaces the previous deadline, 0 clears it
+     */
+    void setWriteDeadline(long millisecs);
+    /**
+     * cb is called when the socket has data, EOF or an error to read, nothing is read. For
+     * moving data with splice(). Puts the socket in non-blocking mode. Honours the read deadline
+     */
+    void asyncWaitReadable(std::function<void(Marvin::ErrorType& err)> cb);
+    /// cb is called when a write to the socket would not block. Honours the write deadline
+    void asyncWaitWritable(std::function<void(Marvin::ErrorType& err)> cb);
+    void setSocketOptions(const SocketOptions& options);
     void shutdown();
+    void shutdownSend();
     void close();
+    bool isAlive();
     
     long nativeSocketFD();
     
@@ -82,27 +126,52 @@ class TCPConnection : public ConnectionInterface
     
 private:
 
-    void handle_resolve(
-        const boost::system::error_code& err,
-        tcp::resolver::iterator endpoint_iterator
-    );
-    
-    void handle_connect(
-        const boost::system::error_code& err,
-        tcp::resolver::iterator endpoint_iterator
-    );
+    struct ConnectRace;
+    typedef std::shared_ptr<ConnectRace> ConnectRaceSPtr;
 
+    void startRace(ConnectRaceSPtr race, const std::vector<tcp::endpoint>& endpoints);
+    void startNextAttempt(ConnectRaceSPtr race);
+    void attemptDone(ConnectRaceSPtr race, std::shared_ptr<tcp::socket> sock, tcp::endpoint endpoint, const boost::system::error_code& err);
     void completeWithError(Marvin::ErrorType& ec);
     void completeWithSuccess();
 
+    void sendFileSome(BodyFileSPtr body_file_sptr, std::size_t offset, AsyncWriteCallback cb);
+    void copyFileSome(BodyFileSPtr body_file_sptr, std::size_t offset, MBufferSPtr chunk, AsyncWriteCallback cb);
+    void postFileWriteResult(Marvin::ErrorType err, std::size_t bytes_transfered, AsyncWriteCallback cb);
+
+    /// a read or a wait for readability, the deadline or the socket completes it - whichever is first
+    struct ReadOp
+    {
+        ReadOp() : done(false) {}
+        std::atomic<bool>       done;
+        std::function<void()>   expire;     /// reports the timeout
+    };
+    typedef std::shared_ptr<ReadOp> ReadOpSPtr;
+
+    void waitToRead(ReadOpSPtr op, MBuffer& buffer, AsyncReadCallbackType cb);
+    void readDeadlinePassed();
+    void writeDeadlinePassed();
+    bool writeExpired(AsyncWriteCallback cb);
+    bool writeExpired(std::function<void(Marvin::ErrorType& err)> cb);
+    Marvin::ErrorType writeError(const Marvin::ErrorType& err);
+    void connectDeadlinePassed();
+
 
     std::string                     _scheme;
     std::string                     _server;
     std::string                     _port;
     boost::asio::io_service&        _io;
-    boost::asio::ip::tcp::resolver  _resolver;
     boost::asio::ip::tcp::socket    _boost_socket;
     ConnectCallbackType             _finalCb;
+    SocketOptions                   _socketOptions;
+    ConnectRaceSPtr                 _race;      /// the connect attempts in flight, if any
+    TimingWheel::Timer              _readTimer;
+    std::atomic<bool>               _readExpired;   /// the read deadline has passed
+    ReadOpSPtr                      _readOp;        /// the latest read, only accessed atomically
+    TimingWheel::Timer              _writeTimer;
+    std::atomic<bool>               _writeExpired;  /// the write deadline has passed
+    TimingWheel::Timer              _connectTimer;
+    std::atomic<bool>               _connectDone;   /// the connect callback has been called
 };
 
 
@@ -0,0 +1,219 @@
+//
+//  timing_wheel.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/23/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <algorithm>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "timing_wheel.hpp"
+
+static long __resolutionMs = 100;
+
+boost::asio::io_service::id TimingWheel::id;
+
+void TimingWheel::configSet_Resolution(long millisecs) { __resolutionMs = std::max<long>(1, millisecs); }
+
+#pragma mark - Timer
+TimingWheel::Timer::Timer(boost::asio::io_service& io)
+    : _wheel(&boost::asio::use_service<TimingWheel>(io)),
+      _prev(nullptr), _next(nullptr), _slot(nullptr), _expiry(0)
+{
+}
+TimingWheel::Timer::~Timer()
+{
+    cancel();
+}
+void TimingWheel::Timer::expiresIn(long millisecs, std::function<void()> cb)
+{
+    if( _wheel != nullptr )
+        _wheel->schedule(*this, millisecs, cb);
+}
+void TimingWheel::Timer::cancel()
+{
+    if( _wheel != nullptr )
+        _wheel->cancel(*this);
+}
+bool TimingWheel::Timer::pending()
+{
+    if( _wheel == nullptr )
+        return false;
+    std::lock_guard<std::recursive_mutex> lock(_wheel->_mutex);
+    return (_slot != nullptr);
+}
+
+#pragma mark - TimingWheel
+TimingWheel::TimingWheel(boost::asio::io_service& io)
+    : boost::asio::io_service::service(io),
+      _resolutionMs(__resolutionMs), _start(Clock::now()), _current(0), _count(0),
+      _ticker(io), _ticking(false)
+{
+    for(int l = 0; l < kLevels; l++) {
+        std::fill(std::begin(_slots[l]), std::end(_slots[l]), nullptr);
+    }
+}
+TimingWheel::~TimingWheel()
+{
+}
+/**
+* the io_service is going away - timers still scheduled are left unscheduled and forget the
+* wheel, so their owners can still destroy them
+*/
+void TimingWheel::shutdown_service()
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    for(int l = 0; l < kLevels; l++) {
+        for(std::uint64_t s = 0; s < kSlots; s++) {
+            for(Timer* t = _slots[l][s]; t != nullptr; ) {
+                Timer* next = t->_next;
+                t->_wheel = nullptr;
+                t->_slot = nullptr;
+                t->_prev = t->_next = nullptr;
+                t->_callback = nullptr;
+                t = next;
+            }
+            _slots[l][s] = nullptr;
+        }
+    }
+    _count = 0;
+    boost::system::error_code ignored;
+    _ticker.cancel(ignored);
+}
+std::size_t TimingWheel::size()
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    return _count;
+}
+std::uint64_t TimingWheel::ticksNow()
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _start);
+    return (std::uint64_t)elapsed.count() / (std::uint64_t)_resolutionMs;
+}
+/**
+* Expires at the end of the tick that is millisecs after the current one, so it is never early
+*/
+void TimingWheel::schedule(Timer& timer, long millisecs, std::function<void()> cb)
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if( timer._slot != nullptr ) {
+        unlink(timer);
+        _count--;
+    }
+    std::uint64_t now = ticksNow();
+    if( ! _ticking ) {
+        // nothing is scheduled, so skipping the idle ticks loses nothing
+        _current = std::max(_current, now);
+    }
+    std::uint64_t ticks = (std::uint64_t)((std::max<long>(0, millisecs) + _resolutionMs - 1) / _resolutionMs);
+    timer._expiry = std::max(now, _current) + ticks + 1;
+    timer._callback = cb;
+    link(timer);
+    _count++;
+    if( ! _ticking )
+        startTicking();
+}
+void TimingWheel::cancel(Timer& timer)
+{
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if( timer._slot == nullptr )
+        return;
+    unlink(timer);
+    timer._callback = nullptr;
+    _count--;
+}
+/**
+* puts the timer on the level whose span covers the time left to its expiry, in the slot its
+* expiry hashes to on that level
+*/
+void TimingWheel::link(Timer& timer)
+{
+    const std::uint64_t max_delta = (std::uint64_t)1 << (kSlotBits * kLevels);
+    if( timer._expiry - _current >= max_delta )
+        timer._expiry = _current + max_delta - 1;
+    std::uint64_t delta = timer._expiry - _current;
+    int level = 0;
+    while( (level < kLevels - 1) && (delta >= ((std::uint64_t)1 << (kSlotBits * (level + 1)))) )
+        level++;
+    std::uint64_t slot = (timer._expiry >> (kSlotBits * level)) & (kSlots - 1);
+    Timer** head = &_slots[level][slot];
+    timer._prev = nullptr;
+    timer._next = *head;
+    if( *head != nullptr )
+        (*head)->_prev = &timer;
+    *head = &timer;
+    timer._slot = head;
+}
+void TimingWheel::unlink(Timer& timer)
+{
+    if( timer._prev != nullptr )
+        timer._prev->_next = timer._next;
+    else
+        *(timer._slot) = timer._next;
+    if( timer._next != nullptr )
+        timer._next->_prev = timer._prev;
+    timer._prev = timer._next = nullptr;
+    timer._slot = nullptr;
+}
+/**
+* moves to the next tick - when a level wraps the slot of the level above that is now current
+* is moved down, then everything in the level 0 slot fires
+*/
+void TimingWheel::advance()
+{
+    _current++;
+    for(int level = 1; level < kLevels; level++) {
+        if( ((_current >> (kSlotBits * (level - 1))) & (kSlots - 1)) != 0 )
+            break;
+        std::uint64_t slot = (_current >> (kSlotBits * level)) & (kSlots - 1);
+        Timer* t = _slots[level][slot];
+        _slots[level][slot] = nullptr;
+        while( t != nullptr ) {
+            Timer* next = t->_next;
+            link(*t);
+            t = next;
+        }
+    }
+    Timer** head = &_slots[0][_current & (kSlots - 1)];
+    Timer* t;
+    while( (t = *head) != nullptr ) {
+        unlink(*t);
+        if( t->_expiry > _current ) {
+            // clamped to the top level when it was scheduled
+            link(*t);
+            continue;
+        }
+        _count--;
+        std::function<void()> cb = std::move(t->_callback);
+        t->_callback = nullptr;
+        if( cb )
+            cb();
+    }
+}
+void TimingWheel::startTicking()
+{
+    _ticking = true;
+    auto next = _start + std::chrono::milliseconds((long)((_current + 1) * (std::uint64_t)_resolutionMs));
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now());
+    _ticker.expires_from_now(boost::posix_time::milliseconds(std::max<long>(0, (long)wait.count())));
+    _ticker.async_wait([this](const boost::system::error_code& err){
+        handleTick(err);
+    });
+}
+void TimingWheel::handleTick(const boost::system::error_code& err)
+{
+    if( err == boost::asio::error::operation_aborted )
+        return;
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    std::uint64_t now = ticksNow();
+    while( (_current < now) && (_count > 0) ) {
+        advance();
+    }
+    if( _count == 0 ) {
+        _current = std::max(_current, now);
+        _ticking = false;
+        return;
+    }
+    startTicking();
+}
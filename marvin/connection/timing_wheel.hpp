@@ -0,0 +1,104 @@
+//
+//  timing_wheel.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/23/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef timing_wheel_hpp
+#define timing_wheel_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <boost/asio.hpp>
+
+#pragma mark - TimingWheel class
+/**
+ * A hierarchical hashed timing wheel (Varghese and Lauck) for connection deadlines.
+ *
+ * One deadline_timer per read would put every connection in the io_service's timer heap
+ * and cost O(log n) for each read started or finished. The wheel is an asio service, so there
+ * is one per io_service shared by all its threads, and a single deadline_timer ticks it at the
+ * configured resolution, only while something is scheduled.
+ *
+ *  -   4 levels of 256 slots. Level 0 slots are one tick each, every level up is 256 times
+ *      coarser, so at the default 100ms resolution level 0 covers 25s and level 3 years
+ *  -   a timer is an intrusive list node, so scheduling and cancelling are O(1). Each tick
+ *      touches one slot. When level 0 wraps a slot of level 1 is moved down, and so on
+ *  -   timers fire no earlier than asked and at most about two ticks late
+ *
+ * Callbacks are called on an io thread with the wheel's lock held. They should be short (the
+ * usual one cancels a socket). A callback may schedule or cancel timers. Once cancel() has
+ * returned the callback will not run.
+ */
+class TimingWheel : public boost::asio::io_service::service
+{
+public:
+    static boost::asio::io_service::id id;
+
+    /**
+     * A deadline on the wheel of an io_service. Owned by whatever it guards, not copyable,
+     * cancelled when destroyed
+     */
+    class Timer
+    {
+    public:
+        explicit Timer(boost::asio::io_service& io);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        /// cb is called millisecs from now. Replaces anything scheduled before
+        void expiresIn(long millisecs, std::function<void()> cb);
+        void cancel();
+        bool pending();
+
+    private:
+        friend class TimingWheel;
+        TimingWheel*            _wheel;     /// nullptr once the io_service has shut down
+        Timer*                  _prev;
+        Timer*                  _next;
+        Timer**                 _slot;      /// the list head it is on, nullptr when not scheduled
+        std::uint64_t           _expiry;    /// in ticks
+        std::function<void()>   _callback;
+    };
+
+    /// the tick length in milliseconds, for wheels created after the call. Defaults to 100
+    static void configSet_Resolution(long millisecs);
+
+    explicit TimingWheel(boost::asio::io_service& io);
+    ~TimingWheel();
+
+    /// timers scheduled now
+    std::size_t size();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const int            kLevels = 4;
+    static const int            kSlotBits = 8;
+    static const std::uint64_t  kSlots = 1 << kSlotBits;
+
+    void shutdown_service();
+    void schedule(Timer& timer, long millisecs, std::function<void()> cb);
+    void cancel(Timer& timer);
+    void link(Timer& timer);
+    void unlink(Timer& timer);
+    std::uint64_t ticksNow();
+    void startTicking();
+    void handleTick(const boost::system::error_code& err);
+    void advance();
+
+    std::recursive_mutex            _mutex;
+    long                            _resolutionMs;
+    Clock::time_point               _start;
+    std::uint64_t                   _current;   /// the last tick processed
+    std::size_t                     _count;
+    Timer*                          _slots[kLevels][kSlots];
+    boost::asio::deadline_timer     _ticker;
+    bool                            _ticking;
+};
+
+#endif /* timing_wheel_hpp */
@@ -0,0 +1,219 @@
+//
+//  tls_client_context.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <sys/stat.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "tls_client_context.hpp"
+#include "tls_session_cache.hpp"
+
+namespace ssl = boost::asio::ssl;
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+    * the shared contexts, keyed by TlsClientProfile::key()
+    */
+    struct Registry
+    {
+        std::mutex                                      mutex;
+        std::map<std::string, TlsClientContextSPtr>     contexts;
+        TlsClientProfile                                defaultProfile;
+        long                                            checkIntervalSecs = 30;
+        Clock::time_point                               lastCheck = Clock::now();
+    };
+    Registry& registry()
+    {
+        static Registry __registry;
+        return __registry;
+    }
+}
+
+TlsClientProfile::TlsClientProfile() : verifyPeer(true)
+{
+}
+std::string TlsClientProfile::key() const
+{
+    std::ostringstream os;
+    os << (verifyPeer ? "verify" : "noverify") << "|" << ciphers << "|";
+    for(const std::string& p : alpn)
+        os << p << ",";
+    os << "|" << caFile;
+    return os.str();
+}
+
+bool TlsClientContext::FileStamp::operator==(const FileStamp& other) const
+{
+    return (mtime == other.mtime) && (size == other.size);
+}
+
+void TlsClientContext::configSet_DefaultProfile(const TlsClientProfile& profile)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.defaultProfile = profile;
+}
+void TlsClientContext::configSet_ReloadCheckInterval(long secs)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.checkIntervalSecs = secs;
+}
+
+TlsClientContextSPtr TlsClientContext::get()
+{
+    TlsClientProfile profile;
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        profile = r.defaultProfile;
+    }
+    return get(profile);
+}
+/**
+* The first get() for a profile builds its context with the registry unlocked, so a slow
+* trust store does not hold up connections using other profiles. If two threads race to
+* build the same profile the first one stored wins
+*/
+TlsClientContextSPtr TlsClientContext::get(const TlsClientProfile& profile)
+{
+    Registry& r = registry();
+    std::string key = profile.key();
+    bool check = false;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        Clock::time_point now = Clock::now();
+        if( (r.checkIntervalSecs > 0) && (now - r.lastCheck >= std::chrono::seconds(r.checkIntervalSecs)) ) {
+            r.lastCheck = now;
+            check = true;
+        }
+        auto it = r.contexts.find(key);
+        if( (it != r.contexts.end()) && ! check )
+            return it->second;
+    }
+    if( check )
+        reloadIfChanged();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto it = r.contexts.find(key);
+        if( it != r.contexts.end() )
+            return it->second;
+    }
+    TlsClientContextSPtr built = std::make_shared<TlsClientContext>(profile);
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.contexts.emplace(key, built).first->second;
+}
+
+bool TlsClientContext::reloadIfChanged()
+{
+    Registry& r = registry();
+    std::map<std::string, TlsClientContextSPtr> current;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        current = r.contexts;
+    }
+    bool replaced = false;
+    for(auto& entry : current) {
+        TlsClientContextSPtr old_ctx = entry.second;
+        if( stamp(trustStorePath(old_ctx->_profile)) == old_ctx->_stamp )
+            continue;
+        LogInfo("trust store changed, reloading: ", trustStorePath(old_ctx->_profile));
+        TlsClientContextSPtr new_ctx = std::make_shared<TlsClientContext>(old_ctx->_profile);
+        if( ! new_ctx->_trustLoaded && old_ctx->_trustLoaded ) {
+            LogWarn("new trust store did not load, keeping the old one: ", trustStorePath(old_ctx->_profile));
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.contexts[entry.first] = new_ctx;
+        replaced = true;
+    }
+    return replaced;
+}
+
+TlsClientContext::TlsClientContext(const TlsClientProfile& profile)
+    : _profile(profile), _context(ssl::context::sslv23_client), _trustLoaded(false)
+{
+    // the flexible method with everything before TLS 1.2 turned off, so TLS 1.3 is used when the server has it
+    _context.set_options(
+        ssl::context::default_workarounds
+        | ssl::context::no_sslv2
+        | ssl::context::no_sslv3
+        | ssl::context::no_tlsv1
+        | ssl::context::no_tlsv1_1
+        | ssl::context::single_dh_use
+    );
+    _context.set_verify_mode(profile.verifyPeer
+        ? (ssl::verify_peer | ssl::verify_fail_if_no_peer_cert)
+        : ssl::verify_none);
+    TlsSessionCache::enable(_context.native_handle());
+
+    // stamp before loading - a change while loading is then seen by the next check
+    _stamp = stamp(trustStorePath(profile));
+    boost::system::error_code err;
+    if( profile.caFile.empty() )
+        _context.set_default_verify_paths(err);
+    else
+        _context.load_verify_file(profile.caFile, err);
+    _trustLoaded = ! err;
+    if( err )
+        LogError("could not load trust store ", trustStorePath(profile), " ", err.message());
+
+    if( ! profile.ciphers.empty() && (SSL_CTX_set_cipher_list(_context.native_handle(), profile.ciphers.c_str()) != 1) )
+        LogError("no usable cipher in: ", profile.ciphers);
+
+    if( ! profile.alpn.empty() ) {
+        // wire format - each name preceded by its length
+        std::string wire;
+        for(const std::string& p : profile.alpn) {
+            wire.push_back((char)p.size());
+            wire += p;
+        }
+        if( SSL_CTX_set_alpn_protos(_context.native_handle(), (const unsigned char*)wire.data(), (unsigned int)wire.size()) != 0 )
+            LogError("could not set alpn protocols");
+    }
+}
+
+ssl::context& TlsClientContext::context()
+{
+    return _context;
+}
+const TlsClientProfile& TlsClientContext::profile() const
+{
+    return _profile;
+}
+bool TlsClientContext::trustLoaded() const
+{
+    return _trustLoaded;
+}
+
+/**
+* the file the trust store is loaded from - for the default verify paths the file OpenSSL
+* reads, which SSL_CERT_FILE can override
+*/
+std::string TlsClientContext::trustStorePath(const TlsClientProfile& profile)
+{
+    if( ! profile.caFile.empty() )
+        return profile.caFile;
+    const char* env = std::getenv(X509_get_default_cert_file_env());
+    return (env != nullptr) ? std::string(env) : std::string(X509_get_default_cert_file());
+}
+TlsClientContext::FileStamp TlsClientContext::stamp(const std::string& path)
+{
+    struct stat st;
+    if( ::stat(path.c_str(), &st) != 0 )
+        return FileStamp{0, -1};
+    return FileStamp{st.st_mtime, (long long)st.st_size};
+}
@@ -0,0 +1,93 @@
+//
+//  tls_client_context.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef tls_client_context_hpp
+#define tls_client_context_hpp
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ctime>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+class TlsClientContext;
+typedef std::shared_ptr<TlsClientContext> TlsClientContextSPtr;
+
+#pragma mark - TlsClientProfile
+/**
+ * The settings that go into a client ssl::context. Connections with equal profiles share
+ * one context
+ */
+struct TlsClientProfile
+{
+    TlsClientProfile();
+
+    bool                        verifyPeer;     /// verify_peer | verify_fail_if_no_peer_cert, otherwise verify_none. Defaults to true
+    std::string                 ciphers;        /// an OpenSSL cipher list, empty for the library default
+    std::vector<std::string>    alpn;           /// protocols offered with ALPN in order of preference, empty for none
+    std::string                 caFile;         /// PEM trust store, empty for the system default verify paths
+
+    /// a string that is equal for equal profiles
+    std::string key() const;
+};
+
+#pragma mark - TlsClientContext class
+/**
+ * A process wide ssl::context for upstream TLS connections, one per profile.
+ *
+ * Building a context parses the whole CA bundle, which takes milliseconds and megabytes, so
+ * it is done once and every TLSConnection with the same profile shares the result. Once built
+ * a context is never changed, which is what lets OpenSSL use it from many threads at once.
+ *
+ * When the trust store file changes (its modification time or size) a new context is built
+ * and swapped into the registry under a lock - get() hands out the new one from then on while
+ * connections already holding the old one keep it until they are done. If the new trust store
+ * cannot be loaded the old context is kept. The file is looked at, at most, once per reload
+ * check interval, from get(), or straight away by reloadIfChanged().
+ */
+class TlsClientContext
+{
+public:
+    /// the context for the default profile
+    static TlsClientContextSPtr get();
+    static TlsClientContextSPtr get(const TlsClientProfile& profile);
+
+    /// the profile get() with no argument uses, from the next call on
+    static void configSet_DefaultProfile(const TlsClientProfile& profile);
+    /// how often get() looks for a changed trust store, in seconds. 0 turns it off. Defaults to 30
+    static void configSet_ReloadCheckInterval(long secs);
+
+    /// rebuilds the context of every profile whose trust store has changed, returns true if any was
+    static bool reloadIfChanged();
+
+    /// for ssl::stream, which wants a non const reference - do not change it
+    boost::asio::ssl::context& context();
+    const TlsClientProfile& profile() const;
+    /// false if the trust store could not be loaded, no server certificate will verify
+    bool trustLoaded() const;
+
+    TlsClientContext(const TlsClientProfile& profile);
+
+private:
+    struct FileStamp
+    {
+        std::time_t     mtime;
+        long long       size;
+        bool operator==(const FileStamp& other) const;
+    };
+    static std::string trustStorePath(const TlsClientProfile& profile);
+    static FileStamp stamp(const std::string& path);
+
+    TlsClientProfile                _profile;
+    boost::asio::ssl::context       _context;
+    bool                            _trustLoaded;
+    FileStamp                       _stamp;     /// of the trust store when it was loaded
+};
+
+#endif /* tls_client_context_hpp */
@@ -28,6 +28,8 @@ RBLOGGER_SETLEVEL(LOG_LEVEL_INFO)
 #include "connection_interface.hpp"
 #include "tls_connection.hpp"
 #include <cassert>
+#include <cerrno>
+#include <sys/socket.h>
 
 using namespace boost;
 using namespace boost::asio;
@@ -48,35 +50,27 @@ TLSConnection::TLSConnection(
             )
             :
             _io(io_service),
-            _resolver(io_service),
             _scheme(scheme),
             _server(server),
             _port(port)
 {
     LogTorTrace();
-//        boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23);
-
-    _sslContextUPtr = std::unique_ptr<ssl::context>(new ssl::context(boost::asio::ssl::context::tlsv12));
-    _sslContextUPtr->set_default_verify_paths();
-    _sslContextUPtr->set_options(
-        asio::ssl::context::default_workarounds
-        | asio::ssl::context::no_sslv2
-        | asio::ssl::context::single_dh_use
-    );
-/* needed for server only
-    _sslContextUPtr->use_certificate_chain_file("server.pem");
-    _sslContextUPtr->use_private_key_file("server.pem", asio::ssl::context::pem);
-    _sslContextUPtr->use_tmp_dh_file("dh2048.pem");
-*/
+    // the context (and its trust store) is built once per profile and shared by all connections
+    _tlsContext = TlsClientContext::get();
     
     typedef ssl::stream<tcp::socket> SslSocket;
     
-    _boostSslSocketUPtr = std::unique_ptr<SslSocket>(new  SslSocket(_io, *_sslContextUPtr));
+    _boostSslSocketUPtr = std::unique_ptr<SslSocket>(new  SslSocket(_io, _tlsContext->context()));
     /*
-    * client only
+    * client only - the verify mode comes from the context
     */
-    _boostSslSocketUPtr->set_verify_mode(boost::asio::ssl::verify_peer | ssl::verify_fail_if_no_peer_cert);
     _boostSslSocketUPtr->set_verify_callback(boost::bind(&TLSConnection::verifyCertificate, this, _1, _2));
+    // SNI - servers need it to pick a certificate, and it must not be an address literal
+    boost::system::error_code addr_err;
+    boost::asio::ip::address::from_string(_server, addr_err);
+    if( addr_err )
+        SSL_set_tlsext_host_name(_boostSslSocketUPtr->native_handle(), _server.c_str());
+    _sessionKey = TlsSessionCache::key(_tlsContext->profile().key(), _server, _port);
 
 //ssl::rfc2818_verification("host.name")
 //context_.set_options(
@@ -87,8 +81,7 @@ TLSConnection::TLSConnection(
 //----------------------------------------------------------------------------
 TLSConnection::TLSConnection(
     boost::asio::io_service& io_service
-    ):   _io(io_service),
-         _resolver(io_service)
+    ):   _io(io_service)
 
 {
     LogTorTrace();
@@ -113,13 +106,48 @@ bool TLSConnection::verifyCertificate(bool preverified, boost::asio::ssl::verify
 void TLSConnection::close()
 {
     LogDebug(" fd: ", nativeSocketFD());
-    _boostSocketUPtr->cancel();
-    _boostSocketUPtr->close();
+    _boostSslSocketUPtr->lowest_layer().cancel();
+    _boostSslSocketUPtr->lowest_layer().close();
+}
+/**
+* Unlike TCPConnection the options are applied once the connect is done, so buffer sizes
+* do not affect the window scale and fast open is not used
+*/
+void TLSConnection::setSocketOptions(const SocketOptions& options)
+{
+    _socketOptions = options;
 }
 void TLSConnection::shutdown()
 {
 }
 //----------------------------------------------------------------------------
+/**
+* Bytes waiting on an idle TLS socket are not necessarily application data - a TLS 1.3 server
+* sends session tickets after the handshake, and a closing peer sends close_notify. So when the
+* raw socket has something to read it is run through the TLS engine with a non blocking read:
+* would_block means only TLS records arrived and the connection is fine, anything else (EOF,
+* close_notify or an unasked for response) means it must not be re-used
+*/
+bool TLSConnection::isAlive()
+{
+    int fd = (int)nativeSocketFD();
+    if( fd < 0 )
+        return false;
+    char c;
+    ssize_t n = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if( n < 0 )
+        return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    if( n == 0 )
+        return false;
+    tcp::socket& sock = _boostSslSocketUPtr->next_layer();
+    bool was_non_blocking = sock.non_blocking();
+    boost::system::error_code err;
+    sock.non_blocking(true, err);
+    std::size_t got = _boostSslSocketUPtr->read_some(boost::asio::buffer(&c, 1), err);
+    boost::system::error_code ignored;
+    sock.non_blocking(was_non_blocking, ignored);
+    return (got == 0) && (err == boost::asio::error::would_block);
+}
 long TLSConnection::nativeSocketFD()
 {
 //    auto x1 = _boostSslSocketUPtr.get();
@@ -162,20 +190,16 @@ void TLSConnection::asyncAccept(
 //----------------------------------------------------------------------------
 void TLSConnection::asyncConnect(ConnectCallbackType final_cb)
 {
-    tcp::resolver::query query(this->_server, _port);
     _finalCb = final_cb; // save the final callback
     
-    _resolver.async_resolve(query, [this](const boost::system::error_code& ec,
-                                          tcp::resolver::iterator endpoint_iterator){
+    ResolverCache::getInstance().asyncResolve(_io, _server, _port, [this](Marvin::ErrorType& ec, EndpointsSPtr endpoints){
         LogDebug("resolve OK","so now connect");
         if( ec ){
-            Marvin::ErrorType me = ec;
             LogError("error_value", ec.value(), " message: ", ec.message());
-            completeWithError(me);
+            completeWithError(ec);
         } else {
-            tcp::endpoint endpoint = *endpoint_iterator;
-            auto connect_cb = bind(&TLSConnection::handleConnect, this, _1, ++endpoint_iterator);
-            _boostSslSocketUPtr->lowest_layer().async_connect(endpoint, connect_cb);
+            auto connect_cb = bind(&TLSConnection::handleConnect, this, _1, endpoints, 1);
+            _boostSslSocketUPtr->lowest_layer().async_connect((*endpoints)[0], connect_cb);
             LogDebug("leaving");
         }
     });
@@ -197,9 +221,9 @@ void TLSConnection::handleResolve(
         return;
     }else{
         LogDebug("resolve OK","so now connect");
-        tcp::endpoint endpoint = *endpoint_iterator;
-        auto connect_cb = bind(&TLSConnection::handleConnect, this, _1, ++endpoint_iterator);
-        _boostSslSocketUPtr->lowest_layer().async_connect(endpoint, connect_cb);
+        EndpointsSPtr endpoints = std::make_shared<std::vector<tcp::endpoint>>(endpoint_iterator, tcp::resolver::iterator());
+        auto connect_cb = bind(&TLSConnection::handleConnect, this, _1, endpoints, 1);
+        _boostSslSocketUPtr->lowest_layer().async_connect((*endpoints)[0], connect_cb);
         LogDebug("leaving");
     }
 }
@@ -210,26 +234,29 @@ void TLSConnection::handleResolve(
 //----------------------------------------------------------------------------
 void TLSConnection::handleConnect(
                     const boost::system::error_code& err,
-                    tcp::resolver::iterator endpoint_iterator)
+                    EndpointsSPtr endpoints,
+                    std::size_t next)
 {
     LogDebug("entry");
     if (!err)
     {
         LogDebug("connect OK");
         _boostSslSocketUPtr->lowest_layer().non_blocking(true);
+        _socketOptions.apply(nativeSocketFD(), SocketOptions::Role::Upstream);
+        // offer a session from an earlier connection to the same origin
+        TlsSessionCache::getInstance().prepare(_boostSslSocketUPtr->native_handle(), &_sessionKey);
 //        completeWithSuccess();
         _boostSslSocketUPtr->async_handshake(
             boost::asio::ssl::stream_base::client,
             boost::bind(&TLSConnection::handleConnectHandshake, this, boost::asio::placeholders::error)
         );
     }
-    else if (endpoint_iterator != tcp::resolver::iterator())
+    else if (next < endpoints->size())
     {
-        LogDebug("try next iterator");
+        LogDebug("try next endpoint");
         _boostSslSocketUPtr->lowest_layer().close();
-        tcp::endpoint endpoint = *endpoint_iterator;
-        auto handler = boost::bind(&TLSConnection::handleConnect, this, _1, ++endpoint_iterator);
-        _boostSslSocketUPtr->lowest_layer().async_connect(endpoint, handler);
+        auto handler = boost::bind(&TLSConnection::handleConnect, this, _1, endpoints, next + 1);
+        _boostSslSocketUPtr->lowest_layer().async_connect((*endpoints)[next], handler);
     }
     else
     {
@@ -245,6 +272,7 @@ void TLSConnection::handleConnect(
 void TLSConnection::handleConnectHandshake(const boost::system::error_code& error)
 {
     if (!error) {
+        TlsSessionCache::getInstance().handshakeDone(_boostSslSocketUPtr->native_handle());
         completeWithSuccess();
     }else{
         LogError("resolve FAILED","Error: ",error.message());
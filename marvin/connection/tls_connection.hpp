@@ -18,6 +18,9 @@
 #include "read_socket_interface.hpp"
 #include "bufferV2.hpp"
 #include "connection_interface.hpp"
+#include "resolver_cache.hpp"
+#include "tls_client_context.hpp"
+#include "tls_session_cache.hpp"
 
 //using namespace boost;
 //using namespace boost::system;
@@ -58,8 +61,10 @@ class TLSConnection : public ConnectionInterface
     void asyncWriteStreamBuf(boost::asio::streambuf& sb, AsyncWriteCallback);
 
     void asyncRead(MBuffer& mb,  AsyncReadCallbackType cb);
+    void setSocketOptions(const SocketOptions& options);
     void shutdown();
     void close();
+    bool isAlive();
     
     long nativeSocketFD();
     
@@ -75,7 +80,8 @@ private:
     
     void handleConnect(
         const boost::system::error_code& err,
-        tcp::resolver::iterator endpoint_iterator
+        EndpointsSPtr endpoints,
+        std::size_t next
     );
     void handleConnectHandshake(const boost::system::error_code& error);
 
@@ -88,14 +94,15 @@ private:
     std::string                     _scheme;
     std::string                     _server;
     std::string                     _port;
+    std::string                     _sessionKey;    /// TlsSessionCache key, its address is held by the SSL
     io_service&                     _io;
-    tcp::resolver                   _resolver;
     
+    TlsClientContextSPtr                            _tlsContext;    /// shared, must outlive the ssl socket
     std::unique_ptr<tcp::socket>                    _boostSocketUPtr;
     std::unique_ptr<SslSocketType>                  _boostSslSocketUPtr;
-    std::unique_ptr<ssl::context>                   _sslContextUPtr;
 
     ConnectCallbackType             _finalCb;
+    SocketOptions                   _socketOptions;
 
 };
 
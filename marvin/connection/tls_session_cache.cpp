@@ -0,0 +1,187 @@
+//
+//  tls_session_cache.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+#include "tls_session_cache.hpp"
+
+static std::size_t  __maxEntries = 256;
+static std::size_t  __maxSessionsPerKey = 4;
+static long         __maxLifetimeSecs = 7200;
+
+void TlsSessionCache::configSet_MaxEntries(std::size_t n)           { __maxEntries = n; }
+void TlsSessionCache::configSet_MaxSessionsPerKey(std::size_t n)    { __maxSessionsPerKey = n; }
+void TlsSessionCache::configSet_MaxLifetime(long secs)              { __maxLifetimeSecs = secs; }
+
+double TlsSessionCache::Metrics::resumeRate() const
+{
+    std::size_t total = resumed + full;
+    return (total == 0) ? 0.0 : (double)resumed / (double)total;
+}
+
+TlsSessionCache& TlsSessionCache::getInstance()
+{
+    static TlsSessionCache __instance;
+    return __instance;
+}
+
+TlsSessionCache::TlsSessionCache() : _metrics()
+{
+}
+TlsSessionCache::~TlsSessionCache()
+{
+    clear();
+}
+
+/**
+* NO_INTERNAL_STORE - OpenSSL's own client cache is keyed by session id, which is no use for
+* finding a session for a host, so the only copies kept are the ones the callback stores
+*/
+void TlsSessionCache::enable(SSL_CTX* ctx)
+{
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &TlsSessionCache::newSessionCallback);
+}
+
+std::string TlsSessionCache::key(const std::string& profileKey, const std::string& server, const std::string& port)
+{
+    return profileKey + "|" + boost::to_lower_copy(server) + ":" + port;
+}
+
+int TlsSessionCache::exDataIndex()
+{
+    static int __index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return __index;
+}
+
+void TlsSessionCache::prepare(SSL* ssl, const std::string* key)
+{
+    SSL_set_ex_data(ssl, exDataIndex(), (void*)key);
+    SSL_SESSION* session = acquire(*key);
+    if( session != nullptr ) {
+        SSL_set_session(ssl, session);
+        SSL_SESSION_free(session);
+    }
+}
+
+void TlsSessionCache::handshakeDone(SSL* ssl)
+{
+    bool resumed = (SSL_session_reused(ssl) == 1);
+    LogDebug("resumed: ", resumed);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if( resumed )
+        _metrics.resumed++;
+    else
+        _metrics.full++;
+}
+
+/**
+* A copy is stored, not the session itself - OpenSSL marks the session of a connection that is
+* closed without a TLS shutdown as not resumable, and the last ticket received is that session.
+* Returning 0 leaves OpenSSL's reference with OpenSSL
+*/
+int TlsSessionCache::newSessionCallback(SSL* ssl, SSL_SESSION* session)
+{
+    const std::string* key = (const std::string*)SSL_get_ex_data(ssl, exDataIndex());
+    if( (key == nullptr) || ! SSL_SESSION_is_resumable(session) )
+        return 0;
+    SSL_SESSION* copy = SSL_SESSION_dup(session);
+    if( copy != nullptr )
+        getInstance().store(*key, copy);
+    return 0;
+}
+
+void TlsSessionCache::store(const std::string& key, SSL_SESSION* session)
+{
+    std::time_t now = std::time(nullptr);
+    long lifetime = std::min<long>((long)SSL_SESSION_get_timeout(session), __maxLifetimeSecs);
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry& e = _entries[key];
+    e.lastUsed = now;
+    e.sessions.push_front(Stored{session, (std::time_t)SSL_SESSION_get_time(session) + lifetime});
+    _metrics.stored++;
+    while( e.sessions.size() > __maxSessionsPerKey ) {
+        SSL_SESSION_free(e.sessions.back().session);
+        e.sessions.pop_back();
+        _metrics.evicted++;
+    }
+    evictIfFull();
+}
+
+/**
+* The newest session for key that has not expired, with a reference the caller must free.
+* A TLS 1.3 ticket is taken out of the cache, a TLS 1.2 session stays
+*/
+SSL_SESSION* TlsSessionCache::acquire(const std::string& key)
+{
+    std::time_t now = std::time(nullptr);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if( it == _entries.end() )
+        return nullptr;
+    Entry& e = it->second;
+    e.lastUsed = now;
+    SSL_SESSION* result = nullptr;
+    while( ! e.sessions.empty() && (result == nullptr) ) {
+        Stored s = e.sessions.front();
+        if( (now >= s.expires) || ! SSL_SESSION_is_resumable(s.session) ) {
+            e.sessions.pop_front();
+            SSL_SESSION_free(s.session);
+            _metrics.expired++;
+        } else if( SSL_SESSION_get_protocol_version(s.session) >= TLS1_3_VERSION ) {
+            e.sessions.pop_front();
+            result = s.session;
+        } else {
+            SSL_SESSION_up_ref(s.session);
+            result = s.session;
+        }
+    }
+    if( e.sessions.empty() )
+        _entries.erase(it);
+    if( result != nullptr )
+        _metrics.offered++;
+    return result;
+}
+
+/**
+* called with _mutex held. Drops the least recently used key
+*/
+void TlsSessionCache::evictIfFull()
+{
+    while( _entries.size() > __maxEntries ) {
+        auto oldest = _entries.begin();
+        for(auto it = _entries.begin(); it != _entries.end(); it++) {
+            if( it->second.lastUsed < oldest->second.lastUsed )
+                oldest = it;
+        }
+        for(Stored& s : oldest->second.sessions) {
+            SSL_SESSION_free(s.session);
+            _metrics.evicted++;
+        }
+        _entries.erase(oldest);
+    }
+}
+
+TlsSessionCache::Metrics TlsSessionCache::metrics()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Metrics m = _metrics;
+    m.entries = _entries.size();
+    return m;
+}
+
+void TlsSessionCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto& entry : _entries) {
+        for(Stored& s : entry.second.sessions)
+            SSL_SESSION_free(s.session);
+    }
+    _entries.clear();
+}
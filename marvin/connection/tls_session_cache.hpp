@@ -0,0 +1,105 @@
+//
+//  tls_session_cache.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/22/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef tls_session_cache_hpp
+#define tls_session_cache_hpp
+
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ctime>
+#include <openssl/ssl.h>
+
+#pragma mark - TlsSessionCache class
+/**
+ * A process wide cache of client TLS sessions so reconnects to an origin can resume instead
+ * of doing a full handshake.
+ *
+ * Sessions are stored by the new session callback of the client SSL_CTX, which OpenSSL calls
+ * when a TLS 1.2 handshake completes and, for TLS 1.3, each time a NewSessionTicket arrives
+ * after the handshake (on a later read). They are kept per key - the client context profile,
+ * server name and port - so a session made with one verify setting is never offered by a
+ * connection using another.
+ *
+ *  -   a TLS 1.3 ticket is offered once and dropped, as RFC 8446 asks, a TLS 1.2 session is
+ *      kept and offered again until it expires
+ *  -   a session expires at the timeout OpenSSL gives it (the ticket lifetime hint for 1.3)
+ *      or after the max lifetime, whichever is first
+ *  -   a few sessions are kept per key, and when there are more than the maximum number of
+ *      keys the least recently used is dropped
+ *
+ * Everything is guarded by one mutex so the cache can be used from any thread.
+ */
+class TlsSessionCache
+{
+public:
+    struct Metrics
+    {
+        std::size_t resumed;        /// handshakes that resumed a session
+        std::size_t full;           /// handshakes that did not
+        std::size_t offered;        /// handshakes a stored session was offered to
+        std::size_t stored;         /// sessions and tickets received from servers
+        std::size_t expired;        /// sessions dropped because they expired
+        std::size_t evicted;        /// sessions dropped to keep under the limits
+        std::size_t entries;        /// keys with sessions now
+        double resumeRate() const;  /// resumed / (resumed + full)
+    };
+
+    static TlsSessionCache& getInstance();
+
+    /// the most keys kept. Defaults to 256
+    static void configSet_MaxEntries(std::size_t n);
+    /// the most sessions kept for one key. Defaults to 4
+    static void configSet_MaxSessionsPerKey(std::size_t n);
+    /// no session is kept longer than this, in seconds. Defaults to 7200
+    static void configSet_MaxLifetime(long secs);
+
+    /// turns on client session caching for ctx and hooks in the new session callback
+    static void enable(SSL_CTX* ctx);
+    /// the key sessions are kept under
+    static std::string key(const std::string& profileKey, const std::string& server, const std::string& port);
+
+    /**
+     * Call before the client handshake. Offers the newest stored session for key, if there is
+     * one, and marks ssl so sessions it receives are stored under key. key must stay valid
+     * for as long as ssl is in use
+     */
+    void prepare(SSL* ssl, const std::string* key);
+    /// call once the client handshake has succeeded, it only counts resumed and full handshakes
+    void handshakeDone(SSL* ssl);
+
+    Metrics metrics();
+    void clear();
+
+private:
+    struct Stored
+    {
+        SSL_SESSION*    session;
+        std::time_t     expires;
+    };
+    struct Entry
+    {
+        std::deque<Stored>  sessions;       /// newest first
+        std::time_t         lastUsed;
+    };
+
+    TlsSessionCache();
+    ~TlsSessionCache();
+    static int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+    static int exDataIndex();
+    void store(const std::string& key, SSL_SESSION* session);
+    SSL_SESSION* acquire(const std::string& key);
+    void evictIfFull();
+
+    std::mutex                      _mutex;
+    std::map<std::string, Entry>    _entries;
+    Metrics                         _metrics;
+};
+
+#endif /* tls_session_cache_hpp */
@@ -6,27 +6,72 @@
 //  Copyright © 2016 Blackwellapps. All rights reserved.
 //
 #include <memory>
+#include <mutex>
 #include "marvin_error.hpp"
 #include "tunnel_handler.hpp"
 #include "half_tunnel.hpp"
+#include "splice_tunnel.hpp"
+
+static std::mutex               __metricsMutex;
+static TunnelHandler::Metrics   __metrics = TunnelHandler::Metrics();
+static long                     __idleTimeoutMs = 300000;
+
+void TunnelHandler::configSet_IdleTimeout(long millisecs) { __idleTimeoutMs = millisecs; }
+
+TunnelHandler::Metrics TunnelHandler::metrics()
+{
+    std::lock_guard<std::mutex> lock(__metricsMutex);
+    return __metrics;
+}
 
 TunnelHandler::TunnelHandler(
+    boost::asio::io_service&    io,
     ConnectionInterfaceSPtr     downstreamConnection,
     TCPConnectionSPtr          upstreamConnection
-)
+) : _idleTimer(io)
 {
     _downstreamConnection   = downstreamConnection;
     _upstreamConnection     = (ConnectionInterfaceSPtr)upstreamConnection;
     
-    _upstreamHalfTunnel     =  std::unique_ptr<HalfTunnel>( new HalfTunnel(_downstreamConnection, _upstreamConnection));
-    _downstreamHalfTunnel   =  std::unique_ptr<HalfTunnel>(new HalfTunnel(_upstreamConnection, _downstreamConnection ));
+    TCPConnectionSPtr downstream_tcp = std::dynamic_pointer_cast<TCPConnection>(downstreamConnection);
+    if( SpliceTunnel::isAvailable() && downstream_tcp && upstreamConnection ) {
+        _upstreamSpliceTunnel   = std::make_shared<SpliceTunnel>(io, downstream_tcp, upstreamConnection);
+        _downstreamSpliceTunnel = std::make_shared<SpliceTunnel>(io, upstreamConnection, downstream_tcp);
+        if( ! (_upstreamSpliceTunnel->open() && _downstreamSpliceTunnel->open()) ) {
+            _upstreamSpliceTunnel.reset();
+            _downstreamSpliceTunnel.reset();
+        }
+    }
+    if( ! _upstreamSpliceTunnel ) {
+        _upstreamHalfTunnel     =  std::unique_ptr<HalfTunnel>( new HalfTunnel(io, _downstreamConnection, _upstreamConnection));
+        _downstreamHalfTunnel   =  std::unique_ptr<HalfTunnel>(new HalfTunnel(io, _upstreamConnection, _downstreamConnection ));
+    }
 
     _upstreamDone = false;
     _downstreamDone = false;
     _firstErr = Marvin::make_error_ok();
+    _idleExpiring = false;
+    _finishDeferred = false;
+    _lastTraffic = Clock::now().time_since_epoch().count();
     
+    auto traffic_cb = std::bind(&TunnelHandler::noteTraffic, this);
+    if( _upstreamSpliceTunnel ) {
+        _upstreamSpliceTunnel->setTrafficCallback(traffic_cb);
+        _downstreamSpliceTunnel->setTrafficCallback(traffic_cb);
+    } else {
+        _upstreamHalfTunnel->setTrafficCallback(traffic_cb);
+        _downstreamHalfTunnel->setTrafficCallback(traffic_cb);
+    }
+}
+TunnelHandler::~TunnelHandler()
+{
+    _idleTimer.cancel();
+    if( _upstreamSpliceTunnel ) {
+        // a wait still pending keeps its tunnel alive, it must not call back into this
+        _upstreamSpliceTunnel->abandon();
+        _downstreamSpliceTunnel->abandon();
+    }
 }
-TunnelHandler::~TunnelHandler(){};
 
 void TunnelHandler::start(std::function<void(Marvin::ErrorType& err)> cb)
 {
@@ -35,26 +80,139 @@ void TunnelHandler::start(std::function<void(Marvin::ErrorType& err)> cb)
     /// start both halves, downstream first as there is not likely to be traffic that way until the upstream starts
     /// we are done when they are both done
     /// the error to record is the one that strikes first.
-    /// we done need to force close anything as the servers ro client should eventually close their end and we will ehar about it
-    _downstreamHalfTunnel->start([this](Marvin::ErrorType& err){
+    /// an EOF is passed on by the half that reads it, so the other end sees the half close and
+    /// closes its own side in time. Any other error shuts both connections down so the other half ends promptly
+    auto down_cb = std::bind(&TunnelHandler::halfDone, this, false, std::placeholders::_1);
+    auto up_cb = std::bind(&TunnelHandler::halfDone, this, true, std::placeholders::_1);
+    _lastTraffic = Clock::now().time_since_epoch().count();
+    armIdleTimer(__idleTimeoutMs);
+    if( _upstreamSpliceTunnel ) {
+        _downstreamSpliceTunnel->start(down_cb);
+        _upstreamSpliceTunnel->start(up_cb);
+    } else {
+        _downstreamHalfTunnel->start(down_cb);
+        _upstreamHalfTunnel->start(up_cb);
+    }
+}
+/**
+* the halves can end on different io threads
+*/
+void TunnelHandler::halfDone(bool upstream, Marvin::ErrorType& err)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if( upstream ) {
+        _upstreamDone = true;
+        _upstreamErr = err;
+    } else {
         _downstreamDone = true;
         _downstreamErr = err;
-        if( (_firstErr == Marvin::make_error_ok()) && (err != Marvin::make_error_ok() ) )
-            _firstErr = err;
+    }
+    if( (_firstErr == Marvin::make_error_ok()) && (err != Marvin::make_error_ok() ) )
+        _firstErr = err;
+    if( _upstreamDone && _downstreamDone ) {
+        if( _idleExpiring ) {
+            // handleIdleTimer() is still using the halves, it finishes the tunnel when done
+            _finishDeferred = true;
+            return;
+        }
+        lock.unlock();
         tryDone();
-    });
-    _upstreamHalfTunnel->start([this](Marvin::ErrorType& err){
-        _upstreamDone = true;
-        _upstreamErr = err;
-        if( (_firstErr == Marvin::make_error_ok()) && (err != Marvin::make_error_ok() ) )
-            _firstErr = err;
+    } else if( err && (err != boost::asio::error::eof) ) {
+        // copies - once unlocked the other half can finish the tunnel and it can be destroyed
+        ConnectionInterfaceSPtr downstream = _downstreamConnection;
+        ConnectionInterfaceSPtr upstream = _upstreamConnection;
+        lock.unlock();
+        downstream->shutdown();
+        upstream->shutdown();
+    }
+}
+/**
+* called by both directions on every read and write, so it only records the time - the
+* idle timer looks at it when it fires
+*/
+void TunnelHandler::noteTraffic()
+{
+    _lastTraffic.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+void TunnelHandler::armIdleTimer(long millisecs)
+{
+    if( __idleTimeoutMs <= 0 )
+        return;
+    _idleTimer.expiresIn(millisecs, std::bind(&TunnelHandler::handleIdleTimer, this));
+}
+/**
+* the idle deadline is the last traffic plus the timeout. If there has been traffic since the
+* timer was armed it is re-armed for what is left, otherwise both directions are stopped and
+* both connections shut down so anything pending ends, and the tunnel ends with a timeout.
+*
+* Stopping a direction can finish it on this thread, so while this runs halfDone() leaves
+* the tunnel's callback to it - it is called last, when nothing here is needed any more
+*/
+void TunnelHandler::handleIdleTimer()
+{
+    Clock::time_point last = Clock::time_point(Clock::duration(_lastTraffic.load(std::memory_order_relaxed)));
+    long idle_ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - last).count();
+    if( idle_ms < __idleTimeoutMs ) {
+        armIdleTimer(__idleTimeoutMs - idle_ms);
+        return;
+    }
+    Marvin::ErrorType timeout = Marvin::make_error_timeout();
+    std::unique_lock<std::mutex> lock(_mutex);
+    if( _upstreamDone && _downstreamDone )
+        return;
+    if( _firstErr == Marvin::make_error_ok() )
+        _firstErr = timeout;
+    _idleExpiring = true;
+    lock.unlock();
+
+    if( _upstreamSpliceTunnel ) {
+        _upstreamSpliceTunnel->stop(timeout);
+        _downstreamSpliceTunnel->stop(timeout);
+    } else {
+        _upstreamHalfTunnel->stop(timeout);
+        _downstreamHalfTunnel->stop(timeout);
+    }
+    _downstreamConnection->shutdown();
+    _upstreamConnection->shutdown();
+
+    lock.lock();
+    _idleExpiring = false;
+    bool finished = _finishDeferred;
+    lock.unlock();
+    if( finished )
         tryDone();
-    });
+}
+std::size_t TunnelHandler::bytesTransferred() const
+{
+    if( _upstreamSpliceTunnel )
+        return _upstreamSpliceTunnel->bytesTransferred() + _downstreamSpliceTunnel->bytesTransferred();
+    return _upstreamHalfTunnel->bytesTransferred() + _downstreamHalfTunnel->bytesTransferred();
+}
+bool TunnelHandler::spliced() const
+{
+    return _upstreamSpliceTunnel && _upstreamSpliceTunnel->spliced() && _downstreamSpliceTunnel->spliced();
 }
 void TunnelHandler::tryDone()
 {
     if( _upstreamDone && _downstreamDone )
     {
+        _idleTimer.cancel();
+        {
+            std::lock_guard<std::mutex> lock(__metricsMutex);
+            __metrics.tunnels++;
+            if( spliced() )
+                __metrics.spliced++;
+            if( _upstreamSpliceTunnel ) {
+                for(SpliceTunnel* t : {_upstreamSpliceTunnel.get(), _downstreamSpliceTunnel.get()}) {
+                    if( t->spliced() )
+                        __metrics.bytesSpliced += t->bytesTransferred();
+                    else
+                        __metrics.bytesCopied += t->bytesTransferred();
+                }
+            } else {
+                __metrics.bytesCopied += bytesTransferred();
+            }
+        }
         _callback(_firstErr);
     }
 }
@@ -11,26 +11,67 @@
 
 #include <stdio.h>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include "marvin_error.hpp"
 #include "tcp_connection.hpp"
 #include "half_tunnel.hpp"
+#include "splice_tunnel.hpp"
+#include "timing_wheel.hpp"
 
 class TunnelHandler;
 typedef std::shared_ptr<TunnelHandler> TunnelHandlerSPtr;
 typedef std::unique_ptr<TunnelHandler> TunnelHandlerUPtr;
 
+/**
+* Joins a downstream and an upstream connection until both directions have ended.
+*
+* When both ends are plain TCP and the platform has splice() the two directions are
+* SpliceTunnels so the data never comes into user space, otherwise they are HalfTunnels.
+*
+* One idle deadline covers the whole tunnel. Traffic in either direction resets it, so a
+* tunnel that only ever moves data one way (a download, a server push) stays up. When it
+* passes both directions are stopped, the connections shut down and the callback gets
+* Marvin::errc::timeout.
+*/
 class TunnelHandler
 {
     public:
+        /// process wide counts, bytes are added when a tunnel ends
+        struct Metrics
+        {
+            std::size_t tunnels;        /// tunnels ended
+            std::size_t spliced;        /// of those, ones that were spliced
+            std::size_t bytesSpliced;   /// bytes moved by splice, both directions
+            std::size_t bytesCopied;    /// bytes copied through user space, both directions
+        };
+        static Metrics metrics();
+        /**
+        * milliseconds the tunnel may go without traffic in either direction before it ends with
+        * Marvin::errc::timeout, 0 for ever. Defaults to 300000
+        */
+        static void configSet_IdleTimeout(long millisecs);
+
         TunnelHandler(
+            boost::asio::io_service& io,
             ConnectionInterfaceSPtr  downStreamConnection,
             TCPConnectionSPtr      upstreamConnection
         );
         ~TunnelHandler();
         void start(std::function<void(Marvin::ErrorType& err)> cb);
+        /// bytes moved so far, both directions
+        std::size_t bytesTransferred() const;
+        bool spliced() const;
 
     private:
+        typedef std::chrono::steady_clock Clock;
+
         void tryDone();
+        void halfDone(bool upstream, Marvin::ErrorType& err);
+        void noteTraffic();
+        void armIdleTimer(long millisecs);
+        void handleIdleTimer();
         std::function<void(Marvin::ErrorType& err)> _callback;
         ConnectionInterfaceSPtr     _downstreamConnection;
 //        TCPConnectionSPtr          _upstreamConnection;
@@ -38,12 +79,19 @@ class TunnelHandler
     
         HalfTunnelUPtr              _upstreamHalfTunnel;
         HalfTunnelUPtr              _downstreamHalfTunnel;
+        SpliceTunnelSPtr            _upstreamSpliceTunnel;
+        SpliceTunnelSPtr            _downstreamSpliceTunnel;
     
+        std::mutex                  _mutex;
         bool                        _upstreamDone;
         Marvin::ErrorType           _upstreamErr;
         bool                        _downstreamDone;
         Marvin::ErrorType           _downstreamErr;
         Marvin::ErrorType           _firstErr;
+        TimingWheel::Timer          _idleTimer;
+        std::atomic<Clock::rep>     _lastTraffic;   /// when data last moved either way, Clock ticks
+        bool                        _idleExpiring;  /// handleIdleTimer() is stopping the halves
+        bool                        _finishDeferred;/// both halves ended while it was
 };
 
 #endif /* tunnel_handler_hpp */
@@ -25,6 +25,9 @@ namespace Marvin{
             case Marvin::errc::end_of_body :
                 return "end of body";
                 break;
+            case Marvin::errc::timeout :
+                return "timed out";
+                break;
             case Marvin::errc::ok:
                 return "success";
                 break;
@@ -92,6 +95,10 @@ namespace Marvin{
         boost::system::error_code r = Marvin::errc::parser_error;
         return r;
     };
+    ErrorType make_error_timeout(){
+        boost::system::error_code r = Marvin::errc::timeout;
+        return r;
+    };
 } // namespace Marvin
 
 namespace Marvin{
@@ -101,4 +108,5 @@ namespace Error{
         ErrorType  make_eom(){ return Marvin::make_error_eom();};
         ErrorType  make_eob(){ return Marvin::make_error_eob();};
         ErrorType  make_eparse(){ return Marvin::make_error_parse();};
+        ErrorType  make_timeout(){ return Marvin::make_error_timeout();};
 }} // namespace Marvin::Error
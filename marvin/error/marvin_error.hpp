@@ -35,7 +35,8 @@ namespace Marvin{
         ok = 0,
         end_of_message = 21,
         end_of_body = 22,
-        parser_error = 23
+        parser_error = 23,
+        timeout = 24            /// a read or connection deadline passed
     };
 
     class category : public boost::system::error_category
@@ -68,6 +69,7 @@ namespace Marvin{
     ErrorType make_error_eom();
     ErrorType make_error_eob();
     ErrorType make_error_parse();
+    ErrorType make_error_timeout();
     std::string make_error_description(Marvin::ErrorType& err);
 } // namespace Marvin
 
@@ -78,6 +80,7 @@ namespace Error{
         ErrorType  make_eom();
         ErrorType  make_eob();
         ErrorType  make_eparse();
+        ErrorType  make_timeout();
 }} // namespace Marvin::Error
 
 
@@ -19,6 +19,7 @@
 #include "request.hpp"
 #include "tcp_connection.hpp"
 #include "http_header.hpp"
+#include "canned_response.hpp"
 #include "tunnel_handler.hpp"
 
 enum class ConnectAction;
@@ -73,17 +74,13 @@ template<class TCollector> class ForwardingHandlerV2 : public RequestHandlerBase
         // methods that are used in handleConnect
         ConnectAction determineConnecAction(std::string host, int port);
         void initiateTunnel();
-    
-        // utility methods
-        void response403Forbidden(MessageWriter& writer);
-        void response200OKConnected(MessageWriter& writer);
-        void response502Badgateway(MessageWriter& writer);
 
 
         /// @brief Only used by the handleConnect method
         ConnectionInterfaceSPtr     _conn;
         MessageReaderSPtr           _req;
         MessageWriterSPtr           _resp;
+        CannedResponseSPtr          _cannedResponse;    /// when set this is sent instead of _resp
         RequestUPtr                 _upStreamRequestUPtr;
         HandlerDoneCallbackType     _doneCallback;
         /// this will collect summaries of the req and resp
@@ -93,7 +90,6 @@ template<class TCollector> class ForwardingHandlerV2 : public RequestHandlerBase
         TCollector*                 _collector;
     
         /// used for handleConnect - tunnel
-        MBufferUPtr                 _initialResponseBuf;
         TunnelHandlerSPtr           _tunnelHandler;
         ConnectionInterfaceSPtr     _downStreamConnection; // used only for tunnel
         TCPConnectionSPtr          _upstreamConnection; // used only for tunnels
@@ -47,11 +47,7 @@ template<class TCollector>
 void ForwardingHandlerV2<TCollector>::handleUpgrade()
 {
     // deny the upgrade
-    _resp->setStatus("Forbidden");
-    _resp->setStatusCode(403);
-    std::string n("");
-    _resp->setContent(n);
-    _resp->asyncWrite([this](Marvin::ErrorType& err){
+    _resp->asyncWrite(CannedResponse::get(CannedResponse::Id::Forbidden), [this](Marvin::ErrorType& err){
         _doneCallback(err, false);
     });
 }
@@ -83,7 +79,6 @@ void ForwardingHandlerV2<TCollector>::handleConnect(
     _req = req;
     _downStreamConnection  = connPtr;
     _doneCallback = done;
-    _initialResponseBuf = std::unique_ptr<MBuffer>(new MBuffer(1000));
     int x = 2;
     //
     // Parse the url to determine were we have to send the "upstream" request
@@ -122,9 +117,8 @@ template<class TCollector>
 void ForwardingHandlerV2<TCollector>::initiateTunnel()
 {
     // first lets try and connect to the upstream host
-    // to do that we need an upstream connection
-    _resp = std::shared_ptr<MessageWriter>(new MessageWriter(_io, false));
-    _resp->setWriteSock(_downStreamConnection.get());
+    // to do that we need an upstream connection.
+    // The reply to the client is a canned response written straight to the connection
     
     LogInfo("scheme:", _scheme, " host:", _host, " port:", _port);
     _upstreamConnection =
@@ -133,8 +127,8 @@ void ForwardingHandlerV2<TCollector>::initiateTunnel()
     _upstreamConnection->asyncConnect([this](Marvin::ErrorType& err, ConnectionInterface* conn){
         if( err ){
             LogWarn("initiateTunnel: FAILED scheme:", this->_scheme, " host:", this->_host, " port:", this->_port);
-            response502Badgateway(*_resp);
-            _resp->asyncWrite([this](Marvin::ErrorType& err){
+            BufferChainSPtr reply = CannedResponse::get(CannedResponse::Id::BadGateway)->render();
+            _downStreamConnection->asyncWrite(reply, [this](Marvin::ErrorType& err, std::size_t bytes_transfered){
                 LogInfo("");
                 if( err ){
                     LogWarn("error: ", err.value(), err.category().name(), err.category().message(err.value()));
@@ -147,8 +141,8 @@ void ForwardingHandlerV2<TCollector>::initiateTunnel()
                 }
             });
         }else{
-            response200OKConnected(*_resp);
-            _resp->asyncWrite([this](Marvin::ErrorType& err){
+            BufferChainSPtr reply = CannedResponse::get(CannedResponse::Id::ConnectOK)->render();
+            _downStreamConnection->asyncWrite(reply, [this](Marvin::ErrorType& err, std::size_t bytes_transfered){
                 LogInfo("");
                 if( err ){
                     LogWarn("error: ", err.value(), err.category().name(), err.category().message(err.value()));
@@ -156,7 +150,7 @@ void ForwardingHandlerV2<TCollector>::initiateTunnel()
                     auto pf = std::bind(_doneCallback, err, false);
                     _io.post(pf);
                 }else{
-                    _tunnelHandler = std::shared_ptr<TunnelHandler>(new TunnelHandler(_downStreamConnection, _upstreamConnection));
+                    _tunnelHandler = std::shared_ptr<TunnelHandler>(new TunnelHandler(_io, _downStreamConnection, _upstreamConnection));
                     _tunnelHandler->start([this](Marvin::ErrorType& err){
                         _doneCallback(err, false);
                     });
@@ -185,6 +179,7 @@ void ForwardingHandlerV2<TCollector>::handleRequest(
     LogInfo("");
     _req = req;
     _resp = resp;
+    _cannedResponse = nullptr;
     _doneCallback = done;
     _collector = TCollector::getInstance(_io);
     handleRequest_Upstream(req, [this, req, resp](Marvin::ErrorType& err){
@@ -193,7 +188,7 @@ void ForwardingHandlerV2<TCollector>::handleRequest(
 
         _collector->collect(_scheme, _host, _req, _resp);
 
-        _resp->asyncWrite([this](Marvin::ErrorType& err){
+        auto onWritten = [this](Marvin::ErrorType& err){
             LogInfo("");
             if( err ){
                 LogWarn("error: ", err.value(), err.category().name(), err.category().message(err.value()));
@@ -204,7 +199,11 @@ void ForwardingHandlerV2<TCollector>::handleRequest(
                 auto pf = std::bind(_doneCallback, err, true);
                 _io.post(pf);
             }
-        });
+        };
+        if( _cannedResponse != nullptr )
+            _resp->asyncWrite(_cannedResponse, onWritten);
+        else
+            _resp->asyncWrite(onWritten);
 
     });
 }
@@ -246,24 +245,22 @@ void ForwardingHandlerV2<TCollector>::handleRequest_Upstream(
     // copy the headers
     // should also test for manditory Host header
     //
-    auto hdrs = _req->getHeaders();
+    HeaderTable& hdrs = _req->headers();
 
-    HttpHeaderFilterSetType dontCopyList{
-        HttpHeader::Name::Host,
-        HttpHeader::Name::ProxyConnection,
-        HttpHeader::Name::Connection
+    static const HttpHeader::IdSet dontCopyList{
+        HttpHeader::Id::Host,
+        HttpHeader::Id::ProxyConnection,
+        HttpHeader::Id::Connection
     };
     
-    HttpHeader::filterNotInList(hdrs, dontCopyList, [this]( HttpHeadersType& hdrs,
-                                                        std::string k,
-                                                         std::string v)
+    hdrs.forEachNotIn(dontCopyList, [this, &hdrs](std::size_t i)
     {
-        this->_upStreamRequestUPtr->setHeader(k,v);
+        this->_upStreamRequestUPtr->addHeader(hdrs.nameData(i), hdrs.nameLength(i), hdrs.valueData(i), hdrs.valueLength(i));
     });
     // set the uri and host header
     _upStreamRequestUPtr->setUrl(_req->uri());
-    // no keep alive
-    _upStreamRequestUPtr->setHeader("Connection", "close");
+    // keep the upstream connection alive, Request::end() gives it back to the ConnectionPool
+    _upStreamRequestUPtr->setHeader(HttpHeader::Id::Connection, "keep-alive");
     _upStreamRequestUPtr->setHeader("Accept-encoding", "identity");
     // Http versions defaults to 1.1, so force it to the same as the request
     _upStreamRequestUPtr->setHttpVersMinor(_req->httpVersMinor());
@@ -297,24 +294,22 @@ template<class TCollector>
 void ForwardingHandlerV2<TCollector>::makeDownstreamResponse()
 {
     LogInfo("");
-    MessageReader& upStreamResponse = _upStreamRequestUPtr->getResponse();
+    MessageReaderV2& upStreamResponse = _upStreamRequestUPtr->getResponse();
     LogTrace("got from server ", traceReader(upStreamResponse));
     
     // copy the headers
-    auto hdrs = upStreamResponse.getHeaders();
-    HttpHeaderFilterSetType dontCopyList{
-        HttpHeader::Name::Host,
-        HttpHeader::Name::ProxyConnection,
-        HttpHeader::Name::Connection,
-        HttpHeader::Name::TransferEncoding,
-        HttpHeader::Name::ETag
+    HeaderTable& hdrs = upStreamResponse.headers();
+    static const HttpHeader::IdSet dontCopyList{
+        HttpHeader::Id::Host,
+        HttpHeader::Id::ProxyConnection,
+        HttpHeader::Id::Connection,
+        HttpHeader::Id::TransferEncoding,
+        HttpHeader::Id::ETag
     };
     
-    HttpHeader::filterNotInList(hdrs, dontCopyList, [this]( HttpHeadersType& hdrs,
-                                                        std::string k,
-                                                         std::string v)
+    hdrs.forEachNotIn(dontCopyList, [this, &hdrs](std::size_t i)
     {
-        this->_resp->setHeader(k,v);
+        this->_resp->addHeader(hdrs.nameData(i), hdrs.nameLength(i), hdrs.valueData(i), hdrs.valueLength(i));
     });
 
     // set the uri and host header
@@ -324,12 +319,13 @@ void ForwardingHandlerV2<TCollector>::makeDownstreamResponse()
     _resp->setHeader("Connection", "close");
     // Http versions defaults to 1.1, so force it to the same as the request
     _resp->setHttpVersMinor(upStreamResponse.httpVersMinor());
-    // now attach the body
-    
-    std::size_t len;
-    if( (len = upStreamResponse.getBody().size()) > 0){
-        _resp->setContent(upStreamResponse.getBody());
-        _resp->setHeader("Content-length", std::to_string(len));
+    // now attach the body - a body the reader spilled to disk is passed on as the file
+    BodyFileSPtr body_file = upStreamResponse.get_body_file();
+    if( body_file != nullptr ){
+        _resp->setContent(body_file);
+    } else if( upStreamResponse.get_body_chain()->size() > 0 ){
+        std::string body = upStreamResponse.get_body_chain()->to_string();
+        _resp->setContent(body);
     }
 }
 
@@ -337,11 +333,11 @@ template<class TCollector>
 void ForwardingHandlerV2<TCollector>::makeDownstreamErrorResponse(Marvin::ErrorType& err)
 {
     LogDebug("");
-    // bad gateway 502
-    _resp->setStatus("Bad gateway");
-    _resp->setStatusCode(501);
-    std::string n("");
-    _resp->setContent(n);
+    // bad gateway 502 - the status is set so the collector sees it, the
+    // bytes sent are the canned response
+    _resp->setStatus("Bad Gateway");
+    _resp->setStatusCode(502);
+    _cannedResponse = CannedResponse::get(CannedResponse::Id::BadGateway);
 }
 template<class TCollector>
 void ForwardingHandlerV2<TCollector>::onComplete(Marvin::ErrorType& err)
@@ -367,29 +363,3 @@ ConnectAction ForwardingHandlerV2<TCollector>::determineConnecAction(std::string
     /// !!! this needs to be upgraded
     return ConnectAction::TUNNEL;
 }
-
-
-template<class TCollector>
-void ForwardingHandlerV2<TCollector>::response403Forbidden(MessageWriter& writer)
-{
-    writer.setStatus("Forbidden");
-    writer.setStatusCode(403);
-    std::string n("");
-    writer.setContent(n);
-}
-template<class TCollector>
-void ForwardingHandlerV2<TCollector>::response200OKConnected(MessageWriter& writer)
-{
-    writer.setStatus("OK");
-    writer.setStatusCode(200);
-    std::string n("");
-    writer.setContent(n);
-}
-template<class TCollector>
-void ForwardingHandlerV2<TCollector>::response502Badgateway(MessageWriter& writer)
-{
-    writer.setStatus("BAD GATEWAY");
-    writer.setStatusCode(503);
-    std::string n("");
-    writer.setContent(n);
-}
@@ -13,6 +13,8 @@
 #include "callback_typedefs.hpp"
 #include "read_socket_interface.hpp"
 #include "bufferV2.hpp"
+#include "body_file.hpp"
+#include "socket_options.hpp"
 #include "connection_interface.hpp"
 
 using namespace boost;
@@ -65,7 +67,7 @@ class ConnectionInterface : public ReadSocketInterface, public WriteSocketInterf
 //    
 //#endif
 //#if 0
-////    virtual ~ConnectionInterface()=0;
+    virtual ~ConnectionInterface() {}
 //
     virtual void asyncConnect(ConnectCallbackType cb) = 0;
     virtual void asyncAccept(
@@ -77,10 +79,26 @@ class ConnectionInterface : public ReadSocketInterface, public WriteSocketInterf
     virtual void asyncWrite(std::string& str, AsyncWriteCallbackType cb) = 0;
     virtual void asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb) = 0;
     virtual void asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback) = 0;
+    virtual void asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb) = 0;
 //
 //    virtual void asyncRead(MBuffer& mb,  AsyncReadCallbackType cb) = 0;
+    /**
+     * the socket options to use for an outgoing connection, must be called before asyncConnect
+     */
+    virtual void setSocketOptions(const SocketOptions& options) = 0;
     virtual void shutdown() = 0;
+    /**
+     * ends the sending direction only, the peer reads EOF once what has been written has
+     * arrived. Does nothing for connections that can not half close
+     */
+    virtual void shutdownSend() {}
     virtual void close() = 0;
+    /**
+     * true if an idle connection can be re-used - the peer has not closed it and nothing
+     * has arrived that was not asked for. Must not be called while a read is in progress.
+     * Connections that can not tell are never re-used
+     */
+    virtual bool isAlive() { return false; }
 //
     virtual long nativeSocketFD() = 0;
 //
@@ -76,19 +76,17 @@ void ForwardingHandler<TCollector>::handleRequest(
     // copy the headers
     // should also test for manditory Host header
     //
-    auto hdrs = _req->getHeaders();
+    HeaderTable& hdrs = _req->headers();
 
-    HttpHeaderFilterSetType dontCopyList{
-        HttpHeader::Name::Host,
-        HttpHeader::Name::ProxyConnection,
-        HttpHeader::Name::Connection
+    static const HttpHeader::IdSet dontCopyList{
+        HttpHeader::Id::Host,
+        HttpHeader::Id::ProxyConnection,
+        HttpHeader::Id::Connection
     };
     
-    HttpHeader::filterNotInList(hdrs, dontCopyList, [this]( HttpHeadersType& hdrs,
-                                                        std::string k,
-                                                         std::string v)
+    hdrs.forEachNotIn(dontCopyList, [this, &hdrs](std::size_t i)
     {
-        this->_upStreamRequestUPtr->setHeader(k,v);
+        this->_upStreamRequestUPtr->addHeader(hdrs.nameData(i), hdrs.nameLength(i), hdrs.valueData(i), hdrs.valueLength(i));
     });
     // set the uri and host header
     _upStreamRequestUPtr->setUrl(_req->uri());
@@ -135,20 +133,18 @@ void ForwardingHandler<TCollector>::makeDownstreamResponse()
     LogTrace("got from server ", traceReader(upStreamResponse));
     
     // copy the headers
-    auto hdrs = upStreamResponse.getHeaders();
-    HttpHeaderFilterSetType dontCopyList{
-        HttpHeader::Name::Host,
-        HttpHeader::Name::ProxyConnection,
-        HttpHeader::Name::Connection,
-        HttpHeader::Name::TransferEncoding,
-        HttpHeader::Name::ETag
+    HeaderTable& hdrs = upStreamResponse.headers();
+    static const HttpHeader::IdSet dontCopyList{
+        HttpHeader::Id::Host,
+        HttpHeader::Id::ProxyConnection,
+        HttpHeader::Id::Connection,
+        HttpHeader::Id::TransferEncoding,
+        HttpHeader::Id::ETag
     };
     
-    HttpHeader::filterNotInList(hdrs, dontCopyList, [this]( HttpHeadersType& hdrs,
-                                                        std::string k,
-                                                         std::string v)
+    hdrs.forEachNotIn(dontCopyList, [this, &hdrs](std::size_t i)
     {
-        this->_resp->setHeader(k,v);
+        this->_resp->addHeader(hdrs.nameData(i), hdrs.nameLength(i), hdrs.valueData(i), hdrs.valueLength(i));
     });
 
     // set the uri and host header
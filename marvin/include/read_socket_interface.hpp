@@ -9,6 +9,7 @@
 #ifndef read_socket_interface_h
 #define read_socket_interface_h
 #include "bufferV2.hpp"
+#include "body_file.hpp"
 #include "marvin_error.hpp"
 #include "callback_typedefs.hpp"
 
@@ -22,6 +23,13 @@ class ReadSocketInterface{
 public:
     virtual void asyncRead(MBuffer& mb, AsyncReadCallback cb) = 0;
     virtual long nativeSocketFD() = 0;
+    /**
+    * Reads still pending the given milliseconds from now, and reads started after that, end with
+    * Marvin::errc::timeout. Replaces the previous deadline, 0 clears it. Set it once before
+    * a run of reads for a deadline over all of them, or before each read for an idle timeout.
+    * Sockets without timers ignore it
+    */
+    virtual void setReadDeadline(long) {}
 
 };
 
@@ -37,5 +45,12 @@ public:
     virtual void asyncWrite(BufferChainSPtr chain_sptr, AsyncWriteCallback) = 0;
     virtual void asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb) = 0;
     virtual void asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback) = 0;
+    virtual void asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb) = 0;
+    /**
+    * Writes still pending the given milliseconds from now, and writes started after that, end with
+    * Marvin::errc::timeout. Replaces the previous deadline, 0 clears it. Sockets without
+    * timers ignore it
+    */
+    virtual void setWriteDeadline(long) {}
 };
 #endif /* read_socket_interface_h */
@@ -0,0 +1,98 @@
+//
+//  canned_response.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/20/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cassert>
+#include <array>
+#include "canned_response.hpp"
+
+const std::string CannedResponse::kSlot = "{}";
+
+static CannedResponseSPtr makeResponse(int status_code, std::string status, bool connect)
+{
+    MessageBase msg;
+    msg.setIsRequest(false);
+    msg.setStatusCode(status_code);
+    msg.setStatus(status);
+    if( ! connect ) {
+        // a 2xx to a CONNECT must not have a Content-Length, the tunnel starts after the headers
+        msg.setHeader(HttpHeader::Id::ContentLength, "0");
+        msg.setHeader(HttpHeader::Id::Connection, "close");
+    }
+    return std::make_shared<CannedResponse>(msg);
+}
+
+static std::array<CannedResponseSPtr, CannedResponse::kIdCount>& registry()
+{
+    static std::array<CannedResponseSPtr, CannedResponse::kIdCount> __registry = {{
+        makeResponse(200, "OK", true),
+        makeResponse(403, "Forbidden", false),
+        makeResponse(502, "Bad Gateway", false)
+    }};
+    return __registry;
+}
+
+CannedResponseSPtr CannedResponse::get(Id id)
+{
+    return registry()[(std::size_t)id];
+}
+
+void CannedResponse::configSet_Response(Id id, CannedResponseSPtr response)
+{
+    assert(response != nullptr);
+    registry()[(std::size_t)id] = response;
+}
+
+/**
+* Serializes the message, then takes each slot marker out of the bytes and remembers where it was
+*/
+CannedResponse::CannedResponse(MessageBase msg, const std::string& body)
+{
+    MBufferSPtr head = serializeHeaders(msg);
+    std::string text = head->toString();
+    const std::string marker = ": " + kSlot + "\r\n";
+    std::size_t pos = 0;
+    while( (pos = text.find(marker, pos)) != std::string::npos ) {
+        pos += 2;
+        text.erase(pos, kSlot.size());
+        _slotOffsets.push_back(pos);
+    }
+    text += body;
+    _bytes = m_buffer(text);
+}
+
+BufferChainSPtr CannedResponse::render(const std::vector<std::string>& values) const
+{
+    assert( values.size() == _slotOffsets.size() );
+    BufferChainSPtr chain_sptr = std::make_shared<BufferChain>();
+    char* base = (char*)_bytes->data();
+    if( _slotOffsets.empty() ) {
+        chain_sptr->push_back(_bytes);
+        return chain_sptr;
+    }
+    std::size_t values_size = 0;
+    for(const std::string& v : values)
+        values_size += v.size();
+    MBufferSPtr values_mb = m_buffer(values_size > 0 ? values_size : 1);
+    std::size_t offset = 0;
+    for(std::size_t i = 0; i < _slotOffsets.size(); i++) {
+        std::size_t start = (i == 0) ? 0 : _slotOffsets[i - 1];
+        chain_sptr->push_back(buffer_slice(_bytes, base + start, _slotOffsets[i] - start));
+        if( values[i].size() > 0 ) {
+            char* v = (char*)values_mb->nextAvailable();
+            values_mb->append((void*)values[i].data(), values[i].size());
+            chain_sptr->push_back(buffer_slice(values_mb, v, values[i].size()));
+        }
+        offset = _slotOffsets[i];
+    }
+    chain_sptr->push_back(buffer_slice(_bytes, base + offset, _bytes->size() - offset));
+    return chain_sptr;
+}
+
+std::string CannedResponse::str(const std::vector<std::string>& values) const
+{
+    return render(values)->to_string();
+}
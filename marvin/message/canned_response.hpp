@@ -0,0 +1,83 @@
+//
+//  canned_response.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/20/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef canned_response_hpp
+#define canned_response_hpp
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "bufferV2.hpp"
+#include "message.hpp"
+
+class CannedResponse;
+typedef std::shared_ptr<CannedResponse> CannedResponseSPtr;
+
+#pragma mark - CannedResponse class
+/**
+ * A complete response (first line, headers and a small body) serialized once and kept as an
+ * immutable block of bytes, for the fixed replies that are sent over and over again - the 200
+ * that opens a tunnel, a 403, a 502.
+ *
+ * Sending one is a single write of slices of the shared block, nothing is formatted or copied.
+ *
+ * A header whose value is exactly CannedResponse::kSlot is a slot - a hole in the bytes that
+ * is filled in by render() each time the response is sent. Slots are numbered in the order
+ * the headers appear. This is for the few per connection values such as the
+ * Connect-Handler-Id header, only the values themselves are copied.
+ *
+ * The built in responses are made on first use and can be replaced with configSet_Response()
+ * before the server starts. After that the registry and every CannedResponse are read only and
+ * can be shared by all threads.
+ */
+class CannedResponse
+{
+public:
+    enum class Id {
+        ConnectOK = 0,  /// 200 to a CONNECT that opened a tunnel
+        Forbidden,      /// 403 with an empty body
+        BadGateway      /// 502 with an empty body, the upstream could not be reached
+    };
+    static const std::size_t    kIdCount = 3;
+    static const std::string    kSlot;
+
+    /**
+     * the registered response for id
+     */
+    static CannedResponseSPtr get(Id id);
+    /**
+     * Replaces the registered response for id - only call this before the server starts
+     */
+    static void configSet_Response(Id id, CannedResponseSPtr response);
+
+    /**
+     * Serializes msg with body as its body. Sets no headers itself, so msg should say
+     * Content-Length (or Connection: close) when that is needed
+     */
+    CannedResponse(MessageBase msg, const std::string& body = "");
+
+    /// the number of slots
+    std::size_t slots() const { return _slotOffsets.size(); }
+    /// the size of the response with every slot empty
+    std::size_t size() const { return _bytes->size(); }
+
+    /**
+     * The response ready for a gathered write, values[i] goes in slot i. With no slots the
+     * chain is a single slice of the shared bytes
+     */
+    BufferChainSPtr render(const std::vector<std::string>& values = std::vector<std::string>()) const;
+
+    /// the response as a string - for logging and testing
+    std::string str(const std::vector<std::string>& values = std::vector<std::string>()) const;
+
+private:
+    MBufferSPtr                 _bytes;
+    std::vector<std::size_t>    _slotOffsets;
+};
+
+#endif /* canned_response_hpp */
@@ -0,0 +1,165 @@
+//
+//  header_table.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/19/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cstring>
+#include <algorithm>
+#include "header_table.hpp"
+
+using HttpHeader::Id;
+
+HeaderTable::HeaderTable()
+{
+    std::memset(_first, 0, sizeof(_first));
+}
+
+void HeaderTable::clear()
+{
+    _entries.clear();
+    _bytes.clear();
+    std::memset(_first, 0, sizeof(_first));
+}
+
+void HeaderTable::add(const char* name, std::size_t name_length, const char* value, std::size_t value_length)
+{
+    Entry e;
+    e.id = HttpHeader::idOf(name, name_length);
+    e.name_offset = (std::uint32_t)_bytes.size();
+    e.name_length = (std::uint32_t)name_length;
+    _bytes.append(name, name_length);
+    e.value_offset = (std::uint32_t)_bytes.size();
+    e.value_length = (std::uint32_t)value_length;
+    _bytes.append(value, value_length);
+    _entries.push_back(e);
+    if( (e.id != Id::Unknown) && (_first[(std::size_t)e.id] == 0) )
+        _first[(std::size_t)e.id] = (std::uint32_t)_entries.size();
+}
+
+void HeaderTable::add(const std::string& name, const std::string& value)
+{
+    add(name.data(), name.size(), value.data(), value.size());
+}
+
+void HeaderTable::set(const std::string& name, const std::string& value)
+{
+    remove(name);
+    add(name, value);
+}
+
+void HeaderTable::set(Id id, const std::string& value)
+{
+    remove(id);
+    const char* name = HttpHeader::nameOf(id);
+    add(name, std::strlen(name), value.data(), value.size());
+}
+
+std::size_t HeaderTable::find(Id id) const
+{
+    if( id == Id::Unknown )
+        return npos;
+    std::uint32_t f = _first[(std::size_t)id];
+    return (f == 0) ? npos : (std::size_t)(f - 1);
+}
+
+std::size_t HeaderTable::find(const char* name, std::size_t name_length) const
+{
+    Id id = HttpHeader::idOf(name, name_length);
+    if( id != Id::Unknown )
+        return find(id);
+    for(std::size_t i = 0; i < _entries.size(); i++) {
+        if( matches(i, id, name, name_length) )
+            return i;
+    }
+    return npos;
+}
+
+std::size_t HeaderTable::count(const std::string& name) const
+{
+    Id id = HttpHeader::idOf(name);
+    std::size_t n = 0;
+    for(std::size_t i = 0; i < _entries.size(); i++) {
+        if( matches(i, id, name.data(), name.size()) )
+            n++;
+    }
+    return n;
+}
+
+void HeaderTable::remove(Id id)
+{
+    if( find(id) == npos )
+        return;
+    _entries.erase(std::remove_if(_entries.begin(), _entries.end(), [id](const Entry& e) {
+        return e.id == id;
+    }), _entries.end());
+    reindex();
+}
+
+void HeaderTable::remove(const std::string& name)
+{
+    Id id = HttpHeader::idOf(name);
+    if( id != Id::Unknown ) {
+        remove(id);
+        return;
+    }
+    std::size_t n = 0;
+    for(std::size_t i = 0; i < _entries.size(); i++) {
+        if( ! matches(i, id, name.data(), name.size()) )
+            _entries[n++] = _entries[i];
+    }
+    if( n == _entries.size() )
+        return;
+    _entries.resize(n);
+    reindex();
+}
+
+std::vector<std::string> HeaderTable::values(const std::string& name) const
+{
+    std::vector<std::string> result;
+    Id id = HttpHeader::idOf(name);
+    for(std::size_t i = 0; i < _entries.size(); i++) {
+        if( matches(i, id, name.data(), name.size()) )
+            result.push_back(value(i));
+    }
+    return result;
+}
+
+std::string HeaderTable::joinedValues(std::size_t first) const
+{
+    std::string result = value(first);
+    if( _entries[first].id == Id::SetCookie )
+        return result;
+    for(std::size_t i = first + 1; i < _entries.size(); i++) {
+        if( matches(i, _entries[first].id, nameData(first), nameLength(first)) ) {
+            result += ", ";
+            result.append(valueData(i), valueLength(i));
+        }
+    }
+    return result;
+}
+
+/**
+* does entry i have the given name - id must be idOf(name)
+*/
+bool HeaderTable::matches(std::size_t i, Id id, const char* name, std::size_t name_length) const
+{
+    const Entry& e = _entries[i];
+    if( e.id != id )
+        return false;
+    if( id != Id::Unknown )
+        return true;
+    return (e.name_length == name_length)
+        && HttpHeader::detail::equalsIgnoreCase(_bytes.data() + e.name_offset, name, name_length);
+}
+
+void HeaderTable::reindex()
+{
+    std::memset(_first, 0, sizeof(_first));
+    for(std::size_t i = _entries.size(); i > 0; i--) {
+        Id id = _entries[i - 1].id;
+        if( id != Id::Unknown )
+            _first[(std::size_t)id] = (std::uint32_t)i;
+    }
+}
@@ -0,0 +1,298 @@
+//
+//  header_table.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/19/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef header_table_hpp
+#define header_table_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <boost/container/small_vector.hpp>
+
+namespace HttpHeader
+{
+    /**
+     * Compile time ids for the header names the library looks at. Any other name is Unknown.
+     * The spelling of each id, in the case normally seen on the wire, is in kIdNames.
+     */
+    enum class Id : std::uint8_t {
+        Unknown = 0,
+        Host,
+        Connection,
+        ContentLength,
+        ContentType,
+        AcceptEncoding,
+        ProxyConnection,
+        TransferEncoding,
+        ETag,
+        ConnectionHandlerId,
+        Upgrade,
+        KeepAlive,
+        ProxyAuthorization,
+        Authorization,
+        TE,
+        Trailer,
+        SetCookie,
+        Cookie,
+        Date,
+        Server,
+        Location,
+        Accept,
+        UserAgent,
+        CacheControl,
+        ContentEncoding,
+        Expect,
+        Via,
+        Vary,
+        LastModified,
+        IfNoneMatch,
+        IfModifiedSince,
+        Referer,
+        AcceptLanguage
+    };
+    constexpr std::size_t kIdCount = 33;
+
+    constexpr const char* kIdNames[kIdCount] = {
+        "",
+        "Host",
+        "Connection",
+        "Content-Length",
+        "Content-Type",
+        "Accept-Encoding",
+        "Proxy-Connection",
+        "Transfer-Encoding",
+        "ETag",
+        "Connect-Handler-Id",
+        "Upgrade",
+        "Keep-Alive",
+        "Proxy-Authorization",
+        "Authorization",
+        "TE",
+        "Trailer",
+        "Set-Cookie",
+        "Cookie",
+        "Date",
+        "Server",
+        "Location",
+        "Accept",
+        "User-Agent",
+        "Cache-Control",
+        "Content-Encoding",
+        "Expect",
+        "Via",
+        "Vary",
+        "Last-Modified",
+        "If-None-Match",
+        "If-Modified-Since",
+        "Referer",
+        "Accept-Language"
+    };
+
+    namespace detail
+    {
+        constexpr char lower(char c)
+        {
+            return ((c >= 'A') && (c <= 'Z')) ? (char)(c - 'A' + 'a') : c;
+        }
+        constexpr std::size_t length(const char* s)
+        {
+            std::size_t n = 0;
+            while( s[n] != '\0' ) n++;
+            return n;
+        }
+        constexpr bool equalsIgnoreCase(const char* a, const char* b, std::size_t n)
+        {
+            for(std::size_t i = 0; i < n; i++) {
+                if( lower(a[i]) != lower(b[i]) )
+                    return false;
+            }
+            return true;
+        }
+        /**
+         * Case insensitive FNV-1a. The seed was found by search so that the top 6 bits
+         * are different for every name in kIdNames - a perfect hash into 64 slots.
+         * Adding a name to Id means searching for a new seed, the static_assert below
+         * will fail until that is done.
+         */
+        constexpr std::uint32_t kHashSeed = 10485;
+        constexpr std::size_t   kSlotBits = 6;
+        constexpr std::size_t slotOf(const char* s, std::size_t n)
+        {
+            std::uint32_t x = kHashSeed;
+            for(std::size_t i = 0; i < n; i++) {
+                x ^= (std::uint32_t)(unsigned char)lower(s[i]);
+                x *= 16777619u;
+            }
+            return (std::size_t)(x >> (32 - kSlotBits));
+        }
+        struct SlotTable
+        {
+            Id              slots[1 << kSlotBits];
+            std::uint8_t    lengths[kIdCount];
+            constexpr SlotTable() : slots{}, lengths{}
+            {
+                for(std::size_t i = 1; i < kIdCount; i++) {
+                    lengths[i] = (std::uint8_t)length(kIdNames[i]);
+                    slots[slotOf(kIdNames[i], lengths[i])] = (Id)i;
+                }
+            }
+        };
+        constexpr SlotTable kSlotTable{};
+    }
+
+    /**
+     * Maps a header name, in any case, to its Id. One hash and one compare, no allocation
+     */
+    constexpr Id idOf(const char* name, std::size_t length)
+    {
+        const Id id = detail::kSlotTable.slots[detail::slotOf(name, length)];
+        const std::size_t i = (std::size_t)id;
+        return ( (id != Id::Unknown)
+                && (detail::kSlotTable.lengths[i] == length)
+                && detail::equalsIgnoreCase(kIdNames[i], name, length) ) ? id : Id::Unknown;
+    }
+    inline Id idOf(const std::string& name)
+    {
+        return idOf(name.data(), name.size());
+    }
+    /// the canonical spelling of a well known name
+    inline const char* nameOf(Id id)
+    {
+        return kIdNames[(std::size_t)id];
+    }
+
+    namespace detail
+    {
+        constexpr bool allIdsDistinct()
+        {
+            for(std::size_t i = 1; i < kIdCount; i++) {
+                if( idOf(kIdNames[i], length(kIdNames[i])) != (Id)i )
+                    return false;
+            }
+            return true;
+        }
+        static_assert(allIdsDistinct(), "HttpHeader::kHashSeed no longer gives a perfect hash for kIdNames");
+    }
+
+    /**
+     * A set of well known header ids, a single 64 bit word
+     */
+    class IdSet
+    {
+    public:
+        constexpr IdSet() : _bits(0) {}
+        constexpr IdSet(std::initializer_list<Id> ids) : _bits(0)
+        {
+            for(Id id : ids)
+                _bits |= bit(id);
+        }
+        constexpr bool contains(Id id) const { return (id != Id::Unknown) && ((_bits & bit(id)) != 0); }
+        void insert(Id id) { _bits |= bit(id); }
+    private:
+        static constexpr std::uint64_t bit(Id id) { return ((std::uint64_t)1) << (std::size_t)id; }
+        std::uint64_t _bits;
+    };
+}
+
+#pragma mark - HeaderTable class
+/**
+ * The headers (or trailers) of a message as a flat table in arrival order.
+ *
+ * Names and values are copied into one contiguous byte string and each header is a small
+ * fixed size entry pointing into it, so building the table from a parsed message is a
+ * memcpy per header rather than two strings and a tree node. Names keep the case they had
+ * on the wire and a name can appear more than once (Set-Cookie for example).
+ *
+ * Each entry carries the Id of its name. Lookups of a well known name go through an index
+ * from Id to the first entry with that id - O(1) and no allocation. Other names are found
+ * by a case insensitive scan of the (few) entries whose id is Unknown.
+ *
+ * Removing or replacing a header leaves its bytes behind in the byte string until clear().
+ */
+class HeaderTable
+{
+public:
+    static const std::size_t npos = (std::size_t)-1;
+
+    HeaderTable();
+
+    std::size_t size() const { return _entries.size(); }
+    bool        empty() const { return _entries.empty(); }
+    /// forgets every header, keeps the memory
+    void        clear();
+
+    /// appends a header, an existing header of the same name is kept
+    void add(const char* name, std::size_t name_length, const char* value, std::size_t value_length);
+    void add(const std::string& name, const std::string& value);
+    /// replaces every header called name with a single one
+    void set(const std::string& name, const std::string& value);
+    void set(HttpHeader::Id id, const std::string& value);
+
+    /// index of the first header called name (or id), or npos
+    std::size_t find(HttpHeader::Id id) const;
+    std::size_t find(const char* name, std::size_t name_length) const;
+    std::size_t find(const std::string& name) const { return find(name.data(), name.size()); }
+    bool has(HttpHeader::Id id) const { return find(id) != npos; }
+    bool has(const std::string& name) const { return find(name) != npos; }
+    /// the number of headers called name
+    std::size_t count(const std::string& name) const;
+    /// the value of every header called name, in arrival order
+    std::vector<std::string> values(const std::string& name) const;
+
+    /// removes every header called name (or id)
+    void remove(HttpHeader::Id id);
+    void remove(const std::string& name);
+
+    /// the parts of the i'th header in arrival order
+    HttpHeader::Id id(std::size_t i) const { return _entries[i].id; }
+    const char*    nameData(std::size_t i) const { return _bytes.data() + _entries[i].name_offset; }
+    std::size_t    nameLength(std::size_t i) const { return _entries[i].name_length; }
+    const char*    valueData(std::size_t i) const { return _bytes.data() + _entries[i].value_offset; }
+    char*          valueData(std::size_t i) { return &_bytes[_entries[i].value_offset]; }
+    std::size_t    valueLength(std::size_t i) const { return _entries[i].value_length; }
+    std::string    name(std::size_t i) const { return std::string(nameData(i), nameLength(i)); }
+    std::string    value(std::size_t i) const { return std::string(valueData(i), valueLength(i)); }
+
+    /**
+    * all the values of a repeated header joined with ", " - see RFC 7230 section 3.2.2.
+    * Set-Cookie is the exception the RFC names, its values cannot be combined, so for it
+    * this is just the value of entry first - use values() to get them all
+    */
+    std::string joinedValues(std::size_t first) const;
+
+    /**
+     * calls f(i) for every header whose id is NOT in ids, in arrival order. Headers with an
+     * Unknown id are always visited
+     */
+    template<class F> void forEachNotIn(const HttpHeader::IdSet& ids, F f) const
+    {
+        for(std::size_t i = 0; i < _entries.size(); i++) {
+            if( ! ids.contains(_entries[i].id) )
+                f(i);
+        }
+    }
+
+private:
+    struct Entry {
+        HttpHeader::Id  id;
+        std::uint32_t   name_offset;
+        std::uint32_t   name_length;
+        std::uint32_t   value_offset;
+        std::uint32_t   value_length;
+    };
+    bool matches(std::size_t i, HttpHeader::Id id, const char* name, std::size_t name_length) const;
+    void reindex();
+
+    boost::container::small_vector<Entry, 16>   _entries;
+    std::string                                 _bytes;
+    std::uint32_t                               _first[HttpHeader::kIdCount];  /// index + 1 of the first entry per id, 0 = none
+};
+
+#endif /* header_table_hpp */
@@ -46,16 +46,13 @@ namespace HttpHeader
     }
 
     void filterNotInList(HttpHeadersType& hdrs,
-            HttpHeaderFilterSetType filterList,
+            const HttpHeaderFilterSetType& filterList,
             std::function<void(HttpHeadersType& hdrs, std::string key, std::string value)> cb)
     {
     
         for(auto it = hdrs.begin(); it != hdrs.end(); it++ )
         {
-            std::string k = it->first;
-//            auto x = filterList.find(k);
-//            auto y = filterList.end();
-            if( filterList.end() == filterList.find(k) )
+            if( filterList.end() == filterList.find(it->first) )
             {
                 // IS in filterList so remove from headers
 //                hdrs.erase(it);
@@ -80,17 +77,15 @@ namespace HttpHeader
     }
 
     void filterInList(HttpHeadersType&  hdrs,
-            HttpHeaderFilterSetType filterList,
+            const HttpHeaderFilterSetType& filterList,
             std::function<void(HttpHeadersType& hdrs, std::string key, std::string value)> cb)
     {
     
         for(auto it = hdrs.begin(); it != hdrs.end(); it++)
         {
-            std::string k = it->first;
-            if( filterList.end() != filterList.find(k) )
+            if( filterList.end() != filterList.find(it->first) )
             {
-                // is NOT in filterlist so remove it
-                hdrs.erase(it);
+                // IS in filterList
                 cb(hdrs, it->first, it->second);
             }
         }
@@ -10,9 +10,12 @@
 #define http_header_hpp
 
 #include <stdio.h>
+#include <string>
 #include <map>
 #include <vector>
 #include <set>
+#include <functional>
+#include "header_table.hpp"
 
 
 typedef std::map<std::string, std::string> HttpHeadersType;
@@ -33,10 +36,11 @@ namespace HttpHeader
     void filterIn(HttpHeadersType& hdrs, std::vector<std::string> list);
     
     /// Filters a header map, calls the cb function for all headers
-    /// whose keys ARE NOT IN the filterList
+    /// whose keys ARE NOT IN the filterList.
+    /// For a message prefer HeaderTable::forEachNotIn() with an IdSet
     void filterNotInList(
-        HttpHeadersType&        hdrs,
-        HttpHeaderFilterSetType list,
+        HttpHeadersType&                hdrs,
+        const HttpHeaderFilterSetType&  list,
         std::function<void(HttpHeadersType& hdrs,
                             std::string key,
                             std::string value)> cb);
@@ -44,14 +48,15 @@ namespace HttpHeader
     /// Filters a header map, calls the cb function for all headers
     /// whose keys ARE IN the filterList
     void filterInList(
-        HttpHeadersType&        hdrs,
-        HttpHeaderFilterSetType list,
+        HttpHeadersType&                hdrs,
+        const HttpHeaderFilterSetType&  list,
         std::function<void(HttpHeadersType& hdrs,
                             std::string key,
                             std::string value)> cb);
 
 
-    /// Selected header keys as named constants in canonical form
+    /// Selected header keys as named constants in canonical form.
+    /// The same names have compile time ids, see HttpHeader::Id in header_table.hpp
     typedef std::string Keys;
     namespace Name{
         static const std::string Host = "HOST";
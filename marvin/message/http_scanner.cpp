@@ -0,0 +1,861 @@
+//
+//  http_scanner.cpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/16/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include "http_scanner.hpp"
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_WARN)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MARVIN_SCANNER_X86 1
+#include <immintrin.h>
+#endif
+
+#pragma mark - delimiter search
+/**
+* Each of these returns a pointer to the first byte in [p, end) that is equal to one of
+* the n (1 to 4) bytes in set, or end if there is none
+*/
+typedef const char* (*FindAnyFn)(const char* p, const char* end, const char* set, int n);
+
+static const char* findAnyScalar(const char* p, const char* end, const char* set, int n)
+{
+    for( ; p < end; p++) {
+        char c = *p;
+        for(int i = 0; i < n; i++) {
+            if( c == set[i] )
+                return p;
+        }
+    }
+    return end;
+}
+
+#ifdef MARVIN_SCANNER_X86
+__attribute__((target("sse4.2")))
+static const char* findAnySSE42(const char* p, const char* end, const char* set, int n)
+{
+    char tmp[16] = {0};
+    memcpy(tmp, set, n);
+    __m128i needles = _mm_loadu_si128((const __m128i*)tmp);
+    while( end - p >= 16 ) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int ix = _mm_cmpestri(needles, n, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if( ix != 16 )
+            return p + ix;
+        p += 16;
+    }
+    return findAnyScalar(p, end, set, n);
+}
+
+__attribute__((target("avx2")))
+static const char* findAnyAVX2(const char* p, const char* end, const char* set, int n)
+{
+    // unused needles repeat the first one
+    __m256i n0 = _mm256_set1_epi8(set[0]);
+    __m256i n1 = _mm256_set1_epi8(set[(n > 1) ? 1 : 0]);
+    __m256i n2 = _mm256_set1_epi8(set[(n > 2) ? 2 : 0]);
+    __m256i n3 = _mm256_set1_epi8(set[(n > 3) ? 3 : 0]);
+    while( end - p >= 32 ) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, n0), _mm256_cmpeq_epi8(chunk, n1)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, n2), _mm256_cmpeq_epi8(chunk, n3)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if( mask != 0 )
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findAnySSE42(p, end, set, n);
+}
+#endif
+
+/**
+* Each of these returns a pointer to the first control character other than tab in [p, end) -
+* CR and LF included, so it finds the end of a header value and any byte a value may not hold
+* in one pass - or end if there is none
+*/
+typedef const char* (*FindCtlFn)(const char* p, const char* end);
+
+static const char* findCtlScalar(const char* p, const char* end)
+{
+    for( ; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if( ((c < 0x20) && (c != '\t')) || (c == 0x7f) )
+            return p;
+    }
+    return end;
+}
+
+#ifdef MARVIN_SCANNER_X86
+__attribute__((target("sse4.2")))
+static const char* findCtlSSE42(const char* p, const char* end)
+{
+    // inclusive ranges 0x00-0x08, 0x0a-0x1f and 0x7f
+    const char tmp[16] = {0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f};
+    __m128i ranges = _mm_loadu_si128((const __m128i*)tmp);
+    while( end - p >= 16 ) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int ix = _mm_cmpestri(ranges, 6, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if( ix != 16 )
+            return p + ix;
+        p += 16;
+    }
+    return findCtlScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* findCtlAVX2(const char* p, const char* end)
+{
+    __m256i us = _mm256_set1_epi8(0x1f);
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i del = _mm256_set1_epi8(0x7f);
+    while( end - p >= 32 ) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        // unsigned chunk <= 0x1f, less tabs, plus DEL
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, us), us);
+        __m256i m = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab), ctl), _mm256_cmpeq_epi8(chunk, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if( mask != 0 )
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findCtlSSE42(p, end);
+}
+#endif
+
+static FindAnyFn findAnyFor(HttpScanner::Isa isa)
+{
+#ifdef MARVIN_SCANNER_X86
+    switch( isa ) {
+        case HttpScanner::Isa::avx2:  return findAnyAVX2;
+        case HttpScanner::Isa::sse42: return findAnySSE42;
+        default: break;
+    }
+#endif
+    return findAnyScalar;
+}
+
+static FindCtlFn findCtlFor(HttpScanner::Isa isa)
+{
+#ifdef MARVIN_SCANNER_X86
+    switch( isa ) {
+        case HttpScanner::Isa::avx2:  return findCtlAVX2;
+        case HttpScanner::Isa::sse42: return findCtlSSE42;
+        default: break;
+    }
+#endif
+    return findCtlScalar;
+}
+
+static HttpScanner::Isa detectIsa()
+{
+#ifdef MARVIN_SCANNER_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx2") )
+        return HttpScanner::Isa::avx2;
+    if( __builtin_cpu_supports("sse4.2") )
+        return HttpScanner::Isa::sse42;
+#endif
+    return HttpScanner::Isa::scalar;
+}
+
+static HttpScanner::Isa __bestIsa = detectIsa();
+static HttpScanner::Isa __isa = __bestIsa;
+static FindAnyFn        __findAny = findAnyFor(__bestIsa);
+static FindCtlFn        __findCtl = findCtlFor(__bestIsa);
+
+#pragma mark - small helpers
+static const char* __methodNames[] = {
+#define XX(num, name, string) #string,
+    HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+static int lookupMethod(const char* p, std::size_t len)
+{
+    for(int i = 0; i < (int)(sizeof(__methodNames)/sizeof(__methodNames[0])); i++) {
+        if( (strlen(__methodNames[i]) == len) && (memcmp(__methodNames[i], p, len) == 0) )
+            return i;
+    }
+    return -1;
+}
+
+/**
+* the RFC 7230 tchar table - the characters http_parser (built strict) accepts in a header name
+*/
+static bool* makeTokenTable()
+{
+    static bool table[256];
+    for(int c = 0; c < 256; c++)
+        table[c] = ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+    for(const char* s = "!#$%&'*+-.^_`|~"; *s != '\0'; s++)
+        table[(unsigned char)*s] = true;
+    return table;
+}
+static const bool* __tokenChars = makeTokenTable();
+
+/// the first byte in [p, end) that is not a token character, or end
+static const char* findNonToken(const char* p, const char* end)
+{
+    while( (p < end) && __tokenChars[(unsigned char)*p] )
+        p++;
+    return p;
+}
+
+static int unhex(char c)
+{
+    if( (c >= '0') && (c <= '9') ) return c - '0';
+    if( (c >= 'a') && (c <= 'f') ) return c - 'a' + 10;
+    if( (c >= 'A') && (c <= 'F') ) return c - 'A' + 10;
+    return -1;
+}
+
+static char lower(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? (char)(c | 0x20) : c;
+}
+
+static void setErrno(http_parser* parser, enum http_errno e)
+{
+    parser->http_errno = e;
+}
+
+/**
+* The notify and data helpers make a callback (if there is one) and return true if the
+* scan must stop - either the callback failed or it paused the parser
+*/
+static bool notify(http_parser* parser, http_cb cb, enum http_errno cbErr)
+{
+    if( (cb != NULL) && (cb(parser) != 0) )
+        setErrno(parser, cbErr);
+    return (HTTP_PARSER_ERRNO(parser) != HPE_OK);
+}
+
+static bool data(http_parser* parser, http_data_cb cb, enum http_errno cbErr, const char* at, std::size_t n)
+{
+    if( (cb != NULL) && (cb(parser, at, n) != 0) )
+        setErrno(parser, cbErr);
+    return (HTTP_PARSER_ERRNO(parser) != HPE_OK);
+}
+
+/**
+* parses "d.d" after "HTTP/" and returns a pointer to the first byte after it, or NULL
+*/
+static const char* parseVersion(http_parser* parser, const char* p, const char* e)
+{
+    unsigned major = 0, minor = 0;
+    const char* s = p;
+    while( (p < e) && (*p >= '0') && (*p <= '9') ) {
+        major = major * 10 + (*p - '0');
+        if( major > 999 ) return NULL;
+        p++;
+    }
+    if( (p == s) || (p == e) || (*p != '.') )
+        return NULL;
+    s = ++p;
+    while( (p < e) && (*p >= '0') && (*p <= '9') ) {
+        minor = minor * 10 + (*p - '0');
+        if( minor > 999 ) return NULL;
+        p++;
+    }
+    if( p == s )
+        return NULL;
+    parser->http_major = (unsigned short)major;
+    parser->http_minor = (unsigned short)minor;
+    return p;
+}
+
+#pragma mark - isa configuration
+HttpScanner::Isa HttpScanner::bestIsa()
+{
+    return __bestIsa;
+}
+
+void HttpScanner::configSet_Isa(Isa isa)
+{
+    __isa = ((int)isa > (int)__bestIsa) ? __bestIsa : isa;
+    __findAny = findAnyFor(__isa);
+    __findCtl = findCtlFor(__isa);
+}
+
+HttpScanner::Isa HttpScanner::isa()
+{
+    return __isa;
+}
+
+#pragma mark - construction
+HttpScanner::HttpScanner()
+{
+    reset();
+}
+
+void HttpScanner::reset()
+{
+    _state = kStart;
+    _line.clear();
+    _headerBytes = 0;
+    _haveHeader = false;
+    _nameLen = 0;
+    _kind = kGeneral;
+    _value.clear();
+}
+
+void HttpScanner::startMessage(http_parser* parser)
+{
+    parser->flags = 0;
+    parser->content_length = ULLONG_MAX;
+    parser->upgrade = 0;
+    _line.clear();
+    _headerBytes = 0;
+    _haveHeader = false;
+}
+
+bool HttpScanner::countHeaderBytes(http_parser* parser, std::size_t n)
+{
+    _headerBytes += n;
+    if( _headerBytes > HTTP_MAX_HEADER_SIZE ) {
+        setErrno(parser, HPE_HEADER_OVERFLOW);
+        return true;
+    }
+    return false;
+}
+
+#pragma mark - first line
+bool HttpScanner::parseStartLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e)
+{
+    if( (e > b) && (e[-1] == '\r') )
+        e--;
+    if( ((e - b) >= 5) && (memcmp(b, "HTTP/", 5) == 0) )
+        return parseStatusLine(parser, settings, b, e);
+    return parseRequestLine(parser, settings, b, e);
+}
+
+bool HttpScanner::parseStatusLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e)
+{
+    parser->type = HTTP_RESPONSE;
+    const char* p = parseVersion(parser, b + 5, e);
+    if( (p == NULL) || (p == e) || (*p != ' ') ) {
+        setErrno(parser, HPE_INVALID_VERSION);
+        return true;
+    }
+    p++;
+    unsigned code = 0;
+    const char* s = p;
+    while( (p < e) && (*p >= '0') && (*p <= '9') ) {
+        code = code * 10 + (*p - '0');
+        p++;
+    }
+    if( (p == s) || (code > 999) || ((p < e) && (*p != ' ')) ) {
+        setErrno(parser, HPE_INVALID_STATUS);
+        return true;
+    }
+    parser->status_code = code;
+    if( p < e ) {
+        p++;
+        if( p < e )
+            return data(parser, settings->on_status, HPE_CB_status, p, e - p);
+    }
+    return false;
+}
+
+bool HttpScanner::parseRequestLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e)
+{
+    parser->type = HTTP_REQUEST;
+    const char* sp = (const char*)memchr(b, ' ', e - b);
+    int method = (sp == NULL) ? -1 : lookupMethod(b, sp - b);
+    if( method < 0 ) {
+        setErrno(parser, HPE_INVALID_METHOD);
+        return true;
+    }
+    parser->method = method;
+    const char* u = sp + 1;
+    while( (u < e) && (*u == ' ') )
+        u++;
+    const char* ue = (const char*)memchr(u, ' ', e - u);
+    if( ue == NULL )
+        ue = e;
+    if( ue == u ) {
+        setErrno(parser, HPE_INVALID_URL);
+        return true;
+    }
+    if( data(parser, settings->on_url, HPE_CB_url, u, ue - u) )
+        return true;
+    if( ue == e ) {
+        // HTTP/0.9
+        parser->http_major = 0;
+        parser->http_minor = 9;
+        return false;
+    }
+    const char* v = ue;
+    while( (v < e) && (*v == ' ') )
+        v++;
+    const char* ve = NULL;
+    if( ((e - v) >= 5) && (memcmp(v, "HTTP/", 5) == 0) )
+        ve = parseVersion(parser, v + 5, e);
+    if( ve != e ) {
+        setErrno(parser, HPE_INVALID_VERSION);
+        return true;
+    }
+    return false;
+}
+
+#pragma mark - headers
+void HttpScanner::classifyHeader()
+{
+    _kind = kGeneral;
+    _value.clear();
+    if( _nameLen > kMaxNamePrefix )
+        return;
+    std::string n(_name, _nameLen);
+    if( n == "content-length" )
+        _kind = kContentLength;
+    else if( n == "transfer-encoding" )
+        _kind = kTransferEncoding;
+    else if( (n == "connection") || (n == "proxy-connection") )
+        _kind = kConnection;
+    else if( n == "upgrade" )
+        _kind = kUpgrade;
+}
+
+/**
+* Called at the end of each header line to act on the headers that affect framing
+*/
+bool HttpScanner::finishHeader(http_parser* parser)
+{
+    _haveHeader = true;
+    switch( _kind ) {
+        case kContentLength: {
+            if( parser->flags & F_CONTENTLENGTH ) {
+                setErrno(parser, HPE_UNEXPECTED_CONTENT_LENGTH);
+                return true;
+            }
+            uint64_t cl = 0;
+            std::size_t i = 0;
+            for( ; (i < _value.size()) && (_value[i] >= '0') && (_value[i] <= '9'); i++) {
+                if( cl > (ULLONG_MAX - 10) / 10 ) {
+                    setErrno(parser, HPE_INVALID_CONTENT_LENGTH);
+                    return true;
+                }
+                cl = cl * 10 + (_value[i] - '0');
+            }
+            bool ok = (i > 0);
+            for( ; i < _value.size(); i++) {
+                if( (_value[i] != ' ') && (_value[i] != '\t') )
+                    ok = false;
+            }
+            if( ! ok ) {
+                setErrno(parser, HPE_INVALID_CONTENT_LENGTH);
+                return true;
+            }
+            parser->flags |= F_CONTENTLENGTH;
+            parser->content_length = cl;
+            break;
+        }
+        case kTransferEncoding: {
+            std::string v(_value);
+            v.erase(v.find_last_not_of(" \t") + 1);
+            std::transform(v.begin(), v.end(), v.begin(), lower);
+            if( v == "chunked" )
+                parser->flags |= F_CHUNKED;
+            break;
+        }
+        case kConnection: {
+            std::size_t pos = 0;
+            while( pos <= _value.size() ) {
+                std::size_t comma = _value.find(',', pos);
+                if( comma == std::string::npos )
+                    comma = _value.size();
+                std::string tok = _value.substr(pos, comma - pos);
+                tok.erase(0, tok.find_first_not_of(" \t"));
+                tok.erase(tok.find_last_not_of(" \t") + 1);
+                std::transform(tok.begin(), tok.end(), tok.begin(), lower);
+                if( tok == "keep-alive" )
+                    parser->flags |= F_CONNECTION_KEEP_ALIVE;
+                else if( tok == "close" )
+                    parser->flags |= F_CONNECTION_CLOSE;
+                else if( tok == "upgrade" )
+                    parser->flags |= F_CONNECTION_UPGRADE;
+                pos = comma + 1;
+            }
+            break;
+        }
+        case kUpgrade:
+            parser->flags |= F_UPGRADE;
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+/**
+* Called with p pointing just past the LF of the blank line that ends the headers (or trailers).
+* Returns true if the scan must stop at p
+*/
+bool HttpScanner::headersDone(http_parser* parser, const http_parser_settings* settings, const char* p, const char* end)
+{
+    _headerBytes = 0;
+    if( parser->flags & F_TRAILING ) {
+        // end of a chunked message
+        _state = kStart;
+        if( notify(parser, settings->on_chunk_complete, HPE_CB_chunk_complete) )
+            return true;
+        return notify(parser, settings->on_message_complete, HPE_CB_message_complete);
+    }
+    if( (parser->flags & F_CHUNKED) && (parser->flags & F_CONTENTLENGTH) ) {
+        setErrno(parser, HPE_UNEXPECTED_CONTENT_LENGTH);
+        return true;
+    }
+    parser->upgrade = (((parser->flags & (F_UPGRADE | F_CONNECTION_UPGRADE)) == (F_UPGRADE | F_CONNECTION_UPGRADE))
+                       || (parser->method == HTTP_CONNECT));
+    if( settings->on_headers_complete != NULL ) {
+        switch( settings->on_headers_complete(parser, p, end - p) ) {
+            case 0:
+                break;
+            case 2:
+                parser->upgrade = 1;
+                // fall through
+            case 1:
+                parser->flags |= F_SKIPBODY;
+                break;
+            default:
+                setErrno(parser, HPE_CB_headers_complete);
+                return true;
+        }
+    }
+    if( HTTP_PARSER_ERRNO(parser) != HPE_OK )
+        return true;
+
+    bool hasBody = (parser->flags & F_CHUNKED) || ((parser->content_length > 0) && (parser->content_length != ULLONG_MAX));
+    if( parser->upgrade && ((parser->method == HTTP_CONNECT) || (parser->flags & F_SKIPBODY) || ! hasBody) ) {
+        // the rest of the data belongs to a different protocol
+        _state = kStart;
+        notify(parser, settings->on_message_complete, HPE_CB_message_complete);
+        return true;
+    }
+    bool needsEOF = (parser->type == HTTP_RESPONSE)
+                    && ((parser->status_code / 100) != 1)
+                    && (parser->status_code != 204)
+                    && (parser->status_code != 304)
+                    && !(parser->flags & F_SKIPBODY)
+                    && !(parser->flags & F_CHUNKED)
+                    && (parser->content_length == ULLONG_MAX);
+    if( parser->flags & F_SKIPBODY ) {
+        _state = kStart;
+    } else if( parser->flags & F_CHUNKED ) {
+        _state = kChunkSizeStart;
+        return false;
+    } else if( (parser->content_length != 0) && (parser->content_length != ULLONG_MAX) ) {
+        _state = kBodyIdentity;
+        return false;
+    } else if( needsEOF ) {
+        _state = kBodyEOF;
+        return false;
+    } else {
+        _state = kStart;
+    }
+    return notify(parser, settings->on_message_complete, HPE_CB_message_complete);
+}
+
+#pragma mark - execute
+std::size_t HttpScanner::executeEOF(http_parser* parser, const http_parser_settings* settings)
+{
+    switch( _state ) {
+        case kBodyEOF:
+            _state = kStart;
+            notify(parser, settings->on_message_complete, HPE_CB_message_complete);
+            return 0;
+        case kStart:
+            return 0;
+        default:
+            setErrno(parser, HPE_INVALID_EOF_STATE);
+            return 1;
+    }
+}
+
+std::size_t HttpScanner::execute(http_parser* parser, const http_parser_settings* settings, const char* buf, std::size_t len)
+{
+    if( HTTP_PARSER_ERRNO(parser) != HPE_OK )
+        return 0;
+    if( len == 0 )
+        return executeEOF(parser, settings);
+
+    const char* p = buf;
+    const char* end = buf + len;
+    while( p < end ) {
+        switch( _state ) {
+            case kStart:
+                if( (*p == '\r') || (*p == '\n') ) {
+                    p++;
+                    break;
+                }
+                startMessage(parser);
+                _state = kStartLine;
+                if( notify(parser, settings->on_message_begin, HPE_CB_message_begin) )
+                    return p - buf;
+                break;
+
+            case kStartLine: {
+                const char* eol = __findAny(p, end, "\n", 1);
+                if( countHeaderBytes(parser, eol - p) )
+                    return p - buf;
+                if( eol == end ) {
+                    _line.append(p, end - p);
+                    p = end;
+                    break;
+                }
+                bool stop;
+                if( _line.empty() ) {
+                    stop = parseStartLine(parser, settings, p, eol);
+                } else {
+                    _line.append(p, eol - p);
+                    stop = parseStartLine(parser, settings, _line.data(), _line.data() + _line.size());
+                    _line.clear();
+                }
+                p = eol + 1;
+                _state = kHeaderLineStart;
+                if( stop )
+                    return p - buf;
+                break;
+            }
+
+            case kHeaderLineStart:
+                if( *p == '\r' ) {
+                    _state = kHeadersEndLF;
+                    p++;
+                } else if( *p == '\n' ) {
+                    p++;
+                    if( headersDone(parser, settings, p, end) )
+                        return p - buf;
+                } else if( (*p == ' ') || (*p == '\t') ) {
+                    if( ! _haveHeader ) {
+                        setErrno(parser, HPE_INVALID_HEADER_TOKEN);
+                        return p - buf;
+                    }
+                    // obsolete line folding - the value continues, white space included
+                    _kind = kGeneral;
+                    _state = kValue;
+                } else {
+                    _nameLen = 0;
+                    _state = kField;
+                }
+                break;
+
+            case kField: {
+                // names are short, a table lookup a byte is quicker than setting up a vector search
+                const char* q = findNonToken(p, end);
+                if( q > p ) {
+                    for(const char* c = p; (c < q) && (_nameLen + (c - p) < kMaxNamePrefix); c++)
+                        _name[_nameLen + (c - p)] = lower(*c);
+                    _nameLen += (q - p);
+                    if( countHeaderBytes(parser, q - p) )
+                        return p - buf;
+                    if( data(parser, settings->on_header_field, HPE_CB_header_field, p, q - p) )
+                        return q - buf;
+                }
+                p = q;
+                if( q == end )
+                    break;
+                if( (*q != ':') || (_nameLen == 0) ) {
+                    setErrno(parser, HPE_INVALID_HEADER_TOKEN);
+                    return q - buf;
+                }
+                classifyHeader();
+                _state = kValueWS;
+                p++;
+                break;
+            }
+
+            case kValueWS:
+                while( (p < end) && ((*p == ' ') || (*p == '\t')) )
+                    p++;
+                if( p == end )
+                    break;
+                if( (*p == '\r') || (*p == '\n') ) {
+                    // empty value
+                    if( data(parser, settings->on_header_value, HPE_CB_header_value, p, 0) )
+                        return p - buf;
+                }
+                _state = kValue;
+                break;
+
+            case kValue: {
+                const char* q = __findCtl(p, end);
+                if( q > p ) {
+                    // the whole value, a framing header cut short would frame the message wrongly
+                    if( countHeaderBytes(parser, q - p) )
+                        return p - buf;
+                    if( _kind != kGeneral )
+                        _value.append(p, q - p);
+                    if( data(parser, settings->on_header_value, HPE_CB_header_value, p, q - p) )
+                        return q - buf;
+                }
+                p = q;
+                if( q == end )
+                    break;
+                if( (*q != '\r') && (*q != '\n') ) {
+                    setErrno(parser, HPE_INVALID_HEADER_TOKEN);
+                    return q - buf;
+                }
+                p++;
+                if( *q == '\r' ) {
+                    _state = kValueLF;
+                } else {
+                    _state = kHeaderLineStart;
+                    if( finishHeader(parser) )
+                        return p - buf;
+                }
+                break;
+            }
+
+            case kValueLF:
+                if( *p != '\n' ) {
+                    setErrno(parser, HPE_LF_EXPECTED);
+                    return p - buf;
+                }
+                p++;
+                _state = kHeaderLineStart;
+                if( finishHeader(parser) )
+                    return p - buf;
+                break;
+
+            case kHeadersEndLF:
+                if( *p != '\n' ) {
+                    setErrno(parser, HPE_LF_EXPECTED);
+                    return p - buf;
+                }
+                p++;
+                if( headersDone(parser, settings, p, end) )
+                    return p - buf;
+                break;
+
+            case kBodyIdentity: {
+                uint64_t n = std::min<uint64_t>(parser->content_length, (uint64_t)(end - p));
+                const char* at = p;
+                parser->content_length -= n;
+                p += n;
+                if( data(parser, settings->on_body, HPE_CB_body, at, n) )
+                    return p - buf;
+                if( parser->content_length == 0 ) {
+                    _state = kStart;
+                    if( notify(parser, settings->on_message_complete, HPE_CB_message_complete) || parser->upgrade )
+                        return p - buf;
+                }
+                break;
+            }
+
+            case kBodyEOF: {
+                const char* at = p;
+                p = end;
+                if( data(parser, settings->on_body, HPE_CB_body, at, end - at) )
+                    return p - buf;
+                break;
+            }
+
+            case kChunkSizeStart: {
+                if( settings->on_chunk_size_start != NULL )
+                    settings->on_chunk_size_start(parser, p, end - p);
+                int v = unhex(*p);
+                if( v < 0 ) {
+                    setErrno(parser, HPE_INVALID_CHUNK_SIZE);
+                    return p - buf;
+                }
+                parser->content_length = v;
+                _state = kChunkSize;
+                p++;
+                break;
+            }
+
+            case kChunkSize:
+                for( ; p < end; p++) {
+                    int v = unhex(*p);
+                    if( v >= 0 ) {
+                        if( parser->content_length > (ULLONG_MAX - 16) / 16 ) {
+                            setErrno(parser, HPE_INVALID_CONTENT_LENGTH);
+                            return p - buf;
+                        }
+                        parser->content_length = parser->content_length * 16 + v;
+                        continue;
+                    }
+                    if( *p == '\r' ) {
+                        _state = kChunkSizeLF;
+                    } else if( (*p == ';') || (*p == ' ') ) {
+                        _state = kChunkParams;
+                    } else {
+                        setErrno(parser, HPE_INVALID_CHUNK_SIZE);
+                        return p - buf;
+                    }
+                    p++;
+                    break;
+                }
+                break;
+
+            case kChunkParams: {
+                // chunk extensions are ignored
+                const char* q = __findAny(p, end, "\r", 1);
+                p = q;
+                if( q != end ) {
+                    _state = kChunkSizeLF;
+                    p++;
+                }
+                break;
+            }
+
+            case kChunkSizeLF:
+                if( *p != '\n' ) {
+                    setErrno(parser, HPE_LF_EXPECTED);
+                    return p - buf;
+                }
+                p++;
+                if( parser->content_length == 0 ) {
+                    parser->flags |= F_TRAILING;
+                    _haveHeader = false;
+                    _state = kHeaderLineStart;
+                } else {
+                    _state = kChunkData;
+                }
+                if( notify(parser, settings->on_chunk_header, HPE_CB_chunk_header) )
+                    return p - buf;
+                break;
+
+            case kChunkData: {
+                uint64_t n = std::min<uint64_t>(parser->content_length, (uint64_t)(end - p));
+                const char* at = p;
+                parser->content_length -= n;
+                p += n;
+                if( parser->content_length == 0 )
+                    _state = kChunkDataCR;
+                if( data(parser, settings->on_body, HPE_CB_body, at, n) )
+                    return p - buf;
+                break;
+            }
+
+            case kChunkDataCR:
+                if( *p != '\r' ) {
+                    setErrno(parser, HPE_LF_EXPECTED);
+                    return p - buf;
+                }
+                p++;
+                _state = kChunkDataLF;
+                break;
+
+            case kChunkDataLF:
+                if( *p != '\n' ) {
+                    setErrno(parser, HPE_LF_EXPECTED);
+                    return p - buf;
+                }
+                p++;
+                _state = kChunkSizeStart;
+                if( notify(parser, settings->on_chunk_complete, HPE_CB_chunk_complete) )
+                    return p - buf;
+                break;
+        }
+    }
+    return p - buf;
+}
@@ -0,0 +1,125 @@
+//
+//  http_scanner.hpp
+//  MarvinCpp
+//
+//  Created by ROBERT BLACKWELL on 12/16/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+
+#ifndef http_scanner_hpp
+#define http_scanner_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "http_parser.h"
+
+#pragma mark - HttpScanner class
+/**
+ * An alternative to http_parser_execute() for HTTP/1.x messages.
+ *
+ * http_parser walks every byte of the first line, the headers and the chunk size lines through
+ * its state machine. HttpScanner instead searches for the delimiters it cares about (LF,
+ * CR, ':' and chunk size terminators) 16 or 32 bytes at a time using SSE4.2 or AVX2, and hands whole runs
+ * of header names, values and body data to the callbacks.
+ *
+ * The scanner is driven with the same http_parser struct and http_parser_settings as http_parser, and
+ * it makes the same callbacks in the same order with the same arguments (including the modified
+ * on_headers_complete that passes the start and length of body data in the buffer). It also keeps
+ * the same READ-ONLY fields of http_parser up to date (method, status_code, http_major/minor,
+ * flags, content_length, upgrade, http_errno) so Parser and its derived classes cannot tell which
+ * engine is running. Pausing works the same way - a callback that calls http_parser_pause()
+ * stops the scan and the number of bytes consumed is returned.
+ *
+ * The instruction set is chosen at runtime from what the cpu supports. It can be forced down
+ * with configSet_Isa() which is intended for testing. http_parser remains the
+ * reference implementation, see Parser::configSet_UseScanner() and the differential test in tests/reader_test.
+ *
+ * Validation is lighter than http_parser - the scanner checks structure (version, status code,
+ * method, content length, chunk sizes, line terminators) but not the individual characters of
+ * urls. Header names and values are checked like http_parser does, as a proxy and its origin
+ * must agree on where a message ends - a name must be all token characters (no white space
+ * before the ':') and a value may not hold control characters other than tab, both fail with
+ * HPE_INVALID_HEADER_TOKEN. The values of the headers that frame the message are never cut
+ * short, they are bounded only by HTTP_MAX_HEADER_SIZE.
+ */
+class HttpScanner
+{
+public:
+    enum class Isa { scalar, sse42, avx2 };
+
+    /**
+     * the best instruction set supported by this cpu
+     */
+    static Isa  bestIsa();
+
+    /**
+     * Selects the instruction set used by all scanners. A request for something the cpu does
+     * not support is reduced to the best available. Intended for testing
+     */
+    static void configSet_Isa(Isa isa);
+    static Isa  isa();
+
+    HttpScanner();
+
+    /**
+     * forgets any partially scanned message, the next byte is expected to start a new message
+     */
+    void reset();
+
+    /**
+     * Equivalent to http_parser_execute(). A len of 0 signals EOF.
+     * Returns the number of bytes consumed.
+     */
+    std::size_t execute(http_parser* parser, const http_parser_settings* settings, const char* data, std::size_t len);
+
+private:
+    enum State {
+        kStart,
+        kStartLine,
+        kHeaderLineStart,
+        kField,
+        kValueWS,
+        kValue,
+        kValueLF,
+        kHeadersEndLF,
+        kBodyIdentity,
+        kBodyEOF,
+        kChunkSizeStart,
+        kChunkSize,
+        kChunkParams,
+        kChunkSizeLF,
+        kChunkData,
+        kChunkDataCR,
+        kChunkDataLF
+    };
+    enum HeaderKind {
+        kGeneral,
+        kContentLength,
+        kTransferEncoding,
+        kConnection,
+        kUpgrade
+    };
+    static const std::size_t kMaxNamePrefix = 20;
+
+    std::size_t executeEOF(http_parser* parser, const http_parser_settings* settings);
+    void startMessage(http_parser* parser);
+    bool countHeaderBytes(http_parser* parser, std::size_t n);
+    bool parseStartLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e);
+    bool parseStatusLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e);
+    bool parseRequestLine(http_parser* parser, const http_parser_settings* settings, const char* b, const char* e);
+    void classifyHeader();
+    bool finishHeader(http_parser* parser);
+    bool headersDone(http_parser* parser, const http_parser_settings* settings, const char* p, const char* end);
+
+    State               _state;
+    std::string         _line;          /// the first line - only used when it spans calls to execute()
+    std::size_t         _headerBytes;
+    bool                _haveHeader;    /// a header line has been seen - so a folded line is legal
+    char                _name[kMaxNamePrefix];
+    std::size_t         _nameLen;       /// total length of the current header name
+    HeaderKind          _kind;
+    std::string         _value;         /// value of the current header - only for the kinds that matter
+};
+
+#endif /* http_scanner_hpp */
@@ -1,10 +1,22 @@
 #include <string>
 #include <map>
 #include <sstream>
+#include <cstring>
+#include <cassert>
 #include "http_parser.h"
 #include "http_header.hpp"
 #include "message.hpp"
 
+// most targets build as C++17 and get std::to_chars, the few still on C++14 or older do not
+#if __cplusplus >= 201703L
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#define MARVIN_TO_CHARS 1
+#endif
+#endif
+#endif
+
 std::string traceMessage(MessageBase& msg)
 {
     std::stringstream ss;
@@ -15,13 +27,13 @@ std::string traceMessage(MessageBase& msg)
     }else{
         ss << "HTTP/1." << msg.httpVersMinor() << " " << msg.statusCode() << " " << msg.status();
     }
-    if( msg.hasHeader(HttpHeader::Name::ContentLength) ){
-        ss << "ContentLen : " << msg.getHeader(HttpHeader::Name::ContentLength);
+    if( msg.hasHeader(HttpHeader::Id::ContentLength) ){
+        ss << "ContentLen : " << msg.getHeader(HttpHeader::Id::ContentLength);
     }else{
         ss << "No content length header";
     }
-    if( msg.hasHeader(HttpHeader::Name::TransferEncoding) ){
-        ss << "TransferEncodin : " << msg.getHeader(HttpHeader::Name::TransferEncoding);
+    if( msg.hasHeader(HttpHeader::Id::TransferEncoding) ){
+        ss << "TransferEncodin : " << msg.getHeader(HttpHeader::Id::TransferEncoding);
     }else{
         ss << "No transfer encoding";
     }
@@ -29,34 +41,101 @@ std::string traceMessage(MessageBase& msg)
     return ss.str();
 }
 
-//void serializeHeaders(MessageBase& msg, boost::asio::streambuf& b)
-void serializeHeaders(MessageBase& msg, MBuffer& mb)
+#pragma mark - head serialization
+/**
+* number of characters in the decimal form of v
+*/
+static std::size_t decimalLength(long v)
+{
+    unsigned long u = (v < 0) ? (0ul - (unsigned long)v) : (unsigned long)v;
+    std::size_t n = (v < 0) ? 2 : 1;
+    while( u >= 10 ) {
+        u /= 10;
+        n++;
+    }
+    return n;
+}
+/**
+* writes the decimal form of v at p and returns the position after it
+*/
+static char* putDecimal(char* p, long v)
 {
-    boost::asio::streambuf b;
-    std::ostream os(&b);
+#ifdef MARVIN_TO_CHARS
+    return std::to_chars(p, p + decimalLength(v), v).ptr;
+#else
+    unsigned long u = (v < 0) ? (0ul - (unsigned long)v) : (unsigned long)v;
+    std::size_t n = decimalLength(v);
+    if( v < 0 )
+        *p = '-';
+    char* q = p + n;
+    do {
+        *--q = (char)('0' + (u % 10));
+        u /= 10;
+    } while( u != 0 );
+    return p + n;
+#endif
+}
+static char* putBytes(char* p, const char* s, std::size_t n)
+{
+    std::memcpy(p, s, n);
+    return p + n;
+}
 
-    std::string vers = "HTTP/" + std::to_string(msg.httpVersMajor()) + "." + std::to_string(msg.httpVersMinor());
+std::size_t serializedHeadersSize(MessageBase& msg)
+{
+    std::size_t n = 5 + decimalLength(msg._http_major) + 1 + decimalLength(msg._http_minor) + 2; // HTTP/M.m\r\n
     if( msg.isRequest() ){
-        std::string m = msg.getMethodAsString();
-        std::string u = msg.uri();
-        os << m << " " << u << " " << vers << "\r\n";
-    } else{
-        os << vers << " " << msg._status_code << " " << msg._status <<  "\r\n";
+        n += std::strlen(http_method_str(msg._method)) + 1 + msg._uri.size() + 1;
+    } else {
+        n += 1 + decimalLength(msg._status_code) + 1 + msg._status.size();
     }
-    
-    for(auto const& h : msg._headers) {
-        os << h.first << ": " << h.second << "\r\n";
+    msg.materializeHeaders();
+    HeaderTable& hdrs = msg._headers;
+    for(std::size_t i = 0; i < hdrs.size(); i++) {
+        n += hdrs.nameLength(i) + 2 + hdrs.valueLength(i) + 2;
+    }
+    return n + 2;
+}
+
+/**
+* Formats straight into a buffer of exactly the right size, no streams and no intermediate strings
+*/
+MBufferSPtr serializeHeaders(MessageBase& msg)
+{
+    std::size_t size = serializedHeadersSize(msg);
+    MBufferSPtr mb = m_buffer(size);
+    char* start = (char*)mb->data();
+    char* p = start;
+    if( msg.isRequest() ){
+        const char* m = http_method_str(msg._method);
+        p = putBytes(p, m, std::strlen(m));
+        *p++ = ' ';
+        p = putBytes(p, msg._uri.data(), msg._uri.size());
+        *p++ = ' ';
+    }
+    p = putBytes(p, "HTTP/", 5);
+    p = putDecimal(p, msg._http_major);
+    *p++ = '.';
+    p = putDecimal(p, msg._http_minor);
+    if( ! msg.isRequest() ){
+        *p++ = ' ';
+        p = putDecimal(p, msg._status_code);
+        *p++ = ' ';
+        p = putBytes(p, msg._status.data(), msg._status.size());
+    }
+    p = putBytes(p, "\r\n", 2);
+    HeaderTable& hdrs = msg._headers;
+    for(std::size_t i = 0; i < hdrs.size(); i++) {
+        p = putBytes(p, hdrs.nameData(i), hdrs.nameLength(i));
+        p = putBytes(p, ": ", 2);
+        p = putBytes(p, hdrs.valueData(i), hdrs.valueLength(i));
+        p = putBytes(p, "\r\n", 2);
     }
     // end of headers
-    os << "\r\n";
-    // debugging only
-    boost::asio::streambuf::const_buffers_type bufs = b.data();
-
-    std::string ss(boost::asio::buffers_begin(bufs), boost::asio::buffers_begin(bufs) + b.size() );
-    mb.append((void*) ss.c_str(), ss.size());
-//    return b;
-    std::string sss = ss;
-    
+    p = putBytes(p, "\r\n", 2);
+    assert( (std::size_t)(p - start) == size );
+    mb->setSize(size);
+    return mb;
 }
 
 std::string httpMethodString(HttpMethod m){
@@ -71,12 +150,29 @@ std::string httpMethodString(HttpMethod m){
 MessageBase::MessageBase()
 {
     this->_is_request = true;
+    this->_method = HTTP_GET;
+    this->_status_code = 0;
     this->setHttpVersMajor(1);
     this->setHttpVersMinor(1);
 }
 
 MessageBase::~MessageBase(){}
 
+void
+MessageBase::clear()
+{
+    _is_request = true;
+    _method = HTTP_GET;
+    _methodStr.clear();
+    _uri.clear();
+    _status_code = 0;
+    _status.clear();
+    _http_major = 1;
+    _http_minor = 1;
+    _headers.clear();
+    _trailers.clear();
+}
+
 bool
 MessageBase::isRequest(){ return _is_request; }
 
@@ -127,50 +223,104 @@ MessageBase::httpVersMinor(){return _http_minor; }
 
 void
 MessageBase::setHeader(std::string key, std::string value){
-    HttpHeader::canonicalKey(key);
-    _headers[key] = value;
+    materializeHeaders();
+    _headers.set(key, value);
+};
+
+void
+MessageBase::setHeader(HttpHeader::Id id, std::string value){
+    materializeHeaders();
+    _headers.set(id, value);
+};
+
+void
+MessageBase::addHeader(const char* key, std::size_t key_length, const char* value, std::size_t value_length){
+    materializeHeaders();
+    _headers.add(key, key_length, value, value_length);
+}
+
+void
+MessageBase::addHeader(const std::string& key, const std::string& value){
+    addHeader(key.data(), key.size(), value.data(), value.size());
+}
+
+bool
+MessageBase::hasHeader(const std::string& key){
+    materializeHeaders();
+    return _headers.has(key);
 };
 
 bool
-MessageBase::hasHeader( std::string key){
-    HttpHeader::canonicalKey(key);
-    return ( _headers.find(key) != _headers.end() );
+MessageBase::hasHeader(HttpHeader::Id id){
+    materializeHeaders();
+    return _headers.has(id);
 };
 
 std::string
 MessageBase::header(std::string key){
-    HttpHeader::canonicalKey(key);
-    if( hasHeader(key) ){ return _headers[key]; } else { return nullptr;}
+    return getHeader(key);
+}
+
+void
+MessageBase::removeHeader(const std::string& key){
+    materializeHeaders();
+    _headers.remove(key);
 }
 
 void
-MessageBase::removeHeader( std::string key){
-    HttpHeader::canonicalKey(key);
-    if( _headers.find(key) != _headers.end()  )
-        _headers.erase(key);
+MessageBase::removeHeader(HttpHeader::Id id){
+    materializeHeaders();
+    _headers.remove(id);
 }
 
 std::string
-MessageBase::getHeader(std::string key){
-    HttpHeader::canonicalKey(key);
-    if( _headers.find(key) != _headers.end() ){
-        return _headers[key];
+MessageBase::getHeader(const std::string& key){
+    materializeHeaders();
+    std::size_t i = _headers.find(key);
+    if( i != HeaderTable::npos ){
+        return _headers.value(i);
     }
     return nullptr;
 }
-std::map<std::string, std::string>&
-MessageBase::getHeaders(){
+
+std::string
+MessageBase::getHeader(HttpHeader::Id id){
+    materializeHeaders();
+    std::size_t i = _headers.find(id);
+    if( i != HeaderTable::npos ){
+        return _headers.value(i);
+    }
+    return nullptr;
+}
+
+HeaderTable&
+MessageBase::headers(){
+    materializeHeaders();
     return _headers;
 }
+
+HttpHeadersType
+MessageBase::getHeaders(){
+    materializeHeaders();
+    HttpHeadersType result;
+    for(std::size_t i = 0; i < _headers.size(); i++) {
+        std::string key = _headers.name(i);
+        HttpHeader::canonicalKey(key);
+        if( result.find(key) == result.end() )
+            result[key] = _headers.joinedValues(i);
+    }
+    return result;
+}
 std::string
 MessageBase::str(){
     std::ostringstream ss;
     ss << "HTTP/" << httpVersMajor() << "." << httpVersMinor() << " " << statusCode() << " " << status() << "\r\n";
-    std::map<std::string, std::string>::iterator it = _headers.begin();
-    while(it != _headers.end())
-    {
-        ss << it->first << ": " << it->second << "\r\n";
-        it++;
+    materializeHeaders();
+    for(std::size_t i = 0; i < _headers.size(); i++) {
+        ss.write(_headers.nameData(i), _headers.nameLength(i));
+        ss << ": ";
+        ss.write(_headers.valueData(i), _headers.valueLength(i));
+        ss << "\r\n";
     }
     ss << "\r\n";
     return ss.str();
@@ -178,18 +328,20 @@ MessageBase::str(){
 void
 MessageBase::dumpHeaders(std::ostream& os)
 {
-    std::map<std::string, std::string>::iterator it = _headers.begin();
-    while(it != _headers.end())
-    {
-        os<<it->first<<" : "<<it->second<<std::endl;
-        it++;
-        }
-        
+    materializeHeaders();
+    for(std::size_t i = 0; i < _headers.size(); i++) {
+        os << _headers.name(i) << " : " << _headers.value(i) << std::endl;
+    }
 }
 void
-MessageBase::setTrailer(std::string key, std::string value){ _trailers[key] = value; };
+MessageBase::materializeHeaders(){}
+
+void
+MessageBase::setTrailer(std::string key, std::string value){ _trailers.set(key, value); };
 bool
-MessageBase::hasTrailer( std::string key){ return ( _trailers.find(key) != _trailers.end() ); };
+MessageBase::hasTrailer( std::string key){ return _trailers.has(key); };
+HeaderTable&
+MessageBase::trailers(){ return _trailers; }
 std::string
-MessageBase::trailer(std::string key){if( hasTrailer(key) ){return _trailers[key];} else{ return nullptr;} }
+MessageBase::trailer(std::string key){if( hasTrailer(key) ){return _trailers.value(_trailers.find(key));} else{ return nullptr;} }
     
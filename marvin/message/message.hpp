@@ -6,6 +6,8 @@
 #include "bufferV2.hpp"
 #include "http_parser.h"
 #include "boost_stuff.hpp"
+#include "http_header.hpp"
+#include "header_table.hpp"
 
 #pragma once
 #pragma mark - http message interfaces
@@ -46,6 +48,7 @@ public:
     virtual int  httpVersMinor() = 0 ;
 
     virtual void setHeader(std::string key, std::string value) = 0 ;
+    virtual void addHeader(const char* key, std::size_t key_length, const char* value, std::size_t value_length) = 0;
     virtual std::string header(std::string key) = 0;
     
     virtual void setTrailer(std::string key, std::string value) = 0;
@@ -60,11 +63,27 @@ public:
 class MessageBase;
 typedef std::shared_ptr<MessageBase> MessageBaseSPtr;
 
+/**
+* the exact number of bytes in the first line and headers of msg, including the blank line
+*/
+std::size_t serializedHeadersSize(MessageBase& msg);
+/**
+* The first line and headers of msg in wire format, in a pooled buffer of exactly
+* serializedHeadersSize(msg) bytes
+*/
+MBufferSPtr serializeHeaders(MessageBase& msg);
+
 class MessageBase : public MessageInterface
 {
 public:
     MessageBase();
     ~MessageBase();
+    
+    /**
+    * Returns the message to the state of a newly constructed one so the object
+    * can be reused for the next message. Keeps the memory of the header tables
+    */
+    void clear();
     void setStatusCode(int sc);
     void setStatus(std::string st);
     int  statusCode();
@@ -85,30 +104,63 @@ public:
     void setHttpVersMinor(int minor);
     int  httpVersMinor();
     
+    /**
+    * setHeader replaces every header with the same name (in any case), addHeader appends
+    * one more - for headers that may be repeated such as Set-Cookie. Names keep their case
+    */
     void setHeader(std::string key, std::string value);
-    bool hasHeader( std::string key);
+    void setHeader(HttpHeader::Id id, std::string value);
+    void addHeader(const char* key, std::size_t key_length, const char* value, std::size_t value_length);
+    void addHeader(const std::string& key, const std::string& value);
+
+    bool hasHeader(const std::string& key);
+    bool hasHeader(HttpHeader::Id id);
     std::string header(std::string key);
     
-    void removeHeader( std::string key);
+    void removeHeader(const std::string& key);
+    void removeHeader(HttpHeader::Id id);
     
-    std::string getHeader(std::string key);
+    /**
+    * the value of the first header with that name - throws if there is none so test with
+    * hasHeader() first
+    */
+    std::string getHeader(const std::string& key);
+    std::string getHeader(HttpHeader::Id id);
+
+    /**
+    * The header table itself - names in their original case, repeated headers as separate
+    * entries, lookup by HttpHeader::Id without allocating
+    */
+    HeaderTable& headers();
 
-    std::map<std::string, std::string>& getHeaders();
+    /**
+    * A copy of the headers in the old map form - keys in canonical (upper case) form and the
+    * values of a repeated header joined with ", ". Set-Cookie values cannot be joined so the
+    * map has only the first one, callers that want them all iterate headers()
+    */
+    HttpHeadersType getHeaders();
     
     std::string  str();
     void    dumpHeaders(std::ostream& os);
     void    setTrailer(std::string key, std::string value);
     bool    hasTrailer( std::string key);
     std::string trailer(std::string key);
+    HeaderTable& trailers();
 
     void    setIsRequest(bool flag);
     bool    isRequest();
     
     friend std::string traceMessage(MessageBase& msg);
-    friend void serializeHeaders(MessageBase& msg, MBuffer& buf);
-//    friend void serializeHeaders(MessageBase& msg, boost::asio::streambuf& buf);
+    friend std::size_t serializedHeadersSize(MessageBase& msg);
+    friend MBufferSPtr serializeHeaders(MessageBase& msg);
 
 protected:
+    /**
+    * Called by every method that reads or modifies _headers before it touches the table.
+    * A derived class that records headers lazily (see MessageReaderV2) overrides this to
+    * copy them into _headers the first time they are needed. The default does nothing
+    */
+    virtual void materializeHeaders();
 
     bool                                _is_request;
     enum http_method  					_method;
@@ -120,8 +172,8 @@ protected:
 
     int									_http_major;
     int									_http_minor;
-    std::map<std::string, std::string>	_headers;
-    std::map<std::string, std::string>	_trailers;
+    HeaderTable                         _headers;
+    HeaderTable                         _trailers;
     
 };
 
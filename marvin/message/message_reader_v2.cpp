@@ -2,11 +2,13 @@
 #include <iostream>
 #include <iterator>
 #include <algorithm>
+#include <cstring>
 #include "catch.hpp"
 #include "boost_stuff.hpp"
 #include "bufferV2.hpp"
 #include "message.hpp"
 #include "parser.hpp"
+#include "http_header.hpp"
 #include "rb_logger.hpp"
 
 RBLOGGER_SETLEVEL(LOG_LEVEL_DEBUG)
@@ -25,6 +27,10 @@ std::string traceReader(MessageReaderV2& rdr)
 #pragma mark - class default constants
 std::size_t MessageReaderV2::__headerBufferSize = 10000;
 std::size_t MessageReaderV2::__bodyBufferSize = 20000;
+std::size_t MessageReaderV2::__spillThreshold = 0;
+long MessageReaderV2::__idleTimeoutMs = 60000;
+long MessageReaderV2::__headerTimeoutMs = 30000;
+long MessageReaderV2::__bodyTimeoutMs = 60000;
 
 #pragma mark - static functions to do once only config for the class
 /**
@@ -44,19 +50,59 @@ void MessageReaderV2::configSet_HeaderBufferSize(long bsize)
 {
     __headerBufferSize = bsize;
 }
+/**
+* Called at program startup to set the body size above which readMessage()
+* moves the body to a temporary file. Zero (the default) means never.
+*/
+void MessageReaderV2::configSet_SpillThreshold(std::size_t bytes)
+{
+    __spillThreshold = bytes;
+}
+/**
+* Called at program startup to set the read deadlines. They are set on the socket with
+* setReadDeadline(), a read that passes one completes with Marvin::errc::timeout
+*/
+void MessageReaderV2::configSet_IdleTimeout(long millisecs)
+{
+    __idleTimeoutMs = millisecs;
+}
+void MessageReaderV2::configSet_HeaderTimeout(long millisecs)
+{
+    __headerTimeoutMs = millisecs;
+}
+void MessageReaderV2::configSet_BodyTimeout(long millisecs)
+{
+    __bodyTimeoutMs = millisecs;
+}
 #pragma mark - constructor
 
-MessageReaderV2::MessageReaderV2( boost::asio::io_service& io, ReadSocketInterfaceSPtr readSock): _io(io), _readSock(readSock)
+MessageReaderV2::MessageReaderV2( boost::asio::io_service& io, ReadSocketInterfaceSPtr readSock): _io(io), _readSock(readSock), _budget_timer(io)
 {
     LogTorTrace();
     _body_buffer_size   = __bodyBufferSize;
     _header_buffer_size = __headerBufferSize;
-    _header_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_header_buffer_size));
+    _header_buffer_sptr = m_buffer(_header_buffer_size);
+    _header_read_sptr = nullptr;
+    _header_pending = 0;
+    _header_arena_start = 0;
+    _leftover_offset = 0;
+    _leftover_length = 0;
+    _reading_full_message = false;
+    _reading_body = false;
+    _awaiting_first_byte = false;
+    _connection_busy = false;
+    _readBodyStarted = false;
+    _body_start_ptr = nullptr;
+    _body_buffer_chain_sptr = std::make_shared<BufferChain>();
+    _raw_body_buffer_chain_sptr = std::make_shared<BufferChain>();
+    // bytes after the end of a message are kept for the next one
+    setStreamingOption(true);
 }
 
 /**
 * Destructor - nothing to do. All pointers held by an instance
-* are smart pointers.
+* are smart pointers. A body read parked on the BufferBudget is cancelled
+* by dropping _budget_wait and _budget_timer.
 */
 MessageReaderV2::~MessageReaderV2()
 {
@@ -69,16 +115,111 @@ MessageReaderV2::~MessageReaderV2()
 /*!
 * accesses the BufferChain containing the de-chunked body data
 */
-BufferChain MessageReaderV2::get_body_chain()
+BufferChainSPtr MessageReaderV2::get_body_chain()
 {
-    return _body_buffer_chain;
+    return _body_buffer_chain_sptr;
 }
 /*!
 * accesses the BufferChain containing the raw (not de-chunked) body data
 */
-BufferChain MessageReaderV2::get_raw_body_chain()
+BufferChainSPtr MessageReaderV2::get_raw_body_chain()
+{
+    return _raw_body_buffer_chain_sptr;
+}
+/*!
+* accesses the file holding the body data - nullptr unless the body was spilled
+*/
+BodyFileSPtr MessageReaderV2::get_body_file()
+{
+    return _body_file_sptr;
+}
+/*!
+* the number of bytes already read that belong to the next message
+*/
+std::size_t MessageReaderV2::leftover()
+{
+    return _leftover_length;
+}
+#pragma mark - reuse
+/*!
+* Discards the current message and prepares for the next one on the same connection.
+* Buffers and chains are reused when the reader is their only owner, otherwise they are
+* left to whoever still has them and fresh ones are made.
+*/
+void MessageReaderV2::reset()
+{
+    LogDebug(" fd: ", _readSock->nativeSocketFD());
+    setUpNextMessage();
+    clear();
+    _reading_full_message = false;
+    _reading_body = false;
+    _awaiting_first_byte = false;
+    _readBodyStarted = false;
+    _body_file_sptr = nullptr;
+    _body_file_err = Marvin::make_error_ok();
+    _parse_buffer_sptr = nullptr;
+    if( _body_buffer_chain_sptr.use_count() == 1 ) {
+        _body_buffer_chain_sptr->clear();
+    } else {
+        _body_buffer_chain_sptr = std::make_shared<BufferChain>();
+    }
+    if( _raw_body_buffer_chain_sptr.use_count() == 1 ) {
+        _raw_body_buffer_chain_sptr->clear();
+    } else {
+        _raw_body_buffer_chain_sptr = std::make_shared<BufferChain>();
+    }
+    _body_start_ptr = nullptr;
+    {
+        MBufferSPtr lo = std::move(_leftover_sptr);
+        _load_pending(lo, _leftover_offset, _leftover_length);
+    }
+    _leftover_offset = 0;
+    _leftover_length = 0;
+    if( _body_buffer_shared() ) {
+        _body_buffer_sptr = nullptr;
+    }
+}
+/*!
+* Moves the bytes previous read past the end of its message into this reader
+*/
+void MessageReaderV2::takeLeftover(MessageReaderV2& previous)
 {
-    return _raw_body_buffer_chain;
+    MBufferSPtr lo = std::move(previous._leftover_sptr);
+    std::size_t offset = previous._leftover_offset;
+    std::size_t len = previous._leftover_length;
+    previous._leftover_offset = 0;
+    previous._leftover_length = 0;
+    _load_pending(lo, offset, len);
+}
+/**
+* Puts len bytes of from (starting at offset) at the front of the header arena, they are parsed
+* by the next read of headers. The arena can only be overwritten if no slice of the previous
+* message refers to it
+*/
+void MessageReaderV2::_load_pending(MBufferSPtr from, std::size_t offset, std::size_t len)
+{
+    long owners = (from == _header_buffer_sptr) ? 2 : 1;
+    if( (_header_buffer_sptr.use_count() > owners) || (len > _header_buffer_sptr->capacity()) ) {
+        _header_buffer_sptr = m_buffer(std::max(_header_buffer_size, len));
+    }
+    if( len > 0 ) {
+        memmove(_header_buffer_sptr->data(), (char*)from->data() + offset, len);
+    }
+    _header_buffer_sptr->setSize(0);
+    _header_pending = len;
+}
+/**
+* Called after a parse that completed the message. Remembers where the bytes of buf
+* after the end of the message are, they are the start of the next message
+*/
+void MessageReaderV2::_save_leftover(MBufferSPtr buf, char* parse_ptr, std::size_t bytes, int nparsed)
+{
+    if( (nparsed < 0) || ((std::size_t)nparsed >= bytes) )
+        return;
+    _leftover_sptr = buf;
+    _leftover_offset = (parse_ptr - (char*)buf->data()) + nparsed;
+    _leftover_length = bytes - nparsed;
+    LogDebug("carrying over ", _leftover_length, " bytes fd: ", _readSock->nativeSocketFD());
 }
 #pragma mark - public interface read methods
 /**
@@ -102,13 +243,15 @@ void MessageReaderV2::readHeaders(std::function<void(Marvin::ErrorType)> cb)
 * An interface method that is called to initiate an async read of some body data.
 * Result is returned via the callback
 */
-void MessageReaderV2::readBody(std::function<void(Marvin::ErrorType err, BufferChain chunk)> cb)
+void MessageReaderV2::readBody(std::function<void(Marvin::ErrorType err, BufferChainSPtr chunk)> cb)
 {
     _read_body_cb = cb;
     _reading_body = true;
-    if (_body_buffer_chain.size() > 0) {
-        post_body_chunk_cb(Marvin::make_error_ok(), _body_buffer_chain);
-        _body_buffer_chain.clear();
+    if (_body_buffer_chain_sptr->size() > 0) {
+        post_body_chunk_cb(Marvin::make_error_ok(), _take_body_chain());
+    } else if( isFinishedMessage() ) {
+        // all the body arrived with an earlier read - do not read into the next message
+        post_body_chunk_cb(Marvin::make_error_eom(), _take_body_chain());
     } else {
         _read_body_chunk();
     }
@@ -134,28 +277,61 @@ void MessageReaderV2::OnMessageComplete(MessageInterface* msg){
 */
 void MessageReaderV2::OnHeadersComplete(MessageInterface* msg, void* body_start_ptr, std::size_t remainder)
 {
-    if (remainder > 0) {
-        MBufferSPtr tmp = std::shared_ptr<MBuffer>(new MBuffer(remainder));
-        tmp->append(body_start_ptr, remainder);
-        _raw_body_buffer_chain.push_back(tmp);
-    }
+    // remainder may run on into the next message, _handle_header_read() takes the
+    // raw body slice once it knows how much of the buffer the parser consumed
+    _body_start_ptr = (remainder > 0) ? (char*)body_start_ptr : nullptr;
     LogDebug("");
 }
 
 MessageInterface* MessageReaderV2::currentMessage(){  return this; }
 
+/**
+* Overrides a MessageBase virtual method.
+* Copies the header spans recorded by the parser out of the header arena into the _headers table.
+* Nothing happens until the headers are complete, and only once per message.
+*/
+void MessageReaderV2::materializeHeaders()
+{
+    if( (! isFinishedHeaders()) || header_spans.empty() )
+        return;
+    const char* base = (const char*)_header_buffer_sptr->data();
+    for(HeaderSpan& span : header_spans) {
+        _headers.add(base + span.name_offset, span.name_length, base + span.value_offset, span.value_length);
+        std::size_t i = _headers.size() - 1;
+        char* value = _headers.valueData(i);
+        char* value_end = value + _headers.valueLength(i);
+        if( std::find(value, value_end, '\n') != value_end ) {
+            // an obsolete folded value - the span includes the line breaks
+            std::replace(value, value_end, '\r', ' ');
+            std::replace(value, value_end, '\n', ' ');
+        }
+    }
+    header_spans.clear();
+}
+
 /**
 * Overrides a Parser virtual method.
 * Called whenever the http_parser sees a piece of body data
 *
 * This function is the only place where each piece of body data whether chunked or not
 * is seen. Hence the only place to catch body data reliably.
+*
+* The data is not copied. buf always points into the buffer currently being parsed
+* (_parse_buffer_sptr) so the body chain just gets a slice of that buffer.
+*
+* Once the body has been spilled the data goes to the file instead. A failed write cannot be
+* reported from inside the parser so it is remembered in _body_file_err and the read handler
+* fails the read when appendBytes() returns.
 */
 void MessageReaderV2::OnBodyData(void* buf, int len)
 {
-    MBufferSPtr tmp = std::shared_ptr<MBuffer>(new MBuffer(len));
-    tmp->append(buf, len);
-    _body_buffer_chain.push_back(tmp);
+    if( _body_file_sptr != nullptr ) {
+        if( (! _body_file_err) && (! _body_file_sptr->append(buf, len)) ) {
+            _body_file_err = boost::system::errc::make_error_code(boost::system::errc::io_error);
+        }
+    } else {
+        _body_buffer_chain_sptr->push_back(buffer_slice(_parse_buffer_sptr, buf, len));
+    }
 }
 
 void MessageReaderV2::OnChunkBegin(int chunkLength) { LogDebug("");}
@@ -173,6 +349,7 @@ void MessageReaderV2::read_message(std::function<void(Marvin::ErrorType err)> cb
 {
     _reading_full_message = true;
     _read_message_cb = cb;
+    _start_header_deadline();
     this->_read_some_headers();
 }
 /**
@@ -184,9 +361,36 @@ void MessageReaderV2::read_headers(std::function<void(Marvin::ErrorType err)> cb
 {
     _reading_full_message = false;
     _read_message_cb = cb;
+    _start_header_deadline();
     this->_read_some_headers();
 }
 /**
+* Until the first byte of a message arrives the connection is idle and gets the idle timeout,
+* unless it is busy sending earlier responses. From the first byte the headers have to be
+* complete within the header timeout
+*/
+void MessageReaderV2::_start_header_deadline()
+{
+    _awaiting_first_byte = (_header_pending == 0);
+    if( ! _awaiting_first_byte ) {
+        _readSock->setReadDeadline(__headerTimeoutMs);
+    } else {
+        _readSock->setReadDeadline(_connection_busy ? 0 : __idleTimeoutMs);
+    }
+}
+/*!
+* Only changes the deadline of a read that is waiting for the first byte of a message
+*/
+void MessageReaderV2::setConnectionBusy(bool busy)
+{
+    if( busy == _connection_busy )
+        return;
+    _connection_busy = busy;
+    if( _awaiting_first_byte ) {
+        _readSock->setReadDeadline(_connection_busy ? 0 : __idleTimeoutMs);
+    }
+}
+/**
 * The first step in a two part async loop that reads all headers (until headersComplete)
 * This function sets up and initiates a read.
 */
@@ -194,8 +398,41 @@ void MessageReaderV2::_read_some_headers()
 {
     LogDebug(" fd: ", _readSock->nativeSocketFD());
     assert( _header_buffer_sptr != nullptr );
+    if( _header_pending > 0 ) {
+        // the start of this message arrived with the previous one and is already in the arena
+        std::size_t n = _header_pending;
+        _header_pending = 0;
+        _header_arena_start = 0;
+        _io.post(std::bind(&MessageReaderV2::_handle_header_read, this, Marvin::make_error_ok(), n));
+        return;
+    }
     auto h = std::bind(&MessageReaderV2::_handle_header_read, this, std::placeholders::_1, std::placeholders::_2);
-    _readSock->asyncRead(*_header_buffer_sptr, h);
+    // remembered because the connection sets the size of the buffer it reads into
+    _header_arena_start = _header_buffer_sptr->size();
+    if( _header_arena_start == 0 ) {
+        _readSock->asyncRead(*_header_buffer_sptr, h);
+    } else {
+        // headers are split across reads - read elsewhere and append to the arena
+        if( _header_read_sptr == nullptr )
+            _header_read_sptr = m_buffer(_header_buffer_size);
+        _header_read_sptr->empty();
+        _readSock->asyncRead(*_header_read_sptr, h);
+    }
+}
+/**
+* Appends the bytes from a continuation read to the header arena. If there is no room the
+* arena is moved to a bigger buffer. Spans are offsets so they survive the move, and no slice
+* of the arena has been handed out before the headers are complete.
+*/
+void MessageReaderV2::_append_to_header_arena(void* data, std::size_t len)
+{
+    MBuffer& arena = *_header_buffer_sptr;
+    if( arena.size() + len > arena.capacity() ) {
+        MBufferSPtr bigger = m_buffer(std::max(2 * arena.capacity(), arena.size() + len));
+        bigger->append(arena.data(), arena.size());
+        _header_buffer_sptr = bigger;
+    }
+    _header_buffer_sptr->append(data, len);
 }
 /**
 * Step two in an async loop to read all headers. This is the async completion
@@ -205,24 +442,49 @@ void MessageReaderV2::_handle_header_read(Marvin::ErrorType er, std::size_t byte
 {
     LogDebug("entry fd: ", _readSock->nativeSocketFD());
     LogDebug("er: ", er.message());
+    if( er == Marvin::errc::timeout ) {
+        post_message_cb(er);
+        return;
+    }
     /**
     * an io error with bytes_transfered == 0 is probably EOF - let the parser handle it
     * otherwise (err && (bytes_transfered > 0)) return with error
     */
     if(er && (bytes_transfered > 0)) {
-        post_message_cb(er);
         LogError("", er.message());
+        post_message_cb(er);
+        return;
+    }
+    if( _awaiting_first_byte && (bytes_transfered > 0) ) {
+        _awaiting_first_byte = false;
+        _readSock->setReadDeadline(__headerTimeoutMs);
     }
 
-    _header_buffer_sptr->setSize(bytes_transfered);
-//    std::cout << *_header_buffer_sptr << std::endl;
-    MBuffer& mb = *_header_buffer_sptr;
-    int  nparsed = this->appendBytes((void*)mb.data(), (int)mb.size());
+    std::size_t start = _header_arena_start;
+    if( start == 0 ) {
+        _header_buffer_sptr->setSize(bytes_transfered);
+    } else {
+        _header_read_sptr->setSize(bytes_transfered);
+        _append_to_header_arena(_header_read_sptr->data(), bytes_transfered);
+    }
+    MBuffer& mb = (start == 0) ? *_header_buffer_sptr : *_header_read_sptr;
+    _parse_buffer_sptr = _header_buffer_sptr;
+    setHeaderArena((const char*)_header_buffer_sptr->data());
+    char* parse_ptr = (char*)_header_buffer_sptr->data() + start;
+    int  nparsed = this->appendBytes((void*)parse_ptr, (int)bytes_transfered);
     if( ! parser_ok(nparsed, mb)) {
         post_message_cb(Marvin::make_error_parse());
         return;
     }
-    
+    // the body bytes that came with the headers, only collected by readMessage()
+    char* consumed_end = parse_ptr + nparsed;
+    if( _reading_full_message && (_body_start_ptr != nullptr) && (consumed_end > _body_start_ptr) ) {
+        _raw_body_buffer_chain_sptr->push_back(buffer_slice(_header_buffer_sptr, _body_start_ptr, consumed_end - _body_start_ptr));
+    }
+    _body_start_ptr = nullptr;
+    if( isFinishedMessage() ) {
+        _save_leftover(_header_buffer_sptr, parse_ptr, bytes_transfered, nparsed);
+    }
 
     if( isFinishedMessage() ) {
         post_message_cb(Marvin::make_error_ok());
@@ -232,6 +494,10 @@ void MessageReaderV2::_handle_header_read(Marvin::ErrorType er, std::size_t byte
         } else {
             post_message_cb(Marvin::make_error_ok());
         }
+    } else if( er ) {
+        // EOF, or the connection closed under the read, before a message started - the
+        // parser accepts that quietly and reading again would fail the same way for ever
+        post_message_cb(er);
     } else if( ! isFinishedHeaders() ) {
         _read_some_headers();
     }
@@ -243,17 +509,28 @@ void MessageReaderV2::_handle_header_read(Marvin::ErrorType er, std::size_t byte
 void MessageReaderV2::_read_all_body()
 {
 //    _body_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_body_buffer_size));
-    _make_new_body_buffer();
     _read_some_body();
 }
 /**
 * First part of an async loop that reads all body data. This method
-* sets up and initiates an async read
+* sets up and initiates an async read into a new buffer.
+*
+* If the process wide BufferBudget is exhausted the read (and the buffer allocation)
+* is deferred until enough buffer memory has been released.
 */
 void MessageReaderV2::_read_some_body()
 {
     LogDebug(" fd: ", _readSock->nativeSocketFD());
+    if( BufferBudget::isExhausted() ) {
+        LogWarn("buffer budget exhausted - deferring body read fd: ", _readSock->nativeSocketFD());
+        _defer_body_read(std::bind(&MessageReaderV2::_read_some_body, this), [this](){
+            post_message_cb(Marvin::make_error_timeout());
+        });
+        return;
+    }
+    _make_new_body_buffer();
     auto h = std::bind(&MessageReaderV2::_handle_body_read, this, std::placeholders::_1, std::placeholders::_2);
+    _readSock->setReadDeadline(__bodyTimeoutMs);
     _readSock->asyncRead(*_body_buffer_sptr, h);
 }
 /**
@@ -263,31 +540,45 @@ void MessageReaderV2::_read_some_body()
 void MessageReaderV2::_handle_body_read(Marvin::ErrorType er, std::size_t bytes_transfered)
 {
     LogDebug("entry fd: ", _readSock->nativeSocketFD());
+    if( er == Marvin::errc::timeout ) {
+        post_message_cb(er);
+        return;
+    }
     /**
     * an io error with bytes_transfered == 0 is probably EOF - let the parser handle it
     * otherwise (err && (bytes_transfered > 0)) return with error
     */
     if(er && (bytes_transfered > 0)) {
-        post_message_cb(er);
         LogError("", er.message());
+        post_message_cb(er);
+        return;
     }
     _body_buffer_sptr->setSize(bytes_transfered);
-    MBufferSPtr tmp = std::shared_ptr<MBuffer>(new MBuffer(bytes_transfered));
-    tmp->append(_body_buffer_sptr->data(), _body_buffer_sptr->size());
-//    std::cout << std::endl << __FUNCTION__ << ": " << tmp->toString() << std::endl;
-    _raw_body_buffer_chain.push_back(tmp);
     
+    _parse_buffer_sptr = _body_buffer_sptr;
     MBuffer& mb = *_body_buffer_sptr;
     int  nparsed = this->appendBytes((void*)mb.data(), (int)mb.size());
     if( ! parser_ok(nparsed, mb)) {
         post_message_cb(Marvin::make_error_parse());
         return;
     }
+    if( _body_file_err ) {
+        LogError("write to body file failed fd: ", _readSock->nativeSocketFD());
+        post_message_cb(_body_file_err);
+        return;
+    }
+    // only the bytes that belong to this message are raw body
+    if( (_body_file_sptr == nullptr) && (nparsed > 0) ) {
+        _raw_body_buffer_chain_sptr->push_back(buffer_slice(_body_buffer_sptr, mb.data(), nparsed));
+    }
+    if( isFinishedMessage() ) {
+        _save_leftover(_body_buffer_sptr, (char*)mb.data(), bytes_transfered, nparsed);
+    }
+    _spill_body_if_needed();
     
     if( isFinishedMessage()) {
         post_message_cb(Marvin::make_error_ok());
     } else {
-        _make_new_body_buffer();
 //        _body_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_body_buffer_size));
         _read_some_body();
     }
@@ -298,15 +589,29 @@ void MessageReaderV2::_handle_body_read(Marvin::ErrorType er, std::size_t bytes_
 * Called by interface method readBody()
 * Initiates the process of reading ONE chunk of body data. Sets up
 * a read and completion handler. No looping for this
+*
+* Like _read_some_body() the read is deferred while the BufferBudget is exhausted.
 */
 void MessageReaderV2::_read_body_chunk()
 {
     LogDebug(" fd: ", _readSock->nativeSocketFD());
+    if( BufferBudget::isExhausted() ) {
+        LogWarn("buffer budget exhausted - deferring body read fd: ", _readSock->nativeSocketFD());
+        _defer_body_read(std::bind(&MessageReaderV2::_read_body_chunk, this), [this](){
+            post_body_chunk_cb(Marvin::make_error_timeout(), _take_body_chain());
+        });
+        return;
+    }
     auto h = std::bind(&MessageReaderV2::_handle_body_chunk, this, std::placeholders::_1, std::placeholders::_2);
-    if(_body_buffer_sptr == nullptr) {
+    /**
+    * slices handed out by the previous readBody() may still refer to the current buffer,
+    * only read into it again if nobody else is holding on to it
+    */
+    if((_body_buffer_sptr == nullptr) || _body_buffer_shared()) {
         _make_new_body_buffer();
 //        _body_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_body_buffer_size));
     }
+    _readSock->setReadDeadline(__bodyTimeoutMs);
     _readSock->asyncRead(*_body_buffer_sptr, h);
 }
 /**
@@ -315,44 +620,113 @@ void MessageReaderV2::_read_body_chunk()
 void MessageReaderV2::_handle_body_chunk(Marvin::ErrorType er, std::size_t bytes_transfered)
 {
     LogDebug("entry fd: ", _readSock->nativeSocketFD());
+    if( er == Marvin::errc::timeout ) {
+        post_body_chunk_cb(er, _take_body_chain());
+        return;
+    }
     /**
     * an io error with bytes_transfered == 0 is probably EOF - let the parser handle it
     * otherwise (err && (bytes_transfered > 0)) return with error
     */
     if(er && (bytes_transfered > 0)) {
-        post_body_chunk_cb(er, _body_buffer_chain);
         LogError("", er.message());
+        post_body_chunk_cb(er, _take_body_chain());
+        return;
     }
     
     _body_buffer_sptr->setSize(bytes_transfered);
-    MBufferSPtr tmp = std::shared_ptr<MBuffer>(new MBuffer(bytes_transfered));
-    _raw_body_buffer_chain.push_back(tmp);
     
+    _parse_buffer_sptr = _body_buffer_sptr;
     MBuffer& mb = *_body_buffer_sptr;
     int  nparsed = this->appendBytes((void*)mb.data(), (int)mb.size());
     if( ! parser_ok(nparsed, mb)) {
-        post_body_chunk_cb(Marvin::make_error_parse(), _body_buffer_chain);
+        post_body_chunk_cb(Marvin::make_error_parse(), _take_body_chain());
         return;
     }
-    
+    if( isFinishedMessage() ) {
+        _save_leftover(_body_buffer_sptr, (char*)mb.data(), bytes_transfered, nparsed);
+    }
 
     if( isFinishedMessage()) {
-        post_body_chunk_cb(Marvin::make_error_eom(), _body_buffer_chain);
-        _body_buffer_chain.clear();
+        post_body_chunk_cb(Marvin::make_error_eom(), _take_body_chain());
     } else {
-        post_body_chunk_cb(Marvin::make_error_ok(), _body_buffer_chain);
-        _body_buffer_chain.clear();
+        post_body_chunk_cb(Marvin::make_error_ok(), _take_body_chain());
 //        _make_new_body_buffer();
 //        _body_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_body_buffer_size));
     }
 }
 #pragma mark - buffer management
 /**
+* Parks a body read on the BufferBudget until a body buffer can be allocated, then calls retry.
+* The body timeout keeps running while the read is parked, if it passes first the wait is
+* cancelled and expired reports the timeout instead.
+*/
+void MessageReaderV2::_defer_body_read(std::function<void()> retry, std::function<void()> expired)
+{
+    _budget_wait = BufferBudget::whenAvailable(_io, _body_buffer_size, [this, retry](){
+        _budget_timer.cancel();
+        _budget_wait = nullptr;
+        retry();
+    });
+    if( __bodyTimeoutMs > 0 ) {
+        _budget_timer.expiresIn(__bodyTimeoutMs, [this, expired](){
+            LogWarn("body read timed out waiting for the buffer budget fd: ", _readSock->nativeSocketFD());
+            _budget_wait = nullptr;
+            expired();
+        });
+    }
+}
+/**
+* True if anything but the reader's own pointers still refers to the body buffer - a slice handed
+* out by readBody() or carried over bytes of the next message for example. The buffer
+* is only read into again when it is not shared
+*/
+bool MessageReaderV2::_body_buffer_shared()
+{
+    long owners = (_parse_buffer_sptr == _body_buffer_sptr) ? 2 : 1;
+    return (_body_buffer_sptr != nullptr) && (_body_buffer_sptr.use_count() > owners);
+}
+/**
 * Creates a shared pointer to a single new buffer for reading body data.
 */
 void MessageReaderV2::_make_new_body_buffer()
 {
-    _body_buffer_sptr = std::shared_ptr<MBuffer>(new MBuffer(_body_buffer_size));
+    _body_buffer_sptr = m_buffer(_body_buffer_size);
+}
+/**
+* Called after each body read of readMessage(). Once the de-chunked body passes the
+* spill threshold it is written to a BodyFile and the in memory chains are released,
+* from then on OnBodyData() appends straight to the file.
+* If the file cannot be created the body simply stays in memory.
+*/
+void MessageReaderV2::_spill_body_if_needed()
+{
+    if( (__spillThreshold == 0) || (_body_file_sptr != nullptr) )
+        return;
+    if( _body_buffer_chain_sptr->size() <= __spillThreshold )
+        return;
+    BodyFileSPtr bf = BodyFile::create();
+    if( bf == nullptr )
+        return;
+    for(BufferSlice& slice : *_body_buffer_chain_sptr) {
+        if( ! bf->append(slice.data(), slice.size()) )
+            return;
+    }
+    LogInfo("body spilled to disk fd: ", _readSock->nativeSocketFD(), " size: ", bf->size());
+    _body_file_sptr = bf;
+    _body_buffer_chain_sptr->clear();
+    _raw_body_buffer_chain_sptr->clear();
+}
+/**
+* Hands the body data collected so far to the caller and starts a new, empty chain.
+* The reader keeps no reference to the chain it returns so it can be passed on
+* (to a writer for example) without copying.
+*/
+BufferChainSPtr MessageReaderV2::_take_body_chain()
+{
+    BufferChainSPtr tmp = std::move(_body_buffer_chain_sptr);
+    _body_buffer_chain_sptr = std::make_shared<BufferChain>();
+    return tmp;
 }
 
 #pragma mark - post method for scheduling a callback to run later on the runloop
@@ -373,16 +747,18 @@ void MessageReaderV2::post_message_cb(Marvin::ErrorType er)
 * _read_body_cb is a property that stores the address of the
 * callback provided to readBody();
 */
-void MessageReaderV2::post_body_chunk_cb(Marvin::ErrorType er, BufferChain chain)
+void MessageReaderV2::post_body_chunk_cb(Marvin::ErrorType er, BufferChainSPtr chain)
 {
-    auto pf = std::bind(_read_body_cb, er, chain);
-    _io.post(pf);
+    auto cb = _read_body_cb;
+    _io.post([cb, er, chain](){
+        cb(er, chain);
+    });
 }
 #pragma mark - error related functions
 bool MessageReaderV2::parser_ok(int nparsed, MBuffer& mb)
 {
     if( nparsed != (int)mb.size()) {
-        LogWarn("some next message in buffer");
+        LogDebug("some next message in buffer - carried over");
     }
     /**
     * if parser status is OK or if (http_parser->errno == HPE_PAUSED && isFinishedMessage())
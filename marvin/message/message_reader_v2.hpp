@@ -8,18 +8,16 @@
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "bufferV2.hpp"
+#include "body_file.hpp"
 #include "message.hpp"
 #include "parser.hpp"
+#include "timing_wheel.hpp"
 #include "rb_logger.hpp"
 
 #include "read_socket_interface.hpp"
 #include "callback_typedefs.hpp"
 
 /**
-    *
-    * NOTE : current implementation binds the message to the reader so a reader
-    * can only read one message and then needs to be discarded
-    *
  * Instances of this class represent an incoming http(s) response message from a socket/stream.
  * Please note the "incoming" because the MessageReader is seeking to provide a dynamic interface
  * so that other components can start interacting with the reader (and the message) once the headers
@@ -37,16 +35,42 @@
  * that contains the message headers. From this buffer the MessageReaders fills in the various header
  * and first line fields and never has to pass that buffer up to the "user" components.
  *
+ * The header buffer is also the header arena. The parser runs in header span mode
+ * (see Parser::setHeaderArena) so no header name or value is copied while parsing, each is
+ * recorded as a HeaderSpan into the arena and only turned into strings in _headers the
+ * first time a MessageBase header method is called. If the headers do not arrive in one read
+ * the following reads go into a separate buffer (_header_read_sptr) and are appended to the
+ * arena, which is moved to a larger buffer if it fills up, so that all header bytes stay contiguous.
+ * The trailers of a chunked message arrive with the body, outside the arena, so the parser copies
+ * them into the message trailers instead.
+ *
  * Body data is buffered differently, there are reasons for this:
  *  -   to implementpromote a"streaming" interface where the next available chunk of body data is return
  *      through a readBody() call.
  *  -   secondly the body data is DE_CHUNKED. Which means that a block of incoming data that may be contiguous
- *      when read, may have holes in it after the DE-CHUNKING process(the chunk headers need to be ignored). To limit copying
- *      the concept of a BufferChain was introduced. Each data chunk is stored a contiguous
- *      buffer and a collection of such buffers are stored non-contiguously in a BufferChain(
- *      (shared pointer to each buffer being retained in a std::vector). This is the structure that
+ *      when read, may have holes in it after the DE-CHUNKING process(the chunk headers need to be ignored). To
+ *      avoid copying, each piece of body data is recorded as a BufferSlice of the buffer it was read into
+ *      and the slices are collected in a BufferChain. This is the structure that
  *      is returned to the called for readMessage() and readBody(). These buffers can easily be used a boost buffer
  *      sequence for i/o.
+ *  -   a read buffer is only reused when no slice handed out by a previous readBody() still refers to it,
+ *      otherwise a fresh buffer is used for the next read.
+ *  -   the raw (not de-chunked) body chain is only collected by readMessage().
+ *
+ * Reuse
+ * =====
+ *
+ * A reader can be used for every message on a connection. After a message has been dealt with
+ * call reset() and then readMessage() or readHeaders() again. The parser runs with the streaming
+ * option on, so any bytes that arrived in the same read as the end of the previous message
+ * (a pipelined request for example) are kept and become the start of the next message -
+ * reset() moves them to the front of the header arena and the next read of headers parses them
+ * before touching the socket. Reuse does not allocate parser state, and the header arena and body
+ * chains are recycled unless somebody outside the reader still holds on to them.
+ *
+ * When the previous message must stay untouched (it is still being served while the next request
+ * of a pipeline is read) a fresh reader is used instead and takeLeftover() moves the carried over
+ * bytes from the previous reader to the new one.
  *  
  */
 class MessageReaderV2;
@@ -59,20 +83,23 @@ public:
 
     static void configSet_HeaderBufferSize(long bsize);
     static void configSet_BodyBufferSize(long bsize);
+    static void configSet_SpillThreshold(std::size_t bytes);
+    /// milliseconds to wait for the first byte of a message, 0 for ever. Defaults to 60000
+    static void configSet_IdleTimeout(long millisecs);
+    /// milliseconds from the first byte of a message to the end of its headers, 0 for ever. Defaults to 30000
+    static void configSet_HeaderTimeout(long millisecs);
+    /// milliseconds each body read may wait for data, 0 for ever. Defaults to 60000
+    static void configSet_BodyTimeout(long millisecs);
 
     MessageReaderV2( boost::asio::io_service& io, ReadSocketInterfaceSPtr readSock);
     ~MessageReaderV2();
     /*!
-    *
-    * NOTE : current implementation binds the message to the reader so a reader
-    * can only read one message and then needs to be discarded
-    *
     * Starts the reading process and invokes cb when all headers have been received
     * Passes back an error code to indicate success/failure or maybe even EOM. 
     * The headers can be obtained from the the MessageReader object as it
     * is an instance of MessageBase.
     *
-    * This method should only be called ONCE
+    * This method should only be called ONCE per message, see reset()
     */
     void readHeaders(std::function<void(Marvin::ErrorType err)> cb);
     
@@ -81,15 +108,16 @@ public:
     *  body is signalled by the returned error code being equal to Marvin::make_error_eob() or
     *  or Marvin::make_error_eom()
     *
-    *  The callback to readBody receives an error code and an instance (by value) of a BufferChain
+    *  The callback to readBody receives an error code and a BufferChainSPtr
     *  This is because the body data returned in that buffer is "de-chunked" and the buffer MAY contain
     *  multiple chunk bodies. It was done this way to prevent copying the 
     *  body data to eliminate the chunk headers.
-    *  the callback is responsible for handling the buffer and delete-ing it when appropriate
     *
-    *  The BufferChain will release all the embedded buffers when the value goes out of scope.
+    *  Ownership of the chain passes to the callback, the reader keeps no reference to it, so it can be
+    *  handed straight to MessageWriterV2::asyncWriteBodyData(BufferChainSPtr, ...) without copying.
+    *  The embedded buffers are released when the last reference to the chain goes away.
     */
-    void readBody(std::function<void(Marvin::ErrorType err, BufferChain chunk)>);
+    void readBody(std::function<void(Marvin::ErrorType err, BufferChainSPtr chunk)>);
     
     /*!
     * This method starts the read of a full message including the body of the message. Use of this method
@@ -101,6 +129,11 @@ public:
     * The (de-chunked) body data can be obtained (as a BufferChain) by calling get_body_chain.
     *
     * The raw not-de-chunked body data can be obtained (as a BufferChain) by calling get_raw_body_chain
+    *
+    * If a spill threshold has been set (configSet_SpillThreshold) and the de-chunked body grows
+    * past it, the body is moved to an unlinked temporary file and the rest of the body is written
+    * there as it arrives. In that case get_body_file() returns the file, get_body_chain() is empty
+    * and the raw body chain is no longer collected.
     */
     void readMessage(std::function<void(Marvin::ErrorType err)> cb);
     
@@ -109,26 +142,63 @@ public:
     * !!! need to do better
     */
     
-    BufferChain  get_body_chain();
-    BufferChain  get_raw_body_chain();
+    BufferChainSPtr  get_body_chain();
+    BufferChainSPtr  get_raw_body_chain();
+    
+    /*!
+    * Returns the file holding the body if readMessage() spilled it to disk, otherwise nullptr
+    */
+    BodyFileSPtr     get_body_file();
+    
+    /*!
+    * Readies the reader for the next message on the same connection. The current message
+    * (headers, body chains, body file) is discarded. Bytes already read that belong to the next
+    * message are carried over.
+    */
+    void reset();
+    
+    /*!
+    * The number of bytes already read that belong to the next message
+    */
+    std::size_t leftover();
+    
+    /*!
+    * Moves the bytes previous has already read past the end of its message into this reader,
+    * they become the start of the next message this reader reads. Must be called before reading
+    */
+    void takeLeftover(MessageReaderV2& previous);
+    
+    /*!
+    * Tells the reader whether the connection still owes responses to earlier requests. While it
+    * does a read of headers that has not seen its first byte is not subject to the idle timeout,
+    * clearing it (re)starts the idle timeout from now. Defaults to false
+    */
+    void setConnectionBusy(bool busy);
     
     friend std::string traceReader(MessageReaderV2& rdr);
     
 protected:
     static std::size_t     __headerBufferSize;
     static std::size_t     __bodyBufferSize;
+    static std::size_t     __spillThreshold;
+    static long            __idleTimeoutMs;
+    static long            __headerTimeoutMs;
+    static long            __bodyTimeoutMs;
     //----------------------------------------------------------------------------------------------------
     // private methods
     //----------------------------------------------------------------------------------------------------
     void read_headers(std::function<void(Marvin::ErrorType err)> cb);
     void read_message(std::function<void(Marvin::ErrorType err)> cb);
+    void _start_header_deadline();
     void _read_some_headers();
     void _handle_header_read(Marvin::ErrorType er, std::size_t bytes_transfered);
     
     bool _reading_full_message;
     bool _reading_body;
+    bool _awaiting_first_byte;      /// under the idle timeout, not yet the header timeout
+    bool _connection_busy;          /// responses are still owed, see setConnectionBusy()
     std::function<void(Marvin::ErrorType err)> _read_message_cb;
-    std::function<void(Marvin::ErrorType err, BufferChain chunk)> _read_body_cb;
+    std::function<void(Marvin::ErrorType err, BufferChainSPtr chunk)> _read_body_cb;
     
     void read_body(std::function<void(Marvin::ErrorType err)> cb);
     void _read_all_body();
@@ -139,23 +209,44 @@ protected:
     void _handle_body_chunk(Marvin::ErrorType er, std::size_t bytes_transfered);
     
     // buffer management
-    MBufferSPtr _header_buffer_sptr;
+    MBufferSPtr                     _header_buffer_sptr; /// the header arena
+    MBufferSPtr                     _header_read_sptr;   /// header reads after the first one land here
+    void _append_to_header_arena(void* data, std::size_t len);
+    std::size_t                     _header_pending;    /// bytes at the front of the arena still to be parsed
+    std::size_t                     _header_arena_start;    /// arena size when the current header read started
+
+    /// bytes read past the end of the current message - the start of the next one
+    MBufferSPtr                     _leftover_sptr;
+    std::size_t                     _leftover_offset;
+    std::size_t                     _leftover_length;
+    void _save_leftover(MBufferSPtr buf, char* parse_ptr, std::size_t bytes, int nparsed);
+    void _load_pending(MBufferSPtr from, std::size_t offset, std::size_t len);
     MBufferSPtr                     _body_buffer_sptr;
+    MBufferSPtr                     _parse_buffer_sptr; /// the buffer currently being fed to the parser
     FBufferSharedPtr                _body_fragments_sptr;
+    char*                           _body_start_ptr;    /// first body byte in the read that completed the headers
 
-    BufferChain                     _raw_body_buffer_chain;
-    BufferChain                     _body_buffer_chain;
+    BufferChainSPtr                 _raw_body_buffer_chain_sptr;
+    BufferChainSPtr                 _body_buffer_chain_sptr;
     std::vector<FBufferSharedPtr>   _body_fragments_chain;
 
     void _make_new_body_buffer();
+    bool _body_buffer_shared();
+    void _defer_body_read(std::function<void()> retry, std::function<void()> expired);
+    BufferBudget::WaitHandle        _budget_wait;   /// a body read parked on the BufferBudget
     void post_message_cb(Marvin::ErrorType er);
-    void post_body_chunk_cb(Marvin::ErrorType er, BufferChain chain);
+    BufferChainSPtr _take_body_chain();
+    void _spill_body_if_needed();
+    BodyFileSPtr                    _body_file_sptr;
+    Marvin::ErrorType               _body_file_err;     /// a failed append to _body_file_sptr
+    void post_body_chunk_cb(Marvin::ErrorType er, BufferChainSPtr chain);
     bool parser_ok(int nparsed, MBuffer& mb);
 
     /**
     *  These methods are overridesa for virtual methods in Paser 
     */
     MessageInterface* currentMessage();
+    void materializeHeaders();
     void OnHeadersComplete(MessageInterface* msg, void* body_start_ptr, std::size_t remainder);
     void OnMessageComplete(MessageInterface* msg);
     void OnBodyData(void* buf, int len);
@@ -170,6 +261,7 @@ protected:
     boost::asio::io_service&    _io;
     std::size_t                 _body_buffer_size;
     std::size_t                 _header_buffer_size;
+    TimingWheel::Timer          _budget_timer;  /// the body timeout of a parked read
     
     
     // records whether a readBody has already been issued
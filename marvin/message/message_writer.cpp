@@ -46,15 +46,30 @@ MessageWriter::setContent(std::string& contentStr)
 {
     _haveContent = true;
     _bodyContent = contentStr;
+    _body_file_sptr = nullptr;
     setHeader("Content-length", std::to_string(contentStr.size()));
     LogDebug("");
 }
+void
+MessageWriter::setContent(BodyFileSPtr body_file_sptr)
+{
+    _haveContent = true;
+    _bodyContent = "";
+    _body_file_sptr = body_file_sptr;
+    setHeader("Content-length", std::to_string(body_file_sptr->size()));
+    LogDebug("");
+}
 std::string&
 MessageWriter::getBody()
 {
     if( ! _haveContent ) _bodyContent = "";
     return _bodyContent;
 }
+BodyFileSPtr
+MessageWriter::getBodyFile()
+{
+    return _body_file_sptr;
+}
 void MessageWriter::putHeadersStuffInBuffer()
 {
     
@@ -68,8 +83,11 @@ void MessageWriter::putHeadersStuffInBuffer()
         _headerStream << "HTTP/1.1 " << _status_code << " " << _status <<  "\r\n";
     }
     
-    for(auto const& h : _headers) {
-        _headerStream << h.first << ": " << h.second << "\r\n";
+    for(std::size_t i = 0; i < _headers.size(); i++) {
+        _headerStream.write(_headers.nameData(i), _headers.nameLength(i));
+        _headerStream << ": ";
+        _headerStream.write(_headers.valueData(i), _headers.valueLength(i));
+        _headerStream << "\r\n";
     }
     // end of headers
     _headerStream << "\r\n";
@@ -108,6 +126,15 @@ MessageWriter::asyncWrite(WriteMessageCallbackType cb)
     });
 }
 
+void
+MessageWriter::asyncWrite(CannedResponseSPtr canned, WriteMessageCallbackType cb)
+{
+    _writeSock->asyncWrite(canned->render(), [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
+        LogDebug("");
+        cb(ec);
+    });
+}
+
 void
 MessageWriter::asyncWriteHeaders(WriteHeadersCallbackType cb)
 {
@@ -133,6 +160,13 @@ void MessageWriter::asyncWriteFullBody(WriteMessageCallbackType cb)
     if( ! _haveContent ){
         LogWarn("writing empty body");
 //        throw std::invalid_argument("asyncWriteFullBody:: no content");
+    } else if( _body_file_sptr != nullptr ){
+        // a spilled body goes straight from the file to the socket
+        _writeSock->asyncWrite(_body_file_sptr, [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
+            LogDebug("");
+            auto pf = std::bind(cb, ec);
+            _io.post(pf);
+        });
     } else if( _bodyContent.size() == 0 ){
         Marvin::ErrorType ee = Marvin::make_error_ok();
         cb(ee);
@@ -14,6 +14,7 @@
 #include "message.hpp"
 #include "read_socket_interface.hpp"
 #include "connection_interface.hpp"
+#include "canned_response.hpp"
 
 class MessageWriter;
 typedef std::shared_ptr<MessageWriter> MessageWriterSPtr;
@@ -26,8 +27,14 @@ public:
     ~MessageWriter();
     
     void setContent(std::string& contentStr);
+    /// the body is the content of a (spilled) BodyFile, it is sent without being read into memory
+    void setContent(BodyFileSPtr body_file_sptr);
     std::string&  getBody();
+    /// the BodyFile set by setContent(BodyFileSPtr), otherwise nullptr
+    BodyFileSPtr  getBodyFile();
     void asyncWrite(WriteMessageCallbackType cb);
+    /// writes a pre-serialized response in a single write instead of this message
+    void asyncWrite(CannedResponseSPtr canned, WriteMessageCallbackType cb);
     void asyncWriteHeaders(WriteHeadersCallbackType cb);
     void asyncWriteBodyData(WriteBodyDataCallbackType cb);
     void asyncWriteTrailers(AsyncWriteCallbackType cb);
@@ -49,6 +56,7 @@ protected:
     bool                        _haveContent;
     boost::asio::streambuf      _bodyBuf;
     std::string                 _bodyContent;
+    BodyFileSPtr                _body_file_sptr;
     FBuffer*                    _currentBodyFBuffer;
     
     boost::asio::streambuf      _headerBuf;
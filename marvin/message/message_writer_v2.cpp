@@ -5,6 +5,7 @@
 //  Created by ROBERT BLACKWELL on 12/10/16.
 //  Copyright © 2016 Blackwellapps. All rights reserved.
 //
+#include <algorithm>
 #include "bufferV2.hpp"
 #include "message_writer_v2.hpp"
 #include "marvin_error.hpp"
@@ -26,8 +27,7 @@ std::string traceWriterV2(MessageWriterV2& writer)
     return ss.str();
 }
 
-//MessageWriterV2::MessageWriterV2(boost::asio::io_service& io, TCPConnection& conn):_io(io), _conn(conn), _m_header_buf(1000)
-MessageWriterV2::MessageWriterV2(boost::asio::io_service& io, ConnectionInterfaceSPtr conn):_io(io), _conn(conn), _m_header_buf(1000)
+MessageWriterV2::MessageWriterV2(boost::asio::io_service& io, ConnectionInterfaceSPtr conn):_io(io), _conn(conn), _chunked(false)
 {
     LogTorTrace();
 //    _isRequest = is_request;
@@ -57,9 +57,8 @@ MessageWriterV2::~MessageWriterV2()
 void MessageWriterV2::putHeadersStuffInBuffer()
 {
     MessageBaseSPtr msg = _currentMessage;
-    _m_header_buf.empty();
-    serializeHeaders(*msg, _m_header_buf);
-    LogDebug("request size: ");
+    _header_buf_sptr = serializeHeaders(*msg);
+    LogDebug("request size: ", _header_buf_sptr->size());
 }
 void MessageWriterV2::onWriteHeaders(Marvin::ErrorType& ec)
 {
@@ -91,41 +90,84 @@ void MessageWriterV2::asyncWrite(MessageBaseSPtr msg, BufferChainSPtr body_chain
     _body_buffer_chain_sptr = body_chain_sptr;
     asyncWrite(msg, cb);
 }
+/**
+* Writes a message whose body was spilled to disk by MessageReaderV2 - the body
+* goes to the connection straight from the file (see TCPConnection::asyncWrite(BodyFileSPtr,..))
+*/
+void MessageWriterV2::asyncWrite(MessageBaseSPtr msg, BodyFileSPtr body_file_sptr, WriteMessageCallbackType cb)
+{
+    assert(body_file_sptr != nullptr);
+    _body_file_sptr = body_file_sptr;
+    asyncWrite(msg, cb);
+}
+
+void MessageWriterV2::asyncWrite(CannedResponseSPtr canned, WriteMessageCallbackType cb)
+{
+    asyncWrite(canned, std::vector<std::string>(), cb);
+}
+
+void MessageWriterV2::asyncWrite(CannedResponseSPtr canned, const std::vector<std::string>& values, WriteMessageCallbackType cb)
+{
+    assert(canned != nullptr);
+    _conn->asyncWrite(canned->render(values), [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
+        auto pf = std::bind(cb, ec);
+        _io.post(pf);
+    });
+}
 
+/**
+* The head and a body held in memory go out as one BufferChain - a single gathered write
+* (one writev) instead of a write for the head followed by a write for the body.
+* A BodyFile body is still sent by its own write after the head.
+*/
 void
 MessageWriterV2::asyncWrite(MessageBaseSPtr msg, WriteMessageCallbackType cb)
 {
     LogDebug("");
     _currentMessage = msg;
-    asyncWriteHeaders(msg, [this, cb](Marvin::ErrorType& ec){
+    if( (_body_file_sptr != nullptr) && (_body_file_sptr->size() > 0) ) {
+        asyncWriteHeaders(msg, [this, cb](Marvin::ErrorType& ec){
+            if( ec ){
+                LogDebug("", ec.value(), ec.category().name(), ec.category().message(ec.value()));
+                cb(ec);
+            } else {
+                asyncWriteFullBody(cb);
+            }
+        });
+        return;
+    }
+    putHeadersStuffInBuffer();
+    BufferChainSPtr chain_sptr = std::make_shared<BufferChain>();
+    chain_sptr->push_back(_header_buf_sptr);
+    if( _body_buffer_chain_sptr ) {
+        for(BufferSlice& slice : *_body_buffer_chain_sptr)
+            chain_sptr->push_back(slice);
+    }
+    _conn->asyncWrite(chain_sptr, [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
         LogDebug(" cb: ", (long) &cb);
-        // doing a full write of the message
-        if( ec ){
-            LogDebug("", ec.value(), ec.category().name(), ec.category().message(ec.value()));
-            cb(ec);
-        } else {
-            asyncWriteFullBody([this, cb](Marvin::ErrorType& ec2){
-                LogDebug(" cb: ", (long) &cb);
-                auto pf = std::bind(cb, ec2);
-//                _io.post(pf);
-                cb(ec2);
-            });
-        }
+        auto pf = std::bind(cb, ec);
+        _io.post(pf);
     });
 }
 
 void
 MessageWriterV2::asyncWriteHeaders(MessageBaseSPtr msg,  WriteHeadersCallbackType cb)
 {
+    _currentMessage = msg;
+    _chunked = false;
+    if( msg->hasHeader(HttpHeader::Id::TransferEncoding) ) {
+        std::string te = msg->getHeader(HttpHeader::Id::TransferEncoding);
+        std::transform(te.begin(), te.end(), te.begin(), ::tolower);
+        _chunked = (te.find("chunked") != std::string::npos);
+    }
     putHeadersStuffInBuffer();
-    
-    _conn->asyncWrite(_m_header_buf, [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
+    MBufferSPtr header_buf_sptr = _header_buf_sptr;
+    _conn->asyncWrite(*header_buf_sptr, [this, header_buf_sptr, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
 
         LogDebug("");
         // need to check and do something about insufficient write
-            auto pf = std::bind(cb, ec);
-//            _io.post(pf);
-        cb(ec);
+        auto pf = std::bind(cb, ec);
+        _io.post(pf);
     });
 }
 
@@ -135,6 +177,13 @@ MessageWriterV2::asyncWriteHeaders(MessageBaseSPtr msg,  WriteHeadersCallbackTyp
 void MessageWriterV2::asyncWriteFullBody(WriteMessageCallbackType cb)
 {
     LogDebug(" cb: ", (long) &cb);
+    if( (_body_file_sptr != nullptr) && (_body_file_sptr->size() > 0) ) {
+        _conn->asyncWrite(_body_file_sptr, [this, cb](Marvin::ErrorType& ec, std::size_t bytes_transfered){
+            LogDebug("");
+            cb(ec);
+        });
+        return;
+    }
     // if body not set throw exception
     if( ( ! _body_buffer_chain_sptr) || ( _body_buffer_chain_sptr->size() == 0) ) {
         LogWarn("writing empty body");
@@ -164,8 +213,47 @@ void MessageWriterV2::asyncWriteFullBody(WriteMessageCallbackType cb)
     
 }
 
+#pragma mark - chunked body data
+static const std::size_t kChunkFrameCRLF = 24;     /// where the CRLF after the data lives in the frame buffer
+
+/**
+* The frame buffer holds the chunk size line at its start and a CRLF at kChunkFrameCRLF. The
+* chain is the size line, the data, the CRLF. Both are made once per writer and reused
+*/
+BufferChainSPtr MessageWriterV2::chunkFrame(std::size_t n)
+{
+    if( _chunk_frame_sptr == nullptr ) {
+        _chunk_frame_sptr = m_buffer(kChunkFrameCRLF + 2);
+        _chunk_chain_sptr = std::make_shared<BufferChain>();
+        char* f = (char*)_chunk_frame_sptr->data();
+        f[kChunkFrameCRLF] = '\r';
+        f[kChunkFrameCRLF + 1] = '\n';
+        _chunk_frame_sptr->setSize(kChunkFrameCRLF + 2);
+    }
+    static const char hex[] = "0123456789abcdef";
+    char digits[16];
+    std::size_t nd = 0;
+    do {
+        digits[nd++] = hex[n & 0xf];
+        n >>= 4;
+    } while( n != 0 );
+    char* start = (char*)_chunk_frame_sptr->data();
+    char* p = start;
+    while( nd > 0 )
+        *p++ = digits[--nd];
+    *p++ = '\r';
+    *p++ = '\n';
+    _chunk_chain_sptr->clear();
+    _chunk_chain_sptr->push_back(buffer_slice(_chunk_frame_sptr, start, (std::size_t)(p - start)));
+    return _chunk_chain_sptr;
+}
+
 void MessageWriterV2::asyncWriteBodyData(std::string& data, WriteBodyDataCallbackType cb)
 {
+    if( _chunked ) {
+        asyncWriteBodyData(buffer_chain(data), cb);
+        return;
+    }
     auto bf = boost::asio::buffer(data);
     _conn->asyncWrite(bf, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
         cb(err);
@@ -173,11 +261,75 @@ void MessageWriterV2::asyncWriteBodyData(std::string& data, WriteBodyDataCallbac
 }
 void MessageWriterV2::asyncWriteBodyData(MBuffer& data, WriteBodyDataCallbackType cb)
 {
+    if( _chunked ) {
+        asyncWriteBodyData(buffer_chain(data), cb);
+        return;
+    }
     _conn->asyncWrite(data, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
         cb(err);
     });
 }
 
+/**
+* Writes a chain of body data as a single gathered write. The chain is typically made
+* of slices of the buffers a MessageReaderV2 read the data into, so nothing is copied.
+* The lambda holds a reference to the chain so the slices stay alive until the write completes.
+*
+* When chunking the chunk frame is put around the slices of the chain, still one write.
+* An empty chain writes nothing - a zero length chunk would end the body.
+*/
+void MessageWriterV2::asyncWriteBodyData(BufferChainSPtr chain_ptr, WriteBodyDataCallbackType cb)
+{
+    if( _chunked ) {
+        if( chain_ptr->size() == 0 ) {
+            Marvin::ErrorType ok = Marvin::make_error_ok();
+            _io.post(std::bind(cb, ok));
+            return;
+        }
+        BufferChainSPtr frame_sptr = chunkFrame(chain_ptr->size());
+        for(BufferSlice& slice : *chain_ptr)
+            frame_sptr->push_back(slice);
+        frame_sptr->push_back(buffer_slice(_chunk_frame_sptr, (char*)_chunk_frame_sptr->data() + kChunkFrameCRLF, 2));
+        _conn->asyncWrite(frame_sptr, [chain_ptr, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+            cb(err);
+        });
+        return;
+    }
+    _conn->asyncWrite(chain_ptr, [chain_ptr, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+        cb(err);
+    });
+}
+void MessageWriterV2::asyncWriteBodyData(BodyFileSPtr body_file_sptr, WriteBodyDataCallbackType cb)
+{
+    if( _chunked ) {
+        if( body_file_sptr->size() == 0 ) {
+            Marvin::ErrorType ok = Marvin::make_error_ok();
+            _io.post(std::bind(cb, ok));
+            return;
+        }
+        BufferChainSPtr frame_sptr = chunkFrame(body_file_sptr->size());
+        _conn->asyncWrite(frame_sptr, [this, body_file_sptr, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+            if( err ) {
+                cb(err);
+                return;
+            }
+            _conn->asyncWrite(body_file_sptr, [this, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+                if( err ) {
+                    cb(err);
+                    return;
+                }
+                boost::asio::const_buffer crlf((char*)_chunk_frame_sptr->data() + kChunkFrameCRLF, 2);
+                _conn->asyncWrite(crlf, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+                    cb(err);
+                });
+            });
+        });
+        return;
+    }
+    _conn->asyncWrite(body_file_sptr, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+        cb(err);
+    });
+}
 //void MessageWriterV2::asyncWriteBodyData(FBuffer& data, WriteBodyDataCallbackType cb)
 //{
 //    _conn->asyncWrite(data, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
@@ -186,13 +338,46 @@ void MessageWriterV2::asyncWriteBodyData(MBuffer& data, WriteBodyDataCallbackTyp
 //}
 void MessageWriterV2::asyncWriteBodyData(boost::asio::const_buffer data, WriteBodyDataCallbackType cb)
 {
+    if( _chunked ) {
+        asyncWriteBodyData(buffer_chain(m_buffer((void*)boost::asio::buffer_cast<const void*>(data), boost::asio::buffer_size(data))), cb);
+        return;
+    }
     _conn->asyncWrite(data, [cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
         cb(err);
     });
 }
 
+/**
+* The last chunk, the trailers and the final CRLF are formatted into one exactly sized buffer
+*/
 void MessageWriterV2::asyncWriteTrailers(MessageBaseSPtr msg,  AsyncWriteCallbackType cb)
 {
+    if( ! _chunked ) {
+        Marvin::ErrorType ok = Marvin::make_error_ok();
+        _io.post(std::bind(cb, ok, 0));
+        return;
+    }
+    _chunked = false;
+    std::size_t size = 3 + 2;
+    HeaderTable* trailers = (msg != nullptr) ? &(msg->trailers()) : nullptr;
+    if( trailers != nullptr ) {
+        for(std::size_t i = 0; i < trailers->size(); i++)
+            size += trailers->nameLength(i) + 2 + trailers->valueLength(i) + 2;
+    }
+    MBufferSPtr mb = m_buffer(size);
+    mb->append((void*)"0\r\n", 3);
+    if( trailers != nullptr ) {
+        for(std::size_t i = 0; i < trailers->size(); i++) {
+            mb->append((void*)trailers->nameData(i), trailers->nameLength(i));
+            mb->append((void*)": ", 2);
+            mb->append((void*)trailers->valueData(i), trailers->valueLength(i));
+            mb->append((void*)"\r\n", 2);
+        }
+    }
+    mb->append((void*)"\r\n", 2);
+    _conn->asyncWrite(buffer_chain(mb), [mb, cb](Marvin::ErrorType& err, std::size_t bytes_transfered) {
+        cb(err, bytes_transfered);
+    });
 }
 
 void MessageWriterV2::end()
@@ -15,6 +15,7 @@
 #include "read_socket_interface.hpp"
 #include "connection_interface.hpp"
 #include "tcp_connection.hpp"
+#include "canned_response.hpp"
 
 class MessageWriterV2;
 typedef std::shared_ptr<MessageWriterV2> MessageWriterV2SPtr;
@@ -34,18 +35,50 @@ public:
     MessageWriterV2(boost::asio::io_service& io, ConnectionInterfaceSPtr conn);
     ~MessageWriterV2();
     
+    /**
+    * Writes a complete message. The head is serialized into a buffer of exactly the
+    * right size and, unless the body is a BodyFile, goes out together with the body
+    * in a single gathered write
+    */
     void asyncWrite(MessageBaseSPtr msg, WriteMessageCallbackType cb);
     void asyncWrite(MessageBaseSPtr msg, std::string& body_string, WriteMessageCallbackType cb);
     void asyncWrite(MessageBaseSPtr msg, MBufferSPtr body_mb_sptr, WriteMessageCallbackType cb);
     void asyncWrite(MessageBaseSPtr msg, BufferChainSPtr body_chain_sptr, WriteMessageCallbackType cb);
+    void asyncWrite(MessageBaseSPtr msg, BodyFileSPtr body_file_sptr, WriteMessageCallbackType cb);
+    /**
+    * Writes a pre-serialized response in a single write, values fill its slots
+    */
+    void asyncWrite(CannedResponseSPtr canned, WriteMessageCallbackType cb);
+    void asyncWrite(CannedResponseSPtr canned, const std::vector<std::string>& values, WriteMessageCallbackType cb);
 
+    /**
+    * Writes the first line and headers only, the body follows with asyncWriteBodyData.
+    * If msg has a Transfer-Encoding: chunked header every piece of body data is sent as a
+    * chunk and the body is ended by asyncWriteTrailers
+    */
     void asyncWriteHeaders(MessageBaseSPtr msg, WriteHeadersCallbackType cb);
 
+    /**
+    * Writes a piece of body data, as a chunk if the headers said so.
+    *
+    * The BufferChainSPtr overload is the one to use for chunks - the chunk size line, the
+    * data and the closing CRLF go out in one gathered write, the data is not copied and
+    * nothing is allocated. The other overloads copy the data into a chain first when
+    * chunking, a BodyFile chunk takes three writes.
+    *
+    * Only one write can be outstanding - wait for cb before writing again.
+    */
     void asyncWriteBodyData(std::string& data, WriteBodyDataCallbackType cb);
     void asyncWriteBodyData(MBuffer& data, WriteBodyDataCallbackType cb);
     void asyncWriteBodyData(BufferChainSPtr chain_ptr, WriteBodyDataCallbackType cb);
+    void asyncWriteBodyData(BodyFileSPtr body_file_sptr, WriteBodyDataCallbackType cb);
     void asyncWriteBodyData(boost::asio::const_buffer data, WriteBodyDataCallbackType cb);
 
+    /**
+    * Ends a chunked body - writes the last (zero length) chunk, the trailers of msg
+    * (msg can be nullptr) and the final CRLF in one write. Does nothing when the body
+    * is not chunked
+    */
     void asyncWriteTrailers(MessageBaseSPtr msg, AsyncWriteCallbackType cb);
     
     void end();
@@ -57,14 +90,17 @@ protected:
 
     void onWriteHeaders(Marvin::ErrorType& ec);
     void putHeadersStuffInBuffer();
+    /// the chunk size line for a chunk of length n followed by the data and a CRLF
+    BufferChainSPtr chunkFrame(std::size_t n);
 
     boost::asio::io_service&    _io;
     ConnectionInterfaceSPtr     _conn;
     MessageBaseSPtr             _currentMessage;
-    /**
-    * @todo - raw pointers for MBuffer and FBuffer are a problem
-    */
-    MBuffer                     _m_header_buf;
+    MBufferSPtr                 _header_buf_sptr;   /// exactly the size of the serialized head
+
+    bool                        _chunked;           /// body data is chunk encoded
+    MBufferSPtr                 _chunk_frame_sptr;  /// chunk size line and CRLF, reused for every chunk
+    BufferChainSPtr             _chunk_chain_sptr;  /// reused for every chunk
     
     bool                        _haveContent;
     boost::asio::streambuf      _bodyBuf;
@@ -73,6 +109,7 @@ protected:
     std::string                 _body_buffer_string;
 //    BufferChain                 _body_buffer_chain;
     BufferChainSPtr             _body_buffer_chain_sptr;
+    BodyFileSPtr                _body_file_sptr;
     
 };
 
@@ -6,6 +6,7 @@
 //  Copyright (c) 2014 Blackwellapps. All rights reserved.
 //
 #include <stdlib.h>
+#include <cstring>
 #include <iostream>
 #include <cassert>
 #include "http_header.hpp"
@@ -40,29 +41,50 @@ int chunk_size_start(http_parser* parser, const char* at, size_t length);
 /******************************************************************************/
 
 
+bool Parser::__useScanner = true;
+
+void Parser::configSet_UseScanner(bool flag)
+{
+    __useScanner = flag;
+}
+
 Parser::Parser()
 {
     messageCompleteFlag = false;
     headersCompleteFlag = false;
-    messageData = "";
+    streamingFlag = false;
     
     url_buf = NULL;
     status_buf = NULL;
     name_buf = NULL;
     value_buf = NULL;
     header_state = kHEADER_STATE_NOTHING;
+    header_arena = NULL;
+    scanner = __useScanner ? new HttpScanner() : NULL;
 
     setUpParserCallbacks();
 }
 
 Parser::~Parser()
 {
-    free(parser);
-    free(parserSettings);
+    delete scanner;
+    if( url_buf != NULL )
+        sb_free(url_buf);
+    if( status_buf != NULL )
+        sb_free(status_buf);
+    if( name_buf != NULL )
+        sb_free(name_buf);
+    if( value_buf != NULL )
+        sb_free(value_buf);
     parser = NULL;
     parserSettings = NULL;
 }
 
+void Parser::setStreamingOption(bool streamingOption)
+{
+    streamingFlag = streamingOption;
+}
+
 void Parser::pause()
 {
     http_parser_pause(parser, 1);
@@ -74,11 +96,26 @@ void Parser::unPause()
 
 int Parser::appendBytes(void *buffer, unsigned length)
 {
-    messageData.append((char*)buffer, length);
-    size_t nparsed = http_parser_execute(parser, parserSettings, (char*)buffer, (int)length);
+    if( streamingFlag && messageCompleteFlag && (length > 0) ) {
+        // the first bytes of the next message on the stream
+        setUpNextMessage();
+    }
+    size_t nparsed = (scanner != NULL)
+                        ? scanner->execute(parser, parserSettings, (char*)buffer, length)
+                        : http_parser_execute(parser, parserSettings, (char*)buffer, (int)length);
     return (int)nparsed;
 }
 
+void Parser::setHeaderArena(const char* base)
+{
+    header_arena = base;
+}
+
+HeaderSpanList& Parser::headerSpans()
+{
+    return header_spans;
+}
+
 void Parser::appendEOF()
 {
     char* buffer = NULL;
@@ -86,7 +123,9 @@ void Parser::appendEOF()
     int someLength = 0;
     if( ! messageCompleteFlag )
     {
-        nparsed = http_parser_execute(parser, parserSettings, buffer, someLength);
+        nparsed = (scanner != NULL)
+                    ? scanner->execute(parser, parserSettings, buffer, someLength)
+                    : http_parser_execute(parser, parserSettings, buffer, someLength);
     }
     LogDebug("back from parser nparsed: ", nparsed);
 }
@@ -173,20 +212,26 @@ void Parser::OnChunkEnd()
 
 #pragma mark - private methods
 
+/**
+* Readies the parser for the next message on the same stream. Nothing is allocated, the
+* http_parser struct is re-initialized in place, the scanner (if any) forgets its state and
+* the url and status buffers are emptied for reuse - they are only freed by the destructor
+*/
 void Parser::setUpNextMessage()
 {
     messageCompleteFlag = false;
     headersCompleteFlag = false;
     
-    messageData = "";
+    http_parser_init(parser, HTTP_BOTH);
+    setParser(parser, this);
+    if( scanner != NULL )
+        scanner->reset();
     
     if(url_buf != NULL){
-        sb_free(url_buf);
-        url_buf = NULL;
+        url_buf->used = 0;
     }
     if( status_buf != NULL){
-        sb_free(status_buf);
-        status_buf = NULL;
+        status_buf->used = 0;
     }
     if(name_buf != NULL){
         sb_free(name_buf);
@@ -196,35 +241,52 @@ void Parser::setUpNextMessage()
         sb_free(value_buf);
         value_buf = NULL;
     }
+    header_spans.clear();
+    header_state = kHEADER_STATE_NOTHING;
 }
 
-void Parser::setUpParserCallbacks()
+/**
+* The callbacks are the same for every Parser so all instances share one settings table,
+* built the first time a Parser is constructed
+*/
+static http_parser_settings makeSettings()
 {
-    parser = (http_parser*)malloc(sizeof(http_parser));
+    http_parser_settings settings;
     
-    http_parser_init( parser, HTTP_BOTH );
-    
-    setParser(parser, this);
+    /* Now set up the call back functions */
+    memset(&settings, 0, sizeof(settings));
+    settings.on_message_begin = message_begin_cb;
+    settings.on_url = url_data_cb;
+    settings.on_status = status_data_cb;
     
-    http_parser_settings* settings = (http_parser_settings*)malloc(sizeof(http_parser_settings));
-    parserSettings = settings;
+    settings.on_header_field = header_field_data_cb;
+    settings.on_header_value = header_value_data_cb;
     
-    /* Now set up the call back functions */
-    settings->on_message_begin = message_begin_cb;
-    settings->on_url = url_data_cb;
-    settings->on_status = status_data_cb;
+    settings.on_headers_complete = headers_complete_cb;
     
-    settings->on_header_field = header_field_data_cb;
-    settings->on_header_value = header_value_data_cb;
+    settings.on_body = body_data_cb;
+    settings.on_message_complete = message_complete_cb;
+    settings.on_chunk_header = chunk_header_cb;
+    settings.on_chunk_complete = chunk_complete_cb;
+    settings.on_chunk_size_start = chunk_size_start;
+    return settings;
+}
+
+static http_parser_settings* sharedSettings()
+{
+    static http_parser_settings settings = makeSettings();
+    return &settings;
+}
+
+void Parser::setUpParserCallbacks()
+{
+    parser = &parserStorage;
     
-    settings->on_headers_complete = headers_complete_cb;
+    http_parser_init( parser, HTTP_BOTH );
     
-    settings->on_body = body_data_cb;
-    settings->on_message_complete = message_complete_cb;
-    settings->on_chunk_header = chunk_header_cb;
-    settings->on_chunk_complete = chunk_complete_cb;
-    settings->on_chunk_size_start = chunk_size_start;
+    setParser(parser, this);
     
+    parserSettings = sharedSettings();
 }
 
 
@@ -235,26 +297,21 @@ Parser* getParser(http_parser* parser)
 }
 
 
+/**
+* Name/value pairs seen after the headers are complete are the trailers of a chunked message
+*/
 void saveNameValuePair(http_parser* parser, simple_buffer_t* name, simple_buffer_t* value)
 {
     Parser* p = getParser(parser);
-    char* n_p = NULL;
-    char* v_p = NULL;
-    int n;
-    n = sb_to_string(name, &n_p);
-    n = sb_to_string(value,&v_p);
-    
-    HttpHeader::canonicalKey(name->buffer, name->used);
-    
-    std::string n_str = std::string(name->buffer, name->used);
-    std::string v_str = std::string(value->buffer, value->used);
-    
-    free(v_p);
-    free(n_p);
-    
-    (p->headers)[n_str] = v_str;
+
     MessageInterface* m = p->currentMessage();
-    m->setHeader(n_str, v_str);
+    if( p->headersCompleteFlag ) {
+        std::string v = (value == NULL) ? std::string("") : std::string(value->buffer, value->used);
+        m->setTrailer(std::string(name->buffer, name->used), v);
+    } else if( value == NULL )
+        m->addHeader(name->buffer, name->used, "", 0);
+    else
+        m->addHeader(name->buffer, name->used, value->buffer, value->used);
 //    std::cout << "SaveNameValuePair::set " << n_str << " " << v_str << std::endl;
 //    auto h = p->headers;
 //    for (auto iter = h.begin(); iter != h.end(); iter++)
@@ -310,6 +367,19 @@ header_field_data_cb(http_parser* parser, const char* at, size_t length)
 {
     Parser* p = getParser(parser);
     int state = p->header_state;
+    // trailers arrive in body buffers, outside the arena, so they are always copied
+    if( (p->header_arena != NULL) && (! p->headersCompleteFlag) ) {
+        std::size_t offset = (std::size_t)(at - p->header_arena);
+        if( state == kHEADER_STATE_FIELD ) {
+            // the rest of a name that was split across reads - it is adjacent in the arena
+            assert( (p->header_spans.back().name_offset + p->header_spans.back().name_length == offset) );
+            p->header_spans.back().name_length += length;
+        } else {
+            p->header_spans.push_back(HeaderSpan{offset, length, offset + length, 0});
+        }
+        p->header_state = kHEADER_STATE_FIELD;
+        return 0;
+    }
     if( (state == 0)||(state == kHEADER_STATE_NOTHING) || (state == kHEADER_STATE_VALUE)){
         if( p->name_buf!= NULL){
             saveNameValuePair(parser, p->name_buf, p->value_buf);
@@ -335,6 +405,20 @@ header_value_data_cb(http_parser* parser, const char* at, size_t length)
     Parser* p = getParser(parser);
     int state = p->header_state;
     
+    if( (p->header_arena != NULL) && (! p->headersCompleteFlag) ) {
+        std::size_t offset = (std::size_t)(at - p->header_arena);
+        HeaderSpan& span = p->header_spans.back();
+        if( state == kHEADER_STATE_FIELD ) {
+            span.value_offset = offset;
+            span.value_length = length;
+        } else {
+            // adjacent unless an obsolete folded line ended the previous piece, the
+            // span then covers the line break
+            span.value_length = offset + length - span.value_offset;
+        }
+        p->header_state = kHEADER_STATE_VALUE;
+        return 0;
+    }
     if( state == kHEADER_STATE_FIELD ){
         simple_buffer_t* sb = sb_create();
         sb_append(sb, (char*)at, length);
@@ -358,7 +442,13 @@ headers_complete_cb(http_parser* parser, const char* aptr, size_t remainder)
     
     if( p->name_buf != NULL){
         saveNameValuePair(parser, p->name_buf, p->value_buf);
+        sb_free(p->name_buf); p->name_buf = NULL;
+        if( p->value_buf != NULL ){
+            sb_free(p->value_buf); p->value_buf = NULL;
+        }
     }
+    // any name/value pairs from here on are trailers
+    p->header_state = kHEADER_STATE_NOTHING;
     message->setMethod((enum http_method)parser->method);
     message->setStatusCode( parser->status_code );
     message->setHttpVersMajor( parser->http_major );
@@ -394,7 +484,7 @@ body_data_cb(http_parser* parser, const char* at, size_t length)
 int chunk_size_start(http_parser* parser, const char* at, size_t length)
 {
     Parser* p =  getParser(parser);
-    
+    return 0;
 }
 int chunk_header_cb(http_parser* parser)
 {
@@ -419,6 +509,14 @@ message_complete_cb(http_parser* parser)
     p->messageCompleteFlag = true;
     
     MessageInterface* message = p->currentMessage();
+    if( p->name_buf != NULL ){
+        // the last trailer
+        saveNameValuePair(parser, p->name_buf, p->value_buf);
+        sb_free(p->name_buf); p->name_buf = NULL;
+        if( p->value_buf != NULL ){
+            sb_free(p->value_buf); p->value_buf = NULL;
+        }
+    }
     p->OnMessageComplete(message);
     // force the parser to exit after this call
     // so that we dont process any data in the read
@@ -10,7 +10,9 @@
 
 #include <map>
 #include <iostream>
+#include <boost/container/small_vector.hpp>
 #include "http_parser.h"
+#include "http_scanner.hpp"
 #include "simple_buffer.h"
 #include "message.hpp"
 #include "rb_logger.hpp"
@@ -25,6 +27,18 @@ struct ParserError {
     enum http_errno     err_number;
 };
 
+/**
+ * In header span mode (see Parser::setHeaderArena) each header line is recorded as the
+ * offset and length of its name and value within the header arena, nothing is copied.
+ */
+struct HeaderSpan {
+    std::size_t         name_offset;
+    std::size_t         name_length;
+    std::size_t         value_offset;
+    std::size_t         value_length;
+};
+typedef boost::container::small_vector<HeaderSpan, 16> HeaderSpanList;
+
 /*
  *  This ABSTRACT class parses streams of data into http Message objects 
  *  (or at least the first line + headers - message body is a little more complicated).
@@ -34,12 +48,14 @@ struct ParserError {
  *
  *  In homage to nodejs we could have used the name IncomingMessage - maybe we will in the future
  *
+ *  The work is done by either HttpScanner or http_parser - see configSet_UseScanner.
+ *
  *  The data stream is provided to the parser using the appendBytes method. Data can be provided
  *  "all at once" - that is a complete message in one lump or "piece meal" a sequence of arbitarily sized
  *  buffers.
  *
  *  setStreamingOption - configures the parser to parse either a single message or a (continuous) stream
- *  of messages. The default is a single message. STREAMING has not been tested
+ *  of messages. The default is a single message.
  *
  *  Generally the parser can detect the end of a http messages as most messages formats have
  *  message length information in the message itself, or each "chunk" has a chunk length. 
@@ -64,8 +80,24 @@ struct ParserError {
  *  BUT WE HAVE FORCE THIS BY HAVING OUR MESSAGE COMPLETE CALLBACK
  *  EXPLICITLY PAUSE THE PARSER.
  *
- *  The parser as we use it will not support reading multiple messages from the
- *  the same buffer. Each message on a connection requires an new Parser.
+ *  Header span mode
+ *  ================
+ *
+ *  By default each header name/value is accumulated in simple_buffers and then copied into the
+ *  message with setHeader(). A derived class that can guarantee that all header bytes
+ *  it passes to appendBytes() live in ONE contiguous block of memory (the header arena) can instead
+ *  call setHeaderArena(). From then on the parser only records a HeaderSpan per header line,
+ *  as offsets relative to the start of the arena, and leaves it to the derived class
+ *  to turn the spans into strings if and when somebody asks for them. Pieces of a name or value that
+ *  arrive in different calls to appendBytes() are simply merged because they are adjacent in the arena.
+ *  Because spans are offsets the arena may be moved (for example to grow it) between calls to
+ *  appendBytes() provided setHeaderArena() is called again with the new address.
+ *  Span mode ends with the headers, the trailers of a chunked message are always copied
+ *  and saved with setTrailer().
+ *
+ *  Without the streaming option the parser will not support reading multiple messages from the
+ *  the same buffer and each message on a connection requires an new Parser. With it a single Parser
+ *  (and its http_parser, which is part of the object rather than separately allocated) serves them all.
  *
  *  The following "callbacks" are provided in the form of virtual methods - NOT PURE
  *  and they MAY be overridden by a derived class to capture the corresponding event
@@ -93,12 +125,23 @@ class  Parser
 {
 public:
 
+    /**
+     * Selects the engine used by Parser instances created after the call. true (the default)
+     * uses HttpScanner, false the byte at a time http_parser which is kept as the reference.
+     * Both make exactly the same callbacks.
+     */
+    static void configSet_UseScanner(bool flag);
     
     Parser();
     ~Parser();
     
 	/**
-	 * Sets the message streaming option - to the value of streamOption
+	 * Sets the message streaming option - to the value of streamOption.
+	 *
+	 * With streaming on a Parser can be used for every message on a connection. Parsing still
+	 * pauses at the end of each message and appendBytes() returns the number of bytes that belonged
+	 * to it, but the next call to appendBytes() starts the next message - the bytes left over from
+	 * the previous call should be passed first. setUpNextMessage() does the same thing explicitly.
 	 */
 	void setStreamingOption(bool  streamingOption);
 
@@ -113,6 +156,17 @@ public:
 	 */
 	void appendEOF();
 
+    /**
+     * Selects header span mode. base is the address of the first byte of the header arena,
+     * nullptr returns to the default (copying) mode. Call again whenever the arena moves.
+     */
+    void setHeaderArena(const char* base);
+
+    /**
+     * In header span mode the spans recorded so far for the current message
+     */
+    HeaderSpanList& headerSpans();
+
     /**
      * Pause and/or unpause the parser
      */
@@ -163,6 +217,10 @@ public:
     virtual void OnChunkEnd();
     
     void setUpParserCallbacks();
+    
+    /**
+     * Resets the parser for the next message without allocating anything
+     */
     void setUpNextMessage();
     
     
@@ -194,11 +252,14 @@ protected:
     /*
      * These are required to run the parser
      */
-    http_parser*            parser;
-    http_parser_settings*   parserSettings;
+    static bool             __useScanner;
+    http_parser             parserStorage;
+    http_parser*            parser;         /// always &parserStorage
+    http_parser_settings*   parserSettings; /// shared by all instances
+    HttpScanner*            scanner;    /// NULL when http_parser_execute() is doing the work
     bool                    headersCompleteFlag;
     bool                    messageCompleteFlag;
-    std::string             messageData;
+    bool                    streamingFlag;
     
     ///////////////////////////////////////////////////////////////////////////////////
     //
@@ -216,7 +277,11 @@ protected:
     simple_buffer_t*   status_buf;
     simple_buffer_t*   name_buf;
     simple_buffer_t*   value_buf;
-    std::map<std::string, std::string> headers;
+    ////////////////////////////////////////////////////////////////////
+    // header span mode - see setHeaderArena()
+    ////////////////////////////////////////////////////////////////////
+    const char*        header_arena;
+    HeaderSpanList     header_spans;
     ////////////////////////////////////////////////////////////////////
     
     
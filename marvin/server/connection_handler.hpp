@@ -10,6 +10,7 @@
 #define CONNECTION_HANDLER_HPP
 
 #include <stdio.h>
+#include <deque>
 #include <boost/asio.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
@@ -18,6 +19,7 @@
 #include "message_reader_v2.hpp"
 #include "message_writer_v2.hpp"
 #include "connection_interface.hpp"
+#include "sequenced_connection.hpp"
 #include "server_connection_manager.hpp"
 
 
@@ -26,10 +28,38 @@
 //
 #define CH_SMARTPOINTER
 #define CON_SMARTPOINTER
-/// TRequestHandler must conform to RequestHandlerBase
+/**
+* Serves the requests that arrive on one connection. TRequestHandler must conform to RequestHandlerBase,
+* a new instance handles each request.
+*
+* Pipelining
+* ==========
+*
+* Up to configSet_PipelineDepth() requests are read ahead - as soon as one request has been read it
+* is dispatched to its own request handler and the next one is read, even though the responses to
+* earlier requests have not been written. The responses still go out strictly in request order:
+* each request handler is given a MessageWriterV2 on a SequencedConnection whose writes are held
+* back by a shared WriteSequencer until every earlier response is complete.
+*
+* Reading ahead stops at a CONNECT request (the rest of the connection belongs to the tunnel, and
+* the CONNECT is only dispatched once all earlier responses are complete), at a request with
+* "Connection: close", at a response that does not keep the connection alive and at a read error.
+* The connection is finished once the requests already read have been served.
+*
+* A request read ahead is only subject to the idle timeout once every earlier response has been
+* sent, so a long response does not time out the connection it is being written to.
+*
+* With the default depth of 1 a request is only read after the previous response is complete.
+*/
 template<class TRequestHandler> class ConnectionHandler
 {
     public:
+        /**
+        * Called at program startup to set the number of requests on a connection that are read
+        * and dispatched before the oldest response is complete. Defaults to 1 - no read ahead
+        */
+        static void configSet_PipelineDepth(int depth);
+
         ConnectionHandler(
             boost::asio::io_service&                                        io,
             ServerConnectionManager<ConnectionHandler<TRequestHandler>>&    connectionManager,
@@ -42,10 +72,28 @@ template<class TRequestHandler> class ConnectionHandler
         void close();
         long nativeSocketFD();
     private:
-    
+        /// one request/response cycle of a pipeline
+        struct Exchange
+        {
+            std::size_t                         ticket;
+            MessageReaderV2SPtr                 reader;
+            MessageWriterV2SPtr                 writer;
+            std::unique_ptr<TRequestHandler>    handler;
+            bool                                read;       /// the request has been read
+            bool                                dispatched; /// handed to the request handler
+            bool                                done;       /// the request handler has called done
+        };
+        typedef std::shared_ptr<Exchange> ExchangeSPtr;
+        typedef std::weak_ptr<Exchange> ExchangeWPtr;
+
+        static int __pipelineDepth;
+
         void serveAnother();
-        void readMessageHandler(Marvin::ErrorType err);
-        void requestComplete(Marvin::ErrorType err, bool keepAlive);
+        void readMessageHandler(ExchangeSPtr ex, Marvin::ErrorType err);
+        void dispatch(ExchangeSPtr ex);
+        void requestComplete(ExchangeSPtr ex, Marvin::ErrorType err, bool keepAlive);
+        void retireExchanges();
+        bool responsesOwed();
         void handlerComplete(Marvin::ErrorType err);
         void handleConnectComplete(bool hijack);
 
@@ -53,9 +101,13 @@ template<class TRequestHandler> class ConnectionHandler
         boost::asio::io_service&                            _io;
 //        boost::asio::strand&                                _serverStrand;
 //        ConnectionInterface*                                _conn;
+        boost::asio::strand                                 _strand;    /// serializes the read and done callbacks
         ServerConnectionManager<ConnectionHandler>&         _connectionManager;
-        TRequestHandler*                                    _requestHandlerPtr;
-        std::unique_ptr<TRequestHandler>                    _requestHandlerUnPtr;
+        std::deque<ExchangeSPtr>                            _exchanges; /// oldest first
+        WriteSequencerSPtr                                  _sequencer;
+        bool                                                _reading;
+        bool                                                _readClosed;    /// no more requests will be read
+        Marvin::ErrorType                                   _readError;
     
 #ifdef CON_SMARTPOINTER
         ConnectionInterfaceSPtr                             _connection;
@@ -63,13 +115,8 @@ template<class TRequestHandler> class ConnectionHandler
         ConnectionInterface*                         _connection;
 #endif
 
-#ifdef CH_SMARTPOINTER
+        /// the reader that last read from the connection - it holds any bytes read ahead
         MessageReaderV2SPtr   _reader;
-        MessageWriterV2SPtr   _writer;
-#else
-        MessageReaderV2*      _reader;
-        MessageWriterV2*      _writer;
-#endif
 };
 
 #include "connection_handler.ipp"
@@ -5,19 +5,31 @@
 //  Created by ROBERT BLACKWELL on 12/12/16.
 //  Copyright © 2016 Blackwellapps. All rights reserved.
 //
+#include <algorithm>
+#include <cctype>
 #include "http_header.hpp"
 
+template<class TRequestHandler>
+int ConnectionHandler<TRequestHandler>::__pipelineDepth = 1;
+
+template<class TRequestHandler>
+void ConnectionHandler<TRequestHandler>::configSet_PipelineDepth(int depth)
+{
+    __pipelineDepth = std::max(depth, 1);
+}
+
 template<class TRequestHandler>
 ConnectionHandler<TRequestHandler>::ConnectionHandler(
     boost::asio::io_service&                                        io,
     ServerConnectionManager<ConnectionHandler<TRequestHandler>>&    connectionManager,
     ConnectionInterface*                                            conn
-):  _io(io), _connectionManager(connectionManager),
+):  _io(io), _strand(io), _connectionManager(connectionManager),
     _uuid(boost::uuids::random_generator()())
 {
     LogTorTrace();
-    _requestHandlerPtr  = new TRequestHandler(_io);
-    _requestHandlerUnPtr = std::unique_ptr<TRequestHandler>(_requestHandlerPtr);
+    _reading = false;
+    _readClosed = false;
+    _readError = Marvin::make_error_ok();
     
 #ifdef CON_SMARTPOINTER
     _connection = std::shared_ptr<ConnectionInterface>(conn);
@@ -69,28 +81,79 @@ void ConnectionHandler<TRequestHandler>::handleConnectComplete(bool hijacked)
     _connectionManager.deregister(this); // should be maybe called deregister
 }
 /*!
-* Called when a request/response cycle is complete and starts a read
-* to initiate another request/response cycle or to wait for the client to
-* close the connection
+* Come here when the request handler of ex calls its done callback. The response is complete so
+* the sequencer can let the next response out. Retires finished exchanges and, if there is room
+* in the pipeline, starts reading the next request.
+*
+* A response that did not keep the connection alive ends reading, a request read ahead
+* behind it is not served
 */
 template<class TRequestHandler>
-void ConnectionHandler<TRequestHandler>::requestComplete(Marvin::ErrorType err, bool keepAlive)
+void ConnectionHandler<TRequestHandler>::requestComplete(ExchangeSPtr ex, Marvin::ErrorType err, bool keepAlive)
 {
-    /*!
-    * start serving the next request/response cycle
-    */
-    if(!err){
-        try{
-//            _connection->shutdown();
-            this->serveAnother();
-            }
-            catch (std::exception& e)
-            {
-                LogError("exception: ", e.what());
-            }
-    }else{
+    LogInfo(" fd:", nativeSocketFD(), " ticket: ", ex->ticket);
+    if( ex->done )
+        return;
+    ex->done = true;
+    _sequencer->complete(ex->ticket);
+    if( err ) {
+        _readClosed = true;
         _connection->close(); //TODO - this is wrong I think
+    } else if( ! keepAlive ) {
+        _readClosed = true;
+    }
+    try {
+        retireExchanges();
+    }
+    catch (std::exception& e)
+    {
+        LogError("exception: ", e.what());
+    }
+}
+/*!
+* Drops the finished exchanges at the front of the pipeline, dispatches a CONNECT that was
+* waiting to be the oldest, and then either reads the next request or, when nothing more
+* will be read and nothing is in flight, finishes with the connection
+*/
+template<class TRequestHandler>
+void ConnectionHandler<TRequestHandler>::retireExchanges()
+{
+    while( (! _exchanges.empty()) && _exchanges.front()->done ) {
+        /// let go of the reader now so it can be reused for the next request
+        ExchangeSPtr ex = _exchanges.front();
+        _exchanges.pop_front();
+        ex->handler = nullptr;
+        ex->writer = nullptr;
+        ex->reader = nullptr;
+    }
+    if( (! _exchanges.empty()) && _exchanges.front()->read && (! _exchanges.front()->dispatched) ) {
+        dispatch(_exchanges.front());
+        return;
+    }
+    if( ! _readClosed ) {
+        if( _reading && (! responsesOwed()) ) {
+            // the read ahead becomes an ordinary wait for the next request
+            _reader->setConnectionBusy(false);
+        }
+        serveAnother();
+    } else if( _exchanges.empty() && (! _reading) ) {
+        handlerComplete(_readError);
+    } else if( _reading && (_exchanges.size() == 1) ) {
+        // only a read ahead that will not be served is left - closing ends it with an error
+        _connection->close();
+    }
+}
+/*!
+* True while a request that has been read is still waiting for its response to complete
+*/
+template<class TRequestHandler>
+bool ConnectionHandler<TRequestHandler>::responsesOwed()
+{
+    for(ExchangeSPtr& ex : _exchanges) {
+        if( ex->read && (! ex->done) )
+            return true;
     }
+    return false;
 }
 
 /*!
@@ -111,48 +174,90 @@ void ConnectionHandler<TRequestHandler>::handlerComplete(Marvin::ErrorType err)
     
 }
 /*!
-* Come here after a request message has been successfully read,
-* this is the first step in the request/response cycle
+* Come here after a request message has been read (or the read failed), this is the first
+* step in the request/response cycle of ex. Dispatches the request and reads ahead
 */
 template<class TRequestHandler>
-void ConnectionHandler<TRequestHandler>::readMessageHandler(Marvin::ErrorType err)
+void ConnectionHandler<TRequestHandler>::readMessageHandler(ExchangeSPtr ex, Marvin::ErrorType err)
 {
-    LogInfo(" fd:", nativeSocketFD());
+    LogInfo(" fd:", nativeSocketFD(), " ticket: ", ex->ticket);
     LogInfo("", Marvin::make_error_description(err));
-//    LogError("error value: ", err.value(),
-//        " category: ", err.category().name(),
-//        " msg: ", err.category().message(err.value()));
-    std::string uuid_str = boost::uuids::to_string(_uuid);
+    _reading = false;
     if( err ){
         LogError("error value: ", err.value(),
             " category: ", err.category().name(),
             " msg: ", err.category().message(err.value()));
-            //
-            // On read error do not call the handler - simply abort the request
-            //
-            this->handlerComplete(err);
-    } else{
-        if(_reader->method() == HttpMethod::CONNECT ){
-            LogWarn("CONNECT request");
-//            std::cout << std:: hex << &_reader << " " << (long)_reader.get() << std::endl;
-             _requestHandlerUnPtr->handleConnect(_reader, _connection, [this](Marvin::ErrorType& err, bool keepAlive){
-                this->requestComplete(err, false);
-             });
-        } else {
-            LogTrace(traceMessage(*_reader));
-            
-            // this is a testing aid
-            _reader->setHeader(HttpHeader::Name::ConnectionHandlerId, uuid_str);
-            
-            _requestHandlerUnPtr->handleRequest(_reader, _writer, [this](Marvin::ErrorType& err, bool keepAlive){
-                LogInfo("");
-                this->requestComplete(err, keepAlive);
-            } );
-        }
+        //
+        // On read error do not call the handler - simply abort the request, and finish
+        // the connection once the requests already read have been served
+        //
+        assert( _exchanges.back() == ex );
+        _exchanges.pop_back();
+        _sequencer->complete(ex->ticket);
+        _readClosed = true;
+        _readError = err;
+        retireExchanges();
+        return;
+    }
+    if( _readClosed ) {
+        // read ahead of a response that closed the connection - not served
+        LogInfo("request after connection close dropped fd:", nativeSocketFD());
+        _exchanges.pop_back();
+        _sequencer->complete(ex->ticket);
+        retireExchanges();
+        return;
+    }
+    ex->read = true;
+    MessageReaderV2SPtr rdr = ex->reader;
+    std::string conn_hdr = rdr->hasHeader(HttpHeader::Id::Connection) ? rdr->getHeader(HttpHeader::Id::Connection) : "";
+    std::transform(conn_hdr.begin(), conn_hdr.end(), conn_hdr.begin(), ::tolower);
+    if( (rdr->method() == HttpMethod::CONNECT) || (conn_hdr.find("close") != std::string::npos) ) {
+        _readClosed = true;
     }
+    /// a CONNECT takes over the connection so it waits until it is the oldest request
+    if( (rdr->method() != HttpMethod::CONNECT) || (_exchanges.front() == ex) ) {
+        dispatch(ex);
+    }
+    serveAnother();
     LogInfo(" fd:", nativeSocketFD());
 }
 /*!
+* Hands the request of ex to its request handler
+*/
+template<class TRequestHandler>
+void ConnectionHandler<TRequestHandler>::dispatch(ExchangeSPtr ex)
+{
+    ex->dispatched = true;
+    MessageReaderV2SPtr rdr = ex->reader;
+    if(rdr->method() == HttpMethod::CONNECT ){
+        LogWarn("CONNECT request");
+        ExchangeWPtr wex = ex;
+        ex->handler->handleConnect(rdr, _connection, [this, wex](Marvin::ErrorType& err, bool keepAlive){
+            Marvin::ErrorType e = err;
+            _strand.post([this, wex, e](){
+                if( ExchangeSPtr ex = wex.lock() )
+                    this->requestComplete(ex, e, false);
+            });
+        });
+    } else {
+        LogTrace(traceMessage(*rdr));
+        
+        // this is a testing aid
+        std::string uuid_str = boost::uuids::to_string(_uuid);
+        rdr->setHeader(HttpHeader::Id::ConnectionHandlerId, uuid_str);
+        
+        ExchangeWPtr wex = ex;
+        ex->handler->handleRequest(rdr, ex->writer, [this, wex](Marvin::ErrorType& err, bool keepAlive){
+            LogInfo("");
+            Marvin::ErrorType e = err;
+            _strand.post([this, wex, e, keepAlive](){
+                if( ExchangeSPtr ex = wex.lock() )
+                    this->requestComplete(ex, e, keepAlive);
+            });
+        } );
+    }
+}
+/*!
 * Come here to start the read of a request message, ahdnhence start a request/response cycle
 */
 template<class TRequestHandler>
@@ -160,35 +265,53 @@ void ConnectionHandler<TRequestHandler>::serve()
 {
     LogInfo(" fd:", nativeSocketFD());
 //    std::cout << "connection_handler::serve " << std::hex << (long) this << std::endl;
-    ConnectionInterface* cptr = _connection.get();
-    
-    _reader = std::shared_ptr<MessageReaderV2>(new MessageReaderV2(_io, _connection));
-    _writer = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, _connection));
-
-    auto rmh = std::bind(&ConnectionHandler::readMessageHandler, this, std::placeholders::_1 );
-    _reader->readMessage(rmh);
-    
+    _sequencer = std::make_shared<WriteSequencer>();
+    _strand.dispatch([this](){ this->serveAnother(); });
 }
 /*!
-* Serve the next request/response cycle - deliberately DO NOT create new MessageReader
-* and MessageWriter objects - this is a effort to keep the same connection/socket open
-* for the next request
+* Starts reading the next request on the same connection/socket, unless a read is already
+* in progress, reading has stopped or the pipeline is full.
+*
+* When no earlier request still holds the previous MessageReader it is reset and reused,
+* otherwise a new one takes over the bytes the previous one read ahead. Either way
+* pipelined bytes that arrived with the previous request are not lost. Each request gets a
+* new request handler and a writer that is sequenced behind the earlier responses
 */
 template<class TRequestHandler>
 void ConnectionHandler<TRequestHandler>::serveAnother()
 {
+    if( _reading || _readClosed || (_exchanges.size() >= (std::size_t)__pipelineDepth) )
+        return;
     LogInfo(" fd:", nativeSocketFD());
-    /// get a new request object
-    ConnectionInterface* cptr = _connection.get();
-//    std::cout << "connection_handler::serveAnother " << std::hex << (long) this << std::endl;
+    ExchangeSPtr ex = std::make_shared<Exchange>();
+    ex->ticket = _sequencer->nextTicket();
+    ex->read = false;
+    ex->dispatched = false;
+    ex->done = false;
 
-    _reader = std::shared_ptr<MessageReaderV2>(new MessageReaderV2(_io, _connection));
-    _writer = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, _connection));
-//    _writer->setWriteSock(cptr);
-    
-    _requestHandlerPtr  = new TRequestHandler(_io);
-    _requestHandlerUnPtr = std::unique_ptr<TRequestHandler>(_requestHandlerPtr);
+    if( (_reader != nullptr) && (_reader.use_count() == 1) ) {
+        _reader->reset();
+    } else {
+        MessageReaderV2SPtr previous = _reader;
+        _reader = std::shared_ptr<MessageReaderV2>(new MessageReaderV2(_io, _connection));
+        if( previous != nullptr )
+            _reader->takeLeftover(*previous);
+    }
+    ex->reader = _reader;
+    /// no idle timeout while earlier responses are still being sent, see retireExchanges()
+    _reader->setConnectionBusy(responsesOwed());
+    ConnectionInterfaceSPtr sconn = std::make_shared<SequencedConnection>(_connection, _sequencer, ex->ticket);
+    ex->writer = std::shared_ptr<MessageWriterV2>(new MessageWriterV2(_io, sconn));
+    ex->handler = std::unique_ptr<TRequestHandler>(new TRequestHandler(_io));
+    _exchanges.push_back(ex);
 
-    auto rmh = std::bind(&ConnectionHandler::readMessageHandler, this, std::placeholders::_1 );
-    _reader->readMessage(rmh);
+    /// callbacks hold the exchange weakly, the reader and handler belong to it
+    _reading = true;
+    ExchangeWPtr wex = ex;
+    _reader->readMessage([this, wex](Marvin::ErrorType err){
+        _strand.post([this, wex, err](){
+            if( ExchangeSPtr ex = wex.lock() )
+                this->readMessageHandler(ex, err);
+        });
+    });
 }
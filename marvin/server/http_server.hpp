@@ -6,6 +6,9 @@
 #include <string>
 #include <signal.h>
 #include <utility>
+#include <vector>
+#include <memory>
+#include <atomic>
 
 #include "marvin_error.hpp"
 #include "server_connection_manager.hpp"
@@ -13,6 +16,7 @@
 #include "connection_interface.hpp"
 #include "tcp_connection.hpp"
 #include "tls_connection.hpp"
+#include "socket_options.hpp"
 #include "message_reader_v2.hpp"
 #include "message_writer_v2.hpp"
 #include "rb_logger.hpp"
@@ -33,19 +37,57 @@
 *   connection.
 *
 *   server_connection_manager (ServerConnectionManager)
-*   -   only one of these exists. That instance
+*   -   only one of these exists per shard. That instance
 *   -   keeps track of  a smart pointer to every active instane of ConnectionHandler
 *       thereby ensures they stay in existence while active and can be deleted en-mass if/when the
 *       server needs to close down
 *   -   limits the number of active ConnectionHandler instances at any point in time to ensure that
 *       the server does not get overloaded.
 *
+*   A shard is an io_service with its own acceptor, server strand and connection manager.
+*   -   by default there is one shard and its io_service is run by configSet_NumberOfThreads threads,
+*       so a connection's handlers can run on any of them
+*   -   with configSet_Shards(n) there are n shards, each run by one thread of its own. Every acceptor
+*       is bound to the port with SO_REUSEPORT so the kernel spreads new connections across them,
+*       and a connection stays on the shard that accepted it for its whole life. Per thread state -
+*       the MBufferPool free lists, the TimingWheel of the io_service - is then per shard too.
+*       With configSet_PinShards(true) each shard's thread is pinned to a cpu (Linux only)
+*
 */
 template<class TRequestHandler> class HTTPServer
 {
 public:
 
     static void configSet_NumberOfThreads(int num);
+    
+    /**
+    ** @brief sets the number of pipelined requests read ahead on each connection,
+    ** see ConnectionHandler::configSet_PipelineDepth
+    */
+    static void configSet_PipelineDepth(int depth);
+    /**
+    ** @brief sets the number of shards, each an event loop on its own thread with its own SO_REUSEPORT
+    ** acceptor. 0, the default, runs a single io_service on configSet_NumberOfThreads threads
+    */
+    static void configSet_Shards(int n);
+    /**
+    ** @brief pins the thread of shard i to cpu i (modulo the number of cpus). Linux only, off by default
+    */
+    static void configSet_PinShards(bool on);
+    /**
+    ** @brief sets the number of accepts kept pending on each acceptor. Defaults to 4
+    */
+    static void configSet_PendingAccepts(int n);
+    /**
+    ** @brief sets the most connections taken from the backlog without blocking each time an
+    ** accept completes, before that accept is started again. Defaults to 16
+    */
+    static void configSet_AcceptBatch(int n);
+    /**
+    ** @brief sets how long, in milliseconds, an acceptor waits before accepting again after an
+    ** accept failed - out of file descriptors, say. Defaults to 100
+    */
+    static void configSet_AcceptRetryDelay(long millisecs);
 
     HTTPServer(const HTTPServer&) = delete;
     HTTPServer& operator=(const HTTPServer&) = delete;
@@ -61,10 +103,51 @@ public:
     ** dispatches instances of TRequestHandler to service the connection
     */
     void listen(long port = 9991);
+
+    /**
+    ** @brief sets the options for the listening socket, must be called before listen().
+    ** Defaults to SocketOptions::listenerDefaults()
+    */
+    void setListenerOptions(const SocketOptions& options);
+    /**
+    ** @brief sets the options applied to every accepted connection, must be called before listen()
+    */
+    void setDownstreamOptions(const SocketOptions& options);
+    /**
+    ** @brief the values the kernel reports for the listening socket, once listen() has started
+    */
+    SocketOptions effectiveListenerOptions();
     
 private:
 
-    static int __numberOfThreads;
+    /**
+    ** @brief an event loop and what accepts onto it
+    */
+    struct Shard
+    {
+        Shard(int index, int concurrency_hint);
+        int                                                             index;
+        boost::asio::io_service                                         io;
+        boost::asio::strand                                             serverStrand;
+        boost::asio::ip::tcp::acceptor                                  acceptor;
+        ServerConnectionManager<ConnectionHandler<TRequestHandler>>     connectionManager;
+        boost::asio::deadline_timer                                     acceptRetryTimer;
+        int                                                             acceptsBackedOff;   /// accepts waiting for the timer, on the strand
+    };
+    typedef std::unique_ptr<Shard> ShardUPtr;
+
+    static int  __numberOfThreads;
+    static int  __numberOfShards;
+    static bool __pinShards;
+    static int  __pendingAccepts;
+    static int  __acceptBatch;
+    static long __acceptRetryDelayMs;
+
+    static std::vector<ShardUPtr> makeShards();
+    /**
+    ** @brief pins the calling thread to cpu index modulo the number of cpus, if pinning is on
+    */
+    static void pinThread(int index);
 
     /**
     ** @brief just as it says - init the server ready to list
@@ -74,20 +157,37 @@ private:
     /**
     ** @brief Initiates an asynchronous accept operation.
     */
-    void startAccept();
+    void startAccept(Shard& shard);
     
     /**
     ** @brief callback that is invoked on completio of an accept call
-    ** @param handler an object responsible for managing the new connection established by the
-    **          completed accept call.
+    ** @param conn the connection the accept call was made for, it is connected to a client
+    **          unless there is an error
     ** @param err a boost errorcide that described any error condition
     */
-    void handleAccept(ConnectionHandler<TRequestHandler>* handler, const boost::system::error_code& err);
+    void handleAccept(Shard& shard, TCPConnection* conn, const boost::system::error_code& err);
+
+    /**
+    ** @brief after an accept error, starts the accept again once the retry delay has passed
+    ** instead of straight away, as the error would most likely come straight back
+    */
+    void backOffAccept(Shard& shard);
+
+    /**
+    ** @brief called on the shard's strand when the retry delay has passed, starts the accepts
+    ** that backed off
+    */
+    void handleAcceptRetry(Shard& shard, const boost::system::error_code& err);
+
+    /**
+    ** @brief makes the ConnectionHandler for a newly accepted connection and starts it
+    */
+    void serveConnection(Shard& shard, TCPConnection* conn);
 
     /**
-    ** @brief encapsulates the process of posting a callback fn to the servcers strand
+    ** @brief encapsulates the process of posting a callback fn to a shard's server strand
     */
-    void postOnStrand(std::function<void()> fn);
+    void postOnStrand(Shard& shard, std::function<void()> fn);
     
     /**
     ** @brief sets up a signal callback
@@ -101,11 +201,12 @@ private:
     
     int                                             _numberOfThreads;
     long                                            _port;
-    boost::asio::io_service                         _io;
-    boost::asio::strand                             _serverStrand;
+    bool                                            _sharded;
+    std::vector<ShardUPtr>                          _shards;    /// the first one also handles the signals
     boost::asio::signal_set                         _signals;
-    boost::asio::ip::tcp::acceptor                  _acceptor;
-    ServerConnectionManager<ConnectionHandler<TRequestHandler>>   _connectionManager;
+    SocketOptions                                   _listenerOptions;
+    SocketOptions                                   _downstreamOptions;
+    std::atomic<bool>                               _downstreamOptionsReported;
 
 };
 template <class TRequestHandler>
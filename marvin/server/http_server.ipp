@@ -8,9 +8,24 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 #include <thread>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 template<class TRequestHandler>
 int HTTPServer<TRequestHandler>::__numberOfThreads = 4;
+template<class TRequestHandler>
+int HTTPServer<TRequestHandler>::__numberOfShards = 0;
+template<class TRequestHandler>
+bool HTTPServer<TRequestHandler>::__pinShards = false;
+template<class TRequestHandler>
+int HTTPServer<TRequestHandler>::__pendingAccepts = 4;
+template<class TRequestHandler>
+int HTTPServer<TRequestHandler>::__acceptBatch = 16;
+template<class TRequestHandler>
+long HTTPServer<TRequestHandler>::__acceptRetryDelayMs = 100;
 
 template<class TRequestHandler>
 void HTTPServer<TRequestHandler>::configSet_NumberOfThreads(int n)
@@ -18,15 +33,97 @@ void HTTPServer<TRequestHandler>::configSet_NumberOfThreads(int n)
     __numberOfThreads = n;
 }
 
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_Shards(int n)
+{
+    __numberOfShards = std::max(0, n);
+}
+
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_PinShards(bool on)
+{
+    __pinShards = on;
+}
+
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_PendingAccepts(int n)
+{
+    __pendingAccepts = std::max(1, n);
+}
+
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_AcceptBatch(int n)
+{
+    __acceptBatch = std::max(0, n);
+}
+
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_AcceptRetryDelay(long millisecs)
+{
+    __acceptRetryDelayMs = std::max(1L, millisecs);
+}
 
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::configSet_PipelineDepth(int depth)
+{
+    ConnectionHandler<TRequestHandler>::configSet_PipelineDepth(depth);
+}
+
+
+
+#pragma mark - shards
+template<class TRequestHandler>
+HTTPServer<TRequestHandler>::Shard::Shard(int index, int concurrency_hint)
+  : index(index),
+    io(concurrency_hint),
+    serverStrand(io),
+    acceptor(io),
+    connectionManager(io, serverStrand),
+    acceptRetryTimer(io),
+    acceptsBackedOff(0)
+{
+}
+/**
+** one shard run by many threads, or one single threaded shard per configSet_Shards
+*/
+template<class TRequestHandler>
+std::vector<typename HTTPServer<TRequestHandler>::ShardUPtr> HTTPServer<TRequestHandler>::makeShards()
+{
+    std::vector<ShardUPtr> shards;
+    if( __numberOfShards == 0 ) {
+        shards.push_back(ShardUPtr(new Shard(0, 5)));
+    } else {
+        for(int i = 0; i < __numberOfShards; i++) {
+            shards.push_back(ShardUPtr(new Shard(i, 1)));
+        }
+    }
+    return shards;
+}
+template<class TRequestHandler>
+void HTTPServer<TRequestHandler>::pinThread(int index)
+{
+    if( ! __pinShards )
+        return;
+#ifdef __linux__
+    int cpus = std::max(1, (int)std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if( rc != 0 )
+        LogWarn("could not pin shard ", index, " to cpu ", index % cpus, " error: ", rc);
+#else
+    LogWarn("cpu pinning is only supported on Linux - shard ", index, " not pinned");
+#endif
+}
 
 template<class TRequestHandler>
 HTTPServer<TRequestHandler>::HTTPServer()
-  : _io(5),
-    _signals(_io),
-    _acceptor(_io),
-    _serverStrand(_io),
-    _connectionManager(_io, _serverStrand)
+  : _sharded(__numberOfShards > 0),
+    _shards(makeShards()),
+    _signals(_shards[0]->io),
+    _listenerOptions(SocketOptions::listenerDefaults()),
+    _downstreamOptionsReported(false)
 {
     LogTorTrace();
 
@@ -80,11 +177,31 @@ template<class TRequestHandler> void HTTPServer<TRequestHandler>::initialize()
     
     waitForStop();
     boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), _port);
-    _acceptor.open(endpoint.protocol());
-    _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    _acceptor.bind(endpoint);
+    SocketOptions options = _listenerOptions;
+    if( _sharded ) {
+        // every shard binds the same port, the kernel balances connections across them
+        options.reusePort = true;
+    }
+    for(ShardUPtr& shard : _shards) {
+        shard->acceptor.open(endpoint.protocol());
+        // SO_REUSEADDR and SO_REUSEPORT have to be set before the bind
+        options.apply(shard->acceptor.native_handle(), SocketOptions::Role::Listener);
+        shard->acceptor.bind(endpoint);
+    }
 
 }
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::setListenerOptions(const SocketOptions& options)
+{
+    _listenerOptions = options;
+}
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::setDownstreamOptions(const SocketOptions& options)
+{
+    _downstreamOptions = options;
+}
+template<class TRequestHandler> SocketOptions HTTPServer<TRequestHandler>::effectiveListenerOptions()
+{
+    return SocketOptions::effective(_shards[0]->acceptor.native_handle(), SocketOptions::Role::Listener, _listenerOptions);
+}
 template<class TRequesstHandler>
 HTTPServer<TRequesstHandler>::~HTTPServer()
 {
@@ -98,93 +215,168 @@ template<class TRequestHandler> void HTTPServer<TRequestHandler>::listen(long po
 {
     _port = port;
     initialize();
-    _acceptor.listen();
-    
-    // start the accept process on the _serverStrand
-    auto hf = std::bind(&HTTPServer<TRequestHandler>::startAccept, this);
-    postOnStrand(hf);
+    for(ShardUPtr& shard : _shards) {
+        if( _listenerOptions.listenBacklog ) {
+            shard->acceptor.listen(*_listenerOptions.listenBacklog);
+        } else {
+            shard->acceptor.listen();
+        }
+        // so the backlog can be drained without blocking, asynchronous accepts are not affected
+        shard->acceptor.non_blocking(true);
+    }
+    LogInfo("listener socket options ", effectiveListenerOptions().str(), " shards: ", _shards.size());
     
-#define MULTI_THREAD
-#ifndef MULTI_THREAD
-    _io.run();
-#else
-    long numThreads = _numberOfThreads;
-    std::thread threads[15];
+    // start the accepts on each shard's server strand
+    for(ShardUPtr& shard : _shards) {
+        Shard* sp = shard.get();
+        for(int i = 0; i < __pendingAccepts; i++) {
+            postOnStrand(*sp, [this, sp](){ startAccept(*sp); });
+        }
+    }
     
-    boost::asio::io_service& tmp_io = _io;
-    for(int t_count = 0; t_count < numThreads - 1; t_count++)
-    {
-        threads[t_count] = std::thread([&tmp_io](){
-            LogDebug("thread");
-            tmp_io.run();
-        });
+    std::vector<std::thread> threads;
+    if( _sharded ) {
+        for(std::size_t i = 1; i < _shards.size(); i++) {
+            Shard* sp = _shards[i].get();
+            threads.push_back(std::thread([sp](){
+                LogDebug("shard thread ", sp->index);
+                pinThread(sp->index);
+                sp->io.run();
+            }));
+        }
+        pinThread(0);
+    } else {
+        boost::asio::io_service& tmp_io = _shards[0]->io;
+        for(int t_count = 0; t_count < _numberOfThreads - 1; t_count++)
+        {
+            threads.push_back(std::thread([&tmp_io](){
+                LogDebug("thread");
+                tmp_io.run();
+            }));
+        }
     }
     LogDebug("original thread");
-    _io.run();
-    for(int t_count = 0; t_count < numThreads - 1; t_count++)
+    _shards[0]->io.run();
+    for(std::thread& t : threads)
     {
-        threads[t_count-1].join();
+        t.join();
     }
-#endif
 }
 //-------------------------------------------------------------------------------------
 // startAccept
 //-------------------------------------------------------------------------------------
-template<class TRequestHandler> void HTTPServer<TRequestHandler>::startAccept()
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::startAccept(Shard& shard)
 {
     LogInfo("");
-    ConnectionInterface* conptr = new TCPConnection(_io);
+    // only the socket is made now - the handlers wait until there is a connection for them
+    TCPConnection* conptr = new TCPConnection(shard.io);
     
-    RequestHandlerBase* hi = new TRequestHandler(_io);
-    
-    ConnectionHandler<TRequestHandler>* connectionHandler =
-        new ConnectionHandler<TRequestHandler>(_io, _connectionManager, conptr);
-
-    auto hf = _serverStrand.wrap(
-                    std::bind(&HTTPServer::handleAccept, this, connectionHandler, std::placeholders::_1)
+    auto hf = shard.serverStrand.wrap(
+                    std::bind(&HTTPServer::handleAccept, this, std::ref(shard), conptr, std::placeholders::_1)
                     );
-    conptr->asyncAccept(_acceptor, hf);
+    conptr->asyncAccept(shard.acceptor, hf);
 }
 
 //-------------------------------------------------------------------------------------
-// handleAccept - called on _strand to handle a new client connection
+// handleAccept - called on the shard's strand to handle a new client connection.
+// A completed accept usually means more are waiting in the backlog, they are taken
+// without blocking, up to __acceptBatch of them, before this accept is started again.
+// After an error other than a cancel the accept backs off before it is started again
 //-------------------------------------------------------------------------------------
 template<class TRequestHandler> void HTTPServer<TRequestHandler>::handleAccept(
-                                                                ConnectionHandler<TRequestHandler>* connHandler,
+                                                                Shard& shard,
+                                                                TCPConnection* conn,
                                                                 const boost::system::error_code& err)
 {
-    LogInfo("", connHandler);
-    if (! _acceptor.is_open()){
-        delete connHandler;
+    LogInfo("", conn);
+    if (! shard.acceptor.is_open()){
+        delete conn;
         LogWarn("Accept is not open ???? WTF - lets TERM the server");
         return; // something is wrong
     }
     if (!err){
-        LogInfo("got a connection", connHandler->nativeSocketFD());
-        
-        _connectionManager.registerConnectionHandler(connHandler);
-        //
-        // at this point we are running on _serveStrand start the connectionHandler with a post to
-        // liberate it from the strand
-        //
-//        std::cout << "Server handleAccept " << std::hex << (long) this << " " << (long)connHandler << std::endl;
-        auto hf = std::bind(&ConnectionHandler<TRequestHandler>::serve, connHandler);
-        _io.post(hf);
-    }else{
+        serveConnection(shard, conn);
+        for(int i = 0; i < __acceptBatch; i++) {
+            TCPConnection* another = new TCPConnection(shard.io);
+            Marvin::ErrorType accept_err = another->accept(shard.acceptor);
+            if( accept_err ) {
+                delete another;
+                if( accept_err != boost::asio::error::would_block ) {
+                    LogWarn("Accept error value:",accept_err.value()," cat:", accept_err.category().name(), "message: ",accept_err.message());
+                    backOffAccept(shard);
+                    return;
+                }
+                break;
+            }
+            serveConnection(shard, another);
+        }
+    }else if( err != boost::asio::error::operation_aborted ){
         LogWarn("Accept error value:",err.value()," cat:", err.category().name(), "message: ",err.message());
-        delete connHandler;
+        delete conn;
+        backOffAccept(shard);
+        return;
+    }else{
+        delete conn;
     }
-    startAccept();
+    startAccept(shard);
     
 }
 
 //-------------------------------------------------------------------------------------
-// postOnStrand - wraps a parameterless function in _strand and posts to _io
+// backOffAccept - called on the shard's strand after an accept error. EMFILE, ENFILE,
+// ENOBUFS and the like last until something is released, so accepting again at once
+// would spin the shard's thread. One timer serves all the shard's accepts that back off
 //-------------------------------------------------------------------------------------
-template<class TRequestHandler> void HTTPServer<TRequestHandler>::postOnStrand(std::function<void()> fn)
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::backOffAccept(Shard& shard)
 {
-    auto wrappedFn = _serverStrand.wrap(fn);
-    _io.post(wrappedFn);
+    if( shard.acceptsBackedOff++ > 0 )
+        return;
+    shard.acceptRetryTimer.expires_from_now(boost::posix_time::milliseconds(__acceptRetryDelayMs));
+    shard.acceptRetryTimer.async_wait(shard.serverStrand.wrap(
+        std::bind(&HTTPServer::handleAcceptRetry, this, std::ref(shard), std::placeholders::_1)
+    ));
+}
+
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::handleAcceptRetry(Shard& shard, const boost::system::error_code& err)
+{
+    int backed_off = shard.acceptsBackedOff;
+    shard.acceptsBackedOff = 0;
+    if( err || ! shard.acceptor.is_open() )
+        return;
+    for(int i = 0; i < backed_off; i++)
+        startAccept(shard);
+}
+
+//-------------------------------------------------------------------------------------
+// serveConnection - called on the shard's strand with a connected socket
+//-------------------------------------------------------------------------------------
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::serveConnection(Shard& shard, TCPConnection* conn)
+{
+    LogInfo("got a connection", conn->nativeSocketFD());
+    _downstreamOptions.apply(conn->nativeSocketFD(), SocketOptions::Role::Downstream);
+    if( ! _downstreamOptionsReported.exchange(true) ) {
+        LogInfo("downstream socket options ",
+            SocketOptions::effective(conn->nativeSocketFD(), SocketOptions::Role::Downstream).str());
+    }
+    ConnectionHandler<TRequestHandler>* connHandler =
+        new ConnectionHandler<TRequestHandler>(shard.io, shard.connectionManager, conn);
+    
+    shard.connectionManager.registerConnectionHandler(connHandler);
+    //
+    // at this point we are running on the shard's server strand start the connectionHandler with a post to
+    // liberate it from the strand
+    //
+    auto hf = std::bind(&ConnectionHandler<TRequestHandler>::serve, connHandler);
+    shard.io.post(hf);
+}
+
+//-------------------------------------------------------------------------------------
+// postOnStrand - wraps a parameterless function in the shard's strand and posts to its io_service
+//-------------------------------------------------------------------------------------
+template<class TRequestHandler> void HTTPServer<TRequestHandler>::postOnStrand(Shard& shard, std::function<void()> fn)
+{
+    auto wrappedFn = shard.serverStrand.wrap(fn);
+    shard.io.post(wrappedFn);
 }
 #pragma mark - signal handling
 //-------------------------------------------------------------------------------------
@@ -193,7 +385,7 @@ template<class TRequestHandler> void HTTPServer<TRequestHandler>::postOnStrand(s
 template<class TRequestHandler> void HTTPServer<TRequestHandler>::waitForStop()
 {
     LogDebug("");
-    auto hf = _serverStrand.wrap(
+    auto hf = _shards[0]->serverStrand.wrap(
                     std::bind(&HTTPServer::doStop, this, std::placeholders::_1)
                     );
 
@@ -203,8 +395,15 @@ template<class TRequestHandler> void HTTPServer<TRequestHandler>::doStop(const M
 {
     LogDebug("");
     std::cout << "doStop" << std::endl;
-    _io.stop();
-    _acceptor.close();
+    // an acceptor belongs to its shard's thread, so each shard closes its own
+    for(ShardUPtr& shard : _shards) {
+        Shard* sp = shard.get();
+        sp->io.post([sp](){
+            boost::system::error_code ignored;
+            sp->acceptor.close(ignored);
+            sp->io.stop();
+        });
+    }
 //  connection_manager_.stop_all();
 }
 
@@ -1,11 +1,16 @@
 #include <iostream>
 #include <ostream>
 #include <iterator>
+#include <fstream>
 #include <algorithm>
 #include "catch.hpp"
 #include "boost_stuff.hpp"
 #include <functional>
 #include <memory>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <boost/filesystem.hpp>
 
 #include "rb_logger.hpp"
 
@@ -18,6 +23,19 @@ RBLOGGER_SETLEVEL(LOG_LEVEL_DEBUG);
 #include "mock_read_socket.hpp"
 
 #include "message_reader_v2.hpp"
+#include "canned_response.hpp"
+#include "message_writer_v2.hpp"
+#include "socket_options.hpp"
+#include "tcp_connection.hpp"
+#include "resolver_cache.hpp"
+#include "connection_pool.hpp"
+#include "tls_client_context.hpp"
+#include "tls_session_cache.hpp"
+#include "timing_wheel.hpp"
+#include "tunnel_handler.hpp"
+#include "sequenced_connection.hpp"
+#include "request_handler_base.hpp"
+#include "connection_handler.hpp"
 class MyMessageReader : public MessageReaderV2
 {
 public:
@@ -34,6 +52,7 @@ public:
 };
 #include "testcase.hpp"
 #include "testcase_defs.hpp"
+#include "scanner_diff.hpp"
 #include "test_runner.cpp"
 
 void testRepeatTimer(){
@@ -81,6 +100,1250 @@ void testStreamingReader(Testcase testcase)
     delete tr;
 }
 
+/**
+* Several responses sent back to back on one connection with the message boundaries falling
+* inside reads, including inside a body read. Either one reader is reset between messages, or
+* (as when the previous request is still being served) each message gets a new reader that takes
+* over the bytes the previous one read ahead.
+*/
+void testPipelinedReader(bool new_reader_per_message)
+{
+    boost::asio::io_service io_service;
+    std::vector<std::pair<int, std::string>> expected {
+        {200, "hello"}, {201, "abc"}, {204, ""}, {200, "0123456789"}, {202, "ok"}
+    };
+    // the raw body stops where the message does, it never includes the next one
+    std::vector<std::string> expected_raw {
+        "hello", "abc", "", "5\r\n01234\r\n5\r\n56789\r\n0\r\n\r\n", "ok"
+    };
+    Testcase tc(
+        "pipelined - 5 messages through one reader",
+        std::vector<std::string> {
+            "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhelloHTTP/1.1 201 Created\r\nContent-Length: 3\r\n\r\nabcHTTP/1.1 204 No Content\r\n",
+            "Content-Length: 0\r\n\r\nHTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n",
+            "5\r\n01234\r\n5\r\n56789\r\n0\r\n\r\nHTTP/1.1 202 Accepted\r\nContent-Length: 2\r\n\r\nok"
+        },
+        std::string("HTTP/1.1 200 OK"), 200, Marvin::make_error_ok(), std::map<std::string, std::string>{}, std::string("hello")
+    );
+    MockReadSocketSPtr msock_ptr = std::shared_ptr<MockReadSocket>(new MockReadSocket(io_service, tc));
+    MessageReaderV2SPtr rdr = std::make_shared<MessageReaderV2>(io_service, msock_ptr);
+    std::size_t index = 0;
+    std::function<void(Marvin::ErrorType)> onMessage = [&](Marvin::ErrorType er) {
+        assert( ! er );
+        assert( rdr->statusCode() == expected[index].first );
+        assert( rdr->get_body_chain()->to_string() == expected[index].second );
+        assert( rdr->get_raw_body_chain()->to_string() == expected_raw[index] );
+        REQUIRE( rdr->statusCode() == expected[index].first );
+        REQUIRE( rdr->get_body_chain()->to_string() == expected[index].second );
+        index++;
+        if( index < expected.size() ) {
+            if( new_reader_per_message ) {
+                MessageReaderV2SPtr previous = rdr;
+                rdr = std::make_shared<MessageReaderV2>(io_service, msock_ptr);
+                rdr->takeLeftover(*previous);
+            } else {
+                rdr->reset();
+            }
+            rdr->readMessage(onMessage);
+        } else {
+            assert( rdr->leftover() == 0 );
+            std::cout << "testPipelinedReader Success for testcase " << tc.getDescription() << std::endl;
+        }
+    };
+    rdr->readMessage(onMessage);
+    io_service.run();
+    assert( index == expected.size() );
+}
+
+/**
+* The trailers of a chunked message arrive in body reads, outside the header arena. They must
+* end up in the trailers, copied, and leave the headers alone
+*/
+void testChunkedTrailers()
+{
+    boost::asio::io_service io_service;
+    Testcase tc(
+        "chunked with trailers",
+        std::vector<std::string> {
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nX-Header: one\r\n\r\n5\r\nhello\r\n",
+            "6\r\n world\r\n0\r\nX-Checksum: abc",
+            "123\r\nX-Other: two\r\n\r\n"
+        },
+        std::string("HTTP/1.1 200 OK"), 200, Marvin::make_error_ok(), std::map<std::string, std::string>{}, std::string("hello world")
+    );
+    MockReadSocketSPtr msock_ptr = std::shared_ptr<MockReadSocket>(new MockReadSocket(io_service, tc));
+    MessageReaderV2SPtr rdr = std::make_shared<MessageReaderV2>(io_service, msock_ptr);
+    bool done = false;
+    rdr->readMessage([&](Marvin::ErrorType er) {
+        assert( ! er );
+        assert( rdr->get_body_chain()->to_string() == "hello world" );
+        assert( rdr->headers().size() == 2 );
+        assert( rdr->getHeader("X-Header") == "one" );
+        assert( ! rdr->hasHeader("X-Checksum") );
+        assert( rdr->hasTrailer("X-Checksum") && (rdr->trailer("X-Checksum") == "abc123") );
+        assert( rdr->hasTrailer("X-Other") && (rdr->trailer("X-Other") == "two") );
+        REQUIRE( rdr->trailers().size() == 2 );
+        done = true;
+    });
+    io_service.run();
+    assert( done );
+    std::cout << "testChunkedTrailers Success" << std::endl;
+}
+
+void testHeaderTable()
+{
+    assert( HttpHeader::idOf("content-length", 14) == HttpHeader::Id::ContentLength );
+    assert( HttpHeader::idOf(std::string("SET-COOKIE")) == HttpHeader::Id::SetCookie );
+    assert( HttpHeader::idOf(std::string("Content-Lengthx")) == HttpHeader::Id::Unknown );
+    assert( HttpHeader::idOf(std::string("X-Custom")) == HttpHeader::Id::Unknown );
+
+    MessageBase msg;
+    msg.addHeader("Set-Cookie", "a=1");
+    msg.addHeader("x-custom", "one");
+    msg.addHeader("Set-Cookie", "b=2");
+    msg.setHeader("CONTENT-LENGTH", "10");
+    msg.setHeader("Content-Length", "20");
+    HeaderTable& t = msg.headers();
+    assert( t.size() == 4 );
+    assert( t.count("set-cookie") == 2 );
+    assert( t.name(0) == "Set-Cookie" );
+    assert( t.name(3) == "Content-Length" );
+    assert( msg.hasHeader(HttpHeader::Id::ContentLength) );
+    assert( msg.getHeader(HttpHeader::Name::ContentLength) == "20" );
+    assert( msg.getHeader("X-CUSTOM") == "one" );
+    assert( msg.getHeaders()["SET-COOKIE"] == "a=1" );
+    assert( (t.values("set-cookie") == std::vector<std::string>{"a=1", "b=2"}) );
+    assert( msg.str().find("Set-Cookie: b=2\r\n") != std::string::npos );
+
+    std::vector<std::string> copied;
+    static const HttpHeader::IdSet skip{HttpHeader::Id::SetCookie};
+    t.forEachNotIn(skip, [&t, &copied](std::size_t i) { copied.push_back(t.name(i)); });
+    assert( (copied == std::vector<std::string>{"x-custom", "Content-Length"}) );
+    msg.addHeader("X-Custom", "two");
+    assert( msg.getHeaders()["X-CUSTOM"] == "one, two" );
+
+    msg.removeHeader(HttpHeader::Id::SetCookie);
+    msg.removeHeader("X-Custom");
+    assert( t.size() == 1 );
+    assert( t.find(HttpHeader::Id::ContentLength) == 0 );
+    std::cout << "testHeaderTable Success" << std::endl;
+}
+
+void testSerializeHeaders()
+{
+    MessageBase req;
+    req.setMethod(HttpMethod::POST);
+    req.setUri("/a/b?c=d");
+    req.setHeader("Host", "example.com");
+    req.addHeader("X-Two", "1");
+    req.addHeader("x-two", "2");
+    MBufferSPtr mb = serializeHeaders(req);
+    std::string expected = "POST /a/b?c=d HTTP/1.1\r\nHost: example.com\r\nX-Two: 1\r\nx-two: 2\r\n\r\n";
+    assert( mb->toString() == expected );
+    assert( serializedHeadersSize(req) == expected.size() );
+
+    MessageBase resp;
+    resp.setStatusCode(404);
+    resp.setStatus("Not Found");
+    resp.setHttpVersMinor(0);
+    resp.setHeader(HttpHeader::Id::ContentLength, "0");
+    std::string big(5000, 'v');
+    resp.setHeader("X-Big", big);
+    mb = serializeHeaders(resp);
+    assert( mb->toString() == "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nX-Big: " + big + "\r\n\r\n" );
+    std::cout << "testSerializeHeaders Success" << std::endl;
+}
+
+void testCannedResponse()
+{
+    CannedResponseSPtr ok = CannedResponse::get(CannedResponse::Id::ConnectOK);
+    assert( ok->slots() == 0 );
+    assert( ok->str() == "HTTP/1.1 200 OK\r\n\r\n" );
+    assert( ok->render()->size() == ok->size() );
+    assert( CannedResponse::get(CannedResponse::Id::BadGateway)->str()
+                == "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+
+    MessageBase msg;
+    msg.setStatusCode(200);
+    msg.setStatus("OK");
+    msg.setHeader(HttpHeader::Id::ContentLength, "5");
+    msg.setHeader(HttpHeader::Id::ConnectionHandlerId, CannedResponse::kSlot);
+    msg.setHeader("X-Other", CannedResponse::kSlot);
+    CannedResponse canned(msg, "12345");
+    assert( canned.slots() == 2 );
+    assert( canned.str({"abc-123", ""})
+                == "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnect-Handler-Id: abc-123\r\nX-Other: \r\n\r\n12345" );
+    assert( canned.str({"x", "y"}).find("Connect-Handler-Id: x\r\nX-Other: y\r\n") != std::string::npos );
+
+    CannedResponse::configSet_Response(CannedResponse::Id::Forbidden, std::make_shared<CannedResponse>(msg, "12345"));
+    assert( CannedResponse::get(CannedResponse::Id::Forbidden)->slots() == 2 );
+    std::cout << "testCannedResponse Success" << std::endl;
+}
+
+/**
+* A connection that records what is written to it - one entry per write
+*/
+class MockWriteConnection : public ConnectionInterface
+{
+public:
+    MockWriteConnection(boost::asio::io_service& io) : _io(io) {}
+    void asyncConnect(ConnectCallbackType cb){ assert(false); }
+    void asyncAccept(boost::asio::ip::tcp::acceptor& acceptor, std::function<void(const boost::system::error_code& err)> cb){ assert(false); }
+    void asyncRead(MBuffer& mb, AsyncReadCallbackType cb){ assert(false); }
+    void asyncWrite(MBuffer& buffer, AsyncWriteCallbackType cb){ done(buffer.toString(), cb); }
+    void asyncWrite(BufferChainSPtr chain_sptr, AsyncWriteCallbackType cb){ done(chain_sptr->to_string(), cb); }
+    void asyncWrite(std::string& str, AsyncWriteCallbackType cb){ done(str, cb); }
+    void asyncWrite(boost::asio::const_buffer buf, AsyncWriteCallback cb)
+    {
+        done(std::string(boost::asio::buffer_cast<const char*>(buf), boost::asio::buffer_size(buf)), cb);
+    }
+    void asyncWrite(boost::asio::streambuf& sb, AsyncWriteCallback cb){ assert(false); }
+    void asyncWrite(BodyFileSPtr body_file_sptr, AsyncWriteCallback cb){ assert(false); }
+    void setSocketOptions(const SocketOptions& options){}
+    void shutdown(){}
+    void close(){}
+    long nativeSocketFD(){ return -1; }
+
+    std::vector<std::string> writes;
+private:
+    void done(std::string s, AsyncWriteCallback cb)
+    {
+        writes.push_back(s);
+        std::size_t n = s.size();
+        _io.post([cb, n](){
+            Marvin::ErrorType ok = Marvin::make_error_ok();
+            cb(ok, n);
+        });
+    }
+    boost::asio::io_service& _io;
+};
+
+void testChunkedWriter()
+{
+    boost::asio::io_service io;
+    std::shared_ptr<MockWriteConnection> conn = std::make_shared<MockWriteConnection>(io);
+    MessageWriterV2SPtr wrtr = std::make_shared<MessageWriterV2>(io, conn);
+    MessageBaseSPtr msg = std::make_shared<MessageBase>();
+    msg->setMethod(HttpMethod::POST);
+    msg->setUri("/upload");
+    msg->setHeader(HttpHeader::Id::TransferEncoding, "chunked");
+    msg->setTrailer("X-Checksum", "abc");
+
+    MBufferSPtr mb = m_buffer(std::string("0123456789abcdefXYZ"));
+    BufferChainSPtr chunk1 = std::make_shared<BufferChain>();
+    chunk1->push_back(buffer_slice(mb, mb->data(), 10));
+    BufferChainSPtr chunk2 = buffer_chain(m_buffer(std::string(300, 'z')));
+    int steps = 0;
+    wrtr->asyncWriteHeaders(msg, [&](Marvin::ErrorType& err){
+        assert( ! err );
+        wrtr->asyncWriteBodyData(chunk1, [&](Marvin::ErrorType& err){
+            assert( ! err );
+            wrtr->asyncWriteBodyData(chunk2, [&](Marvin::ErrorType& err){
+                assert( ! err );
+                wrtr->asyncWriteTrailers(msg, [&](Marvin::ErrorType& err, std::size_t bytes_transfered){
+                    assert( ! err );
+                    steps++;
+                });
+            });
+        });
+    });
+    io.run();
+    assert( steps == 1 );
+    assert( conn->writes.size() == 4 );
+    assert( conn->writes[0] == "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" );
+    assert( conn->writes[1] == "a\r\n0123456789\r\n" );
+    assert( conn->writes[2] == "12c\r\n" + std::string(300, 'z') + "\r\n" );
+    assert( conn->writes[3] == "0\r\nX-Checksum: abc\r\n\r\n" );
+    std::cout << "testChunkedWriter Success" << std::endl;
+}
+
+/**
+* Two pipelined responses - the second is written and completed before the first has started,
+* the connection must still see all of the first response and then the second
+*/
+void testWriteSequencer()
+{
+    boost::asio::io_service io;
+    std::shared_ptr<MockWriteConnection> conn = std::make_shared<MockWriteConnection>(io);
+    WriteSequencerSPtr seq = std::make_shared<WriteSequencer>();
+    std::size_t t0 = seq->nextTicket();
+    std::size_t t1 = seq->nextTicket();
+    SequencedConnection first(conn, seq, t0);
+    SequencedConnection second(conn, seq, t1);
+    std::string first_head("first-head");
+    std::string first_body("first-body");
+    std::string second_all("second");
+    std::vector<std::string> callbacks;
+    second.asyncWrite(second_all, [&](Marvin::ErrorType& err, std::size_t n){
+        assert( ! err );
+        callbacks.push_back("second");
+    });
+    seq->complete(t1);
+    io.poll();
+    assert( conn->writes.empty() && callbacks.empty() );
+    io.reset();
+    first.asyncWrite(first_head, [&](Marvin::ErrorType& err, std::size_t n){
+        assert( ! err );
+        callbacks.push_back("first-head");
+        first.asyncWrite(first_body, [&](Marvin::ErrorType& err, std::size_t n){
+            assert( ! err );
+            callbacks.push_back("first-body");
+            seq->complete(t0);
+        });
+    });
+    io.run();
+    assert( (conn->writes == std::vector<std::string>{"first-head", "first-body", "second"}) );
+    assert( (callbacks == std::vector<std::string>{"first-head", "first-body", "second"}) );
+    std::cout << "testWriteSequencer Success" << std::endl;
+}
+
+/**
+* Answers each request with its uri as the body. "/slow" answers after a delay, "/close" does not
+* keep the connection alive. Records the order requests are dispatched and answered in
+*/
+class PipelineTestHandler : public RequestHandlerBase
+{
+public:
+    static std::vector<std::string> dispatched;
+    static std::vector<std::string> answered;   /// when the handler hands its response to the writer
+    static std::vector<std::string> completed;  /// when the response has been written
+
+    PipelineTestHandler(boost::asio::io_service& io) : RequestHandlerBase(io), _timer(io) {}
+
+    void handleConnect(MessageReaderV2SPtr req, ConnectionInterfaceSPtr connPtr, HandlerDoneCallbackType done)
+    {
+        // a CONNECT is only dispatched once every earlier response is complete
+        assert( completed.size() == dispatched.size() );
+        dispatched.push_back("CONNECT");
+        Marvin::ErrorType ok = Marvin::make_error_ok();
+        done(ok, false);
+    }
+    void handleRequest(MessageReaderV2SPtr req, MessageWriterV2SPtr rep, HandlerDoneCallbackType done)
+    {
+        std::string uri = req->uri();
+        dispatched.push_back(uri);
+        _body = uri;
+        _response = std::make_shared<MessageBase>();
+        _response->setStatusCode(200);
+        _response->setStatus("OK");
+        _response->setHeader(HttpHeader::Id::ContentLength, std::to_string(_body.size()));
+        bool keep_alive = (uri != "/close");
+        auto respond = [this, uri, rep, done, keep_alive](){
+            answered.push_back(uri);
+            rep->asyncWrite(_response, _body, [uri, done, keep_alive](Marvin::ErrorType& err){
+                assert( ! err );
+                completed.push_back(uri);
+                done(err, keep_alive);
+            });
+        };
+        if( uri == "/slow" ) {
+            _timer.expires_from_now(boost::posix_time::milliseconds(100));
+            _timer.async_wait([respond](const boost::system::error_code& err){ respond(); });
+        } else {
+            respond();
+        }
+    }
+private:
+    boost::asio::deadline_timer _timer;
+    MessageBaseSPtr             _response;
+    std::string                 _body;
+};
+std::vector<std::string> PipelineTestHandler::dispatched;
+std::vector<std::string> PipelineTestHandler::answered;
+std::vector<std::string> PipelineTestHandler::completed;
+
+/**
+* Serves one accepted connection with a ConnectionHandler. The client sends requests, and once
+* it has seen wait_for it pauses and sends then_send. Returns everything the client received
+* up to the server closing the connection
+*/
+static std::string servePipelined(const std::string& requests, const std::string& wait_for = "", const std::string& then_send = "")
+{
+    PipelineTestHandler::dispatched.clear();
+    PipelineTestHandler::answered.clear();
+    PipelineTestHandler::completed.clear();
+    boost::asio::io_service io;
+    boost::asio::strand server_strand(io);
+    ServerConnectionManager<ConnectionHandler<PipelineTestHandler>> manager(io, server_strand);
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    TCPConnection* conn = new TCPConnection(io);
+    boost::asio::streambuf at_client;
+    boost::asio::deadline_timer pause(io);
+    bool closed = false;
+    conn->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        ConnectionHandler<PipelineTestHandler>* handler = new ConnectionHandler<PipelineTestHandler>(io, manager, conn);
+        manager.registerConnectionHandler(handler);
+        handler->serve();
+    });
+    client.connect(acceptor.local_endpoint());
+    boost::asio::write(client, boost::asio::buffer(requests));
+    auto read_to_end = [&](){
+        boost::asio::async_read(client, at_client, [&](const boost::system::error_code& err, std::size_t n){
+            // a request sent after the server closed can turn the end into a reset
+            assert( (err == boost::asio::error::eof) || (err == boost::asio::error::connection_reset) );
+            closed = true;
+        });
+    };
+    if( wait_for.empty() ) {
+        read_to_end();
+    } else {
+        boost::asio::async_read_until(client, at_client, wait_for, [&](const boost::system::error_code& err, std::size_t n){
+            assert( ! err );
+            pause.expires_from_now(boost::posix_time::milliseconds(50));
+            pause.async_wait([&](const boost::system::error_code& err){
+                boost::system::error_code ignored;
+                boost::asio::write(client, boost::asio::buffer(then_send), ignored);
+                read_to_end();
+            });
+        });
+    }
+    io.run();
+    assert( closed );
+    return std::string(boost::asio::buffers_begin(at_client.data()), boost::asio::buffers_end(at_client.data()));
+}
+
+/**
+* Requests read ahead on one connection - responses are answered out of order but leave in
+* request order, a CONNECT waits until it is the oldest request, and a request read ahead
+* behind a response that does not keep the connection alive is not served
+*/
+void testPipelinedConnectionHandler()
+{
+    typedef std::vector<std::string> Strings;
+    ConnectionHandler<PipelineTestHandler>::configSet_PipelineDepth(4);
+
+    std::string wire = servePipelined(
+        "GET /slow HTTP/1.1\r\nHost: x\r\n\r\n"
+        "GET /fast HTTP/1.1\r\nHost: x\r\n\r\n"
+        "GET /close HTTP/1.1\r\nHost: x\r\n\r\n");
+    assert( (PipelineTestHandler::dispatched == Strings{"/slow", "/fast", "/close"}) );
+    assert( (PipelineTestHandler::answered == Strings{"/fast", "/close", "/slow"}) );
+    assert( (PipelineTestHandler::completed == Strings{"/slow", "/fast", "/close"}) );
+    std::size_t slow = wire.find("\r\n\r\n/slow");
+    std::size_t fast = wire.find("\r\n\r\n/fast");
+    std::size_t close = wire.find("\r\n\r\n/close");
+    assert( (slow != std::string::npos) && (fast != std::string::npos) && (close != std::string::npos) );
+    assert( (slow < fast) && (fast < close) );
+
+    wire = servePipelined(
+        "GET /slow HTTP/1.1\r\nHost: x\r\n\r\n"
+        "CONNECT example.com:443 HTTP/1.1\r\nHost: example.com:443\r\n\r\n");
+    assert( (PipelineTestHandler::dispatched == Strings{"/slow", "CONNECT"}) );
+    assert( wire.find("\r\n\r\n/slow") != std::string::npos );
+
+    wire = servePipelined(
+        "GET /close HTTP/1.1\r\nHost: x\r\n\r\n",
+        "/close",
+        "GET /after HTTP/1.1\r\nHost: x\r\n\r\n");
+    assert( (PipelineTestHandler::dispatched == Strings{"/close"}) );
+    assert( wire.find("/after") == std::string::npos );
+
+    ConnectionHandler<PipelineTestHandler>::configSet_PipelineDepth(1);
+    std::cout << "testPipelinedConnectionHandler Success" << std::endl;
+}
+
+void testSocketOptions()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    assert( fd >= 0 );
+    SocketOptions options;
+    options.noDelay = true;
+    options.keepAlive = true;
+    options.sendBufferSize = 65536;
+    options.reuseAddress = true;    // not a downstream option - ignored
+    Marvin::ErrorType err = options.apply(fd, SocketOptions::Role::Downstream);
+    assert( ! err );
+    SocketOptions eff = SocketOptions::effective(fd, SocketOptions::Role::Downstream);
+    assert( eff.noDelay && *eff.noDelay );
+    assert( eff.keepAlive && *eff.keepAlive );
+    assert( eff.sendBufferSize && (*eff.sendBufferSize >= 65536) );
+    assert( ! eff.reuseAddress );
+    assert( ! eff.listenBacklog );
+
+    SocketOptions listener = SocketOptions::listenerDefaults();
+#ifdef SO_REUSEPORT
+    listener.reusePort = true;
+#endif
+    err = listener.apply(fd, SocketOptions::Role::Listener);
+    assert( ! err );
+    eff = SocketOptions::effective(fd, SocketOptions::Role::Listener, listener);
+    assert( eff.reuseAddress && *eff.reuseAddress );
+#ifdef SO_REUSEPORT
+    assert( eff.reusePort && *eff.reusePort );
+#endif
+    assert( eff.listenBacklog == listener.listenBacklog );
+    assert( ! eff.noDelay );
+    assert( options.str().find("noDelay=1") != std::string::npos );
+    ::close(fd);
+    std::cout << "testSocketOptions Success" << std::endl;
+}
+
+void testHappyEyeballs()
+{
+    typedef boost::asio::ip::address addr;
+    std::vector<tcp::endpoint> eps = {
+        tcp::endpoint(addr::from_string("2001:db8::1"), 80),
+        tcp::endpoint(addr::from_string("2001:db8::2"), 80),
+        tcp::endpoint(addr::from_string("192.0.2.1"), 80),
+        tcp::endpoint(addr::from_string("192.0.2.2"), 80),
+        tcp::endpoint(addr::from_string("192.0.2.3"), 80)
+    };
+    // families alternate, starting with whichever the resolver put first
+    std::vector<tcp::endpoint> order = TCPConnection::orderEndpoints(eps, 0);
+    assert( order.size() == 5 );
+    assert( order[0] == eps[0] && order[1] == eps[2] && order[2] == eps[1] && order[3] == eps[3] && order[4] == eps[4] );
+    // unless the other family is known to work
+    order = TCPConnection::orderEndpoints(eps, AF_INET);
+    assert( order[0] == eps[2] && order[1] == eps[0] && order[2] == eps[3] && order[3] == eps[1] && order[4] == eps[4] );
+    // a preference for a family that is not there is ignored
+    std::vector<tcp::endpoint> v4only(eps.begin() + 2, eps.end());
+    order = TCPConnection::orderEndpoints(v4only, AF_INET6);
+    assert( order == v4only );
+
+    // a real connect to a local listener, and one to a port nobody listens on
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(addr::from_string("127.0.0.1"), 0));
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+    tcp::socket accepted(io);
+    acceptor.async_accept(accepted, [](const boost::system::error_code& err){ assert( ! err ); });
+    TCPConnection good(io, "http", "localhost", port);
+    TCPConnection bad(io, "http", "localhost", "1");
+    int results = 0;
+    good.asyncConnect([&](Marvin::ErrorType& err, ConnectionInterface* conn){
+        assert( ! err && (conn == &good) );
+        results++;
+    });
+    bad.asyncConnect([&](Marvin::ErrorType& err, ConnectionInterface* conn){
+        assert( err && (conn == nullptr) );
+        results++;
+    });
+    io.run();
+    assert( results == 2 );
+    std::cout << "testHappyEyeballs Success" << std::endl;
+}
+
+void testResolverCache()
+{
+    ResolverCache& cache = ResolverCache::getInstance();
+    cache.clear();
+    ResolverCache::Metrics before = cache.metrics();
+    boost::asio::io_service io;
+    int answers = 0;
+    auto good = [&](Marvin::ErrorType& err, EndpointsSPtr endpoints){
+        assert( ! err && (endpoints->size() > 0) );
+        assert( (*endpoints)[0].port() == 80 );
+        answers++;
+    };
+    auto bad = [&](Marvin::ErrorType& err, EndpointsSPtr endpoints){
+        assert( err && endpoints->empty() );
+        answers++;
+    };
+    // two at once - one lookup
+    cache.asyncResolve(io, "localhost", "80", good);
+    cache.asyncResolve(io, "LOCALHOST", "80", good);
+    cache.asyncResolve(io, "no-such-host.invalid", "80", bad);
+    io.run();
+    io.reset();
+    assert( answers == 3 );
+    // now both from the cache, including the failure
+    cache.asyncResolve(io, "localhost", "80", good);
+    cache.asyncResolve(io, "no-such-host.invalid", "80", bad);
+    io.run();
+    assert( answers == 5 );
+    ResolverCache::Metrics m = cache.metrics();
+    assert( m.lookups - before.lookups == 2 );
+    assert( m.misses - before.misses == 2 );
+    assert( m.merged - before.merged == 1 );
+    assert( m.hits - before.hits == 2 );
+    assert( m.negativeHits - before.negativeHits == 1 );
+    assert( m.failures - before.failures == 1 );
+    assert( m.entries == 2 );
+    assert( m.hitRate() > 0.0 );
+    std::cout << "testResolverCache Success" << std::endl;
+}
+
+/**
+* each io_service has a pool of its own, so the shards of a sharded server never share one
+*/
+void testConnectionPoolPerIoService()
+{
+    boost::asio::io_service io_one;
+    boost::asio::io_service io_two;
+    ConnectionPool* one = ConnectionPool::getInstance(io_one);
+    ConnectionPool* two = ConnectionPool::getInstance(io_two);
+    assert( one != nullptr && two != nullptr );
+    assert( one != two );
+    assert( ConnectionPool::getInstance(io_one) == one );
+    assert( ConnectionPool::getInstance(io_two) == two );
+    std::cout << "testConnectionPoolPerIoService Success" << std::endl;
+}
+
+void testConnectionPool()
+{
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+    std::vector<std::shared_ptr<tcp::socket>> accepted;
+    std::function<void()> acceptOne = [&](){
+        std::shared_ptr<tcp::socket> s = std::make_shared<tcp::socket>(io);
+        acceptor.async_accept(*s, [&, s](const boost::system::error_code& err){
+            if( err ) return;
+            accepted.push_back(s);
+            acceptOne();
+        });
+    };
+    acceptOne();
+    ConnectionPool* pool = new ConnectionPool(io);
+    ConnectionInterface* first = nullptr;
+    int steps = 0;
+    auto finish = [&](){
+        steps++;
+        acceptor.close();
+        // the idle timer would keep the io_service running until the idle connection expires
+        io.stop();
+    };
+    // connect, release for re-use, get it back
+    pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* conn){
+        assert( ! err );
+        first = conn;
+        pool->releaseConnection(conn, true);
+        pool->asyncGetConnection("HTTP", "LocalHost", port, [&](Marvin::ErrorType& err, ConnectionInterface* conn){
+            assert( ! err && (conn == first) );
+            // the server closes it while it is idle - it must not be handed out again
+            pool->releaseConnection(conn, true);
+            io.post([&](){
+                assert( accepted.size() == 1 );
+                accepted[0]->close();
+                io.post([&](){
+                    pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* conn){
+                        assert( ! err );
+                        // not reusable - closed and deleted
+                        pool->releaseConnection(conn, false);
+                        pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* conn){
+                            assert( ! err );
+                            pool->releaseConnection(conn, true);
+                            io.post(finish);
+                        });
+                    });
+                });
+            });
+        });
+    });
+    io.run();
+    assert( steps == 1 );
+    ConnectionPool::Metrics m = pool->metrics();
+    assert( m.created == 3 );
+    assert( m.reused == 1 );
+    assert( m.stale == 1 );
+    assert( m.closed == 1 );
+    assert( m.idle == 1 );
+    assert( m.inUse == 0 );
+    assert( (m.reuseRatio() > 0.24) && (m.reuseRatio() < 0.26) );
+    std::cout << "testConnectionPool Success" << std::endl;
+}
+
+void testConnectionPoolQueues()
+{
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+    std::vector<std::shared_ptr<tcp::socket>> accepted;
+    std::function<void()> acceptOne = [&](){
+        std::shared_ptr<tcp::socket> s = std::make_shared<tcp::socket>(io);
+        acceptor.async_accept(*s, [&, s](const boost::system::error_code& err){
+            if( err ) return;
+            accepted.push_back(s);
+            acceptOne();
+        });
+    };
+    acceptOne();
+    // one connection in total - "localhost" and "127.0.0.1" are different targets
+    ConnectionPool::configSet_MaxConnections(1);
+    ConnectionPool::configSet_WaitTimeout(100);
+    ConnectionPool* pool = new ConnectionPool(io);
+    std::vector<std::string> order;
+    bool timed_out = false;
+    auto waiter = [&](std::string name, std::string host, std::function<void()> then){
+        pool->asyncGetConnection("http", host, port, [&, name, then](Marvin::ErrorType& err, ConnectionInterface* conn){
+            assert( ! err );
+            order.push_back(name);
+            pool->releaseConnection(conn, false);
+            if( then ) then();
+        });
+    };
+    pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* first){
+        assert( ! err );
+        waiter("a2", "localhost", nullptr);
+        waiter("a3", "localhost", nullptr);
+        waiter("b1", "127.0.0.1", [&](){
+            // the last of them - hold a connection past the wait timeout of the next request
+            pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* held){
+                assert( ! err );
+                pool->asyncGetConnection("http", "127.0.0.1", port, [&, held](Marvin::ErrorType& err, ConnectionInterface* conn){
+                    assert( err == boost::asio::error::timed_out && (conn == nullptr) );
+                    timed_out = true;
+                    pool->releaseConnection(held, false);
+                    acceptor.close();
+                });
+            });
+        });
+        // a2 is served first, then b1 takes its turn before a3
+        io.post([&, first](){ pool->releaseConnection(first, false); });
+    });
+    io.run();
+    assert( (order.size() == 3) && (order[0] == "a2") && (order[1] == "b1") && (order[2] == "a3") );
+    assert( timed_out );
+    ConnectionPool::Metrics m = pool->metrics();
+    assert( (m.timedOut == 1) && (m.waiting == 0) && (m.inUse == 0) );
+
+    // a per target limit holds back only that target
+    io.reset();
+    ConnectionPool::configSet_MaxConnections(25);
+    ConnectionPool::configSet_MaxConnectionsPerHost(1);
+    ConnectionPool::configSet_WaitTimeout(30000);
+    pool = new ConnectionPool(io);
+    order.clear();
+    acceptor.close();
+    tcp::acceptor acceptor2(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    port = std::to_string(acceptor2.local_endpoint().port());
+    pool->asyncGetConnection("http", "localhost", port, [&](Marvin::ErrorType& err, ConnectionInterface* first){
+        assert( ! err );
+        waiter("a2", "localhost", nullptr);
+        waiter("b1", "127.0.0.1", [&, first](){
+            pool->releaseConnection(first, false);
+        });
+    });
+    io.run();
+    assert( (order.size() == 2) && (order[0] == "b1") && (order[1] == "a2") );
+    ConnectionPool::configSet_MaxConnectionsPerHost(0);
+    std::cout << "testConnectionPoolQueues Success" << std::endl;
+}
+
+void testTlsClientContext()
+{
+    // a copy of the system trust store so the test can change it
+    std::ifstream system_ca(X509_get_default_cert_file(), std::ios::binary);
+    if( ! system_ca ) {
+        std::cout << "testTlsClientContext skipped - no " << X509_get_default_cert_file() << std::endl;
+        return;
+    }
+    std::string pem((std::istreambuf_iterator<char>(system_ca)), std::istreambuf_iterator<char>());
+    std::string path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    std::ofstream(path, std::ios::binary) << pem;
+
+    TlsClientContext::configSet_ReloadCheckInterval(0);
+    TlsClientProfile profile;
+    profile.caFile = path;
+    TlsClientContextSPtr first = TlsClientContext::get(profile);
+    assert( first->trustLoaded() );
+    assert( TlsClientContext::get(profile) == first );
+    TlsClientProfile alpn_profile = profile;
+    alpn_profile.alpn = {"http/1.1"};
+    assert( TlsClientContext::get(alpn_profile) != first );
+    assert( ! TlsClientContext::reloadIfChanged() );
+
+    // the trust store changes - get() hands out a new context, the old one stays usable
+    std::ofstream(path, std::ios::binary | std::ios::app) << pem;
+    assert( TlsClientContext::reloadIfChanged() );
+    TlsClientContextSPtr second = TlsClientContext::get(profile);
+    assert( (second != first) && second->trustLoaded() && first->trustLoaded() );
+    SSL* ssl = SSL_new(first->context().native_handle());
+    assert( ssl != nullptr );
+    SSL_free(ssl);
+
+    // a trust store that does not load keeps the last good context
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a certificate";
+    assert( ! TlsClientContext::reloadIfChanged() );
+    assert( TlsClientContext::get(profile) == second );
+    boost::filesystem::remove(path);
+    TlsClientContext::configSet_ReloadCheckInterval(30);
+    std::cout << "testTlsClientContext Success" << std::endl;
+}
+
+/**
+* a throw away self signed certificate for a local TLS server
+*/
+static void makeTestCertificate(SSL_CTX* ctx)
+{
+    EVP_PKEY* pkey = EVP_PKEY_new();
+    EC_KEY* ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    EC_KEY_generate_key(ec);
+    EVP_PKEY_assign_EC_KEY(pkey, ec);
+    X509* x = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+    X509_gmtime_adj(X509_get_notBefore(x), 0);
+    X509_gmtime_adj(X509_get_notAfter(x), 3600);
+    X509_set_pubkey(x, pkey);
+    X509_NAME* name = X509_get_subject_name(x);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(x, name);
+    X509_sign(x, pkey, EVP_sha256());
+    SSL_CTX_use_certificate(ctx, x);
+    SSL_CTX_use_PrivateKey(ctx, pkey);
+    X509_free(x);
+    EVP_PKEY_free(pkey);
+}
+void testTlsSessionResumption()
+{
+    boost::asio::io_service io;
+    boost::asio::ssl::context server_ctx(boost::asio::ssl::context::sslv23_server);
+    makeTestCertificate(server_ctx.native_handle());
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    std::string port = std::to_string(acceptor.local_endpoint().port());
+    // the server handshakes and sends one byte, behind the TLS 1.3 tickets
+    std::function<void()> acceptOne = [&](){
+        auto s = std::make_shared<boost::asio::ssl::stream<tcp::socket>>(io, server_ctx);
+        acceptor.async_accept(s->lowest_layer(), [&, s](const boost::system::error_code& err){
+            if( err ) return;
+            s->async_handshake(boost::asio::ssl::stream_base::server, [s](const boost::system::error_code& err){
+                if( err ) return;
+                boost::asio::async_write(*s, boost::asio::buffer("x", 1), [s](const boost::system::error_code& err, std::size_t n){});
+            });
+            acceptOne();
+        });
+    };
+    acceptOne();
+
+    TlsClientProfile profile;
+    profile.verifyPeer = false;
+    TlsClientContext::configSet_DefaultProfile(profile);
+    TlsSessionCache& cache = TlsSessionCache::getInstance();
+    TlsSessionCache::Metrics before = cache.metrics();
+    // the same steps TLSConnection takes - offer a session before the handshake, count it after
+    int connections = 0;
+    std::string key = TlsSessionCache::key(TlsClientContext::get()->profile().key(), "localhost", port);
+    char byte;
+    std::function<void()> connectOne = [&](){
+        auto s = std::make_shared<boost::asio::ssl::stream<tcp::socket>>(io, TlsClientContext::get()->context());
+        s->lowest_layer().async_connect(acceptor.local_endpoint(), [&, s](const boost::system::error_code& err){
+            assert( ! err );
+            cache.prepare(s->native_handle(), &key);
+            s->async_handshake(boost::asio::ssl::stream_base::client, [&, s](const boost::system::error_code& err){
+                assert( ! err );
+                cache.handshakeDone(s->native_handle());
+                boost::asio::async_read(*s, boost::asio::buffer(&byte, 1), [&, s](const boost::system::error_code& err, std::size_t n){
+                    assert( ! err && (n == 1) );
+                    s->lowest_layer().close();
+                    if( ++connections < 2 )
+                        connectOne();
+                    else
+                        acceptor.close();
+                });
+            });
+        });
+    };
+    connectOne();
+    io.run();
+    TlsSessionCache::Metrics m = cache.metrics();
+    assert( (m.full - before.full == 1) && (m.resumed - before.resumed == 1) );
+    assert( (m.offered - before.offered == 1) && (m.stored > before.stored) );
+    cache.clear();
+    assert( cache.metrics().entries == 0 );
+    TlsClientContext::configSet_DefaultProfile(TlsClientProfile());
+    std::cout << "testTlsSessionResumption Success" << std::endl;
+}
+
+void testTimingWheel()
+{
+    // 1ms ticks so the 300ms timer starts on level 1 and has to be moved down
+    TimingWheel::configSet_Resolution(1);
+    boost::asio::io_service io;
+    TimingWheel& wheel = boost::asio::use_service<TimingWheel>(io);
+    std::vector<std::string> fired;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&](){
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    TimingWheel::Timer t300(io), t30(io), t10(io), cancelled(io), rescheduled(io);
+    t300.expiresIn(300, [&](){ assert( elapsed() >= 300 ); fired.push_back("300"); });
+    t30.expiresIn(30, [&](){ assert( elapsed() >= 30 ); fired.push_back("30"); });
+    t10.expiresIn(10, [&](){
+        assert( elapsed() >= 10 );
+        fired.push_back("10");
+        // a callback may cancel another timer
+        cancelled.cancel();
+    });
+    cancelled.expiresIn(50, [&](){ fired.push_back("cancelled"); });
+    rescheduled.expiresIn(5, [&](){ fired.push_back("too early"); });
+    rescheduled.expiresIn(100, [&](){ fired.push_back("100"); });
+    assert( wheel.size() == 5 );
+    io.run();
+    assert( (fired.size() == 4) && (fired[0] == "10") && (fired[1] == "30") && (fired[2] == "100") && (fired[3] == "300") );
+    assert( (wheel.size() == 0) && ! t300.pending() );
+    TimingWheel::configSet_Resolution(100);
+    std::cout << "testTimingWheel Success" << std::endl;
+}
+void testReadDeadlines()
+{
+    TimingWheel::configSet_Resolution(5);
+    MessageReaderV2::configSet_IdleTimeout(1000);
+    MessageReaderV2::configSet_HeaderTimeout(50);
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    std::shared_ptr<TCPConnection> conn = std::make_shared<TCPConnection>(io);
+    MBufferSPtr mb = m_buffer(100);
+    bool read_timed_out = false;
+    bool reader_timed_out = false;
+    std::shared_ptr<MessageReaderV2> rdr;
+    auto start = std::chrono::steady_clock::now();
+    conn->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        // a bare read with a deadline and nothing sent
+        conn->setReadDeadline(30);
+        conn->asyncRead(*mb, [&](Marvin::ErrorType& err, std::size_t n){
+            assert( (err == Marvin::errc::timeout) && (n == 0) );
+            assert( std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(30) );
+            read_timed_out = true;
+            // the start of a request arrives and the rest never does - the header timeout applies
+            rdr = std::make_shared<MessageReaderV2>(io, conn);
+            rdr->readMessage([&](Marvin::ErrorType err){
+                assert( err == Marvin::errc::timeout );
+                assert( Marvin::make_error_description(err).find("timed out") != std::string::npos );
+                reader_timed_out = true;
+                conn->close();
+            });
+            boost::asio::write(client, boost::asio::buffer(std::string("GET / HTTP/1.1\r\nHost: x\r\n")));
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    io.run();
+    assert( read_timed_out && reader_timed_out );
+    MessageReaderV2::configSet_IdleTimeout(60000);
+    MessageReaderV2::configSet_HeaderTimeout(30000);
+    TimingWheel::configSet_Resolution(100);
+    std::cout << "testReadDeadlines Success" << std::endl;
+}
+
+/**
+* 1MB each way through a tunnel between two accepted TCPConnections. On Linux it must be
+* spliced, and the bytes must arrive intact and be counted
+*/
+/**
+* A read deadline only ends the read - a write held up by a peer that is not reading carries on.
+* A write deadline only ends the sending side - reads carry on
+*/
+void testDeadlinesIndependent()
+{
+    TimingWheel::configSet_Resolution(5);
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    std::shared_ptr<TCPConnection> conn = std::make_shared<TCPConnection>(io);
+    const std::size_t big = 32 * 1024 * 1024;
+    std::string first(big, 'a');
+    std::string second(big, 'b');
+    MBufferSPtr mb = m_buffer(100);
+    boost::asio::streambuf at_client;
+    bool first_written = false;
+    bool second_timed_out = false;
+    bool read_after = false;
+    conn->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        // more than the socket buffers hold, and the client does not read yet
+        conn->asyncWrite(first, [&](Marvin::ErrorType& err, std::size_t n){
+            assert( ! err && (n == big) );
+            first_written = true;
+            // now nobody reads the second one, the write deadline ends it
+            conn->setWriteDeadline(30);
+            conn->asyncWrite(second, [&](Marvin::ErrorType& err, std::size_t n){
+                assert( err == Marvin::errc::timeout );
+                second_timed_out = true;
+                // reading still works
+                conn->setReadDeadline(1000);
+                conn->asyncRead(*mb, [&](Marvin::ErrorType& err, std::size_t n){
+                    assert( ! err && (std::string((char*)mb->data(), n) == "hello") );
+                    read_after = true;
+                    conn->close();
+                });
+                boost::asio::write(client, boost::asio::buffer(std::string("hello")));
+            });
+        });
+        conn->setReadDeadline(30);
+        conn->asyncRead(*mb, [&](Marvin::ErrorType& err, std::size_t n){
+            assert( (err == Marvin::errc::timeout) && (n == 0) );
+            assert( ! first_written );
+            boost::asio::async_read(client, at_client, boost::asio::transfer_exactly(big), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err && (n == big) );
+            });
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    io.run();
+    assert( first_written && second_timed_out && read_after );
+    TimingWheel::configSet_Resolution(100);
+    std::cout << "testDeadlinesIndependent Success" << std::endl;
+}
+
+void testSpliceTunnel()
+{
+    const std::size_t size = 1024 * 1024;
+    std::string up_data(size, ' ');
+    std::string down_data(size, ' ');
+    for(std::size_t i = 0; i < size; i++) {
+        up_data[i] = (char)('a' + (i % 26));
+        down_data[i] = (char)('A' + ((i * 7) % 26));
+    }
+    TunnelHandler::Metrics before = TunnelHandler::metrics();
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    tcp::socket origin(io);
+    TCPConnectionSPtr down = std::make_shared<TCPConnection>(io);
+    TCPConnectionSPtr up = std::make_shared<TCPConnection>(io);
+    std::shared_ptr<TunnelHandler> tunnel;
+    std::string at_origin(size, '\0');
+    std::string at_client(size, '\0');
+    bool tunnel_done = false;
+    int received = 0;
+    down->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        up->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+            assert( ! err );
+            tunnel = std::make_shared<TunnelHandler>(io, down, up);
+            assert( tunnel->spliced() == SpliceTunnel::isAvailable() );
+            tunnel->start([&](Marvin::ErrorType& err){
+                assert( err == boost::asio::error::eof );
+                assert( tunnel->bytesTransferred() == 2 * size );
+                tunnel_done = true;
+                down->close();
+                up->close();
+            });
+            boost::asio::async_write(client, boost::asio::buffer(up_data), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err );
+                client.shutdown(tcp::socket::shutdown_send);
+            });
+            boost::asio::async_write(origin, boost::asio::buffer(down_data), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err );
+                origin.shutdown(tcp::socket::shutdown_send);
+            });
+            boost::asio::async_read(origin, boost::asio::buffer(&at_origin[0], size), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err && (n == size) );
+                received++;
+            });
+            boost::asio::async_read(client, boost::asio::buffer(&at_client[0], size), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err && (n == size) );
+                received++;
+            });
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    origin.connect(acceptor.local_endpoint());
+    io.run();
+    assert( tunnel_done && (received == 2) );
+    assert( (at_origin == up_data) && (at_client == down_data) );
+    TunnelHandler::Metrics after = TunnelHandler::metrics();
+    assert( after.tunnels == before.tunnels + 1 );
+    if( SpliceTunnel::isAvailable() ) {
+        assert( after.spliced == before.spliced + 1 );
+        assert( after.bytesSpliced == before.bytesSpliced + 2 * size );
+    } else {
+        assert( after.bytesCopied == before.bytesCopied + 2 * size );
+    }
+    std::cout << "testSpliceTunnel Success" << std::endl;
+}
+
+/**
+* data only goes one way, a byte at a time more often than the idle timeout - the tunnel stays
+* up while it flows and ends with a timeout once it stops
+*/
+void testTunnelIdleDeadline()
+{
+    const int sends = 12;
+    TimingWheel::configSet_Resolution(10);
+    TunnelHandler::configSet_IdleTimeout(200);
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    tcp::socket origin(io);
+    TCPConnectionSPtr down = std::make_shared<TCPConnection>(io);
+    TCPConnectionSPtr up = std::make_shared<TCPConnection>(io);
+    std::shared_ptr<TunnelHandler> tunnel;
+    boost::asio::deadline_timer ticker(io);
+    std::function<void()> send_next;
+    int sent = 0;
+    char at_client[sends];
+    bool tunnel_done = false;
+    std::chrono::steady_clock::time_point last_sent;
+    send_next = [&](){
+        ticker.expires_from_now(boost::posix_time::milliseconds(50));
+        ticker.async_wait([&](const boost::system::error_code& err){
+            assert( ! err && ! tunnel_done );
+            boost::asio::write(origin, boost::asio::buffer("x", 1));
+            last_sent = std::chrono::steady_clock::now();
+            if( ++sent < sends )
+                send_next();
+        });
+    };
+    down->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        up->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+            assert( ! err );
+            tunnel = std::make_shared<TunnelHandler>(io, down, up);
+            tunnel->start([&](Marvin::ErrorType& err){
+                assert( err == Marvin::make_error_timeout() );
+                assert( sent == sends );
+                assert( std::chrono::steady_clock::now() - last_sent >= std::chrono::milliseconds(200) );
+                tunnel_done = true;
+                down->close();
+                up->close();
+            });
+            boost::asio::async_read(client, boost::asio::buffer(at_client, sends), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err && (n == (std::size_t)sends) );
+            });
+            send_next();
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    origin.connect(acceptor.local_endpoint());
+    io.run();
+    assert( tunnel_done );
+    TunnelHandler::configSet_IdleTimeout(300000);
+    TimingWheel::configSet_Resolution(100);
+    std::cout << "testTunnelIdleDeadline Success" << std::endl;
+}
+
+/**
+* the origin never reads, so the full pipe (or buffer) waits on the write end until the write
+* timeout ends the tunnel. Then a tunnel whose owner lets go of it mid-flight - its pending
+* waits complete when the connections close and must call nobody
+*/
+void testTunnelWriteTimeout()
+{
+    const std::size_t size = 32 * 1024 * 1024;
+    std::string data(size, 'w');
+    TimingWheel::configSet_Resolution(10);
+    HalfTunnel::configSet_WriteTimeout(200);
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    tcp::socket origin(io);
+    TCPConnectionSPtr down = std::make_shared<TCPConnection>(io);
+    TCPConnectionSPtr up = std::make_shared<TCPConnection>(io);
+    std::shared_ptr<TunnelHandler> tunnel;
+    bool tunnel_done = false;
+    down->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        up->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+            assert( ! err );
+            tunnel = std::make_shared<TunnelHandler>(io, down, up);
+            tunnel->start([&](Marvin::ErrorType& err){
+                assert( err == Marvin::make_error_timeout() );
+                tunnel_done = true;
+                down->close();
+                up->close();
+                client.close();
+            });
+            boost::asio::async_write(client, boost::asio::buffer(data), [&](const boost::system::error_code& err, std::size_t n){
+                assert( err );
+            });
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    origin.connect(acceptor.local_endpoint());
+    io.run();
+    assert( tunnel_done );
+    origin.close();
+
+    io.reset();
+    tcp::socket client2(io);
+    tcp::socket origin2(io);
+    TCPConnectionSPtr down2 = std::make_shared<TCPConnection>(io);
+    TCPConnectionSPtr up2 = std::make_shared<TCPConnection>(io);
+    down2->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        up2->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+            assert( ! err );
+            std::shared_ptr<TunnelHandler> dropped = std::make_shared<TunnelHandler>(io, down2, up2);
+            dropped->start([&](Marvin::ErrorType& err){
+                assert( false );
+            });
+            dropped.reset();
+            down2->close();
+            up2->close();
+        });
+    });
+    client2.connect(acceptor.local_endpoint());
+    origin2.connect(acceptor.local_endpoint());
+    io.run();
+    HalfTunnel::configSet_WriteTimeout(300000);
+    TimingWheel::configSet_Resolution(100);
+    std::cout << "testTunnelWriteTimeout Success" << std::endl;
+}
+
+/**
+* a request up one HalfTunnel, then the reply down the other. Each side reads to EOF, so the
+* half close has to be passed on for the test to end
+*/
+void testHalfTunnel()
+{
+    const std::size_t up_size = 1024 * 1024;
+    const std::size_t down_size = 100 * 1000;
+    std::string up_data(up_size, ' ');
+    std::string down_data(down_size, ' ');
+    for(std::size_t i = 0; i < up_size; i++)
+        up_data[i] = (char)('a' + (i % 26));
+    for(std::size_t i = 0; i < down_size; i++)
+        down_data[i] = (char)('A' + ((i * 7) % 26));
+    boost::asio::io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    tcp::socket client(io);
+    tcp::socket origin(io);
+    TCPConnectionSPtr down = std::make_shared<TCPConnection>(io);
+    TCPConnectionSPtr up = std::make_shared<TCPConnection>(io);
+    HalfTunnelUPtr to_origin;
+    HalfTunnelUPtr to_client;
+    boost::asio::streambuf at_origin;
+    boost::asio::streambuf at_client;
+    int halves_done = 0;
+    bool client_done = false;
+    auto half_done = [&](Marvin::ErrorType& err){
+        assert( err == boost::asio::error::eof );
+        if( ++halves_done == 2 ) {
+            down->close();
+            up->close();
+        }
+    };
+    down->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+        assert( ! err );
+        up->asyncAccept(acceptor, [&](const boost::system::error_code& err){
+            assert( ! err );
+            to_origin = HalfTunnelUPtr(new HalfTunnel(io, down, up));
+            to_client = HalfTunnelUPtr(new HalfTunnel(io, up, down));
+            to_origin->start(half_done);
+            to_client->start(half_done);
+            boost::asio::async_write(client, boost::asio::buffer(up_data), [&](const boost::system::error_code& err, std::size_t n){
+                assert( ! err );
+                client.shutdown(tcp::socket::shutdown_send);
+                boost::asio::async_read(client, at_client, [&](const boost::system::error_code& err, std::size_t n){
+                    assert( err == boost::asio::error::eof );
+                    client_done = true;
+                });
+            });
+            boost::asio::async_read(origin, at_origin, [&](const boost::system::error_code& err, std::size_t n){
+                // the whole request and then the client's half close
+                assert( err == boost::asio::error::eof );
+                boost::asio::async_write(origin, boost::asio::buffer(down_data), [&](const boost::system::error_code& err, std::size_t n){
+                    assert( ! err );
+                    origin.shutdown(tcp::socket::shutdown_send);
+                });
+            });
+        });
+    });
+    client.connect(acceptor.local_endpoint());
+    origin.connect(acceptor.local_endpoint());
+    io.run();
+    assert( client_done && (halves_done == 2) );
+    assert( std::string(boost::asio::buffers_begin(at_origin.data()), boost::asio::buffers_end(at_origin.data())) == up_data );
+    assert( std::string(boost::asio::buffers_begin(at_client.data()), boost::asio::buffers_end(at_client.data())) == down_data );
+    assert( (to_origin->bytesTransferred() == up_size) && (to_client->bytesTransferred() == down_size) );
+    // bulk data fills the buffers, so they grow
+    assert( to_origin->bufferSize() > 16384 );
+    std::cout << "testHalfTunnel Success" << std::endl;
+}
+
 int main(){
 //    TestBuffer();
     RBLogging::setEnabled(false);
@@ -101,6 +1364,33 @@ int main(){
     testStreamingReader(tcs.get_case(5));
     testStreamingReader(tcs.get_case(6));
     testStreamingReader(tcs.get_case(7));
+    testStreamingReader(tcs.get_case(8));
 #endif
+    testPipelinedReader(false);
+    testPipelinedReader(true);
+    testChunkedTrailers();
+    testHeaderTable();
+    testSerializeHeaders();
+    testCannedResponse();
+    testChunkedWriter();
+    testWriteSequencer();
+    testPipelinedConnectionHandler();
+    testSocketOptions();
+    testHappyEyeballs();
+    testResolverCache();
+    testConnectionPool();
+    testConnectionPoolPerIoService();
+    testConnectionPoolQueues();
+    testTlsClientContext();
+    testTlsSessionResumption();
+    testTimingWheel();
+    testReadDeadlines();
+    testDeadlinesIndependent();
+    testSpliceTunnel();
+    testTunnelIdleDeadline();
+    testTunnelWriteTimeout();
+    testHalfTunnel();
+    bool scanner_ok = testScannerDifferentialAll();
+    assert( scanner_ok );
 
 }
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include "rb_logger.hpp"
+RBLOGGER_SETLEVEL(LOG_LEVEL_DEBUG)
+#include "message.hpp"
+#include "parser.hpp"
+#include "http_scanner.hpp"
+#include "testcase_defs.hpp"
+#include "scanner_diff.hpp"
+
+/**
+* A Parser that writes every event it sees into a string
+*/
+class RecordingParser : public Parser, public MessageBase
+{
+public:
+    std::string log;
+    MessageInterface* currentMessage(){ return this; }
+    void OnParseBegin(){ log += "<begin>"; }
+    void OnHeadersComplete(MessageInterface* msg, void* body_start_ptr, std::size_t remainder)
+    {
+        std::ostringstream os;
+        os << "<headers ";
+        if( isRequest() )
+            os << getMethodAsString() << " " << uri();
+        else
+            os << statusCode() << " [" << status() << "]";
+        os << " " << httpVersMajor() << "." << httpVersMinor() << " remainder:" << remainder;
+        for(auto const& h : getHeaders())
+            os << " " << h.first << "=[" << h.second << "]";
+        os << " flags:" << parser->flags << " upgrade:" << parser->upgrade << ">";
+        log += os.str();
+    }
+    void OnMessageComplete(MessageInterface* msg){ log += "<complete>"; }
+    void OnBodyData(void* buf, int len){ log += "<body " + std::string((char*)buf, len) + ">"; }
+    void OnChunkBegin(int chunkLength){ log += "<chunk " + std::to_string(chunkLength) + ">"; }
+    void OnChunkEnd(){ log += "<chunkend>"; }
+    
+    /**
+    * feeds the pieces and returns the event log - stops at end of message or the first error
+    */
+    std::string run(std::vector<std::string>& pieces)
+    {
+        for(std::string& s : pieces) {
+            int n = 0;
+            if( s == "eof" )
+                appendEOF();
+            else
+                n = appendBytes((void*)s.data(), (unsigned)s.size());
+            if( isError() && ! isFinishedMessage() ) {
+                // error codes and how far the engines get before detecting the error
+                // legitimately differ - only the fact of an error is compared
+                log = "<error>";
+                break;
+            }
+            log += (s == "eof") ? std::string("<eof>") : "<n " + std::to_string(n) + ">";
+            if( isFinishedMessage() )
+                break;
+        }
+        return log;
+    }
+};
+
+static std::string runEngine(bool useScanner, std::vector<std::string> pieces)
+{
+    Parser::configSet_UseScanner(useScanner);
+    RecordingParser p;
+    std::string result = p.run(pieces);
+    Parser::configSet_UseScanner(true);
+    return result;
+}
+
+static bool compareEngines(std::string description, std::vector<std::string> pieces)
+{
+    bool ok = true;
+    std::string expected = runEngine(false, pieces);
+    for(int isa = 0; isa <= (int)HttpScanner::bestIsa(); isa++) {
+        HttpScanner::configSet_Isa((HttpScanner::Isa)isa);
+        std::string actual = runEngine(true, pieces);
+        if( actual != expected ) {
+            std::cout << "FAILED scanner differential isa: " << isa << " " << description << std::endl;
+            std::cout << "    expected: " << expected << std::endl;
+            std::cout << "    actual  : " << actual << std::endl;
+            ok = false;
+        }
+    }
+    HttpScanner::configSet_Isa(HttpScanner::bestIsa());
+    return ok;
+}
+
+bool testScannerDifferential(std::string description, std::vector<std::string> buffers)
+{
+    bool hasEOF = (! buffers.empty()) && (buffers.back() == "eof");
+    std::string all;
+    for(std::string& s : buffers) {
+        if( s != "eof" )
+            all += s;
+    }
+    std::vector<std::string> one{all};
+    std::vector<std::string> bytes;
+    for(char c : all)
+        bytes.push_back(std::string(1, c));
+    if( hasEOF ) {
+        one.push_back("eof");
+        bytes.push_back("eof");
+    }
+    bool ok = compareEngines(description + " (as given)", buffers);
+    ok = compareEngines(description + " (one buffer)", one) && ok;
+    ok = compareEngines(description + " (byte at a time)", bytes) && ok;
+    if( ok )
+        std::cout << "Success scanner differential " << description << std::endl;
+    return ok;
+}
+
+bool testScannerDifferential(Testcase testcase)
+{
+    return testScannerDifferential(testcase.getDescription(), testcase.buffers());
+}
+
+bool testScannerDifferentialAll()
+{
+    bool ok = true;
+    TestcaseDefinitions tcs = makeTestcaseDefinitions_01();
+    for(int i = 0; i < tcs.number_of_testcases(); i++)
+        ok = testScannerDifferential(tcs.get_case(i)) && ok;
+    TestcaseDefinitions eofs = makeTCS_eof();
+    for(int i = 0; i < eofs.number_of_testcases(); i++)
+        ok = testScannerDifferential(eofs.get_case(i)) && ok;
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> extra {
+        {"GET request no body", {"GET /a/b?c=d HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n\r\n"}},
+        {"POST request with body", {"POST /upload HTTP/1.0\r\nContent-Length: 5\r\n", "\r\nhel", "lo"}},
+        {"chunked with extensions and trailer", {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5;name=value\r\nhello\r\n", "6\r\n world\r\n0\r\nX-Trailer: yes\r\n\r\n"}},
+        {"empty value and odd spacing", {"HTTP/1.1 204 No Content\r\nX-Empty:\r\nX-Spaces:   padded  \r\nConnection: keep-alive, Upgrade\r\n\r\n"}},
+        {"folded header", {"HTTP/1.1 200 OK\r\nX-Fold: one\r\n  two\r\nContent-Length: 0\r\n\r\n"}},
+        {"long header value", {"HTTP/1.1 200 OK\r\nX-Long: " + std::string(300, 'v') + "\r\nContent-Length: 2\r\n\r\nok"}},
+        {"CONNECT request", {"CONNECT host.example.com:443 HTTP/1.1\r\nHost: host.example.com:443\r\n\r\n"}},
+        {"bad version", {"HTTP/x.1 200 OK\r\n\r\n"}},
+        {"bad method", {"FROB / HTTP/1.1\r\n\r\n"}},
+        {"bad content length", {"HTTP/1.1 200 OK\r\nContent-Length: 12abc\r\n\r\n"}},
+        {"bad chunk size", {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n"}},
+        {"content length and chunked", {"HTTP/1.1 200 OK\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"}},
+        {"space before colon content length", {"POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\nhello"}},
+        {"space before colon transfer encoding", {"POST / HTTP/1.1\r\nTransfer-Encoding : chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n"}},
+        {"space inside header name", {"GET / HTTP/1.1\r\nX Y: 1\r\n\r\n"}},
+        {"non token in header name", {"GET / HTTP/1.1\r\nX(Y): 1\r\n\r\n"}},
+        {"long content length", {"POST / HTTP/1.1\r\nContent-Length: " + std::string(290, '0') + "5\r\n\r\nhello"}},
+        {"control character in value", {"GET / HTTP/1.1\r\nX-Ctl: a\x01b\r\n\r\n"}},
+        {"delete in value", {"GET / HTTP/1.1\r\nX-Del: a\x7f" "b\r\n\r\n"}},
+        {"tab in value", {"GET / HTTP/1.1\r\nX-Tab: a\tb\r\n\r\n"}},
+        {"high bytes in value", {"GET / HTTP/1.1\r\nX-Utf8: caf\xc3\xa9 " + std::string(40, 'x') + "\r\n\r\n"}}
+    };
+    for(auto& x : extra)
+        ok = testScannerDifferential(x.first, x.second) && ok;
+
+    // http_parser only looks at the first bytes of a general header value before it skips to
+    // the CR, the scanner checks every byte - so these only the scanner rejects
+    std::vector<std::pair<std::string, std::vector<std::string>>> stricter {
+        {"control character deep in value", {"GET / HTTP/1.1\r\nX-Ctl: " + std::string(45, 'x') + "\x1b" + std::string(20, 'y') + "\r\n\r\n"}},
+        {"delete deep in value", {"GET / HTTP/1.1\r\nX-Del: " + std::string(70, 'x') + "\x7f\r\n\r\n"}}
+    };
+    for(auto& x : stricter) {
+        for(int isa = 0; isa <= (int)HttpScanner::bestIsa(); isa++) {
+            HttpScanner::configSet_Isa((HttpScanner::Isa)isa);
+            std::string actual = runEngine(true, x.second);
+            if( actual != "<error>" ) {
+                std::cout << "FAILED scanner rejects isa: " << isa << " " << x.first << " got: " << actual << std::endl;
+                ok = false;
+            }
+        }
+        HttpScanner::configSet_Isa(HttpScanner::bestIsa());
+    }
+    return ok;
+}
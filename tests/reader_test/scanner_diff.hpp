@@ -0,0 +1,24 @@
+#ifndef scanner_diff_hpp
+#define scanner_diff_hpp
+
+#include <string>
+#include <vector>
+#include "testcase.hpp"
+
+/**
+* Differential tests for HttpScanner. Each message is fed to a Parser running http_parser
+* (the reference) and to a Parser running HttpScanner, once for each instruction set the cpu
+* supports, and the sequence of parser events recorded by each must be identical.
+*
+* Every message is fed three ways - in the buffers given, all in one buffer and one byte at a time.
+* An entry "eof" in the buffer list signals end of data.
+*/
+bool testScannerDifferential(std::string description, std::vector<std::string> buffers);
+bool testScannerDifferential(Testcase testcase);
+
+/**
+* Runs the differential test over the reader testcases plus some requests and malformed messages
+*/
+bool testScannerDifferentialAll();
+
+#endif
@@ -3,9 +3,9 @@
 RBLOGGER_SETLEVEL(LOG_LEVEL_DEBUG)
 #include "test_runner.hpp"
 
-std::string chain_to_string(BufferChain chain)
+std::string chain_to_string(BufferChainSPtr chain)
 {
-    return chain.to_string();
+    return chain->to_string();
 }
 
 void Testrunner::makeReader()
@@ -59,7 +59,7 @@ void Testrunner::onMessage(Marvin::ErrorType er)
     auto desc = _tcObj.getDescription();
     std::cout << "TestRunner::readMessage Success for testcase " << _tcObj.getDescription() <<std::endl;
 }
-void Testrunner::onBody(Marvin::ErrorType er, BufferChain chunk)
+void Testrunner::onBody(Marvin::ErrorType er, BufferChainSPtr chunk)
 {
     LogDebug(" entry");
     // are we done - if not hang another read
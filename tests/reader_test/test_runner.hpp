@@ -19,7 +19,7 @@
 class Testrunner;
 typedef std::shared_ptr<Testrunner> TestrunnerSPtr;
 
-std::string chain_to_string(BufferChain chain);
+std::string chain_to_string(BufferChainSPtr chain);
 /**
 * Class TestRunner - Creates an instance of MessageReaderV2 using
 * its ReadSocketInterface and then exercises that MessageReaderV2
@@ -57,7 +57,7 @@ public:
 
     void makeReader();
     void onMessage(Marvin::ErrorType er);
-    void onBody(Marvin::ErrorType er, BufferChain chunk);
+    void onBody(Marvin::ErrorType er, BufferChainSPtr chunk);
     void onHeaders(Marvin::ErrorType er);
 };
 #endif
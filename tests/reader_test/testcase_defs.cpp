@@ -320,6 +320,36 @@ TestcaseDefinitions makeTestcaseDefinitions_01()
                 + std::string("1234567890")
                 )
     );
+//    // 8 header names and values split across reads - exercises the header arena
+    tcases.add_case(
+            Testcase(
+                "index 8 - 200 header names and values split across buffers",
+                std::vector<std::string> {
+                    "HTTP/1.1 200 OK Split Headers\r\nHo",
+                    "st: ah",
+                    "ost\r\nConnection: keep-alive\r\nProxy-Conn",
+                    "ection",
+                    ": keep-",
+                    "alive\r\nContent-length: 1",
+                    "0\r\n\r\nABCDE",
+                    "FGHIJ"
+                },
+                std::string("HTTP/1.1 200 OK Split Headers\r\n"),
+                // expected status code
+                200,
+                // expect error code in onHeader
+                Marvin::make_error_ok(),
+                // expected headers
+                std::map< std::string, std::string >{
+                    {HttpHeader::Name::Host, "ahost"},
+                    {HttpHeader::Name::Connection,"keep-alive"},
+                    {HttpHeader::Name::ProxyConnection,"keep-alive"},
+                    {HttpHeader::Name::ContentLength,"10"}
+                },
+                // body
+                std::string("ABCDEFGHIJ")
+        )
+    );
     return tcases;
 }
 TestcaseDefinitions makeTCS_eof()
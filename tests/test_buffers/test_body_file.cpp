@@ -0,0 +1,42 @@
+//
+//  test_body_file.cpp
+//  test_buffers
+//
+//  Created by ROBERT BLACKWELL on 12/14/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <iostream>
+#include <gtest/gtest.h>
+#include "body_file.hpp"
+#include "rb_logger.hpp"
+
+#pragma mark - testcase_body_file
+TEST( BodyFile, AppendAndRead)
+{
+    BodyFileSPtr bf = BodyFile::create();
+    ASSERT_TRUE(bf != nullptr);
+    ASSERT_EQ(bf->size(), 0);
+    ASSERT_TRUE(bf->map() == nullptr);
+    std::string s1("0123456789");
+    std::string s2("ABCDEFGHIJ");
+    ASSERT_TRUE(bf->append((void*)s1.c_str(), s1.size()));
+    ASSERT_TRUE(bf->append((void*)s2.c_str(), s2.size()));
+    ASSERT_EQ(bf->size(), 20);
+    char tmp[8];
+    ASSERT_EQ(bf->pread(8, tmp, 4), 4);
+    ASSERT_EQ(std::string(tmp, 4), "89AB");
+}
+TEST( BodyFile, LazyMap)
+{
+    BodyFileSPtr bf = BodyFile::create();
+    std::string big(100000, 'x');
+    big[99999] = 'y';
+    bf->append((void*)big.c_str(), big.size());
+    const char* p = bf->map();
+    ASSERT_TRUE(p != nullptr);
+    ASSERT_EQ(p[0], 'x');
+    ASSERT_EQ(p[99999], 'y');
+    // a second call returns the same mapping
+    ASSERT_EQ(bf->map(), p);
+    ASSERT_EQ(bf->toString(), big);
+}
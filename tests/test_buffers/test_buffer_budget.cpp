@@ -0,0 +1,104 @@
+//
+//  test_buffer_budget.cpp
+//  test_buffers
+//
+//  Created by ROBERT BLACKWELL on 12/12/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <iostream>
+#include <gtest/gtest.h>
+#include "buffer_budget.hpp"
+#include "bufferV2.hpp"
+#include "rb_logger.hpp"
+
+#pragma mark - testcase_buffer_budget
+TEST( BufferBudget, ChargeAndCredit)
+{
+    std::size_t before = BufferBudget::current();
+    {
+        MBufferSPtr mb = m_buffer(20000);
+        ASSERT_EQ(BufferBudget::current(), before + 24576);
+        ASSERT_GE(BufferBudget::highWater(), before + 24576);
+    }
+    ASSERT_EQ(BufferBudget::current(), before);
+}
+TEST( BufferBudget, HighWater)
+{
+    BufferBudget::resetHighWater();
+    std::size_t before = BufferBudget::current();
+    {
+        MBufferSPtr a = m_buffer(1000);
+        MBufferSPtr b = m_buffer(1000);
+    }
+    ASSERT_EQ(BufferBudget::current(), before);
+    ASSERT_EQ(BufferBudget::highWater(), before + 2048);
+}
+TEST( BufferBudget, DeferUntilReleased)
+{
+    boost::asio::io_service io;
+    std::size_t before = BufferBudget::current();
+    BufferBudget::configSet_Limit(before + 20000);
+    MBufferSPtr mb = m_buffer(20000);
+    ASSERT_TRUE(BufferBudget::isExhausted());
+    bool ran = false;
+    BufferBudget::WaitHandle wait = BufferBudget::whenAvailable(io, 1000, [&ran](){ ran = true; });
+    ASSERT_EQ(BufferBudget::waiting(), 1);
+    io.poll();
+    io.reset();
+    ASSERT_FALSE(ran);
+    mb = nullptr;
+    ASSERT_FALSE(BufferBudget::isExhausted());
+    ASSERT_EQ(BufferBudget::waiting(), 0);
+    io.poll();
+    ASSERT_TRUE(ran);
+    BufferBudget::configSet_Limit(0);
+}
+TEST( BufferBudget, NotExhaustedRunsImmediately)
+{
+    boost::asio::io_service io;
+    BufferBudget::configSet_Limit(0);
+    bool ran = false;
+    BufferBudget::WaitHandle wait = BufferBudget::whenAvailable(io, 1000, [&ran](){ ran = true; });
+    io.poll();
+    ASSERT_TRUE(ran);
+}
+TEST( BufferBudget, DroppedHandleCancels)
+{
+    boost::asio::io_service io;
+    std::size_t before = BufferBudget::current();
+    BufferBudget::configSet_Limit(before + 20000);
+    MBufferSPtr mb = m_buffer(20000);
+    bool ran = false;
+    BufferBudget::WaitHandle wait = BufferBudget::whenAvailable(io, 1000, [&ran](){ ran = true; });
+    wait = nullptr;
+    mb = nullptr;
+    io.poll();
+    ASSERT_FALSE(ran);
+    ASSERT_EQ(BufferBudget::waiting(), 0);
+    BufferBudget::configSet_Limit(0);
+}
+TEST( BufferBudget, WakesOnlyWhatFits)
+{
+    boost::asio::io_service io;
+    std::size_t before = BufferBudget::current();
+    BufferBudget::configSet_Limit(before + 20000);
+    MBufferSPtr mb = m_buffer(20000);
+    int ran = 0;
+    BufferBudget::WaitHandle first = BufferBudget::whenAvailable(io, 15000, [&ran](){ ran++; });
+    BufferBudget::WaitHandle second = BufferBudget::whenAvailable(io, 15000, [&ran](){ ran++; });
+    mb = nullptr;
+    // the first one's bytes are reserved until it has run
+    ASSERT_TRUE(BufferBudget::isExhausted() == false);
+    ASSERT_EQ(BufferBudget::waiting(), 1);
+    io.poll();
+    io.reset();
+    ASSERT_EQ(ran, 1);
+    // the first reader allocates and later releases its buffer
+    {
+        MBufferSPtr used = m_buffer(15000);
+    }
+    io.poll();
+    ASSERT_EQ(ran, 2);
+    ASSERT_EQ(BufferBudget::waiting(), 0);
+    BufferBudget::configSet_Limit(0);
+}
@@ -54,6 +54,38 @@ TEST( BufferChain, makeboostbuffer)
     std::cout << "" << std::endl;
     std::cout << "" << std::endl;
 }
+TEST( BufferChain, move)
+{
+    BufferChain chain1;
+    MBufferSPtr mb = m_buffer(std::string("0123456789"));
+    chain1.push_back(mb);
+    chain1.push_back(m_buffer(std::string("ABCDEFGHIJ")));
+    BufferChain chain2(std::move(chain1));
+    ASSERT_EQ(chain1.size(), 0);
+    ASSERT_EQ(chain1.buffer_sequence().size(), 0);
+    ASSERT_EQ(chain2.to_string(), "0123456789ABCDEFGHIJ");
+    // moving does not add references to the buffers
+    ASSERT_EQ(mb.use_count(), 2);
+    BufferChain chain3;
+    chain3 = std::move(chain2);
+    ASSERT_EQ(chain2.size(), 0);
+    ASSERT_EQ(chain3.size(), 20);
+    ASSERT_EQ(mb.use_count(), 2);
+}
+TEST( BufferChain, sequenceview)
+{
+    BufferChain chain1;
+    for( int i = 0; i < 10; i++) {
+        chain1.push_back(m_buffer(std::string("GH")));
+    }
+    BufferChain::SequenceView seq = chain1.buffer_sequence();
+    ASSERT_EQ(seq.size(), 10);
+    ASSERT_EQ(boost::asio::buffer_size(seq), 20);
+    char out[20];
+    std::size_t n = boost::asio::buffer_copy(boost::asio::buffer(out, sizeof(out)), seq);
+    ASSERT_EQ(n, 20);
+    ASSERT_EQ(std::string(out, n), chain1.to_string());
+}
 
 
 
@@ -0,0 +1,81 @@
+//
+//  test_buffer_pool.cpp
+//  test_buffers
+//
+//  Created by ROBERT BLACKWELL on 12/10/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <iostream>
+#include <thread>
+#include <gtest/gtest.h>
+#include "buffer_pool.hpp"
+#include "bufferV2.hpp"
+#include "rb_logger.hpp"
+
+#pragma mark - testcase_buffer_pool
+TEST( MBufferPool, SizeClasses)
+{
+    ASSERT_EQ(MBufferPool::sizeClassFor(0), 0);
+    ASSERT_EQ(MBufferPool::classSize(MBufferPool::sizeClassFor(1000)), 1024);
+    ASSERT_EQ(MBufferPool::classSize(MBufferPool::sizeClassFor(10000)), 12288);
+    ASSERT_EQ(MBufferPool::classSize(MBufferPool::sizeClassFor(20000)), 24576);
+    ASSERT_EQ(MBufferPool::sizeClassFor(65537), -1);
+}
+TEST( MBufferPool, RecycleOnLastReference)
+{
+    MBufferPool::trimThreadCache();
+    void* first;
+    {
+        MBufferSPtr mb = m_buffer(20000);
+        first = mb->data();
+        MBufferSPtr other_ref = mb;
+        mb = nullptr;
+        // still referenced - nothing recycled yet
+        MBufferPoolStats s = MBufferPool::stats();
+        MBufferSPtr mb2 = m_buffer(20000);
+        ASSERT_NE(mb2->data(), first);
+        ASSERT_EQ(MBufferPool::stats().hits, s.hits);
+    }
+    MBufferPoolStats before = MBufferPool::stats();
+    MBufferSPtr mb3 = m_buffer(18000);
+    MBufferPoolStats after = MBufferPool::stats();
+    ASSERT_EQ(after.hits, before.hits + 1);
+    ASSERT_EQ(mb3->capacity(), 18000);
+    std::string s("recycled memory is usable");
+    mb3->append((void*)s.c_str(), s.size());
+    ASSERT_EQ(mb3->toString(), s);
+}
+TEST( MBufferPool, Oversize)
+{
+    MBufferPoolStats before = MBufferPool::stats();
+    {
+        MBufferSPtr mb = m_buffer(100000);
+        ASSERT_EQ(mb->capacity(), 100000);
+    }
+    ASSERT_EQ(MBufferPool::stats().oversize, before.oversize + 1);
+}
+TEST( MBufferPool, BoundedFreeList)
+{
+    MBufferPool::trimThreadCache();
+    MBufferPool::configSet_MaxFreePerClass(2);
+    MBufferPoolStats before = MBufferPool::stats();
+    {
+        MBufferSPtr a = m_buffer(1000);
+        MBufferSPtr b = m_buffer(1000);
+        MBufferSPtr c = m_buffer(1000);
+    }
+    MBufferPoolStats after = MBufferPool::stats();
+    ASSERT_EQ(after.recycled, before.recycled + 2);
+    ASSERT_EQ(after.freed, before.freed + 1);
+    MBufferPool::configSet_MaxFreePerClass(64);
+}
+TEST( MBufferPool, CrossThreadRelease)
+{
+    MBufferSPtr mb = m_buffer(4000);
+    std::thread t([&mb](){
+        // last reference dropped on another thread - goes to that threads free list
+        mb = nullptr;
+    });
+    t.join();
+    ASSERT_TRUE(mb == nullptr);
+}
@@ -0,0 +1,64 @@
+//
+//  test_buffer_slice.cpp
+//  test_buffers
+//
+//  Created by ROBERT BLACKWELL on 12/10/17.
+//  Copyright © 2017 Blackwellapps. All rights reserved.
+//
+#include <iostream>
+#include <gtest/gtest.h>
+#include "bufferV2.hpp"
+#include "rb_logger.hpp"
+
+#pragma mark - testcase_buffer_slice
+TEST( BufferSlice, PointsIntoOwner)
+{
+    MBufferSPtr mb = m_buffer(std::string("5\r\nHELLO\r\n6\r\n WORLD\r\n0\r\n\r\n"));
+    char* p = (char*)mb->data();
+    BufferSlice s1 = buffer_slice(mb, p + 3, 5);
+    ASSERT_EQ(s1.data(), (void*)(p + 3));
+    ASSERT_EQ(s1.offset(), 3);
+    ASSERT_EQ(s1.size(), 5);
+    ASSERT_EQ(s1.toString(), "HELLO");
+    ASSERT_EQ(s1.owner(), mb);
+}
+TEST( BufferSlice, KeepsOwnerAlive)
+{
+    MBufferSPtr mb = m_buffer(std::string("some body data"));
+    BufferSlice s(mb, 5, 4);
+    std::weak_ptr<MBuffer> wp = mb;
+    mb = nullptr;
+    ASSERT_FALSE(wp.expired());
+    ASSERT_EQ(s.toString(), "body");
+}
+TEST( BufferChain, DeChunkedSlicesNoCopy)
+{
+    MBufferSPtr mb = m_buffer(std::string("5\r\nHELLO\r\n6\r\n WORLD\r\n0\r\n\r\n"));
+    char* p = (char*)mb->data();
+    BufferChain chain;
+    chain.push_back(buffer_slice(mb, p + 3, 5));
+    chain.push_back(buffer_slice(mb, p + 13, 6));
+    ASSERT_EQ(chain.size(), 11);
+    ASSERT_EQ(chain.to_string(), "HELLO WORLD");
+    auto seq = chain.buffer_sequence();
+    ASSERT_EQ(seq.size(), 2);
+    ASSERT_EQ(boost::asio::buffer_cast<char*>(*seq.begin()), p + 3);
+    ASSERT_EQ(boost::asio::buffer_cast<char*>(*(seq.begin() + 1)), p + 13);
+}
+TEST( BufferChain, ContiguousSlicesCoalesce)
+{
+    MBufferSPtr mb = m_buffer(std::string("0123456789"));
+    char* p = (char*)mb->data();
+    BufferChain chain;
+    chain.push_back(buffer_slice(mb, p, 3));
+    chain.push_back(buffer_slice(mb, p + 3, 4));
+    auto seq = chain.buffer_sequence();
+    ASSERT_EQ(seq.size(), 1);
+    ASSERT_EQ(boost::asio::buffer_size(*seq.begin()), 7);
+    ASSERT_EQ(chain.to_string(), "0123456");
+    // same offsets in a different buffer must not coalesce
+    MBufferSPtr mb2 = m_buffer(std::string("0123456789"));
+    chain.push_back(BufferSlice(mb2, 7, 3));
+    ASSERT_EQ(chain.buffer_sequence().size(), 2);
+    ASSERT_EQ(chain.to_string(), "0123456789");
+}